@@ -0,0 +1,573 @@
+/* microbench: hot-path microbenchmarks
+ *
+ * Usage: microbench [-f filter] [-c cpu] [-t threads] [-r pct] [-b baseline]
+ *                   [-w baseline]
+ *
+ * Each benchmark is warmed up, sized to run for at least MIN_RUN_NS, and
+ * timed REPEATS times on a pinned CPU; the median is reported as ns/op,
+ * along with heap allocations per op. With -b the results are compared
+ * against a saved baseline and slowdowns beyond -r percent (default
+ * REGRESSION_PCT) or any new allocations are flagged (exit status 1);
+ * -w saves the results as the new baseline. Baselines are only
+ * comparable on the machine that recorded them.
+ *
+ * The server and security translation units are compiled in directly so
+ * their static helpers (path checks, pattern matching) can be measured.
+ */
+#define _GNU_SOURCE
+#include "../src/server.c"
+#include "../src/security.c"
+#include <sched.h>
+
+#define MIN_RUN_NS      200000000ULL    /* 0.2 s per timed run */
+#define WARMUP_NS       50000000ULL
+#define REPEATS         5
+#define REGRESSION_PCT  15.0
+#define MAX_BASELINE    64
+#define MAX_THREADS     64
+
+/* Benchmark body: run the operation n times */
+typedef void (*bench_fn_t)(uint64_t n);
+
+typedef struct {
+    const char *name;
+    bench_fn_t fn;
+    void (*setup)(void);
+    void (*teardown)(void);
+    unsigned int threads;       /* Run fn on this many threads at once */
+    size_t bytes;               /* Input bytes per op, for MB/s (0 if not a scan) */
+} bench_t;
+
+/* Result of one benchmark */
+typedef struct {
+    char name[48];
+    double ns_per_op;
+    double allocs_per_op;
+} result_t;
+
+/* Keep the compiler from discarding benchmark results */
+static volatile uint64_t sink;
+
+/* Allocation counting
+ *
+ * malloc and friends are interposed (glibc lets a program replace them)
+ * and forwarded to the real allocator. The count is global and atomic so
+ * allocations made on helper threads are seen too.
+ */
+static uint64_t alloc_count = 0;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Fixtures */
+
+static const char request_text[] =
+    "GET /assets/css/site.css HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "If-None-Match: \"65f1a2b3-1f40\"\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static const char query_text[] =
+    "q=winter+boots&category=outdoor&sort=price_asc&page=3&size=48&utm_source=newsletter";
+
+/* A form post of about 1 KiB with nothing suspicious in it */
+static const char body_text[] =
+    "name=Jane+Doe&email=jane.doe%40example.com&phone=%2B1-555-0100&company=Example+Ltd"
+    "&address=221B+Baker+Street&city=London&postcode=NW1+6XE&country=United+Kingdom"
+    "&subject=Order+enquiry&order=EX-2024-118853&message=Hello%2C+I+ordered+a+pair+of"
+    "+winter+boots+last+week+and+the+tracking+page+has+not+changed+since+Tuesday.+Could"
+    "+you+check+whether+the+parcel+left+the+warehouse%3F+If+it+is+easier+I+am+happy+to"
+    "+collect+it+from+the+depot+on+Saturday+morning.+The+size+on+the+confirmation+email"
+    "+was+42+but+I+may+want+to+exchange+them+for+a+43+as+the+reviews+say+they+run+small."
+    "+Please+let+me+know+what+the+returns+process+looks+like+for+an+exchange+and+whether"
+    "+I+need+to+print+a+label+myself+or+if+one+is+included+in+the+box.+Many+thanks+in"
+    "+advance+for+your+help%2C+and+apologies+if+this+is+already+covered+in+the+FAQ+-+I"
+    "+looked+but+could+not+find+it.&newsletter=yes&consent=1&referrer=search&locale=en-GB"
+    "&csrf=5f2b6c0e9a1d4e7f8b3a2c1d0e9f8a7b&ts=1710334643&tz=Europe%2FLondon&js=1&w=1440"
+    "&h=900&dpr=2&ua=Mozilla%2F5.0+(X11%3B+Linux+x86_64%3B+rv%3A120.0)+Firefox%2F120.0";
+
+static rate_limiter_t *limiter;
+static struct in_addr *client_addrs;
+static uint32_t client_count;
+
+/* Benchmarks */
+
+static void bench_parse_request(uint64_t n) {
+    http_request_t req;
+    for (uint64_t i = 0; i < n; i++) {
+        sink += http_parse_request(request_text, sizeof(request_text) - 1, &req);
+    }
+}
+
+static void bench_mime_type(uint64_t n) {
+    static const char *paths[] = { "/index.html", "/css/site.css", "/img/logo.png", "/app.js" };
+    for (uint64_t i = 0; i < n; i++) {
+        sink += (uintptr_t)http_get_mime_type(paths[i & 3]);
+    }
+}
+
+static void bench_etag_generate(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        char *etag = http_generate_etag(1710334643 + (time_t)(i & 1023), 8000);
+        sink += etag ? (uint8_t)etag[1] : 0;
+        free(etag);
+    }
+}
+
+static void bench_etag_match(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        sink += http_check_etag_match(request_text, "\"65f1a2b3-1f40\"");
+    }
+}
+
+static void bench_normalize(uint64_t n) {
+    static const char target[] = "/assets/css/site-theme.min.css?v=3";
+    normalized_path_t path;
+    for (uint64_t i = 0; i < n; i++) {
+        sink += normalize_path(target, sizeof(target) - 1, &path);
+    }
+}
+
+static void bench_normalize_encoded(uint64_t n) {
+    static const char target[] = "/docs/./release%20notes/../Release%20Notes%202.txt";
+    normalized_path_t path;
+    for (uint64_t i = 0; i < n; i++) {
+        sink += normalize_path(target, sizeof(target) - 1, &path);
+    }
+}
+
+static void bench_path_traversal(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        sink += has_path_traversal("/index.html");
+    }
+}
+
+static void bench_path_traversal_missing(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        sink += has_path_traversal("/wp-admin/setup-config.html");
+    }
+}
+
+static negative_cache_t *negatives;
+
+static void setup_negatives(void) {
+    negatives = negative_cache_create(4096, 60, "www");
+    negative_cache_insert(negatives, "/wp-admin/setup-config.html", 27, 404);
+}
+
+static void teardown_negatives(void) {
+    negative_cache_destroy(negatives);
+    negatives = NULL;
+}
+
+static void bench_negative_lookup(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        sink += negative_cache_lookup(negatives, "/wp-admin/setup-config.html", 27);
+    }
+}
+
+/* A pack of 10k small files, as a large site would have */
+static asset_pack_t *pack;
+static char pack_path[] = "/tmp/microbench-pack-XXXXXX";
+
+static void setup_pack(void) {
+    int fd = mkstemp(pack_path);
+    if (fd < 0) return;
+    close(fd);
+
+    asset_pack_writer_t *writer = asset_pack_writer_create(pack_path);
+    char path[64];
+    for (int i = 0; writer && i < 10000; i++) {
+        snprintf(path, sizeof(path), "/assets/%d/file-%d.css", i % 100, i);
+        asset_pack_writer_add(writer, path, path, strlen(path), NULL, 0);
+    }
+    if (asset_pack_writer_finish(writer)) pack = asset_pack_open(pack_path);
+}
+
+static void teardown_pack(void) {
+    asset_pack_close(pack);
+    pack = NULL;
+    unlink(pack_path);
+}
+
+static void bench_pack_find(uint64_t n) {
+    asset_t asset;
+    for (uint64_t i = 0; i < n; i++) {
+        sink += asset_pack_find(pack, "/assets/42/file-4242.css", 24, &asset);
+    }
+}
+
+static void bench_file_type(uint64_t n) {
+    normalized_path_t path;
+    normalize_path("/assets/css/site.css", 20, &path);
+    for (uint64_t i = 0; i < n; i++) {
+        sink += is_allowed_file_type(&path);
+    }
+}
+
+static void bench_build_path(uint64_t n) {
+    char filepath[512];
+    normalized_path_t path;
+    normalize_path("/index.html", 11, &path);
+    for (uint64_t i = 0; i < n; i++) {
+        sink += build_file_path(&path, filepath, sizeof(filepath));
+    }
+}
+
+static pattern_set_t *patterns;
+
+static void setup_patterns(void) {
+    security_config_t config;
+    security_config_set_defaults(&config);
+    patterns = build_patterns(&config);
+}
+
+static void teardown_patterns(void) {
+    pattern_set_destroy(patterns);
+    patterns = NULL;
+}
+
+static void bench_scan_query(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        sink += pattern_set_scan(patterns, query_text, sizeof(query_text) - 1);
+    }
+}
+
+static void bench_scan_body(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        sink += pattern_set_scan(patterns, body_text, sizeof(body_text) - 1);
+    }
+}
+
+static void bench_log_write(uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        log_write(LOG_INFO, "Request: %s %s from %s", "GET", "/index.html", "192.0.2.1");
+    }
+}
+
+/* Rate limiter over a population of distinct clients (the table holds
+ * 16k, so larger populations would only time the table-full rejection) */
+static void setup_clients(uint32_t count) {
+    rate_limit_config_t config = {
+        .requests_per_window = 1000000000,
+        .burst_size = 1000000000,
+        .window_seconds = 60
+    };
+    limiter = rate_limiter_create(&config);
+    client_addrs = calloc(count, sizeof(*client_addrs));
+    client_count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        client_addrs[i].s_addr = htonl(0x0a000000 + i * 2654435761u % 0x00ffffff);
+    }
+    /* Populate the table before timing */
+    for (uint32_t i = 0; i < count; i++) {
+        rate_limiter_check_addr(limiter, &client_addrs[i]);
+    }
+}
+
+static void setup_clients_1(void) { setup_clients(1); }
+static void setup_clients_1k(void) { setup_clients(1000); }
+static void setup_clients_10k(void) { setup_clients(10000); }
+
+static void teardown_clients(void) {
+    rate_limiter_destroy(limiter);
+    free(client_addrs);
+    limiter = NULL;
+}
+
+static uint32_t next_start = 0;
+
+static void bench_rate_limiter(uint64_t n) {
+    /* Threads start at different clients so they don't move in lockstep */
+    uint32_t i = __atomic_fetch_add(&next_start, 7919, __ATOMIC_RELAXED) % client_count;
+    for (uint64_t done = 0; done < n; done++) {
+        sink += rate_limiter_check_addr(limiter, &client_addrs[i]);
+        if (++i == client_count) i = 0;
+    }
+}
+
+static char log_dir[] = "/tmp/microbench-XXXXXX";
+static char log_path[64];
+
+static void setup_log(void) {
+    if (!mkdtemp(log_dir)) return;
+    snprintf(log_path, sizeof(log_path), "%s/bench.log", log_dir);
+    log_set_output(LOG_TO_FILE);
+    log_set_overflow(LOG_OVERFLOW_BLOCK);
+    log_set_level(LOG_INFO);
+    log_init(log_path);
+}
+
+static void teardown_log(void) {
+    log_close();
+    log_set_level(LOG_FATAL);
+    unlink(log_path);
+    rmdir(log_dir);
+}
+
+static bench_t benches[] = {
+    { "http_parse_request", bench_parse_request, NULL, NULL, 1, 0 },
+    { "http_get_mime_type", bench_mime_type, NULL, NULL, 1, 0 },
+    { "http_generate_etag", bench_etag_generate, NULL, NULL, 1, 0 },
+    { "http_check_etag_match", bench_etag_match, NULL, NULL, 1, 0 },
+    { "normalize_path", bench_normalize, NULL, NULL, 1, 0 },
+    { "normalize_path/encoded", bench_normalize_encoded, NULL, NULL, 1, 0 },
+    { "has_path_traversal", bench_path_traversal, NULL, NULL, 1, 0 },
+    { "has_path_traversal/missing", bench_path_traversal_missing, NULL, NULL, 1, 0 },
+    { "negative_cache_lookup", bench_negative_lookup, setup_negatives, teardown_negatives, 1, 0 },
+    { "asset_pack_find/10k", bench_pack_find, setup_pack, teardown_pack, 1, 0 },
+    { "is_allowed_file_type", bench_file_type, NULL, NULL, 1, 0 },
+    { "build_file_path", bench_build_path, NULL, NULL, 1, 0 },
+    { "rate_limiter_check/1", bench_rate_limiter, setup_clients_1, teardown_clients, 1, 0 },
+    { "rate_limiter_check/1k", bench_rate_limiter, setup_clients_1k, teardown_clients, 1, 0 },
+    { "rate_limiter_check/10k", bench_rate_limiter, setup_clients_10k, teardown_clients, 1, 0 },
+    { "rate_limiter_check/10k/", bench_rate_limiter, setup_clients_10k, teardown_clients, 0, 0 },
+    { "pattern_scan/query", bench_scan_query, setup_patterns, teardown_patterns, 1,
+      sizeof(query_text) - 1 },
+    { "pattern_scan/body", bench_scan_body, setup_patterns, teardown_patterns, 1,
+      sizeof(body_text) - 1 },
+    { "log_write", bench_log_write, setup_log, teardown_log, 1, 0 },
+};
+
+/* Multi-threaded runs */
+typedef struct {
+    bench_fn_t fn;
+    uint64_t n;
+    pthread_barrier_t *barrier;
+} worker_arg_t;
+
+static void *bench_worker(void *ptr) {
+    worker_arg_t *arg = ptr;
+    pthread_barrier_wait(arg->barrier);
+    arg->fn(arg->n);
+    return NULL;
+}
+
+/* Time n operations on each of threads threads */
+static uint64_t run_timed(const bench_t *bench, unsigned int threads, uint64_t n) {
+    if (threads <= 1) {
+        uint64_t start = mono_ns();
+        bench->fn(n);
+        return mono_ns() - start;
+    }
+
+    pthread_t tids[MAX_THREADS];
+    worker_arg_t args[MAX_THREADS];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+    for (unsigned int t = 0; t < threads; t++) {
+        args[t] = (worker_arg_t){ bench->fn, n, &barrier };
+        pthread_create(&tids[t], NULL, bench_worker, &args[t]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    uint64_t start = mono_ns();
+    for (unsigned int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    uint64_t elapsed = mono_ns() - start;
+    pthread_barrier_destroy(&barrier);
+    return elapsed;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+    return da < db ? -1 : da > db;
+}
+
+/* Warm up, size, and time one benchmark */
+static void run_bench(const bench_t *bench, unsigned int threads, result_t *result) {
+    if (bench->setup) bench->setup();
+
+    /* Grow the op count until a run is long enough to time reliably;
+     * the growing runs double as warm-up */
+    uint64_t n = 16;
+    uint64_t elapsed = run_timed(bench, threads, n);
+    while (elapsed < WARMUP_NS) {
+        n *= 2;
+        elapsed = run_timed(bench, threads, n);
+    }
+    n = (uint64_t)((double)n * MIN_RUN_NS / (double)elapsed) + 1;
+
+    double samples[REPEATS];
+    uint64_t allocs_before = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+    for (int r = 0; r < REPEATS; r++) {
+        /* Wall time per op on each thread, so thread scaling shows as
+         * rising ns/op under contention */
+        samples[r] = (double)run_timed(bench, threads, n) / (double)n;
+    }
+    uint64_t allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED) - allocs_before;
+    qsort(samples, REPEATS, sizeof(samples[0]), compare_double);
+
+    result->ns_per_op = samples[REPEATS / 2];
+    result->allocs_per_op = (double)allocs / ((double)n * threads * REPEATS);
+
+    if (bench->teardown) bench->teardown();
+}
+
+/* Baseline file: "name ns_per_op allocs_per_op" per line */
+static size_t load_baseline(const char *path, result_t *baseline) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+
+    size_t count = 0;
+    char line[256];
+    while (count < MAX_BASELINE && fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') continue;
+        result_t *b = &baseline[count];
+        if (sscanf(line, "%47s %lf %lf", b->name, &b->ns_per_op, &b->allocs_per_op) == 3) {
+            count++;
+        }
+    }
+    fclose(f);
+    return count;
+}
+
+static const result_t *find_result(const result_t *results, size_t count, const char *name) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(results[i].name, name) == 0) return &results[i];
+    }
+    return NULL;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: microbench [-f filter] [-c cpu] [-t threads] [-r pct] "
+                    "[-b baseline] [-w baseline]\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *filter = NULL, *baseline_path = NULL, *write_path = NULL;
+    int cpu = -1;
+    double tolerance = REGRESSION_PCT;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:c:t:r:b:w:h")) != -1) {
+        switch (opt) {
+        case 'f': filter = optarg; break;
+        case 'c': cpu = atoi(optarg); break;
+        case 't': threads = atol(optarg); break;
+        case 'r': tolerance = atof(optarg); break;
+        case 'b': baseline_path = optarg; break;
+        case 'w': write_path = optarg; break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (threads < 2) threads = 2;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+    /* Pin to one CPU (the last by default) so runs are repeatable;
+     * multi-threaded benchmarks are left free to spread out */
+    cpu_set_t all_cpus;
+    sched_getaffinity(0, sizeof(all_cpus), &all_cpus);
+    if (cpu < 0) {
+        for (int c = CPU_SETSIZE - 1; c >= 0; c--) {
+            if (CPU_ISSET(c, &all_cpus)) {
+                cpu = c;
+                break;
+            }
+        }
+    }
+    cpu_set_t pinned;
+    CPU_ZERO(&pinned);
+    CPU_SET(cpu, &pinned);
+
+    /* Path checks resolve against ./www */
+    struct stat st;
+    if (stat("www/index.html", &st) != 0) {
+        fprintf(stderr, "microbench: run from the repository root (needs www/index.html)\n");
+        return 2;
+    }
+    /* Only the log_write benchmark logs */
+    log_set_level(LOG_FATAL);
+
+    result_t baseline[MAX_BASELINE];
+    size_t baseline_count = baseline_path ? load_baseline(baseline_path, baseline) : 0;
+    result_t results[sizeof(benches) / sizeof(benches[0])];
+    size_t result_count = 0;
+    int regressions = 0;
+
+    printf("%-30s %12s %10s %9s %12s %8s\n", "benchmark", "ns/op", "allocs/op", "MB/s",
+           "baseline", "change");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        const bench_t *bench = &benches[i];
+        if (filter && !strstr(bench->name, filter)) continue;
+
+        unsigned int bench_threads = bench->threads ? bench->threads : (unsigned int)threads;
+        sched_setaffinity(0, sizeof(cpu_set_t), bench_threads > 1 ? &all_cpus : &pinned);
+
+        result_t *result = &results[result_count++];
+        snprintf(result->name, sizeof(result->name), "%s", bench->name);
+        if (!bench->threads) {
+            snprintf(result->name, sizeof(result->name), "%s%ut", bench->name, bench_threads);
+        }
+        run_bench(bench, bench_threads, result);
+
+        printf("%-30s %12.1f %10.2f", result->name, result->ns_per_op, result->allocs_per_op);
+        if (bench->bytes) printf(" %9.0f", bench->bytes * 1e3 / result->ns_per_op);
+        else printf(" %9s", "");
+        const result_t *base = find_result(baseline, baseline_count, result->name);
+        if (base && base->ns_per_op > 0) {
+            double change = (result->ns_per_op / base->ns_per_op - 1) * 100;
+            bool regressed = change > tolerance ||
+                             result->allocs_per_op > base->allocs_per_op + 0.01;
+            printf(" %12.1f %+7.1f%%%s", base->ns_per_op, change, regressed ? "  REGRESSION" : "");
+            if (regressed) regressions++;
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (write_path) {
+        FILE *f = fopen(write_path, "w");
+        if (!f) {
+            perror("microbench: baseline");
+            return 1;
+        }
+        fprintf(f, "# microbench baseline: name ns/op allocs/op\n");
+        for (size_t i = 0; i < result_count; i++) {
+            fprintf(f, "%s %.1f %.2f\n", results[i].name, results[i].ns_per_op,
+                    results[i].allocs_per_op);
+        }
+        fclose(f);
+        printf("Baseline written to %s\n", write_path);
+    }
+
+    if (regressions) {
+        printf("%d benchmark(s) regressed more than %.0f%% against %s\n",
+               regressions, tolerance, baseline_path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,400 @@
+/* ratesim: deterministic rate limiter simulator
+ *
+ * Usage: ratesim [-s scenario] [-H hours] [-q rate] [-n clients]
+ *                [-p requests/window/burst] [-S seed]
+ *
+ * Drives the rate limiter with synthetic traffic on a simulated clock, so
+ * hours of traffic from millions of clients run in seconds and every run
+ * with the same seed is identical. Each check is also decided by an exact
+ * GCRA with unbounded per-client state; disagreements are the limiter's
+ * error against its configured policy. A false deny means the limiter
+ * refused a conforming request (its table was full, or a recycled slot
+ * still carried another client's charge), a false allow the opposite.
+ *
+ * Scenarios:
+ *   zipf     Poisson arrivals from Zipf-distributed clients
+ *   bursts   zipf, plus single clients sending back-to-back bursts
+ *   botnet   zipf, plus a botnet whose members each run just over the limit
+ *
+ * checks/s times only the limiter calls, not the traffic generator.
+ */
+#define _GNU_SOURCE
+#include "rate_limiter.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#define BLOCK           4096    /* Arrivals generated, then checked, at a time */
+#define ZIPF_EXPONENT   1.1
+#define BURST_EVERY     2.0     /* Seconds between bursts */
+#define BOTNET_SIZE     5000
+#define BOTNET_OVERDRIVE 1.5    /* Bot rate relative to the limit */
+#define BOTNET_ON       600.0   /* Attack seconds per cycle */
+#define BOTNET_CYCLE    1800.0
+
+/* One arrival */
+typedef struct {
+    uint64_t time_usec;
+    struct in_addr addr;
+    bool expected;              /* Exact policy's decision */
+    bool allowed;               /* Limiter's decision */
+} arrival_t;
+
+/* Exact per-client GCRA state, open addressing */
+typedef struct {
+    uint32_t *keys;             /* Address + 1, 0 if free */
+    uint64_t *tats;
+    size_t mask;
+    size_t count;
+} reference_t;
+
+/* Traffic source state */
+typedef struct {
+    uint64_t rng;
+    double now;                 /* Seconds */
+    double next_background;
+    double next_burst;
+    double next_bot;
+    unsigned int burst_left;
+    uint32_t burst_client;
+} source_t;
+
+typedef enum {
+    SCENARIO_ZIPF,
+    SCENARIO_BURSTS,
+    SCENARIO_BOTNET,
+    SCENARIO_COUNT
+} scenario_t;
+
+static const char *scenario_names[SCENARIO_COUNT] = { "zipf", "bursts", "botnet" };
+
+/* Settings */
+static double hours = 1;
+static double arrival_rate = 2000;
+static size_t clients = 1000000;
+static rate_limit_config_t policy = {
+    .requests_per_window = 60,
+    .burst_size = 10,
+    .window_seconds = 60
+};
+static uint64_t seed = 1;
+
+static double *zipf_cdf;
+static uint64_t interval_usec;
+static uint64_t tolerance_usec;
+
+/* Simulated time read by the limiter */
+static uint64_t sim_clock(void *ctx) {
+    return *(const uint64_t *)ctx;
+}
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* xorshift64* */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static double uniform(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double exponential(uint64_t *state, double rate) {
+    return -log(1.0 - uniform(state)) / rate;
+}
+
+/* Client index to a well-spread public-looking address */
+static struct in_addr client_addr(uint32_t index, uint32_t salt) {
+    uint32_t x = (index ^ salt) * 0x9e3779b1u;
+    x ^= x >> 15;
+    x *= 0x85ebca77u;
+    x ^= x >> 13;
+    struct in_addr addr = { .s_addr = x | 1 };
+    return addr;
+}
+
+static bool build_zipf(void) {
+    zipf_cdf = malloc(clients * sizeof(*zipf_cdf));
+    if (!zipf_cdf) return false;
+
+    double sum = 0;
+    for (size_t i = 0; i < clients; i++) {
+        sum += 1.0 / pow((double)(i + 1), ZIPF_EXPONENT);
+        zipf_cdf[i] = sum;
+    }
+    for (size_t i = 0; i < clients; i++) zipf_cdf[i] /= sum;
+    return true;
+}
+
+static uint32_t zipf_client(uint64_t *state) {
+    double u = uniform(state);
+    size_t lo = 0, hi = clients - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return (uint32_t)lo;
+}
+
+static bool reference_init(reference_t *ref, size_t expected) {
+    size_t size = 1;
+    while (size < expected * 2) size *= 2;
+    ref->keys = calloc(size, sizeof(*ref->keys));
+    ref->tats = calloc(size, sizeof(*ref->tats));
+    ref->mask = size - 1;
+    ref->count = 0;
+    return ref->keys && ref->tats;
+}
+
+static void reference_free(reference_t *ref) {
+    free(ref->keys);
+    free(ref->tats);
+}
+
+static bool reference_grow(reference_t *ref) {
+    reference_t bigger;
+    if (!reference_init(&bigger, ref->mask + 1)) return false;
+    for (size_t i = 0; i <= ref->mask; i++) {
+        if (!ref->keys[i]) continue;
+        size_t j = (ref->keys[i] * 0x9e3779b1u) & bigger.mask;
+        while (bigger.keys[j]) j = (j + 1) & bigger.mask;
+        bigger.keys[j] = ref->keys[i];
+        bigger.tats[j] = ref->tats[i];
+    }
+    bigger.count = ref->count;
+    reference_free(ref);
+    *ref = bigger;
+    return true;
+}
+
+/* The configured policy, applied exactly */
+static bool reference_check(reference_t *ref, uint32_t addr, uint64_t now) {
+    if (ref->count * 2 > ref->mask && !reference_grow(ref)) return false;
+
+    uint32_t key = addr + 1;
+    size_t i = (key * 0x9e3779b1u) & ref->mask;
+    while (ref->keys[i] && ref->keys[i] != key) i = (i + 1) & ref->mask;
+    if (!ref->keys[i]) {
+        ref->keys[i] = key;
+        ref->count++;
+    }
+
+    uint64_t tat = ref->tats[i] > now ? ref->tats[i] : now;
+    if (tat + interval_usec - now > tolerance_usec + interval_usec) return false;
+    ref->tats[i] = tat + interval_usec;
+    return true;
+}
+
+/* Next arrival of the scenario */
+static void next_arrival(source_t *src, scenario_t scenario, arrival_t *out) {
+    double bot_rate = BOTNET_SIZE * BOTNET_OVERDRIVE *
+                      policy.requests_per_window / (double)policy.window_seconds;
+
+    for (;;) {
+        double t = src->next_background;
+        int kind = 0;
+        if (scenario == SCENARIO_BURSTS && src->next_burst < t) {
+            t = src->next_burst;
+            kind = 1;
+        }
+        if (scenario == SCENARIO_BOTNET && src->next_bot < t) {
+            t = src->next_bot;
+            kind = 2;
+        }
+        src->now = t;
+        out->time_usec = (uint64_t)(t * 1e6);
+
+        if (kind == 0) {
+            src->next_background = t + exponential(&src->rng, arrival_rate);
+            out->addr = client_addr(zipf_client(&src->rng), 0);
+            return;
+        }
+
+        if (kind == 1) {
+            /* A burst of twice the allowance, 1 ms apart */
+            if (!src->burst_left) {
+                src->burst_left = policy.burst_size * 2;
+                src->burst_client = (uint32_t)(next_random(&src->rng) % clients);
+            }
+            out->addr = client_addr(src->burst_client, 0);
+            if (--src->burst_left) {
+                src->next_burst = t + 0.001;
+            } else {
+                src->next_burst = t + exponential(&src->rng, 1.0 / BURST_EVERY);
+            }
+            return;
+        }
+
+        /* Bots attack in waves; skip ahead through the quiet part of a cycle */
+        double phase = fmod(t, BOTNET_CYCLE);
+        if (phase >= BOTNET_ON) {
+            src->next_bot = t - phase + BOTNET_CYCLE;
+            continue;
+        }
+        src->next_bot = t + exponential(&src->rng, bot_rate);
+        out->addr = client_addr((uint32_t)(next_random(&src->rng) % BOTNET_SIZE), 0xb07b07);
+        return;
+    }
+}
+
+/* Run one scenario and print its row */
+static bool run_scenario(scenario_t scenario) {
+    rate_limiter_t *limiter = rate_limiter_create(&policy);
+    reference_t ref;
+    arrival_t *block = malloc(BLOCK * sizeof(*block));
+    if (!limiter || !block || !reference_init(&ref, 1 << 16)) {
+        fprintf(stderr, "ratesim: out of memory\n");
+        return false;
+    }
+
+    uint64_t now = 0;
+    rate_limiter_set_clock(limiter, sim_clock, &now);
+
+    source_t src = { .rng = seed * 0x9e3779b97f4a7c15ULL + scenario + 1 };
+    src.next_background = exponential(&src.rng, arrival_rate);
+    src.next_burst = exponential(&src.rng, 1.0 / BURST_EVERY);
+    src.next_bot = 0;
+
+    uint64_t checks = 0, allowed = 0, expected = 0, false_deny = 0, false_allow = 0;
+    uint64_t limiter_ns = 0;
+    uint64_t started = mono_ns();
+    double end = hours * 3600;
+
+    while (src.now < end) {
+        size_t n = 0;
+        while (n < BLOCK && src.now < end) {
+            next_arrival(&src, scenario, &block[n]);
+            block[n].expected = reference_check(&ref, block[n].addr.s_addr,
+                                                block[n].time_usec);
+            n++;
+        }
+
+        uint64_t t0 = mono_ns();
+        for (size_t i = 0; i < n; i++) {
+            now = block[i].time_usec;
+            block[i].allowed = rate_limiter_check_addr(limiter, &block[i].addr);
+        }
+        limiter_ns += mono_ns() - t0;
+
+        for (size_t i = 0; i < n; i++) {
+            allowed += block[i].allowed;
+            expected += block[i].expected;
+            false_deny += block[i].expected && !block[i].allowed;
+            false_allow += !block[i].expected && block[i].allowed;
+        }
+        checks += n;
+    }
+    double wall = (mono_ns() - started) / 1e9;
+
+    printf("%-8s %11llu %8.2f %8.2f %10llu %10llu %10llu %9.0f %8.1f %6.1f\n",
+           scenario_names[scenario], (unsigned long long)checks,
+           100.0 * expected / checks, 100.0 * allowed / checks,
+           (unsigned long long)false_deny,
+           (unsigned long long)rate_limiter_table_full(limiter),
+           (unsigned long long)false_allow,
+           limiter_ns ? checks / (limiter_ns / 1e9) / 1e3 : 0.0,
+           rate_limiter_footprint(limiter) / 1024.0, wall);
+
+    reference_free(&ref);
+    free(block);
+    rate_limiter_destroy(limiter);
+    return true;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: ratesim [-s zipf|bursts|botnet] [-H hours] [-q rate] [-n clients]\n"
+            "               [-p requests/window/burst] [-S seed]\n"
+            "  -s NAME     run one scenario (default all)\n"
+            "  -H HOURS    simulated duration (default 1)\n"
+            "  -q RATE     background requests per simulated second (default 2000)\n"
+            "  -n N        client population (default 1000000)\n"
+            "  -p R/W/B    R requests per W seconds, bursts of B (default 60/60/10)\n"
+            "  -S SEED     random seed (default 1)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int only = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:H:q:n:p:S:h")) != -1) {
+        switch (opt) {
+        case 's':
+            for (int i = 0; i < SCENARIO_COUNT; i++) {
+                if (strcmp(optarg, scenario_names[i]) == 0) only = i;
+            }
+            if (only < 0) {
+                usage();
+                return 2;
+            }
+            break;
+        case 'H': hours = atof(optarg); break;
+        case 'q': arrival_rate = atof(optarg); break;
+        case 'n': clients = strtoul(optarg, NULL, 10); break;
+        case 'p': {
+            unsigned int requests, window, burst;
+            if (sscanf(optarg, "%u/%u/%u", &requests, &window, &burst) != 3) {
+                usage();
+                return 2;
+            }
+            policy.requests_per_window = requests;
+            policy.window_seconds = window;
+            policy.burst_size = burst;
+            break;
+        }
+        case 'S': seed = strtoull(optarg, NULL, 10); break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (hours <= 0 || arrival_rate <= 0 || clients == 0 || clients > UINT32_MAX ||
+        policy.requests_per_window == 0 || policy.window_seconds == 0) {
+        usage();
+        return 2;
+    }
+
+    /* Same derivation as the limiter */
+    unsigned int burst = policy.burst_size ? policy.burst_size : 1;
+    interval_usec = (uint64_t)policy.window_seconds * 1000000 / policy.requests_per_window;
+    if (interval_usec == 0) interval_usec = 1;
+    tolerance_usec = interval_usec * (burst - 1);
+
+    /* Every denial would otherwise be logged */
+    log_set_level(LOG_FATAL);
+
+    if (!build_zipf()) {
+        fprintf(stderr, "ratesim: out of memory\n");
+        return 1;
+    }
+
+    printf("Policy %u requests per %lld s, bursts of %u; %.1f simulated hours, "
+           "%zu clients, seed %llu\n\n",
+           policy.requests_per_window, (long long)policy.window_seconds, burst, hours,
+           clients, (unsigned long long)seed);
+    printf("%-8s %11s %8s %8s %10s %10s %10s %9s %8s %6s\n",
+           "scenario", "checks", "policy%", "allowed%", "false-deny", "table-full",
+           "false-allow", "kchecks/s", "mem KiB", "wall s");
+
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+        if (only >= 0 && i != only) continue;
+        if (!run_scenario((scenario_t)i)) return 1;
+    }
+
+    free(zipf_cdf);
+    return 0;
+}
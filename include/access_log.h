@@ -0,0 +1,63 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* Binary access log format
+ *
+ * A 16-byte file header followed by 32-byte records in host byte order.
+ * Paths are interned: the first request for a path is preceded by a
+ * definition record (status 0) carrying the path id and length, followed
+ * by the path itself padded to a whole number of records. Definitions
+ * from concurrent threads may land after the first use of their id.
+ */
+#define ACCESS_LOG_MAGIC        "ZIRCLOG1"
+#define ACCESS_LOG_VERSION      1
+#define ACCESS_STATUS_PATHDEF   0       /* Record defines a path id */
+#define ACCESS_LOG_PATH_MAX     255     /* Longer paths are truncated */
+
+/* How the response was satisfied */
+typedef enum {
+    ACCESS_CACHE_NONE,          /* Served from the filesystem */
+    ACCESS_CACHE_REVALIDATED,   /* Client copy still valid (304) */
+    ACCESS_CACHE_PACK           /* Served from the asset pack */
+} access_cache_t;
+
+/* File header */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} access_log_header_t;
+
+/* One request, or one path definition */
+typedef struct {
+    uint64_t time_usec;         /* Wall clock at request start */
+    uint64_t bytes;             /* Body bytes sent, or path length for definitions */
+    uint32_t addr;              /* IPv4 client address, network byte order */
+    uint32_t path_id;
+    uint32_t duration_usec;
+    uint16_t status;
+    uint8_t method;             /* http_method_t */
+    uint8_t cache;              /* access_cache_t */
+} access_record_t;
+
+/* Request details handed to the access log */
+typedef struct {
+    struct in_addr addr;
+    uint8_t method;
+    const char *path;
+    uint16_t status;
+    uint64_t bytes;
+    uint64_t start_usec;        /* Wall clock */
+    uint32_t duration_usec;
+    access_cache_t cache;
+} access_entry_t;
+
+/* Function prototypes */
+bool access_log_open(const char *path);
+void access_log_write(const access_entry_t *entry);
+
+#endif /* ACCESS_LOG_H */
@@ -0,0 +1,33 @@
+#ifndef ACCESS_LOG_READER_H
+#define ACCESS_LOG_READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "access_log.h"
+
+/* Reader over a mapped binary access log
+ *
+ * Checks the header, then walks the request records with their paths
+ * resolved. Input is not trusted: definitions longer than the writer's
+ * ACCESS_LOG_PATH_MAX end the walk, and ids are looked up in a table
+ * sized by the definitions actually present, so a corrupt id costs
+ * nothing.
+ */
+typedef struct access_log_reader access_log_reader_t;
+
+/* A defined path, pointing into the mapped file (not terminated) */
+typedef struct {
+    const char *text;
+    uint32_t len;
+    size_t index;               /* Definition number, < access_log_reader_paths() */
+} access_path_t;
+
+/* Function prototypes */
+access_log_reader_t *access_log_reader_open(const void *map, size_t size);
+void access_log_reader_close(access_log_reader_t *reader);
+size_t access_log_reader_paths(const access_log_reader_t *reader);
+const access_record_t *access_log_reader_next(access_log_reader_t *reader,
+                                              const access_path_t **path);
+
+#endif /* ACCESS_LOG_READER_H */
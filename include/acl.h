@@ -0,0 +1,25 @@
+#ifndef ACL_H
+#define ACL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Action attached to an address range */
+typedef enum {
+    ACL_NONE,       /* No rule matched */
+    ACL_ALLOW,      /* Admit, subject to rate and connection limits */
+    ACL_DENY,       /* Drop the connection */
+    ACL_TRUST       /* Admit without rate or connection limits */
+} acl_action_t;
+
+/* Address access list (IPv4 radix tree, longest prefix wins) */
+typedef struct acl acl_t;
+
+/* Function prototypes */
+acl_t *acl_create(void);
+void acl_destroy(acl_t *acl);
+bool acl_add(acl_t *acl, const char *cidr, acl_action_t action);
+bool acl_add_list(acl_t *acl, const char *list, acl_action_t action);
+acl_action_t acl_lookup(const acl_t *acl, uint32_t addr);
+
+#endif /* ACL_H */
@@ -0,0 +1,37 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include "rate_limiter.h"
+
+/* Admission decision for a new connection */
+typedef enum {
+    ADMIT_OK,
+    ADMIT_DENIED,               /* Address is on the deny list */
+    ADMIT_RATE_LIMITED,         /* Client exceeded its request rate */
+    ADMIT_TOO_MANY_CONNECTIONS  /* Client exceeded its concurrent connections */
+} admission_result_t;
+
+/* Admission configuration */
+typedef struct {
+    const char *allow;          /* Comma-separated CIDR ranges */
+    const char *deny;
+    const char *trust;          /* Exempt from rate and connection limits */
+    uint32_t max_connections;   /* Per client address, 0 for unlimited */
+    rate_limiter_t *limiter;    /* Optional, not owned */
+} admission_config_t;
+
+/* Admission context */
+typedef struct admission admission_t;
+
+/* Function prototypes */
+admission_t *admission_create(const admission_config_t *config);
+void admission_destroy(admission_t *adm);
+admission_result_t admission_check(admission_t *adm, const struct in_addr *addr);
+void admission_release(admission_t *adm, const struct in_addr *addr);
+bool admission_is_trusted(admission_t *adm, const struct in_addr *addr);
+const char *admission_result_string(admission_result_t result);
+
+#endif /* ADMISSION_H */
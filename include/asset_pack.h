@@ -0,0 +1,91 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Asset pack format
+ *
+ * A whole web root in one file, built offline by zircon-pack and mapped
+ * by the server. A 48-byte file header is followed by the file bodies
+ * (and their gzip variants), a string table, the entries and an
+ * open-addressed hash index, all in host byte order. Strings (paths,
+ * MIME types, ETags and header blocks) are NUL-terminated. A header
+ * block holds a response's entity headers, each ending in CRLF, ready to
+ * be written out after the status line.
+ */
+#define ASSET_PACK_MAGIC    "ZIRCPAK1"
+#define ASSET_PACK_VERSION  1
+
+/* File header */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;             /* Entries */
+    uint64_t entries;           /* Offset of asset_pack_entry_t[count] */
+    uint64_t index;             /* Offset of uint32_t[index_size] */
+    uint32_t index_size;        /* Power of two; slot holds entry + 1, 0 if free */
+    uint32_t reserved;
+    uint64_t size;              /* Whole file, to catch truncation */
+} asset_pack_header_t;
+
+/* One file; offsets are from the start of the pack */
+typedef struct {
+    uint64_t hash;              /* asset_pack_hash() of the path */
+    uint64_t path;              /* "/dir/name.ext", as requests normalize */
+    uint64_t mime;
+    uint64_t etag;              /* Strong, from the contents */
+    uint64_t headers;           /* Header block for the body as is */
+    uint64_t body;
+    uint64_t body_size;
+    uint64_t gzip_etag;         /* The gzip fields are 0 without a variant */
+    uint64_t gzip_headers;
+    uint64_t gzip;
+    uint64_t gzip_size;
+    uint32_t path_len;
+    uint32_t headers_len;
+    uint32_t gzip_headers_len;
+    uint32_t reserved;
+} asset_pack_entry_t;
+
+/* Opened pack */
+typedef struct asset_pack asset_pack_t;
+
+/* Pack being written */
+typedef struct asset_pack_writer asset_pack_writer_t;
+
+/* A file found in a pack, pointing into the mapping */
+typedef struct {
+    const char *mime;
+    const char *etag;
+    const char *headers;
+    size_t headers_len;
+    const char *body;
+    size_t body_size;
+    uint64_t body_offset;       /* For sending from the pack's descriptor */
+    const char *gzip_etag;      /* NULL without a gzip variant */
+    const char *gzip_headers;
+    size_t gzip_headers_len;
+    const char *gzip;
+    size_t gzip_size;
+    uint64_t gzip_offset;
+} asset_t;
+
+/* Function prototypes */
+uint64_t asset_pack_hash(const char *path, size_t len);
+
+asset_pack_t *asset_pack_open(const char *filename);
+void asset_pack_close(asset_pack_t *pack);
+bool asset_pack_find(const asset_pack_t *pack, const char *path, size_t len, asset_t *asset);
+size_t asset_pack_count(const asset_pack_t *pack);
+int asset_pack_fd(const asset_pack_t *pack);
+
+asset_pack_writer_t *asset_pack_writer_create(const char *filename);
+bool asset_pack_writer_add(asset_pack_writer_t *writer, const char *path,
+                           const void *body, size_t body_size,
+                           const void *gzip, size_t gzip_size);
+bool asset_pack_writer_finish(asset_pack_writer_t *writer);
+void asset_pack_writer_abort(asset_pack_writer_t *writer);
+
+#endif /* ASSET_PACK_H */
@@ -0,0 +1,34 @@
+#ifndef CONCURRENCY_LIMITER_H
+#define CONCURRENCY_LIMITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Adaptive concurrency limiter context */
+typedef struct concurrency_limiter concurrency_limiter_t;
+
+/* Limiter configuration */
+typedef struct {
+    uint32_t min_limit;         /* Floor for the in-flight limit */
+    uint32_t max_limit;         /* Ceiling for the in-flight limit */
+    uint32_t initial_limit;     /* Starting limit (clamped to min/max) */
+} concurrency_config_t;
+
+/* Snapshot for metrics */
+typedef struct {
+    uint32_t limit;             /* Current in-flight limit */
+    uint32_t inflight;          /* Requests being served now */
+    uint64_t shed;              /* Requests rejected so far */
+    uint64_t baseline_usec;     /* Estimated no-load service latency */
+} concurrency_stats_t;
+
+/* Function prototypes */
+concurrency_limiter_t *concurrency_limiter_create(const concurrency_config_t *config);
+void concurrency_limiter_destroy(concurrency_limiter_t *limiter);
+bool concurrency_limiter_acquire(concurrency_limiter_t *limiter, uint64_t *start_usec);
+void concurrency_limiter_release(concurrency_limiter_t *limiter, uint64_t start_usec,
+                                 uint64_t end_usec);
+uint64_t concurrency_limiter_clock(void);
+void concurrency_limiter_stats(concurrency_limiter_t *limiter, concurrency_stats_t *stats);
+
+#endif /* CONCURRENCY_LIMITER_H */
@@ -0,0 +1,28 @@
+#ifndef HEAVY_HITTERS_H
+#define HEAVY_HITTERS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HEAVY_HITTER_KEY_MAX  64    /* Longer keys are truncated */
+#define HEAVY_HITTERS_MAX_K   64
+
+/* Heavy hitter tracker context */
+typedef struct heavy_hitters heavy_hitters_t;
+
+/* One of the current top keys */
+typedef struct {
+    unsigned char key[HEAVY_HITTER_KEY_MAX];
+    size_t len;
+    uint64_t count;             /* Decayed estimate, never below the true count */
+} heavy_hitter_t;
+
+/* Function prototypes */
+heavy_hitters_t *heavy_hitters_create(size_t k, uint32_t half_life_seconds);
+void heavy_hitters_destroy(heavy_hitters_t *hh);
+void heavy_hitters_add(heavy_hitters_t *hh, const void *key, size_t len, uint64_t weight);
+void heavy_hitters_decay(heavy_hitters_t *hh);
+size_t heavy_hitters_top(heavy_hitters_t *hh, heavy_hitter_t *out, size_t max);
+
+#endif /* HEAVY_HITTERS_H */
@@ -2,6 +2,9 @@
 #define LOGGER_H
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* Log levels */
 typedef enum {
@@ -10,7 +13,7 @@ typedef enum {
     LOG_WARN,
     LOG_ERROR,
     LOG_FATAL,
-    
+
     /* Add any additional levels here */
     LOG_LEVEL_COUNT /* Must be last */
 } log_level_t;
@@ -22,11 +25,27 @@ typedef enum {
     LOG_TO_BOTH        /* Log to both file and console */
 } log_output_t;
 
+/* What a thread does when its log buffer is full */
+typedef enum {
+    LOG_OVERFLOW_DROP,   /* Discard the record and count it */
+    LOG_OVERFLOW_BLOCK   /* Wait for the writer thread to make room */
+} log_overflow_t;
+
 /* Function prototypes */
 void log_init(const char *log_file);
 void log_set_level(log_level_t level);
 void log_set_output(log_output_t output);
+void log_set_overflow(log_overflow_t policy);
+void log_set_access_sampling(unsigned int one_in);
+void log_set_rotation(uint64_t max_bytes, unsigned int interval, unsigned int keep);
+void log_reopen(void);
 void log_write(log_level_t level, const char *fmt, ...);
+void log_access(const char *fmt, ...);
+bool log_open_binary(const char *path, const void *header, size_t header_len);
+void log_binary(const void *data, size_t len);
+uint32_t log_binary_generation(void);
+uint64_t log_dropped(void);
+size_t log_buffers(void);
 void log_close(void);
 
 /* Helper macros for convenient logging */
@@ -35,5 +54,6 @@ void log_close(void);
 #define LOG_WARN(...) log_write(LOG_WARN, __VA_ARGS__)
 #define LOG_ERROR(...) log_write(LOG_ERROR, __VA_ARGS__)
 #define LOG_FATAL(...) log_write(LOG_FATAL, __VA_ARGS__)
+#define LOG_ACCESS(...) log_access(__VA_ARGS__)
 
-#endif /* LOGGER_H */ 
\ No newline at end of file
+#endif /* LOGGER_H */
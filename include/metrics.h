@@ -0,0 +1,53 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Why a connection or request was turned away */
+typedef enum {
+    METRIC_REJECT_DENIED,           /* Address on the deny list */
+    METRIC_REJECT_RATE_LIMITED,     /* Request rate or cost budget exceeded */
+    METRIC_REJECT_CONNECTIONS,      /* Too many connections from one client */
+    METRIC_REJECT_BANDWIDTH,        /* Egress budget exceeded */
+    METRIC_REJECT_OVERLOAD,         /* Shed by the concurrency limiter */
+    METRIC_REJECT_COUNT
+} metrics_reject_t;
+
+/* Request checks, in the order the server runs them (cheapest first) */
+typedef enum {
+    METRIC_CHECK_METHOD,            /* Method allowed */
+    METRIC_CHECK_LENGTH,            /* Target, header and body sizes */
+    METRIC_CHECK_BYTES,             /* Characters allowed in path and query */
+    METRIC_CHECK_RATE,              /* Route cost and egress budget */
+    METRIC_CHECK_PATH,              /* File type and resolution under the root */
+    METRIC_CHECK_PATTERNS,          /* Injection patterns in query and body */
+    METRIC_CHECK_COUNT
+} metrics_check_t;
+
+/* Latency histograms; the stage histograms follow trace_stage_t order */
+typedef enum {
+    METRIC_HIST_REQUEST,            /* Whole request, parse to last byte sent */
+    METRIC_HIST_STAGE_READ,
+    METRIC_HIST_STAGE_PARSE,
+    METRIC_HIST_STAGE_CHECK,
+    METRIC_HIST_STAGE_LIMIT,
+    METRIC_HIST_STAGE_PATH,
+    METRIC_HIST_STAGE_OPEN,
+    METRIC_HIST_STAGE_SEND,
+    METRIC_HIST_COUNT
+} metrics_hist_t;
+
+/* Function prototypes */
+void metrics_connection_open(void);
+void metrics_connection_close(void);
+void metrics_request(int method, int status, uint64_t bytes, bool cache_hit);
+void metrics_reject(metrics_reject_t reason);
+void metrics_short_response(void);
+void metrics_check(metrics_check_t check, uint64_t nsec, bool passed);
+void metrics_observe(metrics_hist_t hist, uint64_t usec);
+uint64_t metrics_quantile(metrics_hist_t hist, double quantile);
+size_t metrics_render(char *buf, size_t size);
+
+#endif /* METRICS_H */
@@ -0,0 +1,35 @@
+#ifndef NEGATIVE_CACHE_H
+#define NEGATIVE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NEGATIVE_CACHE_KEY_MAX  128     /* Longer paths are not cached */
+
+/* Recently failed request paths
+ *
+ * Remembers the status (403 or 404) a path was last refused with, so
+ * repeated requests for it skip the filesystem. Entries expire after a
+ * time to live, and all are dropped when the web root's directory is
+ * replaced or its entries change.
+ */
+typedef struct negative_cache negative_cache_t;
+
+/* Counters since creation */
+typedef struct {
+    uint64_t hits;
+    uint64_t inserts;
+    uint64_t clears;            /* Web root changes seen */
+} negative_cache_stats_t;
+
+/* Function prototypes */
+negative_cache_t *negative_cache_create(size_t capacity, uint32_t ttl_seconds,
+                                        const char *root);
+void negative_cache_destroy(negative_cache_t *cache);
+int negative_cache_lookup(negative_cache_t *cache, const char *path, size_t len);
+void negative_cache_insert(negative_cache_t *cache, const char *path, size_t len, int status);
+void negative_cache_clear(negative_cache_t *cache);
+void negative_cache_stats(negative_cache_t *cache, negative_cache_stats_t *stats);
+
+#endif /* NEGATIVE_CACHE_H */
@@ -0,0 +1,29 @@
+#ifndef PATTERN_SET_H
+#define PATTERN_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Case-insensitive multi-pattern matcher
+ *
+ * Patterns are added with a group number (0-31), compiled once, and any
+ * number of inputs can then be scanned concurrently. A scan reports which
+ * groups had at least one pattern occur in the input. Input that arrives
+ * in pieces can be fed chunk by chunk with a 32-bit state carried between
+ * chunks, finding the same matches as a scan of the whole.
+ */
+typedef struct pattern_set pattern_set_t;
+
+#define PATTERN_GROUPS  32
+
+/* Function prototypes */
+pattern_set_t *pattern_set_create(void);
+void pattern_set_destroy(pattern_set_t *set);
+bool pattern_set_add(pattern_set_t *set, const char *pattern, unsigned int group);
+bool pattern_set_compile(pattern_set_t *set);
+uint32_t pattern_set_scan(const pattern_set_t *set, const void *data, size_t len);
+uint32_t pattern_set_feed(const pattern_set_t *set, uint32_t *state,
+                          const void *data, size_t len);
+
+#endif /* PATTERN_SET_H */
@@ -0,0 +1,53 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/* USDT tracepoints
+ *
+ * With <sys/sdt.h> available (systemtap-sdt-dev / systemtap-sdt-devel)
+ * each probe is a single NOP plus an ELF note describing where its
+ * arguments live, so it costs nothing until perf or bpftrace attaches:
+ *
+ *   bpftrace -e 'usdt:./bin/zircon:zircon:response_sent { @[arg1] = count(); }'
+ *
+ * Each probe also has a semaphore that the tracer raises while attached,
+ * and its arguments are only evaluated then, so a probe costs a load and
+ * a not-taken branch even when its arguments need work. The semaphores
+ * are defined once, with ZIRCON_PROBE_SEMAPHORE(), in the file that
+ * fires the probes.
+ *
+ * Without the header, or when built with USDT=0, probes compile away.
+ *
+ *   accept            (fd, addr)
+ *   admission         (fd, addr, admission_result_t)
+ *   request_parsed    (fd, method, path)
+ *   file_opened       (fd, path, size)
+ *   response_sent     (fd, status, bytes, duration_usec)
+ *   connection_closed (fd, duration_usec)
+ */
+#if !defined(ZIRCON_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define ZIRCON_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef ZIRCON_HAVE_USDT
+#define ZIRCON_PROBE_SEMAPHORE(name) \
+    unsigned short zircon_##name##_semaphore __attribute__((section(".probes")))
+#define ZIRCON_PROBE_ENABLED(name)  __builtin_expect(zircon_##name##_semaphore != 0, 0)
+#define ZIRCON_PROBE2(name, a, b) \
+    do { if (ZIRCON_PROBE_ENABLED(name)) DTRACE_PROBE2(zircon, name, a, b); } while (0)
+#define ZIRCON_PROBE3(name, a, b, c) \
+    do { if (ZIRCON_PROBE_ENABLED(name)) DTRACE_PROBE3(zircon, name, a, b, c); } while (0)
+#define ZIRCON_PROBE4(name, a, b, c, d) \
+    do { if (ZIRCON_PROBE_ENABLED(name)) DTRACE_PROBE4(zircon, name, a, b, c, d); } while (0)
+#else
+#define ZIRCON_PROBE_SEMAPHORE(name)        extern int zircon_no_##name##_semaphore
+#define ZIRCON_PROBE_ENABLED(name)          0
+#define ZIRCON_PROBE2(name, a, b)           do { } while (0)
+#define ZIRCON_PROBE3(name, a, b, c)        do { } while (0)
+#define ZIRCON_PROBE4(name, a, b, c, d)     do { } while (0)
+#endif
+
+#endif /* PROBES_H */
@@ -2,21 +2,46 @@
 #define RATE_LIMITER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
+#include <netinet/in.h>
 
 /* Rate limiter context */
 typedef struct rate_limiter rate_limiter_t;
 
-/* Rate limit configuration */
+/* Rate limit configuration
+ *
+ * Clients may sustain requests_per_window requests every window_seconds,
+ * and may send up to burst_size requests back-to-back before that rate
+ * applies. With weighted checks, "requests" are cost units instead, e.g.
+ * KiB for a bandwidth limiter.
+ */
 typedef struct {
-    unsigned int requests_per_second;
-    unsigned int burst_size;
-    time_t window_seconds;
+    unsigned int requests_per_window;   /* Sustained rate numerator */
+    unsigned int burst_size;            /* Max back-to-back requests */
+    time_t window_seconds;              /* Sustained rate denominator */
 } rate_limit_config_t;
 
+/* Clock source in microseconds; it must never go backwards. Processes
+ * sharing a table must use clocks that agree. */
+typedef uint64_t (*rate_limiter_clock_t)(void *ctx);
+
 /* Function prototypes */
 rate_limiter_t *rate_limiter_create(const rate_limit_config_t *config);
+rate_limiter_t *rate_limiter_create_shared(const rate_limit_config_t *config,
+                                           const char *name);
 void rate_limiter_destroy(rate_limiter_t *limiter);
+void rate_limiter_set_clock(rate_limiter_t *limiter, rate_limiter_clock_t clock, void *ctx);
+size_t rate_limiter_footprint(const rate_limiter_t *limiter);
+uint64_t rate_limiter_table_full(const rate_limiter_t *limiter);
 bool rate_limiter_check(rate_limiter_t *limiter, const char *ip);
+bool rate_limiter_check_addr(rate_limiter_t *limiter, const struct in_addr *addr);
+bool rate_limiter_check_cost(rate_limiter_t *limiter, const struct in_addr *addr,
+                             uint32_t cost);
+void rate_limiter_charge(rate_limiter_t *limiter, const struct in_addr *addr,
+                         uint32_t cost);
+uint64_t rate_limiter_reserve(rate_limiter_t *limiter, const struct in_addr *addr,
+                              uint32_t cost);
 
-#endif /* RATE_LIMITER_H */
\ No newline at end of file
+#endif /* RATE_LIMITER_H */
@@ -2,17 +2,36 @@
 #define REQUEST_VALIDATOR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "http.h"
 
+#define MAX_PATH_LENGTH 255
+#define MAX_PATH_DEPTH  32      /* Directory levels below the root */
+
 /* Validation result */
 typedef struct {
     bool valid;
     const char *error;
 } validation_result_t;
 
+/* Request path after decoding and normalization
+ *
+ * The path starts with '/' and has no empty, "." or ".." segments; a
+ * directory keeps its trailing '/'. Percent-encoded bytes are decoded,
+ * so it names the file as it is on disk.
+ */
+typedef struct {
+    char path[MAX_PATH_LENGTH + 1];
+    size_t length;
+    size_t extension;           /* Offset of the final segment's last '.', 0 if none */
+    bool directory;             /* Ends with '/' */
+} normalized_path_t;
+
 /* Function prototypes */
+bool normalize_path(const char *target, size_t len, normalized_path_t *out);
 validation_result_t validate_request(const http_request_t *request);
 bool is_path_safe(const char *path);
+bool is_query_safe(const char *query);
 bool is_method_allowed(http_method_t method);
 
-#endif /* REQUEST_VALIDATOR_H */
\ No newline at end of file
+#endif /* REQUEST_VALIDATOR_H */
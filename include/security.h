@@ -2,11 +2,30 @@
 #define SECURITY_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "security_config.h"
 
 /* Security context */
 typedef struct security_ctx security_ctx_t;
 
+/* Request body inspected as it arrives
+ *
+ * Only the matcher and decoder state and counters are kept, so memory
+ * stays the same whatever the body size; the caller can discard each
+ * chunk once fed. Percent escapes and '+' are decoded before scanning,
+ * and patterns match whole words only.
+ */
+typedef struct {
+    uint32_t state;         /* Pattern matcher state between chunks */
+    uint32_t found;         /* Pattern groups seen so far */
+    size_t length;          /* Body bytes fed so far */
+    uint8_t escape;         /* Bytes of a percent escape held, 0-2 */
+    char held;              /* First hex digit of the escape */
+    bool word;              /* Last byte scanned was part of a word */
+    bool gap;               /* Whitespace since then */
+} security_body_t;
+
 /* Function prototypes */
 security_ctx_t *security_create(const security_config_t *config);
 void security_destroy(security_ctx_t *ctx);
@@ -19,4 +38,9 @@ bool security_check_request(security_ctx_t *ctx,
                           const char *body,
                           size_t body_length);
 
+void security_body_begin(security_body_t *body);
+bool security_body_feed(security_ctx_t *ctx, security_body_t *body,
+                        const char *ip, const void *data, size_t len);
+bool security_body_end(security_ctx_t *ctx, security_body_t *body, const char *ip);
+
 #endif /* SECURITY_H */ 
\ No newline at end of file
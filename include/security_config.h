@@ -27,6 +27,20 @@ typedef struct {
     size_t ext_count;
 } security_files_t;
 
+/* Request inspection rules added to the built-in pattern sets */
+#define SECURITY_MAX_RULES  64
+#define SECURITY_RULE_LEN   64
+
+typedef enum {
+    SECURITY_RULE_SQL,
+    SECURITY_RULE_XSS
+} security_rule_kind_t;
+
+typedef struct {
+    security_rule_kind_t kind;
+    char pattern[SECURITY_RULE_LEN];    /* Matched case-insensitively */
+} security_rule_t;
+
 /* Security configuration structure */
 typedef struct {
     security_level_t level;
@@ -51,6 +65,10 @@ typedef struct {
     uint32_t hsts_max_age;
     bool enable_csp;
     char csp_policy[1024];
+
+    /* Extra injection patterns (sql_pattern= / xss_pattern= lines) */
+    security_rule_t rules[SECURITY_MAX_RULES];
+    size_t rule_count;
 } security_config_t;
 
 /* Function prototypes */
@@ -13,11 +13,49 @@ typedef struct {
     char bind_addr[16];         /* Bind address */
     char root_dir[256];         /* Web root directory */
     uint32_t max_requests;      /* Rate limit: max requests per minute */
+    char rate_limit_shm[64];    /* Shared rate-limit region name, "" for per-process */
+    bool reuse_port;            /* Let several processes bind the same port */
+    uint32_t max_connections;   /* Concurrent connections per client, 0 = unlimited */
+    char acl_allow[256];        /* Comma-separated CIDR ranges to admit */
+    char acl_deny[256];         /* Comma-separated CIDR ranges to drop */
+    char acl_trust[256];        /* CIDR ranges exempt from rate/connection limits */
+    uint32_t concurrency_limit_min;  /* Adaptive in-flight request floor */
+    uint32_t concurrency_limit_max;  /* Adaptive in-flight request ceiling, 0 = off */
+    uint32_t bandwidth_kb_per_minute;  /* Per-client egress budget, 0 = unlimited */
+    uint32_t bandwidth_burst_kb;       /* Egress a client may use back-to-back */
+    char route_costs[256];      /* "prefix:cost,..." request cost classes */
+    uint32_t shape_conn_kbps;   /* Per-connection egress rate in KiB/s, 0 = unshaped */
+    uint32_t shape_ip_kbps;     /* Per-client egress rate in KiB/s, 0 = unshaped */
+    uint32_t shape_min_size_kb; /* Shape bodies at least this large */
+    char shape_mime[256];       /* Shape these comma-separated MIME prefixes */
+    char access_log[256];       /* Log file path, "" for stderr only */
+    char binary_access_log[256]; /* Binary access log path, "" for text lines */
+    bool log_block;             /* Wait for log space instead of dropping */
+    uint32_t log_sampling;      /* Keep 1 in N access lines under load */
+    uint32_t log_rotate_size_mb; /* Rotate logs past this size, 0 = never */
+    uint32_t log_rotate_interval; /* Rotate logs every N seconds, 0 = never */
+    uint32_t log_rotate_keep;   /* Rotated files kept */
+    char metrics_path[64];      /* Prometheus scrape path for trusted clients, "" = off */
+    uint32_t slow_request_ms;   /* Log requests slower than this with stage times, 0 = off */
+    bool server_timing;         /* Send stage times in a Server-Timing header */
+    uint32_t heavy_hitters;     /* Top clients/paths tracked, 0 = off */
+    uint32_t heavy_hitters_half_life; /* Seconds for their weights to halve */
+    char request_checks[128];   /* Comma-separated request checks to run, "" = all but patterns */
+    char methods[32];           /* Comma-separated methods served, "" = GET, HEAD, POST */
+    uint32_t max_request_size;  /* Largest request body in bytes, 0 = 1 MiB */
+    char security_config[256];  /* Extra injection patterns and options, "" = built-in */
+    uint32_t negative_cache;    /* Refused paths remembered, 0 = off */
+    uint32_t negative_cache_ttl; /* Seconds one is remembered, 0 = 10 */
+    char asset_pack[256];       /* Serve from this zircon-pack archive, "" = from www */
 } server_config_t;
 
 /* Function prototypes */
 server_t *server_create(const server_config_t *config);
 void server_destroy(server_t *server);
 bool server_run(server_t *server);
+void server_stop(server_t *server);
+
+/* Configuration file support */
+bool server_config_load(server_config_t *config, const char *filename);
 
 #endif /* SERVER_H */
\ No newline at end of file
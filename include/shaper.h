@@ -0,0 +1,31 @@
+#ifndef SHAPER_H
+#define SHAPER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+/* Egress shaper context */
+typedef struct shaper shaper_t;
+
+/* Shaping configuration */
+typedef struct {
+    uint32_t conn_kbps;         /* Per-connection rate in KiB/s, 0 = unlimited */
+    uint32_t ip_kbps;           /* Per-client rate in KiB/s, 0 = unlimited */
+    uint32_t min_size_kb;       /* Shape bodies at least this large */
+    const char *mime;           /* Comma-separated MIME prefixes to shape */
+    const char *shm_name;       /* Share per-client state, NULL for private */
+} shaper_config_t;
+
+/* Function prototypes */
+shaper_t *shaper_create(const shaper_config_t *config);
+void shaper_destroy(shaper_t *shaper);
+bool shaper_applies(const shaper_t *shaper, const char *mime_type, size_t size);
+size_t shaper_send_file(shaper_t *shaper, int client_fd, int file_fd, size_t size,
+                        const struct in_addr *addr, bool shaped);
+size_t shaper_send_range(shaper_t *shaper, int client_fd, int file_fd, off_t offset,
+                         size_t size, const struct in_addr *addr, bool shaped);
+
+#endif /* SHAPER_H */
@@ -0,0 +1,15 @@
+#ifndef TIMECACHE_H
+#define TIMECACHE_H
+
+#include <time.h>
+
+#define TIMECACHE_LOG_LEN  20   /* "YYYY-MM-DD HH:MM:SS" plus NUL */
+#define TIMECACHE_HTTP_LEN 30   /* "Sun, 06 Nov 1994 08:49:37 GMT" plus NUL */
+
+/* Function prototypes */
+time_t timecache_now(void);
+void timecache_update(void);
+void timecache_log_time(char buf[TIMECACHE_LOG_LEN]);
+void timecache_http_date(char buf[TIMECACHE_HTTP_LEN]);
+
+#endif /* TIMECACHE_H */
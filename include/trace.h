@@ -0,0 +1,72 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Stages of a request, in the order they run */
+typedef enum {
+    TRACE_READ,         /* Waiting for and reading the request */
+    TRACE_PARSE,        /* Parsing the request line and headers */
+    TRACE_CHECK,        /* Request checks, and receiving a POST body */
+    TRACE_LIMIT,        /* Route cost, bandwidth and concurrency checks */
+    TRACE_PATH,         /* File type and path validation (realpath) */
+    TRACE_OPEN,         /* open, fstat and ETag */
+    TRACE_SEND,         /* Response headers and body */
+    TRACE_STAGE_COUNT
+} trace_stage_t;
+
+/* Stage timestamps for one request, kept in raw clock ticks */
+typedef struct {
+    uint64_t start;                     /* Ticks at trace_begin */
+    uint64_t mark;                      /* Ticks at the last stage boundary */
+    uint64_t ticks[TRACE_STAGE_COUNT];  /* Ticks spent in each stage */
+    uint32_t seen;                      /* Bit per stage that ran */
+} request_trace_t;
+
+/* Raw tick source: the TSC where available, else the monotonic clock in ns */
+static inline uint64_t trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* Start timing a request */
+static inline void trace_begin(request_trace_t *trace) {
+    trace->start = trace->mark = trace_ticks();
+    for (int i = 0; i < TRACE_STAGE_COUNT; i++) trace->ticks[i] = 0;
+    trace->seen = 0;
+}
+
+/* Charge the time since the last mark to a stage */
+static inline void trace_mark(request_trace_t *trace, trace_stage_t stage) {
+    uint64_t now = trace_ticks();
+    trace->ticks[stage] += now - trace->mark;
+    trace->mark = now;
+    trace->seen |= 1u << stage;
+}
+
+static inline bool trace_ran(const request_trace_t *trace, trace_stage_t stage) {
+    return trace->seen & (1u << stage);
+}
+
+/* Function prototypes */
+void trace_init(void);
+const char *trace_stage_name(trace_stage_t stage);
+uint32_t trace_stage_usec(const request_trace_t *trace, trace_stage_t stage);
+uint32_t trace_total_usec(const request_trace_t *trace);
+uint32_t trace_since_usec(uint64_t ticks);
+uint64_t trace_ticks_nsec(uint64_t ticks);
+size_t trace_breakdown(const request_trace_t *trace, char *buf, size_t size);
+size_t trace_server_timing(const request_trace_t *trace, char *buf, size_t size);
+
+#endif /* TRACE_H */
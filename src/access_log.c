@@ -0,0 +1,134 @@
+#include "access_log.h"
+#include "logger.h"
+#include <string.h>
+
+#define INTERN_SLOTS    4096    /* Distinct paths remembered, power of two */
+#define INTERN_PROBES   16
+
+/* Interned path
+ *
+ * Slots are claimed by CAS on the hash, then the id is published. A
+ * thread that finds a claimed slot whose id is not yet visible, or a full
+ * neighbourhood, just defines the path again under a fresh id.
+ */
+typedef struct {
+    uint64_t hash;
+    uint32_t id;
+} intern_slot_t;
+
+static intern_slot_t intern_table[INTERN_SLOTS];
+static uint32_t next_path_id = 0;
+static uint32_t table_generation = 0;   /* Binary log file the table describes */
+
+/* 64-bit FNV-1a, never zero */
+static uint64_t path_hash(const char *path, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+/* Forget interned paths once the log moves to a new file
+ *
+ * Definitions live in the file they were written to, so a reopened or
+ * rotated file needs its own, and its ids start again from 1; otherwise
+ * ids would keep growing for as long as the server runs. Records queued
+ * just before the switch may still land in the new file without a
+ * definition.
+ */
+static void check_generation(void) {
+    uint32_t current = log_binary_generation();
+    uint32_t seen = __atomic_load_n(&table_generation, __ATOMIC_ACQUIRE);
+
+    if (current != seen &&
+        __atomic_compare_exchange_n(&table_generation, &seen, current, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        for (size_t i = 0; i < INTERN_SLOTS; i++) {
+            __atomic_store_n(&intern_table[i].hash, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&intern_table[i].id, 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&next_path_id, 0, __ATOMIC_RELAXED);
+    }
+}
+
+/* Look up a path id, returning 0 and a new id in *fresh if it must be defined */
+static uint32_t intern_path(const char *path, size_t len, uint32_t *fresh) {
+    uint64_t hash = path_hash(path, len);
+    check_generation();
+
+    for (uint32_t i = 0; i < INTERN_PROBES; i++) {
+        intern_slot_t *slot = &intern_table[(hash + i) & (INTERN_SLOTS - 1)];
+        uint64_t seen = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+
+        if (seen == 0 &&
+            __atomic_compare_exchange_n(&slot->hash, &seen, hash, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *fresh = __atomic_add_fetch(&next_path_id, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->id, *fresh, __ATOMIC_RELEASE);
+            return 0;
+        }
+        if (seen == hash) {
+            uint32_t id = __atomic_load_n(&slot->id, __ATOMIC_ACQUIRE);
+            if (id) return id;
+            break;
+        }
+    }
+
+    *fresh = __atomic_add_fetch(&next_path_id, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Open the binary access log */
+bool access_log_open(const char *path) {
+    access_log_header_t header = {
+        .version = ACCESS_LOG_VERSION,
+        .record_size = sizeof(access_record_t)
+    };
+    memcpy(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic));
+
+    return log_open_binary(path, &header, sizeof(header));
+}
+
+/* Append one request to the binary access log */
+void access_log_write(const access_entry_t *entry) {
+    /* Definition (if any) and request go out as one logger record */
+    unsigned char buf[sizeof(access_record_t) * 2 + ACCESS_LOG_PATH_MAX + 1];
+    size_t len = 0;
+
+    const char *path = entry->path ? entry->path : "-";
+    size_t path_len = strnlen(path, ACCESS_LOG_PATH_MAX);
+
+    uint32_t fresh = 0;
+    uint32_t id = intern_path(path, path_len, &fresh);
+    if (!id) {
+        access_record_t def = {
+            .bytes = path_len,
+            .path_id = fresh,
+            .status = ACCESS_STATUS_PATHDEF
+        };
+        size_t padded = (path_len + sizeof(def) - 1) / sizeof(def) * sizeof(def);
+
+        memcpy(buf, &def, sizeof(def));
+        memcpy(buf + sizeof(def), path, path_len);
+        memset(buf + sizeof(def) + path_len, 0, padded - path_len);
+        len = sizeof(def) + padded;
+        id = fresh;
+    }
+
+    access_record_t rec = {
+        .time_usec = entry->start_usec,
+        .bytes = entry->bytes,
+        .addr = entry->addr.s_addr,
+        .path_id = id,
+        .duration_usec = entry->duration_usec,
+        .status = entry->status,
+        .method = entry->method,
+        .cache = (uint8_t)entry->cache
+    };
+    memcpy(buf + len, &rec, sizeof(rec));
+    len += sizeof(rec);
+
+    log_binary(buf, len);
+}
@@ -0,0 +1,147 @@
+#include "access_log_reader.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Path id table entry; def is the definition number + 1, 0 if free */
+typedef struct {
+    size_t def;
+    uint32_t id;
+} id_slot_t;
+
+/* Access log reader
+ *
+ * Ids are only unique within one run of one writer: a server restart
+ * appends to the same file and starts its ids again, and so does a
+ * reopen of an unrenamed file. Definitions are therefore applied in file
+ * order, each one holding until its id is defined again. A definition
+ * written by another thread may land just after the first use of its
+ * id; a request whose id has not been defined yet takes the id's first
+ * definition in the file.
+ */
+struct access_log_reader {
+    const char *begin;          /* First record after the header */
+    const char *end;            /* End of the last whole, valid record */
+    const char *pos;            /* Next record to read */
+    access_path_t *defs;        /* In file order */
+    size_t def_count;
+    size_t next_def;            /* Definitions read so far */
+    id_slot_t *first;           /* Id -> its first definition */
+    id_slot_t *current;         /* Id -> its latest definition read */
+    size_t mask;                /* Table slots - 1 */
+};
+
+/* Whole records taken by a definition and its path */
+static size_t def_span(const access_record_t *rec) {
+    return sizeof(*rec) + (rec->bytes + sizeof(*rec) - 1) / sizeof(*rec) * sizeof(*rec);
+}
+
+static id_slot_t *find_slot(id_slot_t *table, size_t mask, uint32_t id) {
+    uint64_t hash = id * 0x9e3779b97f4a7c15ULL;
+    size_t i = (size_t)(hash ^ (hash >> 29)) & mask;
+    while (table[i].def && table[i].id != id) {
+        i = (i + 1) & mask;
+    }
+    return &table[i];
+}
+
+/* Check the header and index the path definitions */
+access_log_reader_t *access_log_reader_open(const void *map, size_t size) {
+    const access_log_header_t *header = map;
+    if (!map || size < sizeof(*header) ||
+        memcmp(header->magic, ACCESS_LOG_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != ACCESS_LOG_VERSION ||
+        header->record_size != sizeof(access_record_t)) {
+        return NULL;
+    }
+
+    access_log_reader_t *reader = calloc(1, sizeof(*reader));
+    if (!reader) return NULL;
+
+    reader->begin = (const char *)map + sizeof(*header);
+    reader->end = reader->begin + (size - sizeof(*header)) / sizeof(access_record_t) *
+                                  sizeof(access_record_t);
+    reader->pos = reader->begin;
+
+    /* Count definitions; a malformed one ends the usable part of the file */
+    for (const char *p = reader->begin; p < reader->end; p += sizeof(access_record_t)) {
+        const access_record_t *rec = (const access_record_t *)p;
+        if (rec->status != ACCESS_STATUS_PATHDEF) continue;
+
+        if (rec->bytes > ACCESS_LOG_PATH_MAX ||
+            def_span(rec) > (size_t)(reader->end - p)) {
+            reader->end = p;
+            break;
+        }
+        reader->def_count++;
+        p += def_span(rec) - sizeof(access_record_t);
+    }
+
+    /* Tables at most half full; definitions are bounded by the file size */
+    size_t slots = 16;
+    while (slots < reader->def_count * 2) slots *= 2;
+    reader->mask = slots - 1;
+    reader->defs = calloc(reader->def_count ? reader->def_count : 1, sizeof(*reader->defs));
+    reader->first = calloc(slots, sizeof(*reader->first));
+    reader->current = calloc(slots, sizeof(*reader->current));
+    if (!reader->defs || !reader->first || !reader->current) {
+        access_log_reader_close(reader);
+        return NULL;
+    }
+
+    size_t n = 0;
+    for (const char *p = reader->begin; p < reader->end; p += sizeof(access_record_t)) {
+        const access_record_t *rec = (const access_record_t *)p;
+        if (rec->status != ACCESS_STATUS_PATHDEF) continue;
+
+        reader->defs[n] = (access_path_t){
+            .text = p + sizeof(*rec),
+            .len = (uint32_t)rec->bytes,
+            .index = n
+        };
+        id_slot_t *slot = find_slot(reader->first, reader->mask, rec->path_id);
+        if (!slot->def) {
+            slot->id = rec->path_id;
+            slot->def = n + 1;
+        }
+        n++;
+        p += def_span(rec) - sizeof(access_record_t);
+    }
+    return reader;
+}
+
+/* Free the reader (the mapping is the caller's) */
+void access_log_reader_close(access_log_reader_t *reader) {
+    if (!reader) return;
+    free(reader->defs);
+    free(reader->first);
+    free(reader->current);
+    free(reader);
+}
+
+/* Number of path definitions in the file */
+size_t access_log_reader_paths(const access_log_reader_t *reader) {
+    return reader ? reader->def_count : 0;
+}
+
+/* Next request record, NULL at the end; *path is NULL if never defined */
+const access_record_t *access_log_reader_next(access_log_reader_t *reader,
+                                              const access_path_t **path) {
+    while (reader->pos < reader->end) {
+        const access_record_t *rec = (const access_record_t *)reader->pos;
+
+        if (rec->status == ACCESS_STATUS_PATHDEF) {
+            id_slot_t *slot = find_slot(reader->current, reader->mask, rec->path_id);
+            slot->id = rec->path_id;
+            slot->def = ++reader->next_def;
+            reader->pos += def_span(rec);
+            continue;
+        }
+        reader->pos += sizeof(*rec);
+
+        const id_slot_t *slot = find_slot(reader->current, reader->mask, rec->path_id);
+        if (!slot->def) slot = find_slot(reader->first, reader->mask, rec->path_id);
+        *path = slot->def ? &reader->defs[slot->def - 1] : NULL;
+        return rec;
+    }
+    return NULL;
+}
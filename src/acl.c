@@ -0,0 +1,114 @@
+#include "acl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+
+/* Radix tree node: one address bit per level */
+typedef struct acl_node {
+    struct acl_node *child[2];
+    acl_action_t action;        /* Action for the prefix ending here */
+} acl_node_t;
+
+/* Access list context */
+struct acl {
+    acl_node_t root;            /* Matches 0.0.0.0/0 */
+};
+
+/* Create empty access list */
+acl_t *acl_create(void) {
+    return calloc(1, sizeof(acl_t));
+}
+
+/* Free a subtree */
+static void free_node(acl_node_t *node) {
+    if (!node) return;
+    free_node(node->child[0]);
+    free_node(node->child[1]);
+    free(node);
+}
+
+/* Clean up access list */
+void acl_destroy(acl_t *acl) {
+    if (!acl) return;
+    free_node(acl->root.child[0]);
+    free_node(acl->root.child[1]);
+    free(acl);
+}
+
+/* Add a rule for "a.b.c.d" or "a.b.c.d/len" */
+bool acl_add(acl_t *acl, const char *cidr, acl_action_t action) {
+    if (!acl || !cidr || action == ACL_NONE) return false;
+
+    char addr_str[INET_ADDRSTRLEN];
+    int prefix_len = 32;
+
+    const char *slash = strchr(cidr, '/');
+    size_t addr_len = slash ? (size_t)(slash - cidr) : strlen(cidr);
+    if (addr_len >= sizeof(addr_str)) return false;
+    memcpy(addr_str, cidr, addr_len);
+    addr_str[addr_len] = '\0';
+
+    if (slash) {
+        char *end;
+        long len = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end || len < 0 || len > 32) return false;
+        prefix_len = (int)len;
+    }
+
+    struct in_addr in;
+    if (inet_pton(AF_INET, addr_str, &in) != 1) return false;
+    uint32_t addr = ntohl(in.s_addr);
+
+    /* Walk down, creating nodes for the prefix bits */
+    acl_node_t *node = &acl->root;
+    for (int bit = 0; bit < prefix_len; bit++) {
+        int dir = (addr >> (31 - bit)) & 1;
+        if (!node->child[dir]) {
+            node->child[dir] = calloc(1, sizeof(acl_node_t));
+            if (!node->child[dir]) return false;
+        }
+        node = node->child[dir];
+    }
+
+    node->action = action;
+    return true;
+}
+
+/* Add rules from a comma-separated list of CIDR ranges */
+bool acl_add_list(acl_t *acl, const char *list, acl_action_t action) {
+    if (!acl || !list) return false;
+
+    char entry[32];
+    const char *p = list;
+    while (*p) {
+        /* Extract next entry without surrounding whitespace */
+        while (*p == ',' || isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+
+        size_t len = 0;
+        while (p[len] && p[len] != ',' && !isspace((unsigned char)p[len])) len++;
+        if (len >= sizeof(entry)) return false;
+
+        memcpy(entry, p, len);
+        entry[len] = '\0';
+        if (!acl_add(acl, entry, action)) return false;
+        p += len;
+    }
+    return true;
+}
+
+/* Find the action of the longest matching prefix (addr in host order) */
+acl_action_t acl_lookup(const acl_t *acl, uint32_t addr) {
+    if (!acl) return ACL_NONE;
+
+    const acl_node_t *node = &acl->root;
+    acl_action_t action = node->action;
+
+    for (int bit = 0; bit < 32; bit++) {
+        node = node->child[(addr >> (31 - bit)) & 1];
+        if (!node) break;
+        if (node->action != ACL_NONE) action = node->action;
+    }
+    return action;
+}
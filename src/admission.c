@@ -0,0 +1,161 @@
+#include "admission.h"
+#include "acl.h"
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#define CONN_BITS   14
+#define CONN_SLOTS  (1u << CONN_BITS)
+#define MAX_PROBES  32
+
+/* Per-address connection counter
+ *
+ * Slots are claimed by tag and recycled once their count drops to zero,
+ * mirroring the rate limiter's client table.
+ */
+typedef struct {
+    uint64_t tag;           /* 0 if free, else (1 << 32) | address */
+    uint32_t count;         /* Open connections from this address */
+    uint32_t pad;
+} conn_slot_t;
+
+/* Admission context */
+struct admission {
+    acl_t *acl;
+    rate_limiter_t *limiter;
+    uint32_t max_connections;
+    conn_slot_t *conns;     /* Only allocated when connections are capped */
+};
+
+/* Create admission context */
+admission_t *admission_create(const admission_config_t *config) {
+    if (!config) return NULL;
+
+    admission_t *adm = calloc(1, sizeof(*adm));
+    if (!adm) return NULL;
+
+    adm->limiter = config->limiter;
+    adm->max_connections = config->max_connections;
+
+    adm->acl = acl_create();
+    if (!adm->acl ||
+        (config->allow && !acl_add_list(adm->acl, config->allow, ACL_ALLOW)) ||
+        (config->deny && !acl_add_list(adm->acl, config->deny, ACL_DENY)) ||
+        (config->trust && !acl_add_list(adm->acl, config->trust, ACL_TRUST))) {
+        admission_destroy(adm);
+        return NULL;
+    }
+
+    if (adm->max_connections) {
+        adm->conns = calloc(CONN_SLOTS, sizeof(conn_slot_t));
+        if (!adm->conns) {
+            admission_destroy(adm);
+            return NULL;
+        }
+    }
+
+    return adm;
+}
+
+/* Clean up admission context */
+void admission_destroy(admission_t *adm) {
+    if (!adm) return;
+    acl_destroy(adm->acl);
+    free(adm->conns);
+    free(adm);
+}
+
+/* Find the counter for an address, claiming one if needed */
+static conn_slot_t *get_conn_slot(admission_t *adm, uint32_t addr, bool create) {
+    uint64_t tag = (1ull << 32) | addr;
+    size_t idx = (size_t)((addr * 2654435761u) >> (32 - CONN_BITS));
+    conn_slot_t *reusable = NULL;
+
+    for (size_t i = 0; i < MAX_PROBES; i++) {
+        conn_slot_t *slot = &adm->conns[(idx + i) & (CONN_SLOTS - 1)];
+        uint64_t cur = __atomic_load_n(&slot->tag, __ATOMIC_ACQUIRE);
+
+        if (cur == tag) return slot;
+        if (!create) continue;
+
+        if (cur == 0) {
+            if (__atomic_compare_exchange_n(&slot->tag, &cur, tag, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+                cur == tag) {
+                return slot;
+            }
+        } else if (!reusable && __atomic_load_n(&slot->count, __ATOMIC_ACQUIRE) == 0) {
+            reusable = slot;
+        }
+    }
+
+    /* Take over an idle slot */
+    if (reusable) {
+        uint64_t cur = __atomic_load_n(&reusable->tag, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&reusable->count, __ATOMIC_ACQUIRE) == 0 &&
+            __atomic_compare_exchange_n(&reusable->tag, &cur, tag, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return reusable;
+        }
+    }
+    return NULL;
+}
+
+/* Decide whether to admit a new connection
+ *
+ * Checks run cheapest first: address list, request rate, then the
+ * concurrent connection count. An admitted connection holds a connection
+ * slot until admission_release() is called for the same address. Checks
+ * come from the single accepting thread; releases may come from any.
+ */
+admission_result_t admission_check(admission_t *adm, const struct in_addr *addr) {
+    if (!adm || !addr) return ADMIT_DENIED;
+
+    acl_action_t action = acl_lookup(adm->acl, ntohl(addr->s_addr));
+    if (action == ACL_DENY) return ADMIT_DENIED;
+    if (action == ACL_TRUST) return ADMIT_OK;
+
+    if (adm->limiter && !rate_limiter_check_addr(adm->limiter, addr))
+        return ADMIT_RATE_LIMITED;
+
+    if (!adm->conns) return ADMIT_OK;
+
+    conn_slot_t *slot = get_conn_slot(adm, addr->s_addr, true);
+    if (!slot) return ADMIT_TOO_MANY_CONNECTIONS;
+
+    uint32_t count = __atomic_load_n(&slot->count, __ATOMIC_ACQUIRE);
+    do {
+        if (count >= adm->max_connections)
+            return ADMIT_TOO_MANY_CONNECTIONS;
+    } while (!__atomic_compare_exchange_n(&slot->count, &count, count + 1, false,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return ADMIT_OK;
+}
+
+/* Release the connection slot taken by a successful admission_check() */
+void admission_release(admission_t *adm, const struct in_addr *addr) {
+    if (!adm || !addr || !adm->conns) return;
+
+    /* Trusted addresses never took a slot */
+    if (admission_is_trusted(adm, addr)) return;
+
+    conn_slot_t *slot = get_conn_slot(adm, addr->s_addr, false);
+    if (slot) {
+        __atomic_fetch_sub(&slot->count, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+/* Check whether an address is exempt from per-client limits */
+bool admission_is_trusted(admission_t *adm, const struct in_addr *addr) {
+    return adm && addr && acl_lookup(adm->acl, ntohl(addr->s_addr)) == ACL_TRUST;
+}
+
+/* Human-readable admission result */
+const char *admission_result_string(admission_result_t result) {
+    switch (result) {
+    case ADMIT_OK:                   return "admitted";
+    case ADMIT_DENIED:               return "denied by access list";
+    case ADMIT_RATE_LIMITED:         return "rate limit exceeded";
+    case ADMIT_TOO_MANY_CONNECTIONS: return "too many connections";
+    }
+    return "unknown";
+}
@@ -0,0 +1,442 @@
+#include "asset_pack.h"
+#include "http.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ALIGN(n)        (((n) + 7) & ~(uint64_t)7)
+#define MAX_INDEX_SIZE  (1u << 31)
+#define SHORT_STRING    128     /* Longest MIME type or ETag accepted */
+
+/* Opened pack
+ *
+ * The file is mapped read-only and checked once: every offset and
+ * size in the entries must lie inside the mapping and every string must
+ * be terminated, so lookups can trust them. Nothing else is read until
+ * a file is served, so opening costs the same for ten files or fifty
+ * thousand, apart from that one pass over the entries.
+ */
+struct asset_pack {
+    int fd;
+    const char *base;
+    size_t size;
+    const asset_pack_entry_t *entries;
+    uint32_t count;
+    const uint32_t *index;
+    uint32_t index_mask;
+};
+
+/* Pack being written
+ *
+ * Bodies are streamed to the file as they are added; the strings and
+ * entries are kept in memory and written after them, then the index,
+ * and finally the header. The pack is built under a temporary name and
+ * renamed into place, so a server never maps a half-written one.
+ */
+struct asset_pack_writer {
+    FILE *f;
+    char *filename;
+    char *temp;
+    uint64_t offset;            /* End of the data written so far */
+    asset_pack_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    char *strings;              /* Offsets in entries are into here until finish */
+    size_t strings_len;
+    size_t strings_capacity;
+};
+
+/* 64-bit FNV-1a */
+uint64_t asset_pack_hash(const char *path, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* A terminated string of known length lies inside the pack */
+static bool valid_string(const asset_pack_t *pack, uint64_t offset, uint64_t len) {
+    return offset < pack->size && len < pack->size - offset && pack->base[offset + len] == '\0';
+}
+
+/* A terminated string of up to SHORT_STRING bytes lies inside the pack */
+static bool valid_short_string(const asset_pack_t *pack, uint64_t offset) {
+    if (offset >= pack->size) return false;
+    size_t room = pack->size - offset;
+    return memchr(pack->base + offset, '\0', room < SHORT_STRING ? room : SHORT_STRING) != NULL;
+}
+
+/* A byte range lies inside the pack */
+static bool valid_range(const asset_pack_t *pack, uint64_t offset, uint64_t size) {
+    return offset <= pack->size && size <= pack->size - offset;
+}
+
+static bool valid_entry(const asset_pack_t *pack, const asset_pack_entry_t *entry) {
+    if (!valid_string(pack, entry->path, entry->path_len) ||
+        !valid_short_string(pack, entry->mime) ||
+        !valid_short_string(pack, entry->etag) ||
+        !valid_string(pack, entry->headers, entry->headers_len) ||
+        !valid_range(pack, entry->body, entry->body_size)) {
+        return false;
+    }
+    if (!entry->gzip_size) return true;
+    return valid_short_string(pack, entry->gzip_etag) &&
+           valid_string(pack, entry->gzip_headers, entry->gzip_headers_len) &&
+           valid_range(pack, entry->gzip, entry->gzip_size);
+}
+
+/* Map and check a pack */
+asset_pack_t *asset_pack_open(const char *filename) {
+    if (!filename) return NULL;
+
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(asset_pack_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    asset_pack_t *pack = calloc(1, sizeof(*pack));
+    if (!pack) {
+        munmap(base, (size_t)st.st_size);
+        close(fd);
+        return NULL;
+    }
+    pack->fd = fd;
+    pack->base = base;
+    pack->size = (size_t)st.st_size;
+
+    const asset_pack_header_t *header = base;
+    bool ok = memcmp(header->magic, ASSET_PACK_MAGIC, sizeof(header->magic)) == 0 &&
+              header->version == ASSET_PACK_VERSION &&
+              header->size == pack->size &&
+              header->index_size && !(header->index_size & (header->index_size - 1)) &&
+              header->count < header->index_size &&
+              header->entries % 8 == 0 && header->index % 4 == 0 &&
+              valid_range(pack, header->entries,
+                          (uint64_t)header->count * sizeof(asset_pack_entry_t)) &&
+              valid_range(pack, header->index, (uint64_t)header->index_size * sizeof(uint32_t));
+
+    if (ok) {
+        pack->entries = (const asset_pack_entry_t *)(pack->base + header->entries);
+        pack->count = header->count;
+        pack->index = (const uint32_t *)(pack->base + header->index);
+        pack->index_mask = header->index_size - 1;
+
+        for (uint32_t i = 0; ok && i < pack->count; i++) {
+            ok = valid_entry(pack, &pack->entries[i]);
+        }
+        for (uint32_t i = 0; ok && i <= pack->index_mask; i++) {
+            ok = pack->index[i] <= pack->count;
+        }
+    }
+
+    if (!ok) {
+        asset_pack_close(pack);
+        return NULL;
+    }
+    return pack;
+}
+
+/* Unmap pack */
+void asset_pack_close(asset_pack_t *pack) {
+    if (!pack) return;
+    munmap((void *)pack->base, pack->size);
+    close(pack->fd);
+    free(pack);
+}
+
+/* Look up a normalized request path */
+bool asset_pack_find(const asset_pack_t *pack, const char *path, size_t len, asset_t *asset) {
+    if (!pack || !path || !asset) return false;
+
+    uint64_t hash = asset_pack_hash(path, len);
+    for (uint32_t probe = 0, slot = (uint32_t)hash & pack->index_mask;
+         probe <= pack->index_mask; probe++, slot = (slot + 1) & pack->index_mask) {
+        uint32_t index = pack->index[slot];
+        if (!index) return false;
+
+        const asset_pack_entry_t *entry = &pack->entries[index - 1];
+        if (entry->hash != hash || entry->path_len != len ||
+            memcmp(pack->base + entry->path, path, len) != 0) {
+            continue;
+        }
+
+        const char *base = pack->base;
+        asset->mime = base + entry->mime;
+        asset->etag = base + entry->etag;
+        asset->headers = base + entry->headers;
+        asset->headers_len = entry->headers_len;
+        asset->body = base + entry->body;
+        asset->body_size = entry->body_size;
+        asset->body_offset = entry->body;
+        if (entry->gzip_size) {
+            asset->gzip_etag = base + entry->gzip_etag;
+            asset->gzip_headers = base + entry->gzip_headers;
+            asset->gzip_headers_len = entry->gzip_headers_len;
+            asset->gzip = base + entry->gzip;
+            asset->gzip_size = entry->gzip_size;
+            asset->gzip_offset = entry->gzip;
+        } else {
+            asset->gzip_etag = NULL;
+            asset->gzip_headers = NULL;
+            asset->gzip_headers_len = 0;
+            asset->gzip = NULL;
+            asset->gzip_size = 0;
+            asset->gzip_offset = 0;
+        }
+        return true;
+    }
+    return false;
+}
+
+/* Number of files in the pack */
+size_t asset_pack_count(const asset_pack_t *pack) {
+    return pack ? pack->count : 0;
+}
+
+/* Descriptor of the pack file, for sendfile() */
+int asset_pack_fd(const asset_pack_t *pack) {
+    return pack ? pack->fd : -1;
+}
+
+/* Start writing a pack */
+asset_pack_writer_t *asset_pack_writer_create(const char *filename) {
+    if (!filename) return NULL;
+
+    asset_pack_writer_t *writer = calloc(1, sizeof(*writer));
+    if (!writer) return NULL;
+
+    size_t len = strlen(filename);
+    writer->filename = strdup(filename);
+    writer->temp = malloc(len + 5);
+    if (!writer->filename || !writer->temp) {
+        asset_pack_writer_abort(writer);
+        return NULL;
+    }
+    snprintf(writer->temp, len + 5, "%s.tmp", filename);
+
+    /* The header is written last, over this placeholder */
+    asset_pack_header_t header = {0};
+    writer->f = fopen(writer->temp, "wb");
+    if (!writer->f || fwrite(&header, sizeof(header), 1, writer->f) != 1) {
+        asset_pack_writer_abort(writer);
+        return NULL;
+    }
+    writer->offset = sizeof(header);
+    return writer;
+}
+
+/* Append data at an 8-byte boundary, returning its offset (0 on failure) */
+static uint64_t write_data(asset_pack_writer_t *writer, const void *data, size_t size) {
+    static const char padding[8];
+    size_t pad = (size_t)(ALIGN(writer->offset) - writer->offset);
+    if (pad && fwrite(padding, 1, pad, writer->f) != pad) return 0;
+    writer->offset += pad;
+
+    uint64_t offset = writer->offset;
+    if (size && fwrite(data, 1, size, writer->f) != size) return 0;
+    writer->offset += size;
+    return offset;
+}
+
+/* Add a formatted string to the string table, returning its offset */
+static bool add_string(asset_pack_writer_t *writer, uint64_t *offset, uint32_t *length,
+                       const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+
+static bool add_string(asset_pack_writer_t *writer, uint64_t *offset, uint32_t *length,
+                       const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (n < 0) return false;
+
+    if (writer->strings_len + (size_t)n + 1 > writer->strings_capacity) {
+        size_t capacity = writer->strings_capacity ? writer->strings_capacity : 4096;
+        while (capacity < writer->strings_len + (size_t)n + 1) capacity *= 2;
+        char *strings = realloc(writer->strings, capacity);
+        if (!strings) return false;
+        writer->strings = strings;
+        writer->strings_capacity = capacity;
+    }
+
+    va_start(args, fmt);
+    vsnprintf(writer->strings + writer->strings_len, (size_t)n + 1, fmt, args);
+    va_end(args);
+
+    *offset = writer->strings_len;
+    if (length) *length = (uint32_t)n;
+    writer->strings_len += (size_t)n + 1;
+    return true;
+}
+
+/* Add a file under its request path, with an optional gzip variant
+ *
+ * The MIME type comes from the extension and the ETag from a hash of
+ * the contents, so it changes exactly when they do; the gzip variant is
+ * a different representation and gets its own.
+ */
+bool asset_pack_writer_add(asset_pack_writer_t *writer, const char *path,
+                           const void *body, size_t body_size,
+                           const void *gzip, size_t gzip_size) {
+    if (!writer || !path || path[0] != '/' || (body_size && !body) ||
+        (gzip_size && !gzip) || writer->count >= MAX_INDEX_SIZE / 2 - 1) {
+        return false;
+    }
+
+    if (writer->count == writer->capacity) {
+        size_t capacity = writer->capacity ? writer->capacity * 2 : 256;
+        asset_pack_entry_t *entries = realloc(writer->entries, capacity * sizeof(*entries));
+        if (!entries) return false;
+        writer->entries = entries;
+        writer->capacity = capacity;
+    }
+
+    asset_pack_entry_t *entry = &writer->entries[writer->count];
+    memset(entry, 0, sizeof(*entry));
+
+    const char *mime = http_get_mime_type(path);
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%016llx\"",
+             (unsigned long long)asset_pack_hash(body, body_size));
+
+    entry->hash = asset_pack_hash(path, strlen(path));
+    entry->body_size = body_size;
+    entry->body = write_data(writer, body, body_size);
+    if (!entry->body ||
+        !add_string(writer, &entry->path, &entry->path_len, "%s", path) ||
+        !add_string(writer, &entry->mime, NULL, "%s", mime) ||
+        !add_string(writer, &entry->etag, NULL, "%s", etag) ||
+        !add_string(writer, &entry->headers, &entry->headers_len,
+                    "Content-Type: %s\r\nContent-Length: %zu\r\nETag: %s\r\n%s",
+                    mime, body_size, etag, gzip_size ? "Vary: Accept-Encoding\r\n" : "")) {
+        return false;
+    }
+
+    if (gzip_size) {
+        char gzip_etag[28];
+        snprintf(gzip_etag, sizeof(gzip_etag), "\"%.16s-gz\"", etag + 1);
+
+        entry->gzip_size = gzip_size;
+        entry->gzip = write_data(writer, gzip, gzip_size);
+        if (!entry->gzip ||
+            !add_string(writer, &entry->gzip_etag, NULL, "%s", gzip_etag) ||
+            !add_string(writer, &entry->gzip_headers, &entry->gzip_headers_len,
+                        "Content-Type: %s\r\nContent-Encoding: gzip\r\n"
+                        "Content-Length: %zu\r\nETag: %s\r\nVary: Accept-Encoding\r\n",
+                        mime, gzip_size, gzip_etag)) {
+            return false;
+        }
+    }
+
+    writer->count++;
+    return true;
+}
+
+/* Write the strings, entries, index and header, then put the pack in
+ * place; fails on a duplicate path. The writer is freed either way. */
+bool asset_pack_writer_finish(asset_pack_writer_t *writer) {
+    if (!writer) return false;
+
+    /* Strings follow the bodies; entries point at them from now on */
+    uint64_t strings = write_data(writer, writer->strings, writer->strings_len);
+    if (!strings) {
+        asset_pack_writer_abort(writer);
+        return false;
+    }
+    for (size_t i = 0; i < writer->count; i++) {
+        asset_pack_entry_t *entry = &writer->entries[i];
+        entry->path += strings;
+        entry->mime += strings;
+        entry->etag += strings;
+        entry->headers += strings;
+        if (entry->gzip_size) {
+            entry->gzip_etag += strings;
+            entry->gzip_headers += strings;
+        }
+    }
+
+    /* Index at most half full, so probes stay short */
+    uint32_t index_size = 2;
+    while (index_size < writer->count * 2) index_size *= 2;
+    uint32_t *index = calloc(index_size, sizeof(*index));
+    if (!index) {
+        asset_pack_writer_abort(writer);
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < writer->count; i++) {
+        const asset_pack_entry_t *entry = &writer->entries[i];
+        const char *path = writer->strings + (entry->path - strings);
+        uint32_t slot = (uint32_t)entry->hash & (index_size - 1);
+        while (index[slot]) {
+            const asset_pack_entry_t *other = &writer->entries[index[slot] - 1];
+            if (other->hash == entry->hash && other->path_len == entry->path_len &&
+                memcmp(writer->strings + (other->path - strings), path, entry->path_len) == 0) {
+                ok = false;
+                break;
+            }
+            slot = (slot + 1) & (index_size - 1);
+        }
+        index[slot] = (uint32_t)i + 1;
+    }
+
+    asset_pack_header_t header = {
+        .version = ASSET_PACK_VERSION,
+        .count = (uint32_t)writer->count,
+        .index_size = index_size
+    };
+    memcpy(header.magic, ASSET_PACK_MAGIC, sizeof(header.magic));
+
+    header.entries = write_data(writer, writer->entries, writer->count * sizeof(*writer->entries));
+    header.index = write_data(writer, index, index_size * sizeof(*index));
+    header.size = writer->offset;
+    free(index);
+
+    ok = ok && header.entries && header.index &&
+         fseek(writer->f, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, writer->f) == 1 &&
+         fflush(writer->f) == 0 && fsync(fileno(writer->f)) == 0;
+    if (!ok) {
+        asset_pack_writer_abort(writer);
+        return false;
+    }
+
+    ok = fclose(writer->f) == 0 && rename(writer->temp, writer->filename) == 0;
+    writer->f = NULL;
+    if (ok) {
+        free(writer->temp);
+        writer->temp = NULL;
+    }
+    asset_pack_writer_abort(writer);
+    return ok;
+}
+
+/* Give up on a pack, removing the partial file */
+void asset_pack_writer_abort(asset_pack_writer_t *writer) {
+    if (!writer) return;
+    if (writer->f) fclose(writer->f);
+    if (writer->temp) unlink(writer->temp);
+    free(writer->entries);
+    free(writer->strings);
+    free(writer->filename);
+    free(writer->temp);
+    free(writer);
+}
@@ -0,0 +1,171 @@
+#include "concurrency_limiter.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#define BASELINE_WINDOW_USEC  10000000  /* Baseline tracks the min of ~10-20s */
+#define LATENCY_SLACK_USEC    1000      /* Ignore jitter below 1ms */
+#define LATENCY_TOLERANCE     2         /* Congested above 2x the baseline */
+
+/* Adaptive concurrency limiter
+ *
+ * AIMD on service latency, judged once per limit's worth of completions
+ * by the mean latency over them: while it stays close to the no-load
+ * baseline and the limit is in use, the limit grows by one; once it
+ * climbs past the tolerance while the limit is in use, the limit shrinks
+ * by 10%. A slow request among light traffic is not congestion, so it
+ * moves neither way. Requests beyond the limit are shed instead of
+ * queueing behind slow ones.
+ */
+struct concurrency_limiter {
+    concurrency_config_t config;
+    uint32_t limit;             /* Read lock-free on acquire */
+    uint32_t inflight;
+    uint64_t shed;
+
+    pthread_mutex_t lock;       /* Guards the estimator below */
+    uint64_t window_start;
+    uint64_t window_min;        /* Lowest latency in current window */
+    uint64_t prev_window_min;   /* Lowest latency in previous window */
+    uint32_t samples;           /* Completions since last adjustment */
+    uint64_t latency_sum;       /* Their total latency */
+    uint32_t peak_inflight;     /* Most in flight at any of them */
+};
+
+/* Monotonic time in microseconds */
+static uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Clock that start times are taken on */
+uint64_t concurrency_limiter_clock(void) {
+    return now_usec();
+}
+
+/* Create limiter */
+concurrency_limiter_t *concurrency_limiter_create(const concurrency_config_t *config) {
+    if (!config || config->max_limit == 0) return NULL;
+
+    concurrency_limiter_t *limiter = calloc(1, sizeof(*limiter));
+    if (!limiter) return NULL;
+
+    limiter->config = *config;
+    if (limiter->config.min_limit == 0) {
+        limiter->config.min_limit = 1;
+    }
+    if (limiter->config.min_limit > limiter->config.max_limit) {
+        limiter->config.min_limit = limiter->config.max_limit;
+    }
+
+    limiter->limit = config->initial_limit;
+    if (limiter->limit < limiter->config.min_limit) limiter->limit = limiter->config.min_limit;
+    if (limiter->limit > limiter->config.max_limit) limiter->limit = limiter->config.max_limit;
+
+    limiter->window_start = now_usec();
+    limiter->window_min = UINT64_MAX;
+    limiter->prev_window_min = UINT64_MAX;
+
+    if (pthread_mutex_init(&limiter->lock, NULL) != 0) {
+        free(limiter);
+        return NULL;
+    }
+
+    return limiter;
+}
+
+/* Clean up limiter */
+void concurrency_limiter_destroy(concurrency_limiter_t *limiter) {
+    if (!limiter) return;
+    pthread_mutex_destroy(&limiter->lock);
+    free(limiter);
+}
+
+/* Take an in-flight slot, or return false if the request should be shed */
+bool concurrency_limiter_acquire(concurrency_limiter_t *limiter, uint64_t *start_usec) {
+    uint32_t inflight = __atomic_load_n(&limiter->inflight, __ATOMIC_RELAXED);
+    do {
+        if (inflight >= __atomic_load_n(&limiter->limit, __ATOMIC_RELAXED)) {
+            __atomic_fetch_add(&limiter->shed, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&limiter->inflight, &inflight, inflight + 1,
+                                          false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    *start_usec = now_usec();
+    return true;
+}
+
+/* Return a slot and feed the request's service latency to the estimator
+ *
+ * Service ends at end_usec, when the response was ready to go out, or at
+ * release if 0: time spent writing a body to a slow client is the
+ * client's, not the server's.
+ */
+void concurrency_limiter_release(concurrency_limiter_t *limiter, uint64_t start_usec,
+                                 uint64_t end_usec) {
+    uint64_t now = now_usec();
+    uint64_t latency = (end_usec ? end_usec : now) - start_usec;
+    uint32_t inflight = __atomic_fetch_sub(&limiter->inflight, 1, __ATOMIC_ACQ_REL);
+
+    pthread_mutex_lock(&limiter->lock);
+
+    /* Rotate the baseline window */
+    if (now - limiter->window_start >= BASELINE_WINDOW_USEC) {
+        limiter->prev_window_min = limiter->window_min;
+        limiter->window_min = UINT64_MAX;
+        limiter->window_start = now;
+    }
+    if (latency < limiter->window_min) {
+        limiter->window_min = latency;
+    }
+
+    uint64_t baseline = limiter->window_min < limiter->prev_window_min ?
+                        limiter->window_min : limiter->prev_window_min;
+    uint32_t limit = limiter->limit;
+    uint32_t new_limit = limit;
+    limiter->latency_sum += latency;
+    if (inflight > limiter->peak_inflight) limiter->peak_inflight = inflight;
+
+    /* Adjust at most once per limit's worth of completions, and only when
+     * the limit was in use during them */
+    uint64_t mean = 0;
+    if (++limiter->samples >= limit) {
+        mean = limiter->latency_sum / limiter->samples;
+        bool loaded = limiter->peak_inflight * 2 >= limit;
+        if (loaded && mean > baseline * LATENCY_TOLERANCE + LATENCY_SLACK_USEC) {
+            new_limit = limit - limit / 10 - 1;
+            if (new_limit < limiter->config.min_limit) new_limit = limiter->config.min_limit;
+        } else if (loaded && limit < limiter->config.max_limit) {
+            new_limit = limit + 1;
+        }
+        limiter->samples = 0;
+        limiter->latency_sum = 0;
+        limiter->peak_inflight = 0;
+    }
+
+    if (new_limit != limit) {
+        __atomic_store_n(&limiter->limit, new_limit, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&limiter->lock);
+
+    if (new_limit < limit) {
+        log_write(LOG_DEBUG, "Concurrency limit lowered to %u (mean latency %lluus, baseline %lluus)",
+                  new_limit, (unsigned long long)mean, (unsigned long long)baseline);
+    }
+}
+
+/* Snapshot current state */
+void concurrency_limiter_stats(concurrency_limiter_t *limiter, concurrency_stats_t *stats) {
+    stats->limit = __atomic_load_n(&limiter->limit, __ATOMIC_RELAXED);
+    stats->inflight = __atomic_load_n(&limiter->inflight, __ATOMIC_RELAXED);
+    stats->shed = __atomic_load_n(&limiter->shed, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&limiter->lock);
+    stats->baseline_usec = limiter->window_min < limiter->prev_window_min ?
+                           limiter->window_min : limiter->prev_window_min;
+    pthread_mutex_unlock(&limiter->lock);
+}
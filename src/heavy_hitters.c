@@ -0,0 +1,202 @@
+#include "heavy_hitters.h"
+#include "timecache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SKETCH_DEPTH    4
+#define SKETCH_WIDTH    1024    /* Overestimate at most ~0.3% of the total, w.h.p. */
+
+/* Candidate top key */
+typedef struct {
+    unsigned char key[HEAVY_HITTER_KEY_MAX];
+    size_t len;
+    uint64_t hash;
+    uint64_t count;
+} candidate_t;
+
+/* Heavy hitter tracker
+ *
+ * A Count-Min sketch estimates every key's weight; the k keys with the
+ * largest estimates are kept as candidates. An update is SKETCH_DEPTH
+ * relaxed atomic adds, and the candidate table is only locked when the
+ * key's estimate beats the smallest candidate -- and then only with
+ * trylock, since a skipped refresh is caught up by the next update of
+ * the same key. Every half-life all weights are halved, so the top
+ * reflects recent traffic.
+ */
+struct heavy_hitters {
+    uint64_t sketch[SKETCH_DEPTH][SKETCH_WIDTH];
+    candidate_t candidates[HEAVY_HITTERS_MAX_K];
+    size_t k;
+    size_t count;
+    uint64_t min_count;         /* Smallest candidate once the table is full */
+    uint32_t half_life;
+    time_t epoch;               /* Current half-life period */
+    pthread_mutex_t mutex;
+};
+
+/* 64-bit FNV-1a */
+static uint64_t hash_key(const unsigned char *key, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* Create tracker for the top k keys */
+heavy_hitters_t *heavy_hitters_create(size_t k, uint32_t half_life_seconds) {
+    if (k == 0 || k > HEAVY_HITTERS_MAX_K) return NULL;
+
+    heavy_hitters_t *hh = calloc(1, sizeof(*hh));
+    if (!hh) return NULL;
+
+    if (pthread_mutex_init(&hh->mutex, NULL) != 0) {
+        free(hh);
+        return NULL;
+    }
+    hh->k = k;
+    hh->half_life = half_life_seconds;
+    if (half_life_seconds) hh->epoch = timecache_now() / half_life_seconds;
+    return hh;
+}
+
+/* Clean up tracker */
+void heavy_hitters_destroy(heavy_hitters_t *hh) {
+    if (!hh) return;
+    pthread_mutex_destroy(&hh->mutex);
+    free(hh);
+}
+
+/* Recompute the admission threshold (mutex held) */
+static void update_min(heavy_hitters_t *hh) {
+    uint64_t min = 0;
+    if (hh->count == hh->k) {
+        min = UINT64_MAX;
+        for (size_t i = 0; i < hh->count; i++) {
+            if (hh->candidates[i].count < min) min = hh->candidates[i].count;
+        }
+    }
+    __atomic_store_n(&hh->min_count, min, __ATOMIC_RELAXED);
+}
+
+/* Shift every weight right; adds racing with this may be partly lost */
+static void halve(heavy_hitters_t *hh, unsigned int shift) {
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        for (int col = 0; col < SKETCH_WIDTH; col++) {
+            uint64_t *cell = &hh->sketch[row][col];
+            __atomic_store_n(cell, __atomic_load_n(cell, __ATOMIC_RELAXED) >> shift,
+                             __ATOMIC_RELAXED);
+        }
+    }
+
+    pthread_mutex_lock(&hh->mutex);
+    for (size_t i = 0; i < hh->count; i++) {
+        hh->candidates[i].count >>= shift;
+    }
+    update_min(hh);
+    pthread_mutex_unlock(&hh->mutex);
+}
+
+/* Halve all weights once per elapsed half-life; one thread does the work */
+static void maybe_decay(heavy_hitters_t *hh) {
+    if (!hh->half_life) return;
+
+    time_t epoch = timecache_now() / hh->half_life;
+    time_t last = __atomic_load_n(&hh->epoch, __ATOMIC_RELAXED);
+    if (epoch <= last) return;
+    if (!__atomic_compare_exchange_n(&hh->epoch, &last, epoch, false,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    halve(hh, epoch - last < 63 ? (unsigned int)(epoch - last) : 63);
+}
+
+/* Halve all weights now */
+void heavy_hitters_decay(heavy_hitters_t *hh) {
+    if (hh) halve(hh, 1);
+}
+
+/* Count weight against a key */
+void heavy_hitters_add(heavy_hitters_t *hh, const void *key, size_t len, uint64_t weight) {
+    if (!hh || !weight) return;
+    if (len > HEAVY_HITTER_KEY_MAX) len = HEAVY_HITTER_KEY_MAX;
+
+    maybe_decay(hh);
+
+    /* Rows are indexed by double hashing of one 64-bit hash */
+    uint64_t hash = hash_key(key, len);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    uint64_t estimate = UINT64_MAX;
+    for (uint32_t row = 0; row < SKETCH_DEPTH; row++) {
+        uint64_t *cell = &hh->sketch[row][(h1 + row * h2) & (SKETCH_WIDTH - 1)];
+        uint64_t value = __atomic_add_fetch(cell, weight, __ATOMIC_RELAXED);
+        if (value < estimate) estimate = value;
+    }
+
+    if (estimate <= __atomic_load_n(&hh->min_count, __ATOMIC_RELAXED)) return;
+    if (pthread_mutex_trylock(&hh->mutex) != 0) return;
+
+    candidate_t *slot = NULL;
+    for (size_t i = 0; i < hh->count; i++) {
+        candidate_t *c = &hh->candidates[i];
+        if (c->hash == hash && c->len == len && memcmp(c->key, key, len) == 0) {
+            slot = c;
+            break;
+        }
+    }
+
+    if (!slot) {
+        if (hh->count < hh->k) {
+            slot = &hh->candidates[hh->count++];
+        } else {
+            /* Evict the smallest candidate if this key now outweighs it */
+            slot = &hh->candidates[0];
+            for (size_t i = 1; i < hh->count; i++) {
+                if (hh->candidates[i].count < slot->count) slot = &hh->candidates[i];
+            }
+            if (slot->count >= estimate) slot = NULL;
+        }
+        if (slot) {
+            memcpy(slot->key, key, len);
+            slot->len = len;
+            slot->hash = hash;
+        }
+    }
+
+    if (slot) {
+        slot->count = estimate;
+        update_min(hh);
+    }
+    pthread_mutex_unlock(&hh->mutex);
+}
+
+static int compare_count(const void *a, const void *b) {
+    uint64_t ca = ((const heavy_hitter_t *)a)->count;
+    uint64_t cb = ((const heavy_hitter_t *)b)->count;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/* Copy out the current top keys, heaviest first */
+size_t heavy_hitters_top(heavy_hitters_t *hh, heavy_hitter_t *out, size_t max) {
+    if (!hh || !out) return 0;
+
+    maybe_decay(hh);
+
+    pthread_mutex_lock(&hh->mutex);
+    size_t n = 0;
+    for (size_t i = 0; i < hh->count && n < max; i++) {
+        if (!hh->candidates[i].count) continue;
+        memcpy(out[n].key, hh->candidates[i].key, hh->candidates[i].len);
+        out[n].len = hh->candidates[i].len;
+        out[n].count = hh->candidates[i].count;
+        n++;
+    }
+    pthread_mutex_unlock(&hh->mutex);
+
+    qsort(out, n, sizeof(*out), compare_count);
+    return n;
+}
@@ -1,9 +1,14 @@
 #include "http.h"
+#include "timecache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <sys/uio.h>
 
 /**
  * Get appropriate MIME type based on file extension
@@ -86,6 +91,102 @@ bool http_check_etag_match(const char *request, const char *etag) {
     return strstr(if_none_match, etag) != NULL;
 }
 
+/**
+ * Find where the body starts
+ *
+ * @param request The HTTP request as read, NUL-terminated
+ * @return The first byte after the blank line ending the headers, or NULL
+ *         if the headers have not all arrived
+ */
+const char *http_headers_end(const char *request) {
+    if (!request) return NULL;
+
+    const char *end = strstr(request, "\r\n\r\n");
+    return end ? end + 4 : NULL;
+}
+
+/**
+ * Get the body length declared by the Content-Length header
+ *
+ * Header names are matched case-insensitively and only within the header
+ * block. A request without the header has no body.
+ *
+ * @param request The HTTP request as read, NUL-terminated
+ * @param length Set to the declared length, or 0 if there is none
+ * @return false if the value is not a plain decimal number
+ */
+bool http_content_length(const char *request, size_t *length) {
+    if (!request || !length) return false;
+    *length = 0;
+
+    /* Each header follows a CRLF; a second CRLF ends them */
+    for (const char *line = strstr(request, "\r\n"); line && line[2] && line[2] != '\r';
+         line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) != 0) continue;
+
+        const char *p = line + 17;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p < '0' || *p > '9') return false;
+
+        size_t value = 0;
+        for (; *p >= '0' && *p <= '9'; p++) {
+            if (value > (SIZE_MAX - 9) / 10) return false;
+            value = value * 10 + (size_t)(*p - '0');
+        }
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != '\r' && *p != '\0') return false;
+
+        *length = value;
+        return true;
+    }
+    return true;
+}
+
+/**
+ * Check whether the client takes gzip-encoded responses
+ *
+ * Looks for "gzip" (or "*") in the Accept-Encoding header, which is
+ * matched like Content-Length, unless it comes with a zero q-value.
+ *
+ * @param request The HTTP request as read, NUL-terminated
+ * @return true if a gzip body may be sent
+ */
+bool http_accepts_gzip(const char *request) {
+    if (!request) return false;
+
+    for (const char *line = strstr(request, "\r\n"); line && line[2] && line[2] != '\r';
+         line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Accept-Encoding:", 16) != 0) continue;
+
+        /* Comma-separated codings, each with optional parameters */
+        const char *p = line + 18;
+        while (*p && *p != '\r') {
+            p += strspn(p, " \t,");
+            size_t len = strcspn(p, " \t,;\r");
+            bool gzip = (len == 4 && strncasecmp(p, "gzip", 4) == 0) ||
+                        (len == 1 && *p == '*');
+            p += len;
+
+            /* q=0, 0.0, 0.00 or 0.000 refuses the coding */
+            bool refused = false;
+            size_t params = strcspn(p, ",\r");
+            const char *q = p;
+            while ((q = memchr(q, ';', params - (size_t)(q - p))) != NULL) {
+                q++;
+                q += strspn(q, " \t");
+                if ((*q == 'q' || *q == 'Q') && q[1] == '=') {
+                    const char *v = q + 2;
+                    refused = *v == '0' && (v[1] != '.' || strspn(v + 2, "0") ==
+                                                           strcspn(v + 2, " \t,;\r"));
+                }
+            }
+            if (gzip && !refused) return true;
+            p += params;
+        }
+    }
+    return false;
+}
+
 bool http_parse_request(const char *buffer, __attribute__((unused)) size_t length, http_request_t *req) {
     char method[16];
     
@@ -109,21 +210,49 @@ bool http_parse_request(const char *buffer, __attribute__((unused)) size_t lengt
     return true;
 }
 
+/* Write a full iovec array, resuming after partial writes */
+static bool write_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        /* Skip fully written buffers, then trim the partial one */
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
 void http_send_response(int client_fd, int status_code, 
                        const char *content_type, 
                        const void *body, size_t body_length,
                        const char *extra_headers) {
     char headers[4096];
+    char date[TIMECACHE_HTTP_LEN];
     int header_len;
 
+    timecache_http_date(date);
+
     /* Format headers */
     header_len = snprintf(headers, sizeof(headers),
         "HTTP/1.1 %d %s\r\n"
+        "Date: %s\r\n"
         "Content-Type: %s\r\n"
         "Content-Length: %zu\r\n"
         "Connection: close\r\n",
         status_code,
         status_code == 200 ? "OK" : "Error",
+        date,
         content_type,
         body_length);
 
@@ -137,13 +266,43 @@ void http_send_response(int client_fd, int status_code,
     strncat(headers, "\r\n", sizeof(headers) - header_len - 1);
     header_len = strlen(headers);
 
-    /* Send headers */
-    write(client_fd, headers, header_len);
+    /* Send headers and body together (body may be NULL when the caller
+     * streams it separately, e.g. for HEAD or file responses) */
+    struct iovec iov[2] = {
+        { .iov_base = headers, .iov_len = header_len },
+        { .iov_base = (void *)body, .iov_len = body ? body_length : 0 }
+    };
+    write_all(client_fd, iov, body && body_length > 0 ? 2 : 1);
+}
 
-    /* Send body */
-    if (body && body_length > 0) {
-        write(client_fd, body, body_length);
-    }
+/**
+ * Send a 200 response whose headers were prepared in advance
+ *
+ * The block holds the entity headers (Content-Type, Content-Length, ...)
+ * and extra_headers any others; only the status line and Date are
+ * formatted here. Headers and body go out in one writev, the body
+ * straight from wherever it lies, such as a mapped file.
+ *
+ * @param body The body, or NULL for a HEAD or a body sent separately
+ * @return false if the client went away
+ */
+bool http_send_prepared(int client_fd, const char *block, size_t block_length,
+                        const char *extra_headers, const void *body, size_t body_length) {
+    char status[96];
+    char date[TIMECACHE_HTTP_LEN];
+
+    timecache_http_date(date);
+    int status_len = snprintf(status, sizeof(status),
+                              "HTTP/1.1 200 OK\r\nDate: %s\r\nConnection: close\r\n", date);
+
+    struct iovec iov[5] = {
+        { .iov_base = status, .iov_len = (size_t)status_len },
+        { .iov_base = (void *)block, .iov_len = block_length },
+        { .iov_base = (void *)extra_headers, .iov_len = extra_headers ? strlen(extra_headers) : 0 },
+        { .iov_base = "\r\n", .iov_len = 2 },
+        { .iov_base = (void *)body, .iov_len = body ? body_length : 0 }
+    };
+    return write_all(client_fd, iov, body && body_length > 0 ? 5 : 4);
 }
 
 void http_send_error(int client_fd, int status_code, const char *message) {
@@ -32,6 +32,13 @@ char *http_generate_etag(time_t mtime, size_t size);
 /* Check if client's If-None-Match header matches our ETag */
 bool http_check_etag_match(const char *request, const char *etag);
 
+/* Find the end of the request headers and the declared body length */
+const char *http_headers_end(const char *request);
+bool http_content_length(const char *request, size_t *length);
+
+/* Check if the client's Accept-Encoding allows gzip */
+bool http_accepts_gzip(const char *request);
+
 void http_send_response(int client_fd, int status_code, 
                        const char *content_type, 
                        const void *body, size_t body_length,
@@ -39,4 +46,8 @@ void http_send_response(int client_fd, int status_code,
                        
 void http_send_error(int client_fd, int status_code, const char *message);
 
+/* Send a 200 with prepared headers and a body already in memory */
+bool http_send_prepared(int client_fd, const char *block, size_t block_length,
+                        const char *extra_headers, const void *body, size_t body_length);
+
 #endif /* HTTP_H */
\ No newline at end of file
@@ -1,15 +1,94 @@
 #include "logger.h"
+#include "timecache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define RING_SLOTS       64      /* Records buffered per thread, power of two */
+#define SLOT_SIZE        512     /* Bytes per record, including header */
+#define MAX_BATCH        256     /* Records per writev() batch */
+#define WRITER_IDLE_USEC 5000    /* Writer sleep when all buffers are empty */
+#define SPARE_RINGS      8       /* Unowned buffers kept for new threads */
+
+#define SLOT_BINARY      0xFF    /* Slot level marking a binary record */
+#define MAX_HEADER       64      /* Bytes of header for new binary files */
+
+/* One formatted log line, or one binary record */
+typedef struct {
+    uint16_t len;                   /* Line length including newline */
+    uint8_t level;
+    char text[SLOT_SIZE - 3];
+} log_slot_t;
+
+/* Per-thread record buffer
+ *
+ * Single producer (the owning thread), single consumer (the writer thread),
+ * so head and tail only need acquire/release ordering. Buffers outlive
+ * their threads: when a thread exits its buffer is released and later
+ * claimed by a new thread, so per-connection threads don't usually
+ * allocate. Past SPARE_RINGS unowned buffers, the writer frees the ones
+ * it has drained, so a burst of connections does not fix memory use and
+ * the writer's scan at their peak.
+ */
+typedef struct log_ring {
+    uint64_t head;                  /* Next slot to fill, written by producer */
+    char pad1[64 - sizeof(uint64_t)];
+    uint64_t tail;                  /* Next slot to drain, written by writer */
+    char pad2[64 - sizeof(uint64_t)];
+    uint32_t owned;                 /* Claimed by a live thread */
+    uint32_t sample_count;
+    struct log_ring *next;
+    log_slot_t slots[RING_SLOTS];
+} log_ring_t;
+
+/* A log file the writer can reopen or rotate */
+typedef struct {
+    char path[256];                 /* "" when not logging to a file */
+    int fd;
+    uint64_t size;                  /* Bytes in the current file */
+    char header[MAX_HEADER];        /* Written at the start of each new file */
+    size_t header_len;
+} log_file_t;
 
 /* Logger state */
-static FILE *log_file = NULL;
+static log_file_t text_log = { .fd = -1 };
+static log_file_t binary_log = { .fd = -1 };
 static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
 static log_level_t current_level = LOG_INFO;
 static log_output_t output_mode = LOG_TO_BOTH;
+static log_overflow_t overflow_policy = LOG_OVERFLOW_DROP;
+static unsigned int access_sampling = 1;
+
+/* Asynchronous writer state */
+static log_ring_t *rings = NULL;    /* Only the writer unlinks from it */
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;    /* Claims and changes */
+static size_t ring_count = 0;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_t writer_thread;
+static bool writer_running = false;
+static bool writer_stop = false;
+static bool writer_idle = false;
+static pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t dropped = 0;
+static uint64_t dropped_reported = 0;
+
+/* Reopen and rotation, carried out by the writer thread */
+static bool reopen_requested = false;
+static uint64_t rotate_size = 0;
+static unsigned int rotate_interval = 0;
+static unsigned int rotate_keep = 5;
+static time_t next_rotation = 0;
+static uint32_t binary_generation = 0;
 
 /* Level strings */
 static const char *level_strings[] = {
@@ -43,87 +122,559 @@ void log_set_output(log_output_t output) {
     output_mode = output;
 }
 
-/* Initialize logger */
-void log_init(const char *filename) {
+/* Set what happens when a thread's buffer is full */
+void log_set_overflow(log_overflow_t policy) {
+    overflow_policy = policy;
+}
+
+/* Keep one in N access lines while a thread's buffer is over half full */
+void log_set_access_sampling(unsigned int one_in) {
+    access_sampling = one_in ? one_in : 1;
+}
+
+/* Rotate files past max_bytes, or every interval seconds (0 disables
+ * either), keeping the newest keep files as path.1 .. path.keep */
+void log_set_rotation(uint64_t max_bytes, unsigned int interval, unsigned int keep) {
     pthread_mutex_lock(&log_mutex);
-    
-    if (log_file && log_file != stderr) {
-        fclose(log_file);
-        log_file = NULL;
+    rotate_size = max_bytes;
+    rotate_interval = interval;
+    rotate_keep = keep ? keep : 1;
+    next_rotation = 0;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+/* Ask the writer to reopen its files (safe to call from a signal handler) */
+void log_reopen(void) {
+    __atomic_store_n(&reopen_requested, true, __ATOMIC_RELEASE);
+}
+
+/* Changes whenever the binary log moves to a new file */
+uint32_t log_binary_generation(void) {
+    return __atomic_load_n(&binary_generation, __ATOMIC_ACQUIRE);
+}
+
+/* Number of per-thread buffers allocated */
+size_t log_buffers(void) {
+    return __atomic_load_n(&ring_count, __ATOMIC_RELAXED);
+}
+
+/* Number of records discarded because a buffer was full */
+uint64_t log_dropped(void) {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+/* Release a thread's buffer for reuse when the thread exits */
+static void release_ring(void *ptr) {
+    log_ring_t *ring = ptr;
+    __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void make_ring_key(void) {
+    pthread_key_create(&ring_key, release_ring);
+}
+
+/* Get the calling thread's buffer, claiming or allocating one */
+static log_ring_t *thread_ring(void) {
+    pthread_once(&ring_key_once, make_ring_key);
+
+    log_ring_t *ring = pthread_getspecific(ring_key);
+    if (ring) return ring;
+
+    /* Reuse a buffer left behind by an exited thread; the lock keeps the
+     * writer from freeing it meanwhile */
+    pthread_mutex_lock(&rings_mutex);
+    for (ring = rings; ring; ring = ring->next) {
+        uint32_t free_ring = 0;
+        if (__atomic_compare_exchange_n(&ring->owned, &free_ring, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
     }
-    
-    if (filename) {
-        log_file = fopen(filename, "a");
-        if (!log_file) {
-            fprintf(stderr, "Failed to open log file %s, falling back to stderr\n", filename);
-            log_file = stderr;
+
+    if (!ring) {
+        ring = calloc(1, sizeof(*ring));
+        if (ring) {
+            ring->owned = 1;
+            ring->next = rings;
+            __atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&ring_count, 1, __ATOMIC_RELAXED);
         }
-    } else {
-        log_file = stderr;
     }
-    
+    pthread_mutex_unlock(&rings_mutex);
+    if (!ring) return NULL;
+
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+/* Format "[time] LEVEL: message\n" into buf, returning its length */
+static size_t format_line(char *buf, size_t size, log_level_t level,
+                          const char *fmt, va_list args) {
+    char timestamp[TIMECACHE_LOG_LEN];
+    timecache_log_time(timestamp);
+
+    size_t len = 0;
+    int n = snprintf(buf, size, "[%s] %s: ", timestamp, level_strings[level]);
+    if (n > 0) len = (size_t)n < size ? (size_t)n : size - 1;
+
+    n = vsnprintf(buf + len, size - len, fmt, args);
+    if (n > 0) len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+
+    /* Always end with a newline, truncating if needed */
+    if (len >= size - 1) len = size - 2;
+    buf[len++] = '\n';
+    buf[len] = '\0';
+    return len;
+}
+
+/* Open (or reopen) a log file, swapping in the new descriptor
+ *
+ * Called with log_mutex held. The old descriptor stays in use if the
+ * open fails, so a bad reopen never loses records.
+ */
+static bool open_log_file(log_file_t *file) {
+    int fd = open(file->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+
+    /* New files start with the header, so restarts keep appending */
+    uint64_t size = st.st_size;
+    if (size == 0 && file->header_len) {
+        if (write(fd, file->header, file->header_len) != (ssize_t)file->header_len) {
+            close(fd);
+            return false;
+        }
+        size = file->header_len;
+    }
+
+    if (file->fd >= 0) close(file->fd);
+    file->fd = fd;
+    file->size = size;
+    return true;
+}
+
+/* Shift path -> path.1 -> ... -> path.keep and start a new file */
+static void rotate_log_file(log_file_t *file) {
+    char from[300], to[300];
+
+    for (unsigned int i = rotate_keep; i > 0; i--) {
+        snprintf(to, sizeof(to), "%s.%u", file->path, i);
+        if (i > 1) {
+            snprintf(from, sizeof(from), "%s.%u", file->path, i - 1);
+        } else {
+            snprintf(from, sizeof(from), "%s", file->path);
+        }
+        rename(from, to);
+    }
+
+    if (!open_log_file(file)) {
+        fprintf(stderr, "Failed to open log file %s after rotation\n", file->path);
+    }
+}
+
+/* Carry out pending reopen and rotation (writer thread, log_mutex held) */
+static void maintain_files(void) {
+    bool reopen = __atomic_exchange_n(&reopen_requested, false, __ATOMIC_ACQ_REL);
+
+    bool interval_due = false;
+    if (rotate_interval) {
+        time_t now = timecache_now();
+        interval_due = next_rotation && now >= next_rotation;
+        if (!next_rotation || interval_due) {
+            next_rotation = (now / rotate_interval + 1) * rotate_interval;
+        }
+    }
+
+    log_file_t *files[] = { &text_log, &binary_log };
+    for (size_t i = 0; i < 2; i++) {
+        log_file_t *file = files[i];
+        if (!file->path[0] || file->fd < 0) continue;
+
+        /* Empty files are not worth rotating */
+        bool has_records = file->size > file->header_len;
+        if (has_records && (interval_due || (rotate_size && file->size >= rotate_size))) {
+            rotate_log_file(file);
+        } else if (reopen) {
+            if (!open_log_file(file)) {
+                fprintf(stderr, "Failed to reopen log file %s\n", file->path);
+                continue;
+            }
+        } else {
+            continue;
+        }
+
+        if (file == &binary_log) {
+            __atomic_add_fetch(&binary_generation, 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/* Write a line synchronously (before the writer thread starts) */
+static void write_sync(log_level_t level, const char *line, size_t len) {
+    pthread_mutex_lock(&log_mutex);
+
+    /* Log to file if needed */
+    if (output_mode == LOG_TO_FILE || output_mode == LOG_TO_BOTH) {
+        if (text_log.fd >= 0 && write(text_log.fd, line, len) > 0) {
+            text_log.size += len;
+        }
+    }
+
+    /* Log to console if needed, using colors */
+    if (output_mode == LOG_TO_CONSOLE || output_mode == LOG_TO_BOTH || text_log.fd < 0) {
+        fprintf(stderr, "%s%.*s%s\n", level_colors[level], (int)len - 1, line, reset_color);
+    }
+
     pthread_mutex_unlock(&log_mutex);
-    
-    /* Log startup */
-    log_write(LOG_INFO, "Logger initialized");
+}
+
+/* Wake the writer early if it is idle */
+static void wake_writer(void) {
+    if (__atomic_load_n(&writer_idle, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&wake_mutex);
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&wake_mutex);
+    }
+}
+
+/* Publish the slot at head, waking the writer once the buffer is half full */
+static void publish_slot(log_ring_t *ring) {
+    uint64_t head = ring->head + 1;
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SLOTS / 2) {
+        wake_writer();
+    }
+}
+
+/* Get the next free slot, applying the overflow policy when full */
+static log_slot_t *reserve_slot(log_ring_t *ring) {
+    uint64_t head = ring->head;
+
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= RING_SLOTS) {
+        wake_writer();
+        if (overflow_policy == LOG_OVERFLOW_DROP) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        usleep(100);
+    }
+    return &ring->slots[head & (RING_SLOTS - 1)];
+}
+
+/* Queue a record, or write it directly if no writer thread is running */
+static void log_record(log_level_t level, bool access, const char *fmt, va_list args) {
+    log_ring_t *ring = __atomic_load_n(&writer_running, __ATOMIC_ACQUIRE) ?
+                       thread_ring() : NULL;
+    if (!ring) {
+        char line[SLOT_SIZE];
+        size_t len = format_line(line, sizeof(line), level, fmt, args);
+        write_sync(level, line, len);
+        return;
+    }
+
+    uint64_t head = ring->head;
+    uint64_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    /* Under load, keep only a sample of access lines */
+    if (access && access_sampling > 1 && used > RING_SLOTS / 2 &&
+        ++ring->sample_count % access_sampling != 0) {
+        return;
+    }
+
+    log_slot_t *slot = reserve_slot(ring);
+    if (!slot) return;
+
+    /* Format straight into the slot, then publish it */
+    slot->level = (uint8_t)level;
+    slot->len = (uint16_t)format_line(slot->text, sizeof(slot->text), level, fmt, args);
+    publish_slot(ring);
 }
 
 /* Write log message */
 void log_write(log_level_t level, const char *fmt, ...) {
     /* Check if this level should be logged */
-    if (level < current_level) {
+    if (level >= LOG_LEVEL_COUNT || level < current_level) {
         return;
     }
-    
-    /* Ensure log_file is valid */
-    if (!log_file) {
-        log_file = stderr;
-    }
 
-    /* Get current time */
-    time_t now = time(NULL);
-    char time_str[32];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    va_list args;
+    va_start(args, fmt);
+    log_record(level, false, fmt, args);
+    va_end(args);
+}
+
+/* Write an access line (INFO level, sampled under load) */
+void log_access(const char *fmt, ...) {
+    if (LOG_INFO < current_level) {
+        return;
+    }
 
-    /* Format message */
-    char message[1024];
     va_list args;
     va_start(args, fmt);
-    vsnprintf(message, sizeof(message), fmt, args);
+    log_record(LOG_INFO, true, fmt, args);
     va_end(args);
+}
+
+/* Open the file that binary records are appended to
+ *
+ * The header starts every new file, including ones created by rotation.
+ */
+bool log_open_binary(const char *path, const void *header, size_t header_len) {
+    if (strlen(path) >= sizeof(binary_log.path) || header_len > sizeof(binary_log.header)) {
+        return false;
+    }
 
-    /* Write log entry */
     pthread_mutex_lock(&log_mutex);
-    
-    /* Log to file if needed */
-    if (output_mode == LOG_TO_FILE || output_mode == LOG_TO_BOTH) {
-        if (log_file != stderr) {
-            fprintf(log_file, "[%s] %s: %s\n", time_str, level_strings[level], message);
-            fflush(log_file);
-        }
-    }
-    
-    /* Log to console if needed */
-    if (output_mode == LOG_TO_CONSOLE || output_mode == LOG_TO_BOTH || log_file == stderr) {
-        /* Use colors for console output */
-        if (level < LOG_LEVEL_COUNT) {
-            fprintf(stderr, "%s[%s] %s: %s%s\n", 
-                    level_colors[level], time_str, level_strings[level], 
-                    message, reset_color);
+    strcpy(binary_log.path, path);
+    memcpy(binary_log.header, header, header_len);
+    binary_log.header_len = header_len;
+
+    bool ok = open_log_file(&binary_log);
+    if (ok) {
+        __atomic_add_fetch(&binary_generation, 1, __ATOMIC_RELEASE);
+    } else {
+        binary_log.path[0] = '\0';
+    }
+    pthread_mutex_unlock(&log_mutex);
+    return ok;
+}
+
+/* Queue a binary record for the binary log file */
+void log_binary(const void *data, size_t len) {
+    if (len > sizeof(((log_slot_t *)0)->text)) {
+        return;
+    }
+
+    log_ring_t *ring = __atomic_load_n(&writer_running, __ATOMIC_ACQUIRE) ?
+                       thread_ring() : NULL;
+    if (!ring) {
+        pthread_mutex_lock(&log_mutex);
+        if (binary_log.fd >= 0 && write(binary_log.fd, data, len) > 0) {
+            binary_log.size += len;
+        }
+        pthread_mutex_unlock(&log_mutex);
+        return;
+    }
+
+    log_slot_t *slot = reserve_slot(ring);
+    if (!slot) return;
+
+    memcpy(slot->text, data, len);
+    slot->len = (uint16_t)len;
+    slot->level = SLOT_BINARY;
+    publish_slot(ring);
+}
+
+/* Write an iovec array completely, returning the bytes written */
+static uint64_t writev_all(int fd, struct iovec *iov, int count) {
+    uint64_t total = 0;
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        total += n;
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return total;
+}
+
+/* Free drained buffers of exited threads beyond the spares (writer thread) */
+static void reclaim_rings(void) {
+    size_t spare = 0;
+
+    pthread_mutex_lock(&rings_mutex);
+    for (log_ring_t **link = &rings; *link;) {
+        log_ring_t *ring = *link;
+        bool idle = !__atomic_load_n(&ring->owned, __ATOMIC_ACQUIRE) &&
+                    ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (idle && ++spare > SPARE_RINGS) {
+            __atomic_store_n(link, ring->next, __ATOMIC_RELEASE);
+            __atomic_sub_fetch(&ring_count, 1, __ATOMIC_RELAXED);
+            free(ring);
         } else {
-            fprintf(stderr, "[%s] UNKNOWN: %s\n", time_str, message);
+            link = &ring->next;
         }
     }
-    
+    pthread_mutex_unlock(&rings_mutex);
+}
+
+/* Drain every buffer once, returning the number of records written */
+static size_t drain_rings(void) {
+    struct iovec file_iov[MAX_BATCH];
+    struct iovec console_iov[MAX_BATCH * 3];
+    struct iovec binary_iov[MAX_BATCH];
+    log_slot_t *batch[MAX_BATCH];
+    size_t total = 0;
+
+    pthread_mutex_lock(&log_mutex);
+    maintain_files();
+
+    bool to_file = text_log.fd >= 0 &&
+                   (output_mode == LOG_TO_FILE || output_mode == LOG_TO_BOTH);
+    bool to_console = output_mode == LOG_TO_CONSOLE || output_mode == LOG_TO_BOTH ||
+                      text_log.fd < 0;
+
+    /* Report records lost to overflow since the last report */
+    uint64_t lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (lost != dropped_reported) {
+        char line[128];
+        int len = snprintf(line, sizeof(line), "[logger] WARN: %llu log records dropped\n",
+                           (unsigned long long)(lost - dropped_reported));
+        if (to_file && write(text_log.fd, line, len) > 0) text_log.size += len;
+        if (to_console) write(STDERR_FILENO, line, len);
+        dropped_reported = lost;
+    }
+
+    for (log_ring_t *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        while (tail != head) {
+            size_t count = 0;
+            for (; tail != head && count < MAX_BATCH; tail++, count++) {
+                batch[count] = &ring->slots[tail & (RING_SLOTS - 1)];
+            }
+
+            /* Sort the batch by destination */
+            int file_count = 0, console_count = 0, binary_count = 0;
+            for (size_t i = 0; i < count; i++) {
+                log_slot_t *slot = batch[i];
+
+                if (slot->level == SLOT_BINARY) {
+                    binary_iov[binary_count].iov_base = slot->text;
+                    binary_iov[binary_count++].iov_len = slot->len;
+                    continue;
+                }
+                if (to_file) {
+                    file_iov[file_count].iov_base = slot->text;
+                    file_iov[file_count++].iov_len = slot->len;
+                }
+                if (to_console) {
+                    console_iov[console_count].iov_base = (void *)level_colors[slot->level];
+                    console_iov[console_count++].iov_len = strlen(level_colors[slot->level]);
+                    console_iov[console_count].iov_base = slot->text;
+                    console_iov[console_count++].iov_len = slot->len - 1;
+                    console_iov[console_count].iov_base = "\033[0m\n";
+                    console_iov[console_count++].iov_len = 5;
+                }
+            }
+
+            if (file_count) {
+                text_log.size += writev_all(text_log.fd, file_iov, file_count);
+            }
+            if (console_count) {
+                writev_all(STDERR_FILENO, console_iov, console_count);
+            }
+            if (binary_count && binary_log.fd >= 0) {
+                binary_log.size += writev_all(binary_log.fd, binary_iov, binary_count);
+            }
+
+            /* Hand the slots back to the producer */
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+            total += count;
+        }
+    }
+
     pthread_mutex_unlock(&log_mutex);
+    if (__atomic_load_n(&ring_count, __ATOMIC_RELAXED) > SPARE_RINGS) {
+        reclaim_rings();
+    }
+    return total;
+}
+
+/* Writer thread: batch queued records into large writes */
+static void *writer_main(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE)) {
+        if (drain_rings() > 0) continue;
+
+        /* Idle: sleep until the interval passes or a buffer fills up */
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WRITER_IDLE_USEC * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&wake_mutex);
+        __atomic_store_n(&writer_idle, true, __ATOMIC_RELEASE);
+        pthread_cond_timedwait(&wake_cond, &wake_mutex, &deadline);
+        __atomic_store_n(&writer_idle, false, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&wake_mutex);
+    }
+    drain_rings();
+    return NULL;
 }
 
-/* Close logger */
+/* Initialize logger */
+void log_init(const char *filename) {
+    pthread_mutex_lock(&log_mutex);
+
+    if (text_log.fd >= 0) {
+        close(text_log.fd);
+        text_log.fd = -1;
+    }
+    text_log.path[0] = '\0';
+
+    if (filename) {
+        if (strlen(filename) < sizeof(text_log.path)) {
+            strcpy(text_log.path, filename);
+        }
+        if (!text_log.path[0] || !open_log_file(&text_log)) {
+            fprintf(stderr, "Failed to open log file %s, falling back to stderr\n", filename);
+            text_log.path[0] = '\0';
+        }
+    }
+
+    /* Start the background writer once */
+    if (!writer_running) {
+        writer_stop = false;
+        if (pthread_create(&writer_thread, NULL, writer_main, NULL) == 0) {
+            __atomic_store_n(&writer_running, true, __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_mutex_unlock(&log_mutex);
+
+    /* Log startup */
+    log_write(LOG_INFO, "Logger initialized");
+}
+
+/* Close logger, flushing queued records */
 void log_close(void) {
+    if (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&writer_running, false, __ATOMIC_RELEASE);
+        __atomic_store_n(&writer_stop, true, __ATOMIC_RELEASE);
+        pthread_join(writer_thread, NULL);
+    }
+
     pthread_mutex_lock(&log_mutex);
-    if (log_file && log_file != stderr) {
-        fclose(log_file);
-        log_file = NULL;
+    log_file_t *files[] = { &text_log, &binary_log };
+    for (size_t i = 0; i < 2; i++) {
+        if (files[i]->fd >= 0) {
+            close(files[i]->fd);
+            files[i]->fd = -1;
+        }
+        files[i]->path[0] = '\0';
     }
     pthread_mutex_unlock(&log_mutex);
-} 
\ No newline at end of file
+}
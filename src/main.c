@@ -1,55 +1,93 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+#include <signal.h>
 #include "server.h"
 #include "logger.h"
+#include "access_log.h"
 
-/* Get formatted timestamp */
-static char* get_timestamp(void) {
-    static char buffer[32];
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", tm_info);
-    return buffer;
+/* Reopen log files; only sets a flag for the writer thread */
+static void handle_sighup(int sig) {
+    (void)sig;
+    log_reopen();
 }
 
-int main(void) {
+int main(int argc, char *argv[]) {
     printf("\n=== Zircon Secure Web Server ===\n");
-    printf("[%s] Server starting up\n\n", get_timestamp());
+    LOG_INFO("Server starting up");
 
     /* Server configuration - Higher rate limit for testing */
     server_config_t config = {
         .port = 8000,
         .bind_addr = "127.0.0.1",
         .root_dir = "www",
-        .max_requests = 10  /* Increased for testing */
+        .max_requests = 10,  /* Increased for testing */
+        .acl_trust = "127.0.0.1"  /* Local testing is never rate limited */
     };
 
+    /* Override defaults from the configuration file, if present */
+    const char *config_file = argc > 1 ? argv[1] : "conf/server.conf";
+    if (server_config_load(&config, config_file)) {
+        LOG_INFO("Loaded configuration from %s", config_file);
+    } else if (argc > 1) {
+        LOG_ERROR("Cannot read configuration file %s", config_file);
+        return 1;
+    }
+
+    /* Start the asynchronous logger */
+    log_set_overflow(config.log_block ? LOG_OVERFLOW_BLOCK : LOG_OVERFLOW_DROP);
+    log_set_access_sampling(config.log_sampling);
+    log_set_rotation((uint64_t)config.log_rotate_size_mb << 20, config.log_rotate_interval,
+                     config.log_rotate_keep ? config.log_rotate_keep : 5);
+    log_init(config.access_log[0] ? config.access_log : NULL);
+
+    /* SIGHUP reopens log files after external rotation */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sighup;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &sa, NULL);
+    if (config.binary_access_log[0] && !access_log_open(config.binary_access_log)) {
+        LOG_ERROR("Cannot open binary access log %s", config.binary_access_log);
+        log_close();
+        return 1;
+    }
+
     /* Show configuration */
-    printf("[%s] Server Configuration:\n", get_timestamp());
+    LOG_INFO("Server Configuration:");
     printf("- Listening on: http://%s:%d\n", config.bind_addr, config.port);
-    printf("- Web root: %s\n", config.root_dir);
+    if (config.asset_pack[0]) {
+        printf("- Asset pack: %s\n", config.asset_pack);
+    } else {
+        printf("- Web root: %s\n", config.root_dir);
+    }
     printf("- Rate limit: %d requests/minute\n", config.max_requests);
-    printf("\n[%s] Initializing server...\n", get_timestamp());
+    if (config.rate_limit_shm[0]) {
+        printf("- Shared rate limit region: %s\n", config.rate_limit_shm);
+    }
+    LOG_INFO("Initializing server...");
 
     /* Create and run server */
     server_t *server = server_create(&config);
     if (!server) {
-        fprintf(stderr, "[%s] Error: Failed to create server\n", get_timestamp());
+        LOG_ERROR("Failed to create server");
+        log_close();
         return 1;
     }
-    printf("[%s] Server created successfully\n", get_timestamp());
+    LOG_INFO("Server created successfully");
 
-    printf("\n[%s] Starting server...\n", get_timestamp());
+    LOG_INFO("Starting server...");
     if (!server_run(server)) {
-        fprintf(stderr, "[%s] Error: Failed to run server\n", get_timestamp());
+        LOG_ERROR("Failed to run server");
         server_destroy(server);
+        log_close();
         return 1;
     }
 
     /* This point is reached when server is stopped */
-    printf("\n[%s] Server shutting down...\n", get_timestamp());
+    LOG_INFO("Server shutting down...");
     server_destroy(server);
-    printf("[%s] Server stopped\n", get_timestamp());
+    LOG_INFO("Server stopped");
+    log_close();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,427 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#define METHOD_COUNT    4       /* GET, HEAD, POST, other (http_method_t order) */
+#define STATUS_COUNT    9
+#define SUB_BITS        3       /* 8 sub-buckets per power of two, ~12% error */
+#define SUB_COUNT       (1 << SUB_BITS)
+#define MAX_MAGNITUDE   32      /* Track latencies up to 2^32 us (~71 min) */
+#define HIST_BUCKETS    ((MAX_MAGNITUDE - SUB_BITS + 1) * SUB_COUNT)
+
+/* Status codes with their own counters; anything else counts as "other" */
+static const int status_codes[STATUS_COUNT] = { 200, 304, 400, 403, 404, 429, 500, 503, 0 };
+static const char *method_names[METHOD_COUNT] = { "GET", "HEAD", "POST", "other" };
+static const char *reject_names[METRIC_REJECT_COUNT] = {
+    "denied", "rate_limited", "connections", "bandwidth", "overload"
+};
+static const char *check_names[METRIC_CHECK_COUNT] = {
+    "method", "length", "bytes", "rate", "path", "patterns"
+};
+static const char *stage_names[METRIC_HIST_COUNT] = {
+    NULL, "read", "parse", "check", "limit", "path", "open", "send"
+};
+
+/* Per-thread counters
+ *
+ * Each thread only ever writes its own shard, so updates are plain
+ * relaxed load/store pairs with no locked instructions, and shards are
+ * cache-line aligned so threads never share a line. A scrape sums all
+ * shards. Shards outlive their threads and are reused by new ones, so
+ * totals stay monotonic.
+ */
+typedef struct metrics_shard {
+    uint64_t requests[METHOD_COUNT][STATUS_COUNT];
+    uint64_t bytes_out;
+    uint64_t cache_hits;
+    uint64_t short_responses;
+    uint64_t connections_opened;
+    uint64_t connections_closed;
+    uint64_t rejects[METRIC_REJECT_COUNT];
+    uint64_t checks[METRIC_CHECK_COUNT];
+    uint64_t check_failures[METRIC_CHECK_COUNT];
+    uint64_t check_nsec[METRIC_CHECK_COUNT];
+    uint64_t hist[METRIC_HIST_COUNT][HIST_BUCKETS];
+    uint64_t hist_sum[METRIC_HIST_COUNT];
+    uint32_t owned;
+    struct metrics_shard *next;
+} __attribute__((aligned(64))) metrics_shard_t;
+
+static metrics_shard_t *shards = NULL;      /* Lock-free push-only list */
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+
+/* Release a thread's shard for reuse when the thread exits */
+static void release_shard(void *ptr) {
+    metrics_shard_t *shard = ptr;
+    __atomic_store_n(&shard->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void make_shard_key(void) {
+    pthread_key_create(&shard_key, release_shard);
+}
+
+/* Get the calling thread's shard, claiming or allocating one */
+static metrics_shard_t *thread_shard(void) {
+    pthread_once(&shard_key_once, make_shard_key);
+
+    metrics_shard_t *shard = pthread_getspecific(shard_key);
+    if (shard) return shard;
+
+    /* Reuse a shard left behind by an exited thread */
+    for (shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); shard; shard = shard->next) {
+        uint32_t free_shard = 0;
+        if (__atomic_compare_exchange_n(&shard->owned, &free_shard, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (!shard) {
+        void *mem = NULL;
+        if (posix_memalign(&mem, 64, sizeof(metrics_shard_t)) != 0) return NULL;
+        shard = memset(mem, 0, sizeof(metrics_shard_t));
+        shard->owned = 1;
+
+        shard->next = __atomic_load_n(&shards, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&shards, &shard->next, shard, false,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    pthread_setspecific(shard_key, shard);
+    return shard;
+}
+
+/* Add to a counter only this thread writes */
+static inline void bump(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+static inline uint64_t read_counter(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/* Log-linear bucket for a latency, in the manner of HDR histograms */
+static unsigned int hist_bucket(uint64_t usec) {
+    if (usec >= (1ULL << MAX_MAGNITUDE)) usec = (1ULL << MAX_MAGNITUDE) - 1;
+    if (usec < SUB_COUNT) return (unsigned int)usec;
+
+    unsigned int magnitude = 63 - __builtin_clzll(usec);
+    unsigned int shift = magnitude - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (unsigned int)((usec >> shift) & (SUB_COUNT - 1));
+}
+
+/* Largest latency that falls in a bucket */
+static uint64_t bucket_upper(unsigned int bucket) {
+    if (bucket < SUB_COUNT) return bucket;
+
+    unsigned int shift = bucket / SUB_COUNT - 1;
+    uint64_t lower = (uint64_t)(SUB_COUNT + bucket % SUB_COUNT) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+static unsigned int status_index(int status) {
+    for (unsigned int i = 0; i < STATUS_COUNT - 1; i++) {
+        if (status_codes[i] == status) return i;
+    }
+    return STATUS_COUNT - 1;
+}
+
+/* Connection accepted and handed to a worker thread */
+void metrics_connection_open(void) {
+    metrics_shard_t *shard = thread_shard();
+    if (shard) bump(&shard->connections_opened, 1);
+}
+
+/* Connection closed (on the same thread that opened it) */
+void metrics_connection_close(void) {
+    metrics_shard_t *shard = thread_shard();
+    if (shard) bump(&shard->connections_closed, 1);
+}
+
+/* Count a finished request */
+void metrics_request(int method, int status, uint64_t bytes, bool cache_hit) {
+    metrics_shard_t *shard = thread_shard();
+    if (!shard) return;
+
+    unsigned int m = method >= 0 && method < METHOD_COUNT ? (unsigned int)method
+                                                          : METHOD_COUNT - 1;
+    bump(&shard->requests[m][status_index(status)], 1);
+    bump(&shard->bytes_out, bytes);
+    if (cache_hit) bump(&shard->cache_hits, 1);
+}
+
+/* Count a rejected connection or request */
+void metrics_reject(metrics_reject_t reason) {
+    metrics_shard_t *shard = thread_shard();
+    if (shard && reason < METRIC_REJECT_COUNT) bump(&shard->rejects[reason], 1);
+}
+
+/* Count a response whose body stopped short of its Content-Length */
+void metrics_short_response(void) {
+    metrics_shard_t *shard = thread_shard();
+    if (shard) bump(&shard->short_responses, 1);
+}
+
+/* Count a request check and the time it took */
+void metrics_check(metrics_check_t check, uint64_t nsec, bool passed) {
+    metrics_shard_t *shard = thread_shard();
+    if (!shard || check >= METRIC_CHECK_COUNT) return;
+
+    bump(&shard->checks[check], 1);
+    bump(&shard->check_nsec[check], nsec);
+    if (!passed) bump(&shard->check_failures[check], 1);
+}
+
+/* Record a latency sample */
+void metrics_observe(metrics_hist_t hist, uint64_t usec) {
+    metrics_shard_t *shard = thread_shard();
+    if (!shard || hist >= METRIC_HIST_COUNT) return;
+
+    bump(&shard->hist[hist][hist_bucket(usec)], 1);
+    bump(&shard->hist_sum[hist], usec);
+}
+
+/* Sum a histogram over all shards */
+static uint64_t collect_hist(metrics_hist_t hist, uint64_t *buckets, uint64_t *sum) {
+    uint64_t total = 0;
+    memset(buckets, 0, sizeof(uint64_t) * HIST_BUCKETS);
+    *sum = 0;
+
+    for (metrics_shard_t *shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); shard;
+         shard = shard->next) {
+        for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+            uint64_t n = read_counter(&shard->hist[hist][i]);
+            buckets[i] += n;
+            total += n;
+        }
+        *sum += read_counter(&shard->hist_sum[hist]);
+    }
+    return total;
+}
+
+/* Quantile of collected buckets, as the upper bound of its bucket */
+static uint64_t bucket_quantile(const uint64_t *buckets, uint64_t total, double quantile) {
+    if (!total) return 0;
+
+    uint64_t rank = (uint64_t)(quantile * total);
+    if (rank >= total) rank = total - 1;
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > rank) return bucket_upper(i);
+    }
+    return bucket_upper(HIST_BUCKETS - 1);
+}
+
+/* Latency at a quantile (0..1) */
+uint64_t metrics_quantile(metrics_hist_t hist, double quantile) {
+    if (hist >= METRIC_HIST_COUNT) return 0;
+
+    uint64_t buckets[HIST_BUCKETS], sum;
+    uint64_t total = collect_hist(hist, buckets, &sum);
+    return bucket_quantile(buckets, total, quantile);
+}
+
+/* Bounded appender for the exposition text */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+} text_t;
+
+static void append(text_t *text, const char *fmt, ...) {
+    if (text->len >= text->size) return;
+
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(text->buf + text->len, text->size - text->len, fmt, args);
+    va_end(args);
+
+    if (n > 0) {
+        text->len += (size_t)n < text->size - text->len ? (size_t)n
+                                                         : text->size - text->len;
+    }
+}
+
+/* Label prefix for a histogram's series: stage="read", or nothing */
+static void hist_labels(metrics_hist_t hist, char *buf, size_t size) {
+    if (stage_names[hist]) {
+        snprintf(buf, size, "stage=\"%s\"", stage_names[hist]);
+    } else {
+        buf[0] = '\0';
+    }
+}
+
+/* One histogram's series
+ *
+ * Bucket bounds are powers of two, which are exact HDR bucket edges, so
+ * the exported buckets are sums of whole internal buckets.
+ */
+static void render_hist(text_t *text, const char *family, metrics_hist_t hist) {
+    uint64_t buckets[HIST_BUCKETS], sum;
+    uint64_t total = collect_hist(hist, buckets, &sum);
+    char labels[32];
+    hist_labels(hist, labels, sizeof(labels));
+    const char *sep = labels[0] ? "," : "";
+
+    uint64_t cumulative = 0;
+    unsigned int bucket = 0;
+    for (unsigned int magnitude = 4; magnitude <= 26; magnitude++) {
+        uint64_t bound = 1ULL << magnitude;
+        for (; bucket < HIST_BUCKETS && bucket_upper(bucket) < bound; bucket++) {
+            cumulative += buckets[bucket];
+        }
+        append(text, "%s_bucket{%s%sle=\"%g\"} %llu\n",
+               family, labels, sep, bound / 1e6, (unsigned long long)cumulative);
+    }
+    append(text, "%s_bucket{%s%sle=\"+Inf\"} %llu\n",
+           family, labels, sep, (unsigned long long)total);
+
+    if (labels[0]) {
+        append(text, "%s_sum{%s} %.6f\n%s_count{%s} %llu\n",
+               family, labels, sum / 1e6, family, labels, (unsigned long long)total);
+    } else {
+        append(text, "%s_sum %.6f\n%s_count %llu\n",
+               family, sum / 1e6, family, (unsigned long long)total);
+    }
+}
+
+/* Quantile gauges from the full-resolution buckets */
+static void render_quantiles(text_t *text, const char *family, metrics_hist_t hist) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t buckets[HIST_BUCKETS], sum;
+    uint64_t total = collect_hist(hist, buckets, &sum);
+    char labels[32];
+    hist_labels(hist, labels, sizeof(labels));
+
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+        append(text, "%s{%s%squantile=\"%g\"} %.6f\n",
+               family, labels, labels[0] ? "," : "", quantiles[q],
+               bucket_quantile(buckets, total, quantiles[q]) / 1e6);
+    }
+}
+
+/* Render all metrics in Prometheus text format, returning the length */
+size_t metrics_render(char *buf, size_t size) {
+    text_t text = { buf, size, 0 };
+    uint64_t requests[METHOD_COUNT][STATUS_COUNT] = {{0}};
+    uint64_t rejects[METRIC_REJECT_COUNT] = {0};
+    uint64_t checks[METRIC_CHECK_COUNT] = {0};
+    uint64_t check_failures[METRIC_CHECK_COUNT] = {0};
+    uint64_t check_nsec[METRIC_CHECK_COUNT] = {0};
+    uint64_t bytes_out = 0, cache_hits = 0, short_responses = 0, opened = 0, closed = 0;
+
+    for (metrics_shard_t *shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); shard;
+         shard = shard->next) {
+        for (unsigned int m = 0; m < METHOD_COUNT; m++) {
+            for (unsigned int s = 0; s < STATUS_COUNT; s++) {
+                requests[m][s] += read_counter(&shard->requests[m][s]);
+            }
+        }
+        for (unsigned int r = 0; r < METRIC_REJECT_COUNT; r++) {
+            rejects[r] += read_counter(&shard->rejects[r]);
+        }
+        for (unsigned int c = 0; c < METRIC_CHECK_COUNT; c++) {
+            checks[c] += read_counter(&shard->checks[c]);
+            check_failures[c] += read_counter(&shard->check_failures[c]);
+            check_nsec[c] += read_counter(&shard->check_nsec[c]);
+        }
+        bytes_out += read_counter(&shard->bytes_out);
+        cache_hits += read_counter(&shard->cache_hits);
+        short_responses += read_counter(&shard->short_responses);
+        opened += read_counter(&shard->connections_opened);
+        closed += read_counter(&shard->connections_closed);
+    }
+
+    append(&text, "# HELP zircon_requests_total Requests served, by method and status.\n"
+                  "# TYPE zircon_requests_total counter\n");
+    for (unsigned int m = 0; m < METHOD_COUNT; m++) {
+        for (unsigned int s = 0; s < STATUS_COUNT; s++) {
+            if (!requests[m][s]) continue;
+            if (status_codes[s]) {
+                append(&text, "zircon_requests_total{method=\"%s\",status=\"%d\"} %llu\n",
+                       method_names[m], status_codes[s], (unsigned long long)requests[m][s]);
+            } else {
+                append(&text, "zircon_requests_total{method=\"%s\",status=\"other\"} %llu\n",
+                       method_names[m], (unsigned long long)requests[m][s]);
+            }
+        }
+    }
+
+    append(&text, "# HELP zircon_response_bytes_total Response body bytes sent.\n"
+                  "# TYPE zircon_response_bytes_total counter\n"
+                  "zircon_response_bytes_total %llu\n", (unsigned long long)bytes_out);
+
+    append(&text, "# HELP zircon_cache_hits_total Requests answered from a cache or revalidated.\n"
+                  "# TYPE zircon_cache_hits_total counter\n"
+                  "zircon_cache_hits_total %llu\n", (unsigned long long)cache_hits);
+
+    append(&text, "# HELP zircon_short_responses_total Responses whose body ended before "
+                  "its Content-Length.\n"
+                  "# TYPE zircon_short_responses_total counter\n"
+                  "zircon_short_responses_total %llu\n", (unsigned long long)short_responses);
+
+    append(&text, "# HELP zircon_connections_total Connections handed to worker threads.\n"
+                  "# TYPE zircon_connections_total counter\n"
+                  "zircon_connections_total %llu\n"
+                  "# HELP zircon_connections_active Connections being served now.\n"
+                  "# TYPE zircon_connections_active gauge\n"
+                  "zircon_connections_active %lld\n",
+           (unsigned long long)opened, (long long)(opened - closed));
+
+    append(&text, "# HELP zircon_rejections_total Connections and requests turned away.\n"
+                  "# TYPE zircon_rejections_total counter\n");
+    for (unsigned int r = 0; r < METRIC_REJECT_COUNT; r++) {
+        append(&text, "zircon_rejections_total{reason=\"%s\"} %llu\n",
+               reject_names[r], (unsigned long long)rejects[r]);
+    }
+
+    append(&text, "# HELP zircon_checks_total Request checks run, by check.\n"
+                  "# TYPE zircon_checks_total counter\n");
+    for (unsigned int c = 0; c < METRIC_CHECK_COUNT; c++) {
+        append(&text, "zircon_checks_total{check=\"%s\"} %llu\n",
+               check_names[c], (unsigned long long)checks[c]);
+    }
+
+    append(&text, "# HELP zircon_check_rejections_total Requests rejected, by the check that failed.\n"
+                  "# TYPE zircon_check_rejections_total counter\n");
+    for (unsigned int c = 0; c < METRIC_CHECK_COUNT; c++) {
+        append(&text, "zircon_check_rejections_total{check=\"%s\"} %llu\n",
+               check_names[c], (unsigned long long)check_failures[c]);
+    }
+
+    append(&text, "# HELP zircon_check_seconds_total Time spent in each request check.\n"
+                  "# TYPE zircon_check_seconds_total counter\n");
+    for (unsigned int c = 0; c < METRIC_CHECK_COUNT; c++) {
+        append(&text, "zircon_check_seconds_total{check=\"%s\"} %.9f\n",
+               check_names[c], check_nsec[c] / 1e9);
+    }
+
+    append(&text, "# HELP zircon_request_duration_seconds Request latency.\n"
+                  "# TYPE zircon_request_duration_seconds histogram\n");
+    render_hist(&text, "zircon_request_duration_seconds", METRIC_HIST_REQUEST);
+
+    append(&text, "# HELP zircon_stage_duration_seconds Latency of each request stage.\n"
+                  "# TYPE zircon_stage_duration_seconds histogram\n");
+    for (unsigned int h = METRIC_HIST_STAGE_READ; h < METRIC_HIST_COUNT; h++) {
+        render_hist(&text, "zircon_stage_duration_seconds", h);
+    }
+
+    append(&text, "# HELP zircon_request_duration_quantile_seconds Request latency quantiles.\n"
+                  "# TYPE zircon_request_duration_quantile_seconds gauge\n");
+    render_quantiles(&text, "zircon_request_duration_quantile_seconds", METRIC_HIST_REQUEST);
+
+    append(&text, "# HELP zircon_stage_duration_quantile_seconds Request stage latency quantiles.\n"
+                  "# TYPE zircon_stage_duration_quantile_seconds gauge\n");
+    for (unsigned int h = METRIC_HIST_STAGE_READ; h < METRIC_HIST_COUNT; h++) {
+        render_quantiles(&text, "zircon_stage_duration_quantile_seconds", h);
+    }
+
+    return text.len;
+}
@@ -0,0 +1,202 @@
+#include "negative_cache.h"
+#include "timecache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define CACHE_WAYS  4   /* Entries per set; the oldest is replaced */
+
+/* Refused path */
+typedef struct {
+    uint64_t hash;
+    time_t expires;             /* 0 for a free entry */
+    uint16_t status;
+    uint8_t len;
+    char key[NEGATIVE_CACHE_KEY_MAX];
+} negative_entry_t;
+
+/* Negative lookup cache
+ *
+ * A set-associative hash table: a path can only live in the CACHE_WAYS
+ * entries of the set its hash selects, so a lookup is a bounded scan
+ * under a shared lock, and memory is fixed at creation. Keys are kept in
+ * full, so unlike a Bloom filter a hit is never a false positive that
+ * would hide a real file. Once a second one caller stats the web root;
+ * a different inode (the directory was swapped) or modification time
+ * (a file was added or removed in it) clears the table. Changes deeper
+ * down are picked up when entries expire.
+ */
+struct negative_cache {
+    negative_entry_t *entries;
+    size_t set_mask;            /* Sets - 1, a power of two less one */
+    uint32_t ttl;
+    char *root;
+    time_t checked;             /* Second the root was last looked at */
+    struct stat root_stat;      /* As last seen, zeroed if it was missing */
+    pthread_rwlock_t lock;
+    uint64_t hits;
+    uint64_t inserts;
+    uint64_t clears;
+};
+
+/* 64-bit FNV-1a */
+static uint64_t hash_key(const char *key, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* Current identity of the web root */
+static void stat_root(const char *root, struct stat *st) {
+    if (stat(root, st) < 0) memset(st, 0, sizeof(*st));
+}
+
+static bool same_root(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/* Create cache for about capacity paths kept ttl_seconds, under root */
+negative_cache_t *negative_cache_create(size_t capacity, uint32_t ttl_seconds,
+                                        const char *root) {
+    if (capacity == 0 || ttl_seconds == 0 || !root) return NULL;
+
+    size_t sets = 1;
+    while (sets * CACHE_WAYS < capacity) sets <<= 1;
+
+    negative_cache_t *cache = calloc(1, sizeof(*cache));
+    if (!cache) return NULL;
+
+    cache->entries = calloc(sets * CACHE_WAYS, sizeof(*cache->entries));
+    cache->root = strdup(root);
+    if (!cache->entries || !cache->root || pthread_rwlock_init(&cache->lock, NULL) != 0) {
+        free(cache->entries);
+        free(cache->root);
+        free(cache);
+        return NULL;
+    }
+    cache->set_mask = sets - 1;
+    cache->ttl = ttl_seconds;
+    cache->checked = timecache_now();
+    stat_root(root, &cache->root_stat);
+    return cache;
+}
+
+/* Clean up cache */
+void negative_cache_destroy(negative_cache_t *cache) {
+    if (!cache) return;
+    pthread_rwlock_destroy(&cache->lock);
+    free(cache->entries);
+    free(cache->root);
+    free(cache);
+}
+
+/* Forget every path (write lock held) */
+static void clear_locked(negative_cache_t *cache) {
+    memset(cache->entries, 0, (cache->set_mask + 1) * CACHE_WAYS * sizeof(*cache->entries));
+}
+
+/* Forget every path */
+void negative_cache_clear(negative_cache_t *cache) {
+    if (!cache) return;
+    pthread_rwlock_wrlock(&cache->lock);
+    clear_locked(cache);
+    pthread_rwlock_unlock(&cache->lock);
+}
+
+/* Clear the table if the web root changed; one thread looks per second */
+static void check_root(negative_cache_t *cache, time_t now) {
+    time_t last = __atomic_load_n(&cache->checked, __ATOMIC_RELAXED);
+    if (now == last) return;
+    if (!__atomic_compare_exchange_n(&cache->checked, &last, now, false,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    struct stat st;
+    stat_root(cache->root, &st);
+
+    pthread_rwlock_wrlock(&cache->lock);
+    if (!same_root(&st, &cache->root_stat)) {
+        cache->root_stat = st;
+        clear_locked(cache);
+        __atomic_fetch_add(&cache->clears, 1, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&cache->lock);
+}
+
+/* Status a path was recently refused with, 0 if none */
+int negative_cache_lookup(negative_cache_t *cache, const char *path, size_t len) {
+    if (!cache || !path || len == 0 || len > NEGATIVE_CACHE_KEY_MAX) return 0;
+
+    time_t now = timecache_now();
+    check_root(cache, now);
+
+    uint64_t hash = hash_key(path, len);
+    const negative_entry_t *set = &cache->entries[(hash & cache->set_mask) * CACHE_WAYS];
+    int status = 0;
+
+    pthread_rwlock_rdlock(&cache->lock);
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        const negative_entry_t *entry = &set[i];
+        if (entry->hash == hash && entry->expires > now && entry->len == len &&
+            memcmp(entry->key, path, len) == 0) {
+            status = entry->status;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&cache->lock);
+
+    if (status) __atomic_fetch_add(&cache->hits, 1, __ATOMIC_RELAXED);
+    return status;
+}
+
+/* Remember that a path was refused with a status */
+void negative_cache_insert(negative_cache_t *cache, const char *path, size_t len, int status) {
+    if (!cache || !path || len == 0 || len > NEGATIVE_CACHE_KEY_MAX ||
+        status <= 0 || status > UINT16_MAX) {
+        return;
+    }
+
+    time_t now = timecache_now();
+    uint64_t hash = hash_key(path, len);
+    negative_entry_t *set = &cache->entries[(hash & cache->set_mask) * CACHE_WAYS];
+
+    pthread_rwlock_wrlock(&cache->lock);
+
+    /* The same path again, else the entry expiring soonest */
+    negative_entry_t *victim = &set[0];
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        negative_entry_t *entry = &set[i];
+        if (entry->hash == hash && entry->len == len && memcmp(entry->key, path, len) == 0) {
+            victim = entry;
+            break;
+        }
+        if (entry->expires < victim->expires) victim = entry;
+    }
+
+    victim->hash = hash;
+    victim->expires = now + cache->ttl;
+    victim->status = (uint16_t)status;
+    victim->len = (uint8_t)len;
+    memcpy(victim->key, path, len);
+
+    pthread_rwlock_unlock(&cache->lock);
+    __atomic_fetch_add(&cache->inserts, 1, __ATOMIC_RELAXED);
+}
+
+/* Read counters */
+void negative_cache_stats(negative_cache_t *cache, negative_cache_stats_t *stats) {
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+    if (!cache) return;
+
+    stats->hits = __atomic_load_n(&cache->hits, __ATOMIC_RELAXED);
+    stats->inserts = __atomic_load_n(&cache->inserts, __ATOMIC_RELAXED);
+    stats->clears = __atomic_load_n(&cache->clears, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,278 @@
+#include "pattern_set.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_STATES      65536
+#define SCAN_LANES      4       /* Unrolled by hand in pattern_set_scan() */
+#define SCAN_LANE_MIN   16      /* Shorter pieces aren't worth interleaving */
+
+/* Compiled pattern set
+ *
+ * The patterns are compiled into an Aho-Corasick automaton and its failure
+ * links are folded into the transition table, giving a DFA that consumes
+ * exactly one table lookup per input byte with no backtracking. Bytes are
+ * first mapped to classes: every (ASCII case-folded) byte that occurs in
+ * some pattern gets its own class and all other bytes share class 0, so a
+ * row is only as wide as the patterns' alphabet, rounded up to a power of
+ * two. Transitions hold the next state's row offset, saving a multiply.
+ */
+struct pattern_set {
+    char **patterns;
+    uint8_t *groups;
+    size_t count;
+    size_t capacity;
+
+    uint8_t classes[256];
+    unsigned int row_shift;     /* Row width is 1 << row_shift */
+    uint32_t *delta;            /* [state << row_shift | class] -> next row offset */
+    uint32_t *matches;          /* Groups matched on entering a state */
+    uint32_t first_match;       /* Offset of the first state with matches */
+    uint32_t all_groups;
+    size_t max_len;             /* Longest pattern */
+};
+
+static unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/* Create an empty set */
+pattern_set_t *pattern_set_create(void) {
+    return calloc(1, sizeof(pattern_set_t));
+}
+
+/* Clean up set */
+void pattern_set_destroy(pattern_set_t *set) {
+    if (!set) return;
+    for (size_t i = 0; i < set->count; i++) {
+        free(set->patterns[i]);
+    }
+    free(set->patterns);
+    free(set->groups);
+    free(set->delta);
+    free(set->matches);
+    free(set);
+}
+
+/* Add a pattern; takes effect at the next compile */
+bool pattern_set_add(pattern_set_t *set, const char *pattern, unsigned int group) {
+    if (!set || !pattern || !pattern[0] || group >= PATTERN_GROUPS) return false;
+
+    if (set->count == set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 16;
+        char **patterns = realloc(set->patterns, capacity * sizeof(*patterns));
+        if (!patterns) return false;
+        set->patterns = patterns;
+        uint8_t *groups = realloc(set->groups, capacity * sizeof(*groups));
+        if (!groups) return false;
+        set->groups = groups;
+        set->capacity = capacity;
+    }
+
+    char *copy = strdup(pattern);
+    if (!copy) return false;
+    set->patterns[set->count] = copy;
+    set->groups[set->count] = (uint8_t)group;
+    set->count++;
+    return true;
+}
+
+/* Build the automaton from the patterns added so far */
+bool pattern_set_compile(pattern_set_t *set) {
+    if (!set) return false;
+
+    /* Byte classes and an upper bound on the state count */
+    uint8_t classes[256] = {0};
+    unsigned int class_count = 1;
+    size_t max_states = 1, max_len = 1;
+    for (size_t i = 0; i < set->count; i++) {
+        size_t len = 0;
+        for (const unsigned char *p = (const unsigned char *)set->patterns[i]; *p; p++) {
+            unsigned char c = fold(*p);
+            if (!classes[c]) classes[c] = (uint8_t)class_count++;
+            len++;
+        }
+        max_states += len;
+        if (len > max_len) max_len = len;
+    }
+    if (max_states > MAX_STATES) return false;
+    for (int c = 'A'; c <= 'Z'; c++) {
+        classes[c] = classes[fold((unsigned char)c)];
+    }
+
+    unsigned int shift = 0;
+    while ((1u << shift) < class_count) shift++;
+    size_t row = (size_t)1 << shift;
+
+    /* Rows are indexed by state while building; 0 means no edge yet,
+     * which is unambiguous because nothing leads back into the root
+     * until the failure links are folded in */
+    uint32_t *next = calloc(max_states * row, sizeof(*next));
+    uint32_t *matches = calloc(max_states, sizeof(*matches));
+    uint32_t *fail = calloc(max_states, sizeof(*fail));
+    uint32_t *queue = malloc(max_states * sizeof(*queue));
+    if (!next || !matches || !fail || !queue) {
+        free(next);
+        free(matches);
+        free(fail);
+        free(queue);
+        return false;
+    }
+
+    /* Trie */
+    uint32_t states = 1;
+    uint32_t all_groups = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        uint32_t state = 0;
+        for (const unsigned char *p = (const unsigned char *)set->patterns[i]; *p; p++) {
+            uint32_t *edge = &next[state * row + classes[*p]];
+            if (!*edge) *edge = states++;
+            state = *edge;
+        }
+        matches[state] |= 1u << set->groups[i];
+        all_groups |= 1u << set->groups[i];
+    }
+
+    /* Breadth-first: failure links, inherited matches, and missing edges
+     * redirected to where the longest matching suffix would go */
+    size_t head = 0, tail = 0;
+    for (size_t c = 0; c < row; c++) {
+        uint32_t child = next[c];
+        if (child) queue[tail++] = child;
+    }
+    while (head < tail) {
+        uint32_t state = queue[head++];
+        for (size_t c = 0; c < row; c++) {
+            uint32_t *edge = &next[state * row + c];
+            uint32_t via_fail = next[fail[state] * row + c];
+            if (*edge) {
+                fail[*edge] = via_fail;
+                matches[*edge] |= matches[via_fail];
+                queue[tail++] = *edge;
+            } else {
+                *edge = via_fail;
+            }
+        }
+    }
+    free(fail);
+
+    /* Renumber so that states with matches come last: the scan loop then
+     * only compares the offset against the first of them. The root never
+     * matches and stays state 0. */
+    uint32_t *order = queue;
+    uint32_t plain = 0, matching = states;
+    for (uint32_t state = 0; state < states; state++) {
+        if (!matches[state]) order[state] = plain++;
+    }
+    for (uint32_t state = states; state-- > 0;) {
+        if (matches[state]) order[state] = --matching;
+    }
+
+    uint32_t *delta = malloc(states * row * sizeof(*delta));
+    uint32_t *groups = malloc(states * sizeof(*groups));
+    if (!delta || !groups) {
+        free(delta);
+        free(groups);
+        free(next);
+        free(matches);
+        free(queue);
+        return false;
+    }
+    for (uint32_t state = 0; state < states; state++) {
+        groups[order[state]] = matches[state];
+        for (size_t c = 0; c < row; c++) {
+            /* Row offsets rather than state numbers */
+            delta[(size_t)order[state] * row + c] = order[next[state * row + c]] << shift;
+        }
+    }
+    free(next);
+    free(matches);
+    free(queue);
+
+    free(set->delta);
+    free(set->matches);
+    memcpy(set->classes, classes, sizeof(classes));
+    set->row_shift = shift;
+    set->delta = delta;
+    set->matches = groups;
+    set->first_match = plain << shift;
+    set->all_groups = all_groups;
+    set->max_len = max_len;
+    return true;
+}
+
+/* Advance one state chain over len bytes, collecting matched groups */
+static uint32_t scan_lane(const pattern_set_t *set, uint32_t *offset,
+                          const unsigned char *p, size_t len, uint32_t found) {
+    const uint32_t *delta = set->delta;
+    const uint8_t *classes = set->classes;
+    uint32_t first_match = set->first_match;
+    uint32_t state = *offset;
+
+    for (size_t i = 0; i < len && found != set->all_groups; i++) {
+        state = delta[state | classes[p[i]]];
+        if (state >= first_match) found |= set->matches[state >> set->row_shift];
+    }
+    *offset = state;
+    return found;
+}
+
+/* Scan the next chunk of a stream; *state carries the matcher between
+ * chunks and starts at 0. Returns the groups matched within this chunk,
+ * including matches that began in earlier chunks. Once every group has
+ * matched the scan stops early and the state is no longer meaningful.
+ *
+ * Each byte's transition depends on the previous one, so a single chain
+ * runs at the speed of one dependent load per byte. Longer chunks are cut
+ * into SCAN_LANES pieces scanned in lockstep, whose independent chains
+ * overlap in the pipeline. A lane carries on past the end of its piece by
+ * the longest pattern less one byte, so matches straddling a cut are seen.
+ * Pieces are at least as long as the longest pattern, so the last lane,
+ * although started afresh, ends in the state a single chain would reach.
+ */
+uint32_t pattern_set_feed(const pattern_set_t *set, uint32_t *state,
+                          const void *data, size_t len) {
+    if (!set || !set->delta || !state || !data || !set->all_groups) return 0;
+
+    const unsigned char *p = data;
+    size_t piece = len / SCAN_LANES;
+    if (piece < SCAN_LANE_MIN || piece < set->max_len) {
+        return scan_lane(set, state, p, len, 0);
+    }
+
+    const uint32_t *delta = set->delta;
+    const uint8_t *classes = set->classes;
+    uint32_t first_match = set->first_match;
+    uint32_t o0 = *state, o1 = 0, o2 = 0, o3 = 0;
+    const unsigned char *p0 = p, *p1 = p + piece, *p2 = p + 2 * piece, *p3 = p + 3 * piece;
+    uint32_t found = 0;
+
+    for (size_t i = 0; i < piece; i++) {
+        o0 = delta[o0 | classes[p0[i]]];
+        o1 = delta[o1 | classes[p1[i]]];
+        o2 = delta[o2 | classes[p2[i]]];
+        o3 = delta[o3 | classes[p3[i]]];
+        if (o0 >= first_match || o1 >= first_match ||
+            o2 >= first_match || o3 >= first_match) {
+            if (o0 >= first_match) found |= set->matches[o0 >> set->row_shift];
+            if (o1 >= first_match) found |= set->matches[o1 >> set->row_shift];
+            if (o2 >= first_match) found |= set->matches[o2 >> set->row_shift];
+            if (o3 >= first_match) found |= set->matches[o3 >> set->row_shift];
+            if (found == set->all_groups) return found;
+        }
+    }
+
+    /* Overlaps into the next piece, and the remainder for the last lane */
+    size_t overlap = set->max_len - 1;
+    found = scan_lane(set, &o0, p1, overlap, found);
+    found = scan_lane(set, &o1, p2, overlap, found);
+    found = scan_lane(set, &o2, p3, overlap, found);
+    found = scan_lane(set, &o3, p3 + piece, len - 4 * piece, found);
+    *state = o3;
+    return found;
+}
+
+/* Scan a whole input; returns the groups with a pattern occurring in it */
+uint32_t pattern_set_scan(const pattern_set_t *set, const void *data, size_t len) {
+    uint32_t state = 0;
+    return pattern_set_feed(set, &state, data, len);
+}
@@ -2,139 +2,511 @@
 #include "logger.h"
 #include <stdlib.h>
 #include <string.h>
-#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
 
-#define MAX_CLIENTS 10000
+#define CLIENT_BITS 14
+#define MAX_CLIENTS (1u << CLIENT_BITS)
+#define MAX_PROBES  32      /* Longest probe sequence per lookup */
 
-/* Client tracking structure */
+#define SHM_MAGIC   0x5a52544cu     /* "ZRTL" */
+#define SHM_VERSION 3u
+#define SHM_WAIT_MS 1000        /* For a creator to publish the header */
+
+/* Client keys: the low 32 bits identify the client within a keyspace,
+ * the bits above say which one, so a hashed key can never equal an IPv4
+ * address. A key is never zero and doubles as the slot tag. */
+#define KEY_IPV4    (1ull << 32)
+#define KEY_HASHED  (2ull << 32)
+
+/* Client tracking slot (16 bytes)
+ *
+ * The limiter implements the Generic Cell Rate Algorithm: each client only
+ * needs its theoretical arrival time (TAT), the earliest time at which it
+ * would be conforming again if it sent at exactly the sustained rate.
+ *
+ * Both fields are updated with atomic compare-and-swap only, so the table
+ * can live in memory shared between processes without a lock that a
+ * crashed worker could leave held.
+ */
+typedef struct {
+    uint64_t tag;       /* 0 if free, else the client key */
+    uint64_t tat;       /* Theoretical arrival time in microseconds */
+} client_slot_t;
+
+/* Client table, placed at the start of a shared mapping */
 typedef struct {
-    char ip[16];
-    time_t *requests;
-    size_t count;
-    time_t window_start;
-    bool blocked;
-} client_track_t;
+    uint32_t magic;         /* SHM_MAGIC once initialized */
+    uint32_t version;
+    uint64_t interval;      /* Emission interval: usec per request */
+    uint64_t tolerance;     /* Burst tolerance: usec a client may run ahead */
+    client_slot_t clients[MAX_CLIENTS];
+} client_table_t;
 
 /* Rate limiter context */
 struct rate_limiter {
     rate_limit_config_t config;
-    client_track_t *clients;
-    size_t client_count;
-    pthread_mutex_t lock;
+    client_table_t *table;
+    bool shared;            /* Table is an mmap()ed region */
+    char *name;             /* Shared memory object, NULL if anonymous */
+    int fd;                 /* Its descriptor, holding a shared flock() */
+    rate_limiter_clock_t clock;
+    void *clock_ctx;
+    uint64_t table_full;    /* Checks rejected for want of a slot */
 };
 
+/* Monotonic time in microseconds (CLOCK_MONOTONIC is system-wide, so
+ * values are comparable across processes sharing a table) */
+static uint64_t now_usec(void *ctx) {
+    (void)ctx;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Key of an IPv4 address */
+static uint64_t addr_key(const struct in_addr *addr) {
+    return KEY_IPV4 | addr->s_addr;
+}
+
+/* Map a client address to its key */
+static uint64_t client_key(const char *ip) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, ip, &addr) == 1) {
+        return addr_key(&addr);
+    }
+
+    /* Not an IPv4 address - fall back to an FNV-1a hash in its own keyspace */
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)ip; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return KEY_HASHED | hash;
+}
+
+/* Spread keys over the table (addresses often share high/low bits) */
+static size_t slot_index(uint64_t key) {
+    uint32_t mixed = (uint32_t)key ^ (uint32_t)(key >> 32);
+    return (size_t)((mixed * 2654435761u) >> (32 - CLIENT_BITS));
+}
+
+/* Validate configuration and derive GCRA parameters */
+static bool init_params(const rate_limit_config_t *config,
+                        uint64_t *interval, uint64_t *tolerance) {
+    if (!config || config->requests_per_window == 0 || config->window_seconds <= 0)
+        return false;
+
+    unsigned int burst = config->burst_size ? config->burst_size : 1;
+
+    *interval = (uint64_t)config->window_seconds * 1000000 /
+                config->requests_per_window;
+    if (*interval == 0) {
+        *interval = 1;
+    }
+    *tolerance = *interval * (burst - 1);
+    return true;
+}
+
 /* Create rate limiter */
 rate_limiter_t *rate_limiter_create(const rate_limit_config_t *config) {
+    uint64_t interval, tolerance;
+    if (!init_params(config, &interval, &tolerance))
+        return NULL;
+
     rate_limiter_t *limiter = calloc(1, sizeof(*limiter));
     if (!limiter) return NULL;
 
     /* Copy configuration */
     limiter->config = *config;
+    limiter->clock = now_usec;
 
-    /* Allocate client tracking array */
-    limiter->clients = calloc(MAX_CLIENTS, sizeof(client_track_t));
-    if (!limiter->clients) {
+    /* Allocate client table */
+    limiter->table = calloc(1, sizeof(client_table_t));
+    if (!limiter->table) {
         free(limiter);
         return NULL;
     }
+    limiter->table->magic = SHM_MAGIC;
+    limiter->table->version = SHM_VERSION;
+    limiter->table->interval = interval;
+    limiter->table->tolerance = tolerance;
+
+    return limiter;
+}
+
+/* The name still refers to the region open on fd */
+static bool names_region(const char *name, int fd) {
+    struct stat held, named;
+    int check = shm_open(name, O_RDONLY, 0600);
+    bool same = check >= 0 && fstat(fd, &held) == 0 && fstat(check, &named) == 0 &&
+                held.st_dev == named.st_dev && held.st_ino == named.st_ino;
+    if (check >= 0) close(check);
+    return same;
+}
+
+/* Open a named region, creator or not, and take a shared lock on it
+ *
+ * Every attached process holds the lock for as long as its limiter
+ * lives, and the kernel drops it if the process dies, so a process that
+ * can take the lock exclusively knows nobody else is attached. The name
+ * may be removed between our open and our lock; then the region we hold
+ * is no longer the one others will find, and we start again.
+ */
+static int open_region(const char *name, bool *creator) {
+    for (int attempt = 0; attempt < 8; attempt++) {
+        *creator = true;
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST) {
+            *creator = false;
+            fd = shm_open(name, O_RDWR, 0600);
+        }
+        if (fd < 0) {
+            if (errno == ENOENT) continue;
+            return -1;
+        }
+
+        if (flock(fd, LOCK_SH) == 0 && names_region(name, fd)) return fd;
+        close(fd);
+    }
+    return -1;
+}
+
+/* Nobody else holds the region: its creator died before publishing it */
+static bool region_abandoned(int fd) {
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) return false;
+    flock(fd, LOCK_SH);
+    return true;
+}
+
+/* Wait for the creator to size the region and publish its header
+ *
+ * A size other than ours is a build with a different layout; it is
+ * refused without mapping, since mapping past its end would fault.
+ */
+static client_table_t *attach_region(int fd, const char *name, uint64_t interval,
+                                     uint64_t tolerance, bool *abandoned) {
+    *abandoned = false;
+    client_table_t *table = NULL;
+    for (int waited = 0; ; waited++) {
+        struct stat st;
+        if (fstat(fd, &st) < 0) return NULL;
+        if (st.st_size != 0 && (size_t)st.st_size != sizeof(client_table_t)) {
+            log_write(LOG_ERROR, "Rate limiter region %s has a different layout", name);
+            return NULL;
+        }
+
+        if (st.st_size && !table) {
+            void *map = mmap(NULL, sizeof(client_table_t), PROT_READ | PROT_WRITE,
+                             MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED) return NULL;
+            table = map;
+        }
+        if (table && __atomic_load_n(&table->magic, __ATOMIC_ACQUIRE) == SHM_MAGIC) break;
+
+        if (waited >= SHM_WAIT_MS) {
+            *abandoned = region_abandoned(fd);
+            if (!*abandoned) {
+                log_write(LOG_ERROR, "Rate limiter region %s was never initialized; "
+                          "remove it with shm_unlink or rm /dev/shm%s", name, name);
+            }
+            if (table) munmap(table, sizeof(client_table_t));
+            return NULL;
+        }
+        usleep(1000);
+    }
+
+    if (table->version != SHM_VERSION || table->interval != interval ||
+        table->tolerance != tolerance) {
+        log_write(LOG_ERROR, "Rate limiter region %s has a different layout or policy", name);
+        munmap(table, sizeof(client_table_t));
+        return NULL;
+    }
+    return table;
+}
+
+/* Create or attach to a rate limiter shared between processes
+ *
+ * With a name, the table is a POSIX shared memory object that unrelated
+ * processes attach to by name; the first one to create it initializes the
+ * header. Each attached process holds a shared lock on it, and the last
+ * one to destroy its limiter removes the name, so the region outlives
+ * neither a clean shutdown nor workers that crashed before it. A region
+ * whose creator died before initializing it is removed and created anew.
+ * The limiter belongs to the process that attached it, not to children
+ * forked later. Without a name, the table is an anonymous shared mapping
+ * that is inherited by children forked after this call.
+ */
+rate_limiter_t *rate_limiter_create_shared(const rate_limit_config_t *config,
+                                           const char *name) {
+    uint64_t interval, tolerance;
+    if (!init_params(config, &interval, &tolerance))
+        return NULL;
+
+    rate_limiter_t *limiter = calloc(1, sizeof(*limiter));
+    if (!limiter) return NULL;
+
+    limiter->config = *config;
+    limiter->shared = true;
+    limiter->clock = now_usec;
+    limiter->fd = -1;
+
+    if (!name) {
+        void *map = mmap(NULL, sizeof(client_table_t), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            free(limiter);
+            return NULL;
+        }
+        limiter->table = map;
+        limiter->table->version = SHM_VERSION;
+        limiter->table->interval = interval;
+        limiter->table->tolerance = tolerance;
+        limiter->table->magic = SHM_MAGIC;
+        return limiter;
+    }
 
-    /* Initialize mutex */
-    if (pthread_mutex_init(&limiter->lock, NULL) != 0) {
-        free(limiter->clients);
+    limiter->name = strdup(name);
+    if (!limiter->name) {
         free(limiter);
         return NULL;
     }
 
+    /* An abandoned region is replaced once; a second would mean a race
+     * with another process doing the same, and it can have the name */
+    for (int attempt = 0; attempt < 2 && !limiter->table; attempt++) {
+        bool creator;
+        int fd = open_region(name, &creator);
+        if (fd < 0) {
+            log_write(LOG_ERROR, "Failed to open rate limiter region %s", name);
+            break;
+        }
+
+        if (creator) {
+            void *map = MAP_FAILED;
+            if (ftruncate(fd, sizeof(client_table_t)) == 0) {
+                map = mmap(NULL, sizeof(client_table_t), PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+            }
+            if (map == MAP_FAILED) {
+                shm_unlink(name);
+                close(fd);
+                break;
+            }
+            limiter->table = map;
+            limiter->table->version = SHM_VERSION;
+            limiter->table->interval = interval;
+            limiter->table->tolerance = tolerance;
+            __atomic_store_n(&limiter->table->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+        } else {
+            bool abandoned;
+            limiter->table = attach_region(fd, name, interval, tolerance, &abandoned);
+            if (!limiter->table) {
+                if (abandoned && names_region(name, fd)) {
+                    log_write(LOG_WARN, "Replacing abandoned rate limiter region %s", name);
+                    shm_unlink(name);
+                }
+                close(fd);
+                if (!abandoned) break;
+                continue;
+            }
+        }
+        limiter->fd = fd;
+    }
+
+    if (!limiter->table) {
+        free(limiter->name);
+        free(limiter);
+        return NULL;
+    }
     return limiter;
 }
 
-/* Find or create client entry */
-static client_track_t *get_client(rate_limiter_t *limiter, const char *ip) {
-    /* Look for existing client */
-    for (size_t i = 0; i < limiter->client_count; i++) {
-        if (strcmp(limiter->clients[i].ip, ip) == 0) {
-            return &limiter->clients[i];
+/* Find or create client slot
+ *
+ * Slots whose TAT has passed carry no state (the client is fully
+ * conforming), so they are recycled for new clients instead of being
+ * freed. Slots are never emptied, which keeps probe sequences intact.
+ * Under a concurrent insert/recycle race a client may briefly own two
+ * slots, or inherit one request charged to the previous owner; both only
+ * err by a single request.
+ */
+static client_slot_t *get_client(client_table_t *table, uint64_t key, uint64_t now) {
+    uint64_t tag = key;
+    size_t idx = slot_index(key);
+
+    for (size_t i = 0; i < MAX_PROBES; i++) {
+        client_slot_t *slot = &table->clients[(idx + i) & (MAX_CLIENTS - 1)];
+        uint64_t cur = __atomic_load_n(&slot->tag, __ATOMIC_ACQUIRE);
+
+        if (cur == tag) {
+            return slot;
+        }
+        if (cur == 0) {
+            /* Claim the free slot, unless another thread just did */
+            if (__atomic_compare_exchange_n(&slot->tag, &cur, tag, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+                cur == tag) {
+                return slot;
+            }
         }
     }
 
-    /* Add new client if space available */
-    if (limiter->client_count < MAX_CLIENTS) {
-        client_track_t *client = &limiter->clients[limiter->client_count++];
-        strncpy(client->ip, ip, sizeof(client->ip) - 1);
-        client->requests = calloc(limiter->config.burst_size, sizeof(time_t));
-        client->window_start = time(NULL);
-        return client;
+    /* Not found and no free slot: recycle one whose TAT has passed */
+    for (size_t i = 0; i < MAX_PROBES; i++) {
+        client_slot_t *slot = &table->clients[(idx + i) & (MAX_CLIENTS - 1)];
+        uint64_t cur = __atomic_load_n(&slot->tag, __ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&slot->tat, __ATOMIC_ACQUIRE) <= now &&
+            __atomic_compare_exchange_n(&slot->tag, &cur, tag, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return slot;
+        }
     }
 
     return NULL;
 }
 
-/* Check if request should be allowed */
-bool rate_limiter_check(rate_limiter_t *limiter, const char *ip) {
-    bool allowed = true;
-    time_t now = time(NULL);
+/* Outcome of a single check */
+typedef enum {
+    CHECK_ALLOWED,
+    CHECK_EXCEEDED,
+    CHECK_TABLE_FULL
+} check_result_t;
 
-    pthread_mutex_lock(&limiter->lock);
+/* Charge cost units to a client key
+ *
+ * Weighted GCRA: a charge of n units is conforming if the client's TAT,
+ * advanced by n emission intervals, stays within one interval plus the
+ * burst tolerance of now (for n == 1 this is the classic test). A forced
+ * charge always advances the TAT, for costs that are only known after
+ * the fact, such as bytes already sent; the client then stays over its
+ * limit until the debt is repaid.
+ */
+static check_result_t check_key(rate_limiter_t *limiter, uint64_t key,
+                                uint32_t cost, bool force, uint64_t *delay) {
+    uint64_t now = limiter->clock(limiter->clock_ctx);
+    client_table_t *table = limiter->table;
 
-    client_track_t *client = get_client(limiter, ip);
+    client_slot_t *client = get_client(table, key, now);
     if (!client) {
-        pthread_mutex_unlock(&limiter->lock);
-        return false;
+        __atomic_add_fetch(&limiter->table_full, 1, __ATOMIC_RELAXED);
+        return CHECK_TABLE_FULL;
     }
 
-    /* Check if client is blocked, but allow localhost (127.0.0.1) for testing */
-    if (client->blocked && strcmp(ip, "127.0.0.1") != 0) {
-        /* Check if block period has expired (10 second timeout) 
-         * This allows clients to resume normal access after a short penalty period
-         */
-        if (now - client->window_start >= 10) {
-            client->blocked = false;
-            client->count = 0;
-            client->window_start = now;
-        } else {
-            pthread_mutex_unlock(&limiter->lock);
-            return false;
+    uint64_t charge = (uint64_t)cost * table->interval;
+    uint64_t old = __atomic_load_n(&client->tat, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint64_t tat = old > now ? old : now;
+        if (!force && tat + charge - now > table->tolerance + table->interval) {
+            return CHECK_EXCEEDED;
+        }
+        if (__atomic_compare_exchange_n(&client->tat, &old, tat + charge,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            /* Time until the charged units would have conformed */
+            if (delay) {
+                uint64_t ahead = tat + charge - now;
+                uint64_t allowed = table->tolerance + table->interval;
+                *delay = ahead > allowed ? ahead - allowed : 0;
+            }
+            return CHECK_ALLOWED;
         }
     }
+}
 
-    /* Reset window if needed */
-    if (now - client->window_start >= limiter->config.window_seconds) {
-        client->count = 0;
-        client->window_start = now;
+/* Log a rejected check */
+static void log_rejection(check_result_t result, const char *ip) {
+    if (result == CHECK_TABLE_FULL) {
+        log_write(LOG_WARN, "Rate limiter table full, rejecting IP: %s", ip);
+    } else if (result == CHECK_EXCEEDED) {
+        log_write(LOG_WARN, "Rate limit exceeded for IP: %s", ip);
     }
+}
 
-    /* For testing purposes, always allow localhost */
-    if (strcmp(ip, "127.0.0.1") == 0) {
-        client->requests[client->count++] = now;
+/* Check if request should be allowed */
+bool rate_limiter_check(rate_limiter_t *limiter, const char *ip) {
+    if (!limiter || !ip) return false;
+
+    check_result_t result = check_key(limiter, client_key(ip), 1, false, NULL);
+    log_rejection(result, ip);
+    return result == CHECK_ALLOWED;
+}
+
+/* Check by binary address, avoiding string formatting on the hot path */
+bool rate_limiter_check_addr(rate_limiter_t *limiter, const struct in_addr *addr) {
+    return rate_limiter_check_cost(limiter, addr, 1);
+}
+
+/* Charge a weighted request if it conforms (cost 0 only tests the client) */
+bool rate_limiter_check_cost(rate_limiter_t *limiter, const struct in_addr *addr,
+                             uint32_t cost) {
+    if (!limiter || !addr) return false;
+
+    check_result_t result = check_key(limiter, addr_key(addr), cost, false, NULL);
+    if (result != CHECK_ALLOWED) {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, addr, ip, sizeof(ip));
+        log_rejection(result, ip);
     }
-    /* Check rate limit for other IPs */
-    else if (client->count >= limiter->config.requests_per_second) {
-        allowed = false;
-        client->blocked = true;
-        log_write(LOG_WARN, "Rate limit exceeded for IP: %s", ip);
-    } else {
-        client->requests[client->count++] = now;
+    return result == CHECK_ALLOWED;
+}
+
+/* Charge cost already incurred, even if it puts the client over its limit */
+void rate_limiter_charge(rate_limiter_t *limiter, const struct in_addr *addr,
+                         uint32_t cost) {
+    if (limiter && addr && cost) {
+        check_key(limiter, addr_key(addr), cost, true, NULL);
+    }
+}
+
+/* Charge cost and return how long to wait (usec) before using it, for
+ * pacing a sender to the configured rate */
+uint64_t rate_limiter_reserve(rate_limiter_t *limiter, const struct in_addr *addr,
+                              uint32_t cost) {
+    uint64_t delay = 0;
+    if (limiter && addr && cost) {
+        check_key(limiter, addr_key(addr), cost, true, &delay);
     }
+    return delay;
+}
+
+/* Replace the clock, e.g. with simulated time (NULL restores the default) */
+void rate_limiter_set_clock(rate_limiter_t *limiter, rate_limiter_clock_t clock, void *ctx) {
+    if (!limiter) return;
+    limiter->clock = clock ? clock : now_usec;
+    limiter->clock_ctx = clock ? ctx : NULL;
+}
+
+/* Memory held by the limiter, including its client table */
+size_t rate_limiter_footprint(const rate_limiter_t *limiter) {
+    return limiter ? sizeof(*limiter) + sizeof(client_table_t) : 0;
+}
 
-    pthread_mutex_unlock(&limiter->lock);
-    return allowed;
+/* Checks rejected because every candidate slot was in use */
+uint64_t rate_limiter_table_full(const rate_limiter_t *limiter) {
+    return limiter ? __atomic_load_n(&limiter->table_full, __ATOMIC_RELAXED) : 0;
 }
 
 /* Clean up rate limiter */
 void rate_limiter_destroy(rate_limiter_t *limiter) {
     if (!limiter) return;
 
-    pthread_mutex_lock(&limiter->lock);
-
-    /* Free client request arrays */
-    for (size_t i = 0; i < limiter->client_count; i++) {
-        free(limiter->clients[i].requests);
+    if (limiter->shared) {
+        /* The last process attached by name removes the region */
+        if (limiter->fd >= 0) {
+            if (flock(limiter->fd, LOCK_EX | LOCK_NB) == 0) shm_unlink(limiter->name);
+            close(limiter->fd);
+        }
+        free(limiter->name);
+        munmap(limiter->table, sizeof(client_table_t));
+    } else {
+        free(limiter->table);
     }
-
-    free(limiter->clients);
-
-    pthread_mutex_unlock(&limiter->lock);
-    pthread_mutex_destroy(&limiter->lock);
-
     free(limiter);
 }
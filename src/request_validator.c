@@ -1,59 +1,217 @@
 #include "request_validator.h"
 #include <string.h>
-#include <ctype.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-/* Known dangerous patterns */
-static const char *dangerous_patterns[] = {
-    "..", "//", "\\", "%2e", "%2f",
-    "<?", "<%", "<script", "eval(",
-    NULL
+/* Byte classes of a raw request path */
+enum {
+    BYTE_BAD,       /* Never valid unencoded */
+    BYTE_PLAIN,     /* Part of a segment name */
+    BYTE_DOT,       /* Part of a name, or a "." or ".." segment */
+    BYTE_SLASH,     /* Ends a segment */
+    BYTE_PERCENT,   /* Starts an encoded byte */
+    BYTE_END        /* Ends the path: '?' or NUL */
 };
 
-/* Allowed file extensions */
-static const char *allowed_extensions[] = {
-    ".html", ".css", ".js", ".txt", ".ico",
-    NULL
+#define X BYTE_BAD
+#define P BYTE_PLAIN
+#define D BYTE_DOT
+#define S BYTE_SLASH
+#define C BYTE_PERCENT
+#define E BYTE_END
+
+/* RFC 3986 path characters: unreserved, sub-delims, ':' and '@' */
+static const unsigned char byte_class[256] = {
+    E, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* 00 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* 10 */
+    X, P, X, X, P, C, P, P, P, P, P, P, P, P, D, S,  /* 20 */
+    P, P, P, P, P, P, P, P, P, P, P, P, X, P, X, E,  /* 30 */
+    P, P, P, P, P, P, P, P, P, P, P, P, P, P, P, P,  /* 40 */
+    P, P, P, P, P, P, P, P, P, P, P, X, X, X, X, P,  /* 50 */
+    X, P, P, P, P, P, P, P, P, P, P, P, P, P, P, P,  /* 60 */
+    P, P, P, P, P, P, P, P, P, P, P, X, X, X, P, X,  /* 70 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* 80 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* 90 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* a0 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* b0 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* c0 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* d0 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  /* e0 */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X   /* f0 */
 };
 
-/* Check if file extension is allowed */
-static bool is_extension_allowed(const char *path) {
-    const char *ext = strrchr(path, '.');
-    if (!ext) return false;
+#undef X
+#undef P
+#undef D
+#undef S
+#undef C
+#undef E
 
-    for (const char **allowed = allowed_extensions; *allowed; allowed++) {
-        if (strcasecmp(ext, *allowed) == 0) {
-            return true;
-        }
-    }
-    return false;
+static int hex_value(unsigned char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
 }
 
-/* Validate path */
-bool is_path_safe(const char *path) {
-    /* Check for NULL or empty path */
-    if (!path || !*path) return false;
+/* Length of the leading run of letters, digits, '-' and '_', which need
+ * nothing but copying; most paths are mostly such runs */
+static size_t plain_run(const unsigned char *p, size_t len) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i a = _mm_set1_epi8('a'), letters = _mm_set1_epi8(25);
+    const __m128i zero = _mm_set1_epi8('0'), digits = _mm_set1_epi8(9);
+    const __m128i dash = _mm_set1_epi8('-'), underscore = _mm_set1_epi8('_');
 
-    /* Check path length */
-    if (strlen(path) > 255) return false;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
 
-    /* Check for dangerous patterns */
-    for (const char **pattern = dangerous_patterns; *pattern; pattern++) {
-        if (strstr(path, *pattern)) return false;
+        /* x in [lo, lo + n] exactly when min(x - lo, n) == x - lo, unsigned */
+        __m128i l = _mm_sub_epi8(_mm_or_si128(v, case_bit), a);
+        __m128i d = _mm_sub_epi8(v, zero);
+        __m128i ok = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(l, letters), l),
+                                  _mm_cmpeq_epi8(_mm_min_epu8(d, digits), d));
+        ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(v, dash),
+                                           _mm_cmpeq_epi8(v, underscore)));
+
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(ok);
+        if (mask != 0xffff) return i + (size_t)__builtin_ctz(~mask);
+    }
+#endif
+    for (; i < len; i++) {
+        unsigned char c = p[i];
+        unsigned char l = c | 0x20;
+        if (!((l >= 'a' && l <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_'))
+            break;
     }
+    return i;
+}
 
-    /* Check characters */
-    for (const char *p = path; *p; p++) {
-        if (!isalnum(*p) && !strchr("/-_.", *p)) {
-            return false;
+/* Decode and normalize a request path in one pass
+ *
+ * Reads up to len bytes of target, stopping early at a '?' or NUL. Each
+ * byte is classified by table: plain runs are copied (16 at a time with
+ * SSE2), %XX is decoded, empty and "." segments are dropped and ".."
+ * removes the previous segment. Fails on a disallowed or badly encoded
+ * byte, a decoded '/', '\\' or control character, a ".." above the root,
+ * or a result too long or deep. Traversal is then impossible lexically;
+ * symbolic links are the filesystem check's concern.
+ */
+bool normalize_path(const char *target, size_t len, normalized_path_t *out) {
+    if (!target || !out || len == 0 || target[0] != '/') return false;
+
+    const unsigned char *p = (const unsigned char *)target;
+    char *path = out->path;
+    size_t starts[MAX_PATH_DEPTH];  /* Where each directory's name begins */
+    size_t depth = 0;
+    size_t o = 1;                   /* Output length; path[0] is the root */
+    size_t i = 1;
+    path[0] = '/';
+
+    for (;;) {
+        /* One segment, up to a slash or the end */
+        size_t begin = o, last_dot = 0;
+        bool dots_only = true;
+        unsigned char cls = BYTE_END;
+
+        while (i < len) {
+            size_t run = plain_run(p + i, len - i);
+            if (run) {
+                if (o + run > MAX_PATH_LENGTH) return false;
+                memcpy(path + o, p + i, run);
+                o += run;
+                i += run;
+                dots_only = false;
+                if (i == len) break;
+            }
+
+            unsigned char c = p[i];
+            cls = byte_class[c];
+            if (cls == BYTE_SLASH || cls == BYTE_END) break;
+            if (cls == BYTE_BAD) return false;
+
+            if (cls == BYTE_PERCENT) {
+                int hi = i + 2 < len ? hex_value(p[i + 1]) : -1;
+                int lo = hi >= 0 ? hex_value(p[i + 2]) : -1;
+                if (lo < 0) return false;
+                c = (unsigned char)(hi << 4 | lo);
+                if (c < 0x20 || c == 0x7f || c == '/' || c == '\\') return false;
+                i += 3;
+            } else {
+                i++;
+            }
+
+            if (o >= MAX_PATH_LENGTH) return false;
+            if (c == '.') {
+                last_dot = o;
+            } else {
+                dots_only = false;
+            }
+            path[o++] = (char)c;
+        }
+        if (i >= len) cls = BYTE_END;
+
+        /* Empty, "." and ".." segments leave no trace */
+        size_t seg_len = o - begin;
+        bool dir = true;
+        if (dots_only && seg_len == 2) {
+            if (depth == 0) return false;
+            o = starts[--depth];
+        } else if (dots_only && seg_len <= 1) {
+            o = begin;
+        } else if (cls == BYTE_SLASH) {
+            if (depth == MAX_PATH_DEPTH || o >= MAX_PATH_LENGTH) return false;
+            starts[depth++] = begin;
+            path[o++] = '/';
+        } else {
+            /* The final segment names a file */
+            dir = false;
+            out->extension = last_dot;
+        }
+
+        if (cls == BYTE_SLASH) {
+            i++;
+            continue;
         }
+
+        if (dir) out->extension = 0;
+        out->directory = dir;
+        out->length = o;
+        path[o] = '\0';
+        return true;
     }
+}
 
-    return is_extension_allowed(path);
+/* Validate path (without the query)
+ *
+ * Safe means it decodes and normalizes without escaping the root.
+ */
+bool is_path_safe(const char *path) {
+    normalized_path_t normalized;
+    return path && normalize_path(path, strlen(path), &normalized);
+}
+
+/* Validate query string (after the '?'); a missing query is fine
+ *
+ * Clients percent-encode anything unusual, so raw control characters,
+ * spaces, non-ASCII bytes, quotes, angle brackets and backslashes only
+ * turn up in hand-crafted requests.
+ */
+bool is_query_safe(const char *query) {
+    if (!query) return true;
+
+    for (const unsigned char *p = (const unsigned char *)query; *p; p++) {
+        if (*p <= ' ' || *p >= 0x7f || strchr("\"<>\\", *p))
+            return false;
+    }
+    return true;
 }
 
 /* Check if method is allowed */
 bool is_method_allowed(http_method_t method) {
-    return method == HTTP_GET || method == HTTP_HEAD;
+    return method == HTTP_GET || method == HTTP_HEAD || method == HTTP_POST;
 }
 
 /* Validate entire request */
@@ -67,14 +225,20 @@ validation_result_t validate_request(const http_request_t *request) {
         return result;
     }
 
-    /* Check path */
-    if (!is_path_safe(request->path)) {
+    /* Check path, which ends at the query */
+    normalized_path_t path;
+    if (!normalize_path(request->path, strlen(request->path), &path)) {
         result.valid = false;
         result.error = "Invalid path";
         return result;
     }
 
-    /* Add more validation as needed */
+    const char *query = strchr(request->path, '?');
+    if (query && !is_query_safe(query + 1)) {
+        result.valid = false;
+        result.error = "Invalid query";
+        return result;
+    }
 
     return result;
-}
\ No newline at end of file
+}
@@ -1,25 +1,36 @@
 #include "security.h"
 #include "logger.h"
+#include "pattern_set.h"
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+
+/* Pattern groups */
+enum {
+    GROUP_SQL,
+    GROUP_XSS
+};
 
 /* Security context structure */
 struct security_ctx {
     security_config_t config;
     size_t request_count;
+    pattern_set_t *patterns;    /* SQL and XSS patterns, one automaton */
 };
 
-/* SQL injection patterns */
+/* Largest scan form of one input byte: a held escape let go, then the
+ * byte, each with the space before it */
+#define DECODED_MAX 6
+
+/* SQL injection patterns, matched as whole words */
 static const char *sql_patterns[] = {
-    "SELECT",
-    "INSERT",
-    "UPDATE",
-    "DELETE",
-    "DROP",
-    "UNION",
-    "OR 1=1",
-    "--",
+    "union select",
+    "union all select",
+    "insert into",
+    "delete from",
+    "drop table",
+    "or 1=1",
+    "' or '",
+    "'--",
     NULL
 };
 
@@ -33,58 +44,216 @@ static const char *xss_patterns[] = {
     NULL
 };
 
-/* Check for dangerous patterns */
-static bool contains_pattern(const char *str, const char *patterns[]) {
-    if (!str) return false;
-    
-    char *tmp = strdup(str);
-    if (!tmp) return false;
-    
-    /* Convert to uppercase for case-insensitive comparison */
-    for (char *p = tmp; *p; p++) {
-        *p = toupper(*p);
+static bool is_word(unsigned char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           c == '_' || c >= 0x80;
+}
+
+static int hex_value(unsigned char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Append a byte in scan form, returning the bytes written
+ *
+ * Scanned text is a run of tokens, each a word or a single punctuation
+ * byte, with one space before every token and whitespace collapsed into
+ * it. Patterns get the same form, so " union select " cannot match inside
+ * "reunion selection", and "--" inside "2024--01" is "- -", not "' - -".
+ */
+static size_t put_token_byte(security_body_t *body, unsigned char c, char *out) {
+    if (c <= ' ' || c == 0x7f) {
+        body->gap = true;
+        return 0;
     }
-    
-    bool found = false;
-    for (const char **pattern = patterns; *pattern; pattern++) {
-        char *upper_pattern = strdup(*pattern);
-        if (!upper_pattern) {
-            free(tmp);
-            return false;
+
+    size_t n = 0;
+    bool word = is_word(c);
+    if (!word || !body->word || body->gap) out[n++] = ' ';
+    out[n++] = (char)c;
+    body->word = word;
+    body->gap = false;
+    return n;
+}
+
+/* An escape cut short stands for itself */
+static size_t put_held_escape(security_body_t *body, char *out) {
+    size_t n = 0;
+    if (body->escape) n += put_token_byte(body, '%', out);
+    if (body->escape == 2) n += put_token_byte(body, (unsigned char)body->held, out + n);
+    body->escape = 0;
+    return n;
+}
+
+/* Decode one byte of a query or form body into scan form */
+static size_t decode_byte(security_body_t *body, unsigned char c, char *out) {
+    if (body->escape) {
+        int value = hex_value(c);
+        if (value >= 0 && body->escape == 1) {
+            body->held = (char)c;
+            body->escape = 2;
+            return 0;
         }
-        
-        for (char *p = upper_pattern; *p; p++) {
-            *p = toupper(*p);
+        if (value >= 0) {
+            body->escape = 0;
+            return put_token_byte(body,
+                                  (unsigned char)(hex_value((unsigned char)body->held) << 4 | value),
+                                  out);
         }
-        
-        if (strstr(tmp, upper_pattern)) {
-            found = true;
-            free(upper_pattern);
-            break;
+    }
+
+    size_t n = put_held_escape(body, out);
+    if (c == '%') {
+        body->escape = 1;
+        return n;
+    }
+    return n + put_token_byte(body, c == '+' ? ' ' : c, out + n);
+}
+
+/* Decode and scan the next piece of input, returning the groups found */
+static uint32_t scan_decoded(const security_ctx_t *ctx, security_body_t *body,
+                             const unsigned char *data, size_t len) {
+    char out[1024];
+    size_t n = 0;
+    uint32_t found = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        n += decode_byte(body, data[i], out + n);
+        if (n > sizeof(out) - DECODED_MAX) {
+            found |= pattern_set_feed(ctx->patterns, &body->state, out, n);
+            n = 0;
         }
-        free(upper_pattern);
     }
-    
-    free(tmp);
+    if (n) found |= pattern_set_feed(ctx->patterns, &body->state, out, n);
     return found;
 }
 
+/* Scan whatever the input ended on, and the word boundary at its end */
+static uint32_t scan_end(const security_ctx_t *ctx, security_body_t *body) {
+    char out[DECODED_MAX];
+    size_t n = put_held_escape(body, out);
+    out[n++] = ' ';
+    return pattern_set_feed(ctx->patterns, &body->state, out, n);
+}
+
+/* Add a pattern in scan form */
+static bool add_pattern(pattern_set_t *set, const char *pattern, unsigned int group) {
+    char form[2 * SECURITY_RULE_LEN + 2];
+    size_t len = strlen(pattern);
+    if (len >= SECURITY_RULE_LEN) return false;
+
+    security_body_t scan;
+    security_body_begin(&scan);
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        n += put_token_byte(&scan, (unsigned char)pattern[i], form + n);
+    }
+    form[n++] = ' ';
+    form[n] = '\0';
+    return pattern_set_add(set, form, group);
+}
+
+/* Compile the built-in and configured patterns into one scanner */
+static pattern_set_t *build_patterns(const security_config_t *config) {
+    pattern_set_t *set = pattern_set_create();
+    if (!set) return NULL;
+
+    bool ok = true;
+    for (const char **pattern = sql_patterns; *pattern; pattern++) {
+        ok = ok && add_pattern(set, *pattern, GROUP_SQL);
+    }
+    for (const char **pattern = xss_patterns; *pattern; pattern++) {
+        ok = ok && add_pattern(set, *pattern, GROUP_XSS);
+    }
+    for (size_t i = 0; i < config->rule_count && i < SECURITY_MAX_RULES; i++) {
+        const security_rule_t *rule = &config->rules[i];
+        ok = ok && add_pattern(set, rule->pattern,
+                               rule->kind == SECURITY_RULE_SQL ? GROUP_SQL : GROUP_XSS);
+    }
+
+    if (!ok || !pattern_set_compile(set)) {
+        pattern_set_destroy(set);
+        return NULL;
+    }
+    return set;
+}
+
 /* Create security context */
 security_ctx_t *security_create(const security_config_t *config) {
     if (!config) return NULL;
     
     security_ctx_t *ctx = calloc(1, sizeof(*ctx));
-    if (ctx) {
-        ctx->config = *config;
+    if (!ctx) return NULL;
+
+    ctx->config = *config;
+    ctx->patterns = build_patterns(config);
+    if (!ctx->patterns) {
+        free(ctx);
+        return NULL;
     }
     return ctx;
 }
 
 /* Clean up security context */
 void security_destroy(security_ctx_t *ctx) {
+    if (!ctx) return;
+    pattern_set_destroy(ctx->patterns);
     free(ctx);
 }
 
+/* Reject on a pattern group the configuration cares about */
+static bool patterns_allowed(const security_ctx_t *ctx, uint32_t found, const char *ip) {
+    /* Check for SQL injection */
+    if (found & (1u << GROUP_SQL)) {
+        log_write(LOG_WARN, "SQL injection attempt from IP: %s", ip);
+        return false;
+    }
+    
+    /* Check for XSS */
+    if (ctx->config.enable_xss_protection && (found & (1u << GROUP_XSS))) {
+        log_write(LOG_WARN, "XSS attempt from IP: %s", ip);
+        return false;
+    }
+    return true;
+}
+
+/* Start inspecting a new body */
+void security_body_begin(security_body_t *body) {
+    if (body) memset(body, 0, sizeof(*body));
+}
+
+/* Inspect the next chunk of a body
+ *
+ * Returns false as soon as the body is over max_request_size or a
+ * pattern has matched, including one split across earlier chunks; the
+ * request should then be rejected without reading the rest.
+ */
+bool security_body_feed(security_ctx_t *ctx, security_body_t *body,
+                        const char *ip, const void *data, size_t len) {
+    if (!ctx || !body || !ip || (!data && len)) return false;
+
+    /* Check request size before spending time on the chunk */
+    body->length += len;
+    if (body->length > ctx->config.limits.max_request_size) {
+        log_write(LOG_WARN, "Request too large from IP: %s", ip);
+        return false;
+    }
+
+    if (len) body->found |= scan_decoded(ctx, body, data, len);
+    return patterns_allowed(ctx, body->found, ip);
+}
+
+/* Finish a body once all of it has been fed; a pattern ending the body
+ * is only complete at its end */
+bool security_body_end(security_ctx_t *ctx, security_body_t *body, const char *ip) {
+    if (!ctx || !body || !ip) return false;
+
+    body->found |= scan_end(ctx, body);
+    return patterns_allowed(ctx, body->found, ip);
+}
+
 /* Check if request is allowed */
 bool security_check_request(security_ctx_t *ctx,
                           const char *ip,
@@ -103,26 +272,25 @@ bool security_check_request(security_ctx_t *ctx,
         }
     }
     
-    /* Check for SQL injection */
-    if (contains_pattern(query, sql_patterns) ||
-        contains_pattern(body, sql_patterns)) {
-        log_write(LOG_WARN, "SQL injection attempt from IP: %s", ip);
-        return false;
+    /* One pass over the decoded query finds both kinds of pattern */
+    if (query) {
+        security_body_t scan;
+        security_body_begin(&scan);
+        uint32_t found = scan_decoded(ctx, &scan, (const unsigned char *)query, strlen(query));
+        found |= scan_end(ctx, &scan);
+        if (!patterns_allowed(ctx, found, ip)) return false;
     }
-    
-    /* Check for XSS */
-    if (ctx->config.enable_xss_protection &&
-        (contains_pattern(query, xss_patterns) ||
-         contains_pattern(body, xss_patterns))) {
-        log_write(LOG_WARN, "XSS attempt from IP: %s", ip);
-        return false;
-    }
-    
+
     /* Check request size */
     if (body_length > ctx->config.limits.max_request_size) {
         log_write(LOG_WARN, "Request too large from IP: %s", ip);
         return false;
     }
-    
-    return true;
-} 
\ No newline at end of file
+
+    /* A body already in hand is inspected as a single chunk */
+    if (!body) return true;
+    security_body_t inspection;
+    security_body_begin(&inspection);
+    return security_body_feed(ctx, &inspection, ip, body, body_length) &&
+           security_body_end(ctx, &inspection, ip);
+}
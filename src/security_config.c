@@ -1,4 +1,5 @@
 #include "security_config.h"
+#include "logger.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,6 +46,9 @@ void security_config_set_defaults(security_config_t *config) {
     strncpy(config->csp_policy, 
             "default-src 'self'; script-src 'self'; style-src 'self'; img-src 'self'",
             sizeof(config->csp_policy) - 1);
+
+    /* Only the built-in injection patterns */
+    config->rule_count = 0;
 }
 
 /* Create security configuration */
@@ -56,7 +60,12 @@ security_config_t *security_config_create(void) {
     return config;
 }
 
-/* Load configuration from file */
+/* Load configuration from file
+ *
+ * An injection pattern that cannot be kept (empty, too long, or past
+ * SECURITY_MAX_RULES) fails the load, so a configured protection is
+ * never silently missing.
+ */
 bool security_config_load(security_config_t *config, const char *filename) {
     if (!config || !filename) return false;
 
@@ -68,8 +77,33 @@ bool security_config_load(security_config_t *config, const char *filename) {
 
     char line[1024];
     char key[64], value[960];
+    unsigned int line_no = 0;
+    bool ok = true;
+
+    while (ok && fgets(line, sizeof(line), f)) {
+        line_no++;
+
+        /* Patterns may contain spaces, so they take the rest of the line */
+        if (strncmp(line, "sql_pattern=", 12) == 0 || strncmp(line, "xss_pattern=", 12) == 0) {
+            const char *pattern = line + 12;
+            size_t len = strcspn(pattern, "\r\n");
+            if (len == 0 || len >= SECURITY_RULE_LEN) {
+                LOG_ERROR("%s:%u: pattern must be 1 to %d bytes", filename, line_no,
+                          SECURITY_RULE_LEN - 1);
+                ok = false;
+            } else if (config->rule_count >= SECURITY_MAX_RULES) {
+                LOG_ERROR("%s:%u: more than %d patterns", filename, line_no,
+                          SECURITY_MAX_RULES);
+                ok = false;
+            } else {
+                security_rule_t *rule = &config->rules[config->rule_count++];
+                rule->kind = line[0] == 's' ? SECURITY_RULE_SQL : SECURITY_RULE_XSS;
+                memcpy(rule->pattern, pattern, len);
+                rule->pattern[len] = '\0';
+            }
+            continue;
+        }
 
-    while (fgets(line, sizeof(line), f)) {
         if (sscanf(line, "%63[^=]=%959s", key, value) == 2) {
             if (strcmp(key, "security_level") == 0) {
                 if (strcmp(value, "low") == 0)
@@ -131,7 +165,7 @@ bool security_config_load(security_config_t *config, const char *filename) {
     }
 
     fclose(f);
-    return true;
+    return ok;
 }
 
 /* Save configuration to file */
@@ -174,6 +208,12 @@ bool security_config_save(const security_config_t *config, const char *filename)
     fprintf(f, "enable_csp=%d\n", config->enable_csp);
     fprintf(f, "csp_policy=%s\n", config->csp_policy);
 
+    for (size_t i = 0; i < config->rule_count; i++) {
+        fprintf(f, "%s_pattern=%s\n",
+                config->rules[i].kind == SECURITY_RULE_SQL ? "sql" : "xss",
+                config->rules[i].pattern);
+    }
+
     fclose(f);
     return true;
 }
@@ -1,7 +1,21 @@
 #include "server.h"
 #include "http.h"
 #include "rate_limiter.h"
+#include "admission.h"
+#include "concurrency_limiter.h"
+#include "shaper.h"
+#include "logger.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "heavy_hitters.h"
+#include "trace.h"
+#include "probes.h"
+#include "request_validator.h"
+#include "security.h"
+#include "negative_cache.h"
+#include "asset_pack.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <string.h>
 #include <strings.h>
@@ -12,24 +26,48 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <limits.h>
+#include <poll.h>
 
-/**
- * Get formatted timestamp for logging purposes
- * 
- * Returns a string representation of the current time in YYYY-MM-DD HH:MM:SS format
- */
-static char* get_timestamp(void) {
-    static char buffer[32];
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", tm_info);
-    return buffer;
-}
+#define MAX_ROUTE_COSTS 16
+#define DEFAULT_HALF_LIFE 60    /* Heavy hitter decay, seconds */
+#define DEFAULT_NEGATIVE_TTL 10 /* Refused paths remembered, seconds */
+#define REQUEST_BUFFER 4096     /* Request head, read in one go */
+#define DEFAULT_MAX_REQUEST_SIZE (1024 * 1024)  /* Request body limit, bytes */
+#define INVALID_PATH_KEY "(invalid)"   /* Heavy hitter key for unnormalized targets */
+#define ALL_METHODS ((1u << HTTP_GET) | (1u << HTTP_HEAD) | (1u << HTTP_POST))
+#define DEFAULT_BODY_TIMEOUT 30  /* Seconds for a whole request body to arrive */
+/* Checks run unless request_checks says otherwise; the pattern scan is
+ * opt-in, its rules being too crude to impose on every site */
+#define DEFAULT_CHECKS (((1u << METRIC_CHECK_COUNT) - 1) & ~(1u << METRIC_CHECK_PATTERNS))
+
+/* Raised by a tracer attached to the matching USDT probe */
+ZIRCON_PROBE_SEMAPHORE(accept);
+ZIRCON_PROBE_SEMAPHORE(admission);
+ZIRCON_PROBE_SEMAPHORE(request_parsed);
+ZIRCON_PROBE_SEMAPHORE(file_opened);
+ZIRCON_PROBE_SEMAPHORE(response_sent);
+ZIRCON_PROBE_SEMAPHORE(connection_closed);
+
+/* Heavy hitter trackers, by key and weight */
+enum {
+    TOP_CLIENT_REQUESTS,
+    TOP_CLIENT_BYTES,
+    TOP_PATH_REQUESTS,
+    TOP_PATH_BYTES,
+    TOP_COUNT
+};
+
+/* Request cost class for a path prefix */
+typedef struct {
+    char prefix[64];
+    uint32_t cost;
+} route_cost_t;
 
 /* Server context structure */
 struct server {
@@ -37,93 +75,82 @@ struct server {
     server_config_t config;
     bool running;
     rate_limiter_t *rate_limiter;
+    admission_t *admission;
+    concurrency_limiter_t *concurrency;     /* NULL when disabled */
+    rate_limiter_t *bandwidth;              /* KiB sent, NULL when unlimited */
+    shaper_t *shaper;                       /* NULL when egress is unshaped */
+    route_cost_t route_costs[MAX_ROUTE_COSTS];
+    size_t route_cost_count;
+    heavy_hitters_t *top[TOP_COUNT];        /* NULL when disabled */
+    security_ctx_t *security;               /* NULL without the patterns check */
+    negative_cache_t *negatives;            /* NULL when disabled */
+    asset_pack_t *pack;                     /* NULL when serving from www */
+    uint32_t checks;                        /* Bit per metrics_check_t that runs */
+    uint32_t methods;                       /* Bit per http_method_t served */
+    size_t max_request_size;                /* Largest body accepted */
+    uint32_t body_timeout;                  /* Seconds for a scanned body to arrive */
 };
 
-/* Check if path contains traversal attempts */
-static bool has_path_traversal(const char *path) {
-    if (!path) return true;
+/* Web root resolved once; empty if it did not exist yet */
+static char root_path[PATH_MAX];
+static pthread_once_t root_once = PTHREAD_ONCE_INIT;
 
-    /* Check for basic traversal patterns */
-    if (strstr(path, "..") || strstr(path, "//") || strstr(path, "\\"))
-        return true;
+static void resolve_root(void) {
+    if (!realpath("www", root_path)) root_path[0] = '\0';
+}
 
-    /* Check for URL-encoded traversal */
-    const char *encoded_traversal[] = {
-        "%2e%2e", "%2E%2E",  /* .. */
-        "%2f",    "%2F",     /* / */
-        "%5c",    "%5C",     /* \ */
-        NULL
-    };
+/* Check whether a resolved path lies inside the web root */
+static bool is_under_root(const char *resolved) {
+    pthread_once(&root_once, resolve_root);
 
-    for (const char **pattern = encoded_traversal; *pattern; pattern++) {
-        if (strstr(path, *pattern))
-            return true;
-    }
+    char buf[PATH_MAX];
+    const char *root = root_path[0] ? root_path : realpath("www", buf);
+    if (!root) return false;
 
-    /* Must start with / */
-    if (path[0] != '/') {
-        return true;
-    }
+    size_t len = strlen(root);
+    return strncmp(resolved, root, len) == 0 &&
+           (resolved[len] == '/' || resolved[len] == '\0');
+}
 
-    /* Get absolute paths */
-    char www_path[PATH_MAX];
-    char requested_path[PATH_MAX];
-    char *www_real = realpath("www", www_path);
-    if (!www_real) return true;
+/* Check if path resolves outside the web root
+ *
+ * Paths arrive normalized, with no dot segments left to climb out with;
+ * this is the authoritative test, on the path as the filesystem resolves
+ * it, symbolic links included.
+ */
+static bool has_path_traversal(const char *path) {
+    /* Must start with / */
+    if (!path || path[0] != '/') return true;
 
     /* Build full requested path */
+    char requested_path[PATH_MAX];
+    char resolved[PATH_MAX];
     snprintf(requested_path, sizeof(requested_path), "www%s", path);
-    char *req_real = realpath(requested_path, NULL);
-    
+
     /* If path doesn't exist, check if it would be under www */
-    if (!req_real) {
+    if (!realpath(requested_path, resolved)) {
         char *last_slash = strrchr(requested_path, '/');
-        if (last_slash) {
-            *last_slash = '\0';
-            req_real = realpath(requested_path, NULL);
-            if (!req_real) return true;
-            
-            /* Check if parent directory is under www */
-            if (strncmp(req_real, www_path, strlen(www_path)) != 0) {
-                free(req_real);
-                return true;
-            }
-            free(req_real);
-            return false;
-        }
-        return true;
+        if (!last_slash) return true;
+        *last_slash = '\0';
+        if (!realpath(requested_path, resolved)) return true;
     }
 
-    /* Check if path is under www directory */
-    bool result = (strncmp(req_real, www_path, strlen(www_path)) == 0);
-    free(req_real);
-    return !result;
+    return !is_under_root(resolved);
 }
 
-/* Check if file type is allowed */
-static bool is_allowed_file_type(const char *path) {
-    /* Allow root path */
-    if (strcmp(path, "/") == 0) {
-        return true;
-    }
-
-    /* Get file extension */
-    const char *ext = strrchr(path, '.');
-    if (!ext) {
-        /* No extension - only allow if it's a directory */
-        struct stat st;
-        char fullpath[PATH_MAX] = "www";
-        strncat(fullpath, path, sizeof(fullpath) - 4);
-        if (stat(fullpath, &st) == 0 && S_ISDIR(st.st_mode)) {
-            /* For directories, require trailing slash */
-            size_t len = strlen(path);
-            return len > 0 && path[len-1] == '/';
-        }
-        return false;
-    }
+/* Check if file type is allowed
+ *
+ * Only the final segment's extension counts: the normalizer has already
+ * split it off, so there is no rescanning, and an extension anywhere else
+ * ("/x.php/y.html") names a directory, not a script. Directories are
+ * served through their index file; an extensionless file never is.
+ */
+static bool is_allowed_file_type(const normalized_path_t *path) {
+    if (path->directory) return true;
+    if (!path->extension) return false;
 
     /* List of allowed extensions */
-    const char *allowed_exts[] = {
+    static const char *allowed_exts[] = {
         ".html", ".htm",  /* HTML files */
         ".css",          /* Stylesheets */
         ".js",           /* JavaScript */
@@ -136,30 +163,8 @@ static bool is_allowed_file_type(const char *path) {
         NULL
     };
 
-    /* Make a copy of path for extension checks */
-    char *path_copy = strdup(path);
-    if (!path_copy) return false;
-
-    /* Check for disallowed extensions anywhere in the path */
-    const char *disallowed_exts[] = {
-        ".php", ".asp", ".aspx", ".jsp", ".cgi", ".pl", ".py",
-        ".sh", ".bash", ".exe", ".dll", ".so",
-        NULL
-    };
-
-    char *curr_ext = path_copy;
-    while ((curr_ext = strchr(curr_ext, '.'))) {
-        for (const char **disallowed = disallowed_exts; *disallowed; disallowed++) {
-            if (strcasecmp(curr_ext, *disallowed) == 0) {
-                free(path_copy);
-                return false;
-            }
-        }
-        curr_ext++;
-    }
-    free(path_copy);
-
     /* Check against allowed extensions (case-insensitive) */
+    const char *ext = path->path + path->extension;
     for (const char **allowed = allowed_exts; *allowed; allowed++) {
         if (strcasecmp(ext, *allowed) == 0) {
             return true;
@@ -170,58 +175,119 @@ static bool is_allowed_file_type(const char *path) {
 }
 
 /* Build file path with security checks */
-static bool build_file_path(const char *request_path, char *filepath, size_t filepath_size) {
+static bool build_file_path(const normalized_path_t *request_path, char *filepath,
+                            size_t filepath_size) {
     /* Basic sanity check */
     if (!request_path || !filepath || filepath_size < 5)
         return false;
 
-    /* Check for path traversal */
-    if (has_path_traversal(request_path))
+    /* Check file type first: it only looks at the extension */
+    if (!is_allowed_file_type(request_path))
         return false;
 
-    /* Check file type */
-    if (!is_allowed_file_type(request_path))
+    /* Check for path traversal */
+    if (has_path_traversal(request_path->path))
         return false;
 
-    /* Initialize with web root */
-    strncpy(filepath, "www", filepath_size);
-    filepath[filepath_size - 1] = '\0';
+    /* Web root, request path, and the index file for directories */
+    const char *index = request_path->directory ? "index.html" : "";
+    int len = snprintf(filepath, filepath_size, "www%s%s", request_path->path, index);
+    return len > 0 && (size_t)len < filepath_size;  /* Fails if too long */
+}
 
-    /* Handle root path */
-    if (strcmp(request_path, "/") == 0) {
-        strncat(filepath, "/index.html", filepath_size - strlen(filepath) - 1);
-        return true;
+/* Parse "prefix:cost" entries separated by commas; a cost above the
+ * burst could never be admitted, so it is refused */
+static bool parse_route_costs(server_t *server, const char *list, unsigned int burst) {
+    char entry[96];
+    const char *p = list;
+
+    while (*p) {
+        while (*p == ',' || *p == ' ') p++;
+        if (!*p) break;
+
+        size_t len = strcspn(p, ",");
+        if (len >= sizeof(entry) || server->route_cost_count >= MAX_ROUTE_COSTS)
+            return false;
+        memcpy(entry, p, len);
+        entry[len] = '\0';
+        p += len;
+
+        /* Split at the last colon, trimming spaces around the cost */
+        char *colon = strrchr(entry, ':');
+        if (!colon || colon == entry) return false;
+        *colon = '\0';
+        int cost = atoi(colon + 1);
+        if (cost < 1) return false;
+        if ((unsigned int)cost > burst) {
+            LOG_ERROR("Route cost %d for %s exceeds the burst of %u requests",
+                      cost, entry, burst);
+            return false;
+        }
+
+        char *end = colon;
+        while (end > entry && end[-1] == ' ') *--end = '\0';
+        if ((size_t)(end - entry) >= sizeof(server->route_costs[0].prefix))
+            return false;
+
+        route_cost_t *route = &server->route_costs[server->route_cost_count++];
+        memcpy(route->prefix, entry, end - entry + 1);
+        route->cost = (uint32_t)cost;
     }
+    return true;
+}
 
-    /* Handle directory index */
-    size_t path_len = strlen(request_path);
-    if (path_len > 0 && request_path[path_len - 1] == '/') {
-        /* Directly construct the path without using a temporary variable */
-        if (strlen(filepath) + path_len + 11 < filepath_size) {
-            strncat(filepath, request_path, filepath_size - strlen(filepath) - 1);
-            strncat(filepath, "index.html", filepath_size - strlen(filepath) - 1);
-            return true;
+/* Cost of a request path: longest matching prefix, else one request */
+static uint32_t route_cost(const server_t *server, const char *path) {
+    uint32_t cost = 1;
+    size_t best = 0;
+
+    for (size_t i = 0; i < server->route_cost_count; i++) {
+        const route_cost_t *route = &server->route_costs[i];
+        size_t len = strlen(route->prefix);
+        if (len > best && strncmp(path, route->prefix, len) == 0) {
+            best = len;
+            cost = route->cost;
         }
-        return false;
     }
+    return cost;
+}
 
-    /* Append request path */
-    if (strlen(filepath) + strlen(request_path) + 1 > filepath_size)
-        return false;  /* Path would be too long */
+/* Names accepted in the request_checks and methods settings */
+static const char *check_names[METRIC_CHECK_COUNT] = {
+    "method", "length", "bytes", "rate", "path", "patterns"
+};
+static const char *method_names[] = { "GET", "HEAD", "POST" };
+
+/* Parse a comma-separated list of names into a bit per name's index */
+static bool parse_names(const char *list, const char **names, size_t count, uint32_t *mask) {
+    const char *p = list;
+    *mask = 0;
+
+    while (*p) {
+        while (*p == ',' || *p == ' ') p++;
+        if (!*p) break;
 
-    strncat(filepath, request_path, filepath_size - strlen(filepath) - 1);
+        size_t len = strcspn(p, ", ");
+        size_t i = 0;
+        while (i < count && (strlen(names[i]) != len || strncasecmp(p, names[i], len) != 0)) i++;
+        if (i == count) return false;
+        *mask |= 1u << i;
+        p += len;
+    }
     return true;
 }
 
+/* Security headers for file responses */
+#define SECURITY_HEADERS \
+    "X-Frame-Options: DENY\r\n" \
+    "X-Content-Type-Options: nosniff\r\n" \
+    "X-XSS-Protection: 1; mode=block\r\n" \
+    "Content-Security-Policy: default-src 'self'\r\n" \
+    "Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n"
+
 /* Add security headers to response */
 static void add_security_headers(char *headers, size_t size) {
-    strncat(headers, 
-        "X-Frame-Options: DENY\r\n"
-        "X-Content-Type-Options: nosniff\r\n"
-        "X-XSS-Protection: 1; mode=block\r\n"
-        "Content-Security-Policy: default-src 'self'\r\n"
-        "Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n",
-        size - strlen(headers) - 1);
+    strncat(headers, SECURITY_HEADERS, size - strlen(headers) - 1);
 }
 
 /* Create server instance */
@@ -233,37 +299,202 @@ server_t *server_create(const server_config_t *config) {
 
     /* Copy configuration */
     server->config = *config;
+    server->sock_fd = -1;
+    trace_init();
     
     /* Initialize rate limiter */
     rate_limit_config_t rate_config = {
-        .requests_per_second = config->max_requests / 60,  // Convert per minute to per second
+        .requests_per_window = config->max_requests,
         .burst_size = config->max_requests,
         .window_seconds = 60
     };
     
-    server->rate_limiter = rate_limiter_create(&rate_config);
+    /* Processes sharing a port must also share rate-limit state */
+    if (config->rate_limit_shm[0]) {
+        server->rate_limiter = rate_limiter_create_shared(&rate_config,
+                                                          config->rate_limit_shm);
+    } else {
+        server->rate_limiter = rate_limiter_create(&rate_config);
+    }
     if (!server->rate_limiter) {
-        free(server);
+        server_destroy(server);
+        return NULL;
+    }
+
+    /* Initialize per-client egress budget, in KiB */
+    if (config->bandwidth_kb_per_minute) {
+        rate_limit_config_t bandwidth_config = {
+            .requests_per_window = config->bandwidth_kb_per_minute,
+            .burst_size = config->bandwidth_burst_kb ? config->bandwidth_burst_kb
+                                                     : config->bandwidth_kb_per_minute,
+            .window_seconds = 60
+        };
+
+        if (config->rate_limit_shm[0]) {
+            char name[sizeof(config->rate_limit_shm) + 4];
+            snprintf(name, sizeof(name), "%s-bw", config->rate_limit_shm);
+            server->bandwidth = rate_limiter_create_shared(&bandwidth_config, name);
+        } else {
+            server->bandwidth = rate_limiter_create(&bandwidth_config);
+        }
+        if (!server->bandwidth) {
+            server_destroy(server);
+            return NULL;
+        }
+    }
+
+    /* Initialize egress shaping for large or bulk responses */
+    if (config->shape_conn_kbps || config->shape_ip_kbps) {
+        shaper_config_t shaper_config = {
+            .conn_kbps = config->shape_conn_kbps,
+            .ip_kbps = config->shape_ip_kbps,
+            .min_size_kb = config->shape_min_size_kb,
+            .mime = config->shape_mime,
+            .shm_name = config->rate_limit_shm[0] ? config->rate_limit_shm : NULL
+        };
+
+        server->shaper = shaper_create(&shaper_config);
+        if (!server->shaper) {
+            server_destroy(server);
+            return NULL;
+        }
+    }
+
+    /* Parse request cost classes */
+    if (!parse_route_costs(server, config->route_costs, rate_config.burst_size)) {
+        server_destroy(server);
+        return NULL;
+    }
+
+    /* Request checks to run; the path check builds the file path, so it
+     * always runs */
+    server->checks = DEFAULT_CHECKS;
+    server->methods = ALL_METHODS;
+    server->max_request_size = config->max_request_size ? config->max_request_size
+                                                        : DEFAULT_MAX_REQUEST_SIZE;
+    if ((config->request_checks[0] &&
+         !parse_names(config->request_checks, check_names, METRIC_CHECK_COUNT,
+                      &server->checks)) ||
+        (config->methods[0] &&
+         !parse_names(config->methods, method_names,
+                      sizeof(method_names) / sizeof(method_names[0]), &server->methods))) {
+        server_destroy(server);
+        return NULL;
+    }
+    server->checks |= 1u << METRIC_CHECK_PATH;
+
+    /* Injection patterns, built in and from the security configuration */
+    if (server->checks & (1u << METRIC_CHECK_PATTERNS)) {
+        security_config_t security_config;
+        security_config_set_defaults(&security_config);
+        if (config->security_config[0] &&
+            !security_config_load(&security_config, config->security_config)) {
+            server_destroy(server);
+            return NULL;
+        }
+
+        /* Per-client rates and the size limit are enforced by earlier checks */
+        security_config.enable_rate_limit = false;
+        security_config.limits.max_request_size = server->max_request_size;
+        server->body_timeout = security_config.limits.timeout_seconds
+                               ? security_config.limits.timeout_seconds
+                               : DEFAULT_BODY_TIMEOUT;
+        server->security = security_create(&security_config);
+        if (!server->security) {
+            server_destroy(server);
+            return NULL;
+        }
+    }
+
+    /* Initialize accept-time admission control */
+    admission_config_t admission_config = {
+        .allow = config->acl_allow,
+        .deny = config->acl_deny,
+        .trust = config->acl_trust,
+        .max_connections = config->max_connections,
+        .limiter = server->rate_limiter
+    };
+
+    server->admission = admission_create(&admission_config);
+    if (!server->admission) {
+        server_destroy(server);
         return NULL;
     }
     
+    /* Initialize load-adaptive overload protection */
+    if (config->concurrency_limit_max) {
+        concurrency_config_t concurrency_config = {
+            .min_limit = config->concurrency_limit_min,
+            .max_limit = config->concurrency_limit_max,
+            .initial_limit = config->concurrency_limit_max / 2
+        };
+
+        server->concurrency = concurrency_limiter_create(&concurrency_config);
+        if (!server->concurrency) {
+            server_destroy(server);
+            return NULL;
+        }
+    }
+
+    /* Remember refused paths */
+    if (config->negative_cache) {
+        uint32_t ttl = config->negative_cache_ttl ? config->negative_cache_ttl
+                                                  : DEFAULT_NEGATIVE_TTL;
+        server->negatives = negative_cache_create(config->negative_cache, ttl, "www");
+        if (!server->negatives) {
+            server_destroy(server);
+            return NULL;
+        }
+    }
+
+    /* Serve from a prebuilt asset pack instead of the web root */
+    if (config->asset_pack[0]) {
+        server->pack = asset_pack_open(config->asset_pack);
+        if (!server->pack) {
+            LOG_ERROR("Cannot open asset pack %s", config->asset_pack);
+            server_destroy(server);
+            return NULL;
+        }
+        LOG_INFO("Serving %zu files from %s", asset_pack_count(server->pack),
+                 config->asset_pack);
+    }
+
+    /* Track the heaviest clients and paths */
+    if (config->heavy_hitters) {
+        uint32_t half_life = config->heavy_hitters_half_life ? config->heavy_hitters_half_life
+                                                             : DEFAULT_HALF_LIFE;
+        for (int i = 0; i < TOP_COUNT; i++) {
+            server->top[i] = heavy_hitters_create(config->heavy_hitters, half_life);
+            if (!server->top[i]) {
+                server_destroy(server);
+                return NULL;
+            }
+        }
+    }
+
     /* Create socket */
     server->sock_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server->sock_fd < 0) {
-        rate_limiter_destroy(server->rate_limiter);
-        free(server);
+        server_destroy(server);
         return NULL;
     }
 
     /* Set socket options */
     int opt = 1;
     if (setsockopt(server->sock_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        close(server->sock_fd);
-        rate_limiter_destroy(server->rate_limiter);
-        free(server);
+        server_destroy(server);
         return NULL;
     }
 
+#ifdef SO_REUSEPORT
+    /* Let the kernel balance connections across worker processes */
+    if (config->reuse_port &&
+        setsockopt(server->sock_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        server_destroy(server);
+        return NULL;
+    }
+#endif
+
     /* Bind socket */
     struct sockaddr_in addr = {
         .sin_family = AF_INET,
@@ -272,32 +503,45 @@ server_t *server_create(const server_config_t *config) {
     };
 
     if (bind(server->sock_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        close(server->sock_fd);
-        rate_limiter_destroy(server->rate_limiter);
-        free(server);
+        server_destroy(server);
         return NULL;
     }
 
     /* Start listening */
     if (listen(server->sock_fd, SOMAXCONN) < 0) {
-        close(server->sock_fd);
-        rate_limiter_destroy(server->rate_limiter);
-        free(server);
+        server_destroy(server);
         return NULL;
     }
 
     return server;
 }
 
+/* Stop accepting connections; server_run returns once woken */
+void server_stop(server_t *server) {
+    if (server && server->running) {
+        server->running = false;
+        /* Unlike close(), shutdown() wakes a thread blocked in accept() */
+        shutdown(server->sock_fd, SHUT_RDWR);
+    }
+}
+
 /* Clean up server */
 void server_destroy(server_t *server) {
     if (server) {
-        server->running = false;
+        server_stop(server);
         if (server->sock_fd >= 0) {
             close(server->sock_fd);
         }
-        if (server->rate_limiter) {
-            rate_limiter_destroy(server->rate_limiter);
+        concurrency_limiter_destroy(server->concurrency);
+        admission_destroy(server->admission);
+        security_destroy(server->security);
+        negative_cache_destroy(server->negatives);
+        asset_pack_close(server->pack);
+        shaper_destroy(server->shaper);
+        rate_limiter_destroy(server->bandwidth);
+        rate_limiter_destroy(server->rate_limiter);
+        for (int i = 0; i < TOP_COUNT; i++) {
+            heavy_hitters_destroy(server->top[i]);
         }
         free(server);
     }
@@ -307,96 +551,733 @@ void server_destroy(server_t *server) {
 typedef struct {
     int fd;
     server_t *server;
+    struct sockaddr_in addr;
+    uint64_t accepted;          /* trace_ticks() at accept */
 } client_context_t;
 
-/* Handle client connection */
-static void *handle_client(void *arg) {
-    client_context_t *ctx = (client_context_t*)arg;
-    int client_fd = ctx->fd;
-    server_t *server = ctx->server;
-    free(ctx);
+/* Headers for rate-limited and load-shedding responses */
+static const char retry_headers[] =
+    "Retry-After: 1\r\n"
+    "X-Frame-Options: DENY\r\n"
+    "X-Content-Type-Options: nosniff\r\n";
 
-    struct sockaddr_in addr;
-    socklen_t addr_len = sizeof(addr);
-    getpeername(client_fd, (struct sockaddr*)&addr, &addr_len);
-    
-    printf("[%s] New connection from %s\n", get_timestamp(), inet_ntoa(addr.sin_addr));
+/* Concurrency slot held while a request is served */
+typedef struct {
+    bool held;
+    uint64_t start_usec;
+    uint64_t served_usec;       /* Body ready to send, 0 until then */
+} request_slot_t;
+
+/* Note that the response is ready; writing the body out is up to the
+ * client's pace, so it is not taken for service latency */
+static void mark_served(request_slot_t *slot) {
+    if (slot->held && !slot->served_usec) slot->served_usec = concurrency_limiter_clock();
+}
+
+/* Give the slot back, once; a paced body is sent without it, so seconds
+ * of shaping are not counted as in flight either */
+static void release_slot(server_t *server, request_slot_t *slot) {
+    if (slot->held) {
+        concurrency_limiter_release(server->concurrency, slot->start_usec, slot->served_usec);
+        slot->held = false;
+    }
+}
+
+static size_t serve_file(server_t *server, int client_fd, const struct sockaddr_in *addr,
+                         const http_request_t *req, const normalized_path_t *path,
+                         const char *filepath, const char *buffer, access_entry_t *entry,
+                         request_trace_t *trace, request_slot_t *slot);
+
+/* Wall clock time in microseconds */
+static uint64_t wall_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Log and count a body cut short after its headers promised more; the
+ * status is already on the wire, so the access log keeps it and the
+ * bytes actually sent */
+static void check_sent(const char *path, size_t sent, size_t size,
+                       const struct sockaddr_in *addr) {
+    if (sent >= size) return;
+    LOG_WARN("Short response for %s to %s: %zu of %zu bytes",
+             path, inet_ntoa(addr->sin_addr), sent, size);
+    metrics_short_response();
+}
+
+/* Monotonic time in milliseconds, for deadlines */
+static uint64_t monotonic_msec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Method name for logs */
+static const char *method_name(int method) {
+    return method == HTTP_GET ? "GET" :
+           method == HTTP_POST ? "POST" :
+           method == HTTP_HEAD ? "HEAD" : "UNKNOWN";
+}
+
+/* Record a finished request in the binary or text access log */
+static void log_request(server_t *server, const access_entry_t *entry) {
+    if (server->config.binary_access_log[0]) {
+        access_log_write(entry);
+        return;
+    }
+
+    LOG_ACCESS("%s - %s %s - %d - %llu bytes - %u us",
+               inet_ntoa(entry->addr), method_name(entry->method), entry->path,
+               entry->status, (unsigned long long)entry->bytes, entry->duration_usec);
+}
+
+/* Feed stage histograms and report slow requests */
+static void finish_trace(server_t *server, const request_trace_t *trace,
+                         const access_entry_t *entry) {
+    for (int i = 0; i < TRACE_STAGE_COUNT; i++) {
+        if (trace_ran(trace, i)) {
+            metrics_observe(METRIC_HIST_STAGE_READ + i, trace_stage_usec(trace, i));
+        }
+    }
+
+    uint32_t total = trace_total_usec(trace);
+    if (server->config.slow_request_ms &&
+        total >= (uint64_t)server->config.slow_request_ms * 1000) {
+        char stages[128];
+        trace_breakdown(trace, stages, sizeof(stages));
+        LOG_WARN("Slow request: %s %s from %s - %d - %u us (%s)",
+                 method_name(entry->method), entry->path, inet_ntoa(entry->addr),
+                 entry->status, total, stages);
+    }
+}
+
+/* Append a Server-Timing header for the stages so far, if enabled */
+static void add_server_timing(server_t *server, const request_trace_t *trace,
+                              char *headers, size_t size) {
+    if (!server->config.server_timing) return;
+
+    size_t len = strlen(headers);
+    trace_server_timing(trace, headers + len, size - len);
+}
+
+static void serve_request(server_t *server, int client_fd, const struct sockaddr_in *addr,
+                          const http_request_t *req, const char *buffer, size_t length,
+                          access_entry_t *entry, request_trace_t *trace);
+
+#define METRICS_BUFFER (64 * 1024)
+
+/* Append to the exposition text, returning the new length (truncating) */
+static size_t append_text(char *buf, size_t len, size_t size, const char *fmt, ...) {
+    if (len + 1 >= size) return len;
 
-    char buffer[4096];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + len, size - len, fmt, args);
+    va_end(args);
+
+    if (n > 0) len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+    return len;
+}
+
+/* Exposition of each heavy hitter tracker */
+static const struct {
+    const char *name;
+    const char *help;
+    bool by_addr;
+} top_metrics[TOP_COUNT] = {
+    { "zircon_top_client_requests", "Heaviest clients by recent requests (decayed).", true },
+    { "zircon_top_client_bytes", "Heaviest clients by recent response bytes (decayed).", true },
+    { "zircon_top_path_requests", "Most requested paths recently (decayed).", false },
+    { "zircon_top_path_bytes", "Paths sending the most bytes recently (decayed).", false }
+};
+
+/* Append one heavy hitter tracker's keys as labelled gauges */
+static size_t render_top(char *buf, size_t len, size_t size, int which,
+                         heavy_hitters_t *hh) {
+    heavy_hitter_t top[HEAVY_HITTERS_MAX_K];
+    size_t count = heavy_hitters_top(hh, top, HEAVY_HITTERS_MAX_K);
+
+    len = append_text(buf, len, size, "# HELP %s %s\n# TYPE %s gauge\n",
+                      top_metrics[which].name, top_metrics[which].help,
+                      top_metrics[which].name);
+
+    for (size_t i = 0; i < count; i++) {
+        /* Label values escape backslash and quote; control bytes, bytes
+         * past ASCII (a key may end mid-character) and '%' itself are
+         * percent-encoded, so the exposition stays valid UTF-8 */
+        static const char hex[] = "0123456789ABCDEF";
+        char label[HEAVY_HITTER_KEY_MAX * 3 + 1];
+        if (top_metrics[which].by_addr) {
+            if (!inet_ntop(AF_INET, top[i].key, label, sizeof(label))) continue;
+        } else {
+            size_t out = 0;
+            for (size_t c = 0; c < top[i].len; c++) {
+                unsigned char ch = top[i].key[c];
+                if (ch < 0x20 || ch >= 0x7f || ch == '%') {
+                    label[out++] = '%';
+                    label[out++] = hex[ch >> 4];
+                    label[out++] = hex[ch & 15];
+                    continue;
+                }
+                if (ch == '\\' || ch == '"') label[out++] = '\\';
+                label[out++] = ch;
+            }
+            label[out] = '\0';
+        }
+
+        len = append_text(buf, len, size, "%s{%s=\"%s\"} %llu\n",
+                          top_metrics[which].name,
+                          top_metrics[which].by_addr ? "addr" : "path",
+                          label, (unsigned long long)top[i].count);
+    }
+    return len;
+}
+
+/* Answer a scrape with the Prometheus text exposition */
+static void serve_metrics(server_t *server, int client_fd, access_entry_t *entry) {
+    char *buf = malloc(METRICS_BUFFER);
+    if (!buf) {
+        http_send_error(client_fd, 500, "Internal Server Error");
+        entry->status = 500;
+        return;
+    }
+
+    size_t len = metrics_render(buf, METRICS_BUFFER);
+
+    /* State owned by other modules, read at scrape time */
+    if (server->concurrency) {
+        concurrency_stats_t stats;
+        concurrency_limiter_stats(server->concurrency, &stats);
+        len = append_text(buf, len, METRICS_BUFFER,
+                          "# HELP zircon_concurrency_limit Adaptive in-flight request limit.\n"
+                          "# TYPE zircon_concurrency_limit gauge\n"
+                          "zircon_concurrency_limit %u\n"
+                          "# HELP zircon_requests_inflight Requests being served now.\n"
+                          "# TYPE zircon_requests_inflight gauge\n"
+                          "zircon_requests_inflight %u\n",
+                          stats.limit, stats.inflight);
+    }
+    len = append_text(buf, len, METRICS_BUFFER,
+                      "# HELP zircon_log_dropped_total Log records dropped on overflow.\n"
+                      "# TYPE zircon_log_dropped_total counter\n"
+                      "zircon_log_dropped_total %llu\n",
+                      (unsigned long long)log_dropped());
+
+    if (server->negatives) {
+        negative_cache_stats_t stats;
+        negative_cache_stats(server->negatives, &stats);
+        len = append_text(buf, len, METRICS_BUFFER,
+                          "# HELP zircon_negative_cache_hits_total Requests refused from the negative cache.\n"
+                          "# TYPE zircon_negative_cache_hits_total counter\n"
+                          "zircon_negative_cache_hits_total %llu\n"
+                          "# HELP zircon_negative_cache_inserts_total Refused paths added to the negative cache.\n"
+                          "# TYPE zircon_negative_cache_inserts_total counter\n"
+                          "zircon_negative_cache_inserts_total %llu\n"
+                          "# HELP zircon_negative_cache_clears_total Web root changes that emptied the negative cache.\n"
+                          "# TYPE zircon_negative_cache_clears_total counter\n"
+                          "zircon_negative_cache_clears_total %llu\n",
+                          (unsigned long long)stats.hits, (unsigned long long)stats.inserts,
+                          (unsigned long long)stats.clears);
+    }
+
+    for (int i = 0; i < TOP_COUNT && server->top[i]; i++) {
+        len = render_top(buf, len, METRICS_BUFFER, i, server->top[i]);
+    }
+
+    http_send_response(client_fd, 200, "text/plain; version=0.0.4; charset=utf-8",
+                       buf, len, "Cache-Control: no-store\r\n");
+    entry->status = 200;
+    entry->bytes = len;
+    free(buf);
+}
+
+/* Serve one request on an admitted connection (caller closes the socket) */
+static void serve_client(server_t *server, int client_fd, const struct sockaddr_in *addr) {
+    LOG_DEBUG("New connection from %s", inet_ntoa(addr->sin_addr));
+
+    request_trace_t trace;
+    trace_begin(&trace);
+
+    char buffer[REQUEST_BUFFER];
     ssize_t bytes = read(client_fd, buffer, sizeof(buffer) - 1);
     if (bytes <= 0) {
-        printf("[%s] Connection closed by %s\n", get_timestamp(), inet_ntoa(addr.sin_addr));
-        close(client_fd);
-        return NULL;
+        LOG_DEBUG("Connection closed by %s", inet_ntoa(addr->sin_addr));
+        return;
     }
     buffer[bytes] = '\0';
+    trace_mark(&trace, TRACE_READ);
+
+    access_entry_t entry = {
+        .addr = addr->sin_addr,
+        .method = HTTP_UNSUPPORTED,
+        .path = "-",
+        .start_usec = wall_usec()
+    };
 
     /* Parse HTTP request */
     http_request_t req;
-    if (!http_parse_request(buffer, bytes, &req)) {
-        printf("[%s] Bad request from %s\n", get_timestamp(), inet_ntoa(addr.sin_addr));
+    bool parsed = http_parse_request(buffer, bytes, &req);
+    trace_mark(&trace, TRACE_PARSE);
+    ZIRCON_PROBE3(request_parsed, client_fd, parsed ? (int)req.method : -1,
+                  parsed ? req.path : "");
+    if (!parsed) {
+        LOG_WARN("Bad request from %s", inet_ntoa(addr->sin_addr));
         http_send_error(client_fd, 400, "Bad Request");
-        close(client_fd);
-        return NULL;
+        entry.status = 400;
+    } else {
+        LOG_DEBUG("Request: %s %s from %s",
+                  method_name(req.method), req.path, inet_ntoa(addr->sin_addr));
+        entry.method = req.method;
+        entry.path = req.path;
+
+        if (server->config.metrics_path[0] &&
+            strcmp(req.path, server->config.metrics_path) == 0 &&
+            admission_is_trusted(server->admission, &addr->sin_addr)) {
+            serve_metrics(server, client_fd, &entry);
+        } else {
+            serve_request(server, client_fd, addr, &req, buffer, (size_t)bytes, &entry, &trace);
+        }
     }
+    trace_mark(&trace, TRACE_SEND);
+    uint64_t total_usec = trace_total_usec(&trace);
+    ZIRCON_PROBE4(response_sent, client_fd, entry.status, entry.bytes, total_usec);
 
-    printf("[%s] Request: %s %s from %s\n", 
-           get_timestamp(),
-           req.method == HTTP_GET ? "GET" :
-           req.method == HTTP_POST ? "POST" :
-           req.method == HTTP_HEAD ? "HEAD" : "UNKNOWN",
-           req.path,
-           inet_ntoa(addr.sin_addr));
-
-    /* Validate file type */
-    if (!is_allowed_file_type(req.path)) {
-        printf("[%s] Forbidden request for %s from %s\n", 
-               get_timestamp(), req.path, inet_ntoa(addr.sin_addr));
-        http_send_error(client_fd, 403, "Forbidden");
-        close(client_fd);
-        return NULL;
+    /* Request time excludes waiting for the client to send it */
+    entry.duration_usec = total_usec - trace_stage_usec(&trace, TRACE_READ);
+    log_request(server, &entry);
+    metrics_request(entry.method, entry.status, entry.bytes,
+                    entry.cache != ACCESS_CACHE_NONE);
+    metrics_observe(METRIC_HIST_REQUEST, entry.duration_usec);
+    finish_trace(server, &trace, &entry);
+
+    if (server->top[0]) {
+        heavy_hitters_add(server->top[TOP_CLIENT_REQUESTS], &entry.addr, sizeof(entry.addr), 1);
+        heavy_hitters_add(server->top[TOP_CLIENT_BYTES], &entry.addr, sizeof(entry.addr),
+                          entry.bytes);
+        if (parsed) {
+            /* Paths are counted as served, without the query; targets
+             * that do not normalize share one key */
+            normalized_path_t path;
+            const char *key = INVALID_PATH_KEY;
+            size_t len = sizeof(INVALID_PATH_KEY) - 1;
+            if (normalize_path(req.path, strlen(req.path), &path)) {
+                key = path.path;
+                len = path.length;
+            }
+            heavy_hitters_add(server->top[TOP_PATH_REQUESTS], key, len, 1);
+            heavy_hitters_add(server->top[TOP_PATH_BYTES], key, len, entry.bytes);
+        }
     }
+}
 
-    /* Build file path with security checks */
-    char filepath[512];
-    if (!build_file_path(req.path, filepath, sizeof(filepath))) {
-        printf("[%s] Invalid path: %s from %s\n", 
-               get_timestamp(), req.path, inet_ntoa(addr.sin_addr));
-        http_send_error(client_fd, 403, "Forbidden");
-        close(client_fd);
-        return NULL;
+/* A request on its way through the checks */
+typedef struct {
+    int fd;
+    const struct sockaddr_in *addr;
+    const http_request_t *req;
+    const char *buffer;         /* Request as read, NUL-terminated */
+    size_t length;              /* Bytes in the buffer */
+    normalized_path_t path;     /* Decoded target without the query */
+    bool normalized;            /* Set once path is filled in */
+    const char *query;          /* Target after the '?', NULL if none */
+    size_t body_length;         /* Declared by Content-Length */
+    bool limited;               /* Subject to route costs and bandwidth */
+    char filepath[512];         /* File to serve, set by the path check */
+    asset_t asset;              /* Or the packed file, when packed is set */
+    bool packed;
+    int status;                 /* Rejection status and reply */
+    const char *message;
+    const char *headers;        /* Extra reply headers, NULL for the defaults */
+} request_context_t;
+
+/* Headers for rejected methods */
+static const char method_headers[] =
+    "Allow: GET, HEAD, POST\r\n"
+    "X-Frame-Options: DENY\r\n"
+    "X-Content-Type-Options: nosniff\r\n";
+
+static bool reject(request_context_t *rc, int status, const char *message) {
+    rc->status = status;
+    rc->message = message;
+    return false;
+}
+
+/* Method served by this server */
+static bool check_method(server_t *server, request_context_t *rc) {
+    if (is_method_allowed(rc->req->method) && (server->methods & (1u << rc->req->method)))
+        return true;
+
+    LOG_WARN("Method not allowed: %s from %s",
+             method_name(rc->req->method), inet_ntoa(rc->addr->sin_addr));
+    rc->headers = method_headers;
+    return reject(rc, 405, "Method Not Allowed");
+}
+
+/* Target, header block and declared body within limits */
+static bool check_length(server_t *server, request_context_t *rc) {
+    /* The parser truncates long targets, so measure the one received */
+    const char *target = rc->buffer + strcspn(rc->buffer, " ");
+    target += strspn(target, " ");
+    if (strcspn(target, " \r\n") > MAX_PATH_LENGTH) {
+        LOG_WARN("Target too long from %s", inet_ntoa(rc->addr->sin_addr));
+        return reject(rc, 414, "URI Too Long");
     }
 
-    /* Check rate limit after security checks */
-    if (!rate_limiter_check(server->rate_limiter, inet_ntoa(addr.sin_addr))) {
-        printf("[%s] Rate limit exceeded for %s\n", get_timestamp(), inet_ntoa(addr.sin_addr));
-        http_send_error(client_fd, 429, "Too Many Requests");
-        close(client_fd);
-        return NULL;
+    /* A full buffer without the end of the headers was cut short */
+    if (rc->length >= REQUEST_BUFFER - 1 && !http_headers_end(rc->buffer)) {
+        LOG_WARN("Headers too large from %s", inet_ntoa(rc->addr->sin_addr));
+        return reject(rc, 431, "Request Header Fields Too Large");
+    }
+
+    if (!http_content_length(rc->buffer, &rc->body_length)) {
+        LOG_WARN("Bad Content-Length from %s", inet_ntoa(rc->addr->sin_addr));
+        return reject(rc, 400, "Bad Request");
+    }
+    if (rc->body_length > server->max_request_size) {
+        LOG_WARN("Request too large from %s", inet_ntoa(rc->addr->sin_addr));
+        return reject(rc, 413, "Payload Too Large");
+    }
+    return true;
+}
+
+/* Path decodes and normalizes, and the query has only expected bytes */
+static bool check_bytes(server_t *server, request_context_t *rc) {
+    (void)server;
+
+    rc->normalized = normalize_path(rc->req->path, strlen(rc->req->path), &rc->path);
+    if (!rc->normalized) {
+        LOG_WARN("Invalid path: %s from %s", rc->req->path, inet_ntoa(rc->addr->sin_addr));
+        return reject(rc, 403, "Forbidden");
+    }
+    if (!is_query_safe(rc->query)) {
+        LOG_WARN("Invalid query: %s from %s", rc->req->path, inet_ntoa(rc->addr->sin_addr));
+        return reject(rc, 400, "Bad Request");
+    }
+    return true;
+}
+
+/* Charge the route's extra cost, and hold back clients still over their
+ * egress budget from earlier responses */
+static bool check_rate(server_t *server, request_context_t *rc) {
+    const struct in_addr *addr = &rc->addr->sin_addr;
+    rc->limited = (server->route_cost_count || server->bandwidth) &&
+                  !admission_is_trusted(server->admission, addr);
+    if (!rc->limited) return true;
+
+    uint32_t cost = route_cost(server, rc->normalized ? rc->path.path : rc->req->path);
+    bool over_cost = cost > 1 &&
+        !rate_limiter_check_cost(server->rate_limiter, addr, cost - 1);
+    bool over_bandwidth = !over_cost && server->bandwidth &&
+        !rate_limiter_check_cost(server->bandwidth, addr, 0);
+    if (!over_cost && !over_bandwidth) return true;
+
+    LOG_WARN("Rate limit exceeded for %s from %s", rc->req->path, inet_ntoa(*addr));
+    metrics_reject(over_cost ? METRIC_REJECT_RATE_LIMITED : METRIC_REJECT_BANDWIDTH);
+    rc->headers = retry_headers;
+    return reject(rc, 429, "Too Many Requests");
+}
+
+/* Look the path up in the asset pack, which stands in for the web root */
+static bool find_asset(server_t *server, request_context_t *rc) {
+    char key[MAX_PATH_LENGTH + sizeof("index.html")];
+    const char *index = rc->path.directory ? "index.html" : "";
+    int len = snprintf(key, sizeof(key), "%s%s", rc->path.path, index);
+
+    rc->packed = asset_pack_find(server->pack, key, (size_t)len, &rc->asset);
+    return rc->packed || reject(rc, 404, "Not Found");
+}
+
+/* File type, then resolution under the web root
+ *
+ * Paths that recently failed to resolve or open are refused again from
+ * the negative cache, without logging, before any filesystem work. With
+ * an asset pack there is no filesystem work: the pack is searched instead.
+ */
+static bool check_path(server_t *server, request_context_t *rc) {
+    /* Without the bytes check the path is normalized here */
+    if (!rc->normalized) {
+        rc->normalized = normalize_path(rc->req->path, strlen(rc->req->path), &rc->path);
+    }
+    if (!rc->normalized || !is_allowed_file_type(&rc->path)) {
+        LOG_WARN("Forbidden request for %s from %s", rc->req->path, inet_ntoa(rc->addr->sin_addr));
+        return reject(rc, 403, "Forbidden");
+    }
+    if (server->pack) return find_asset(server, rc);
+
+    int status = negative_cache_lookup(server->negatives, rc->path.path, rc->path.length);
+    if (status) return reject(rc, status, status == 404 ? "Not Found" : "Forbidden");
+
+    if (!build_file_path(&rc->path, rc->filepath, sizeof(rc->filepath))) {
+        LOG_WARN("Forbidden request for %s from %s", rc->req->path, inet_ntoa(rc->addr->sin_addr));
+        negative_cache_insert(server->negatives, rc->path.path, rc->path.length, 403);
+        return reject(rc, 403, "Forbidden");
+    }
+    return true;
+}
+
+/* Injection patterns in the query, then in a POST body as it arrives */
+static bool check_patterns(server_t *server, request_context_t *rc) {
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &rc->addr->sin_addr, ip, sizeof(ip));
+
+    if (!security_check_request(server->security, ip, method_name(rc->req->method),
+                                rc->path.path, rc->query, NULL, 0)) {
+        return reject(rc, 403, "Forbidden");
+    }
+    if (rc->req->method != HTTP_POST || !rc->body_length) return true;
+
+    /* The body is inspected chunk by chunk and not kept */
+    const char *body = http_headers_end(rc->buffer);
+    if (!body) return reject(rc, 400, "Bad Request");
+
+    security_body_t inspection;
+    security_body_begin(&inspection);
+    size_t have = rc->length - (size_t)(body - rc->buffer);
+    if (have > rc->body_length) have = rc->body_length;
+    if (have && !security_body_feed(server->security, &inspection, ip, body, have))
+        return reject(rc, 403, "Forbidden");
+
+    /* The whole body must arrive by one deadline, so a client trickling
+     * it a byte at a time cannot hold the thread and its slot for long */
+    uint64_t deadline = monotonic_msec() + (uint64_t)server->body_timeout * 1000;
+    char chunk[REQUEST_BUFFER];
+    while (inspection.length < rc->body_length) {
+        uint64_t now = monotonic_msec();
+        struct pollfd pfd = { .fd = rc->fd, .events = POLLIN };
+        int ready = now < deadline ? poll(&pfd, 1, (int)(deadline - now)) : 0;
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready == 0) {
+            LOG_WARN("Body timed out from %s", ip);
+            return reject(rc, 408, "Request Timeout");
+        }
+
+        size_t want = rc->body_length - inspection.length;
+        ssize_t n = ready > 0 ? read(rc->fd, chunk, want < sizeof(chunk) ? want : sizeof(chunk))
+                              : -1;
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            LOG_WARN("Incomplete body from %s", ip);
+            return reject(rc, 400, "Bad Request");
+        }
+        if (!security_body_feed(server->security, &inspection, ip, chunk, (size_t)n))
+            return reject(rc, 403, "Forbidden");
+    }
+    return security_body_end(server->security, &inspection, ip) ||
+           reject(rc, 403, "Forbidden");
+}
+
+/* Request checks, cheapest first (metrics_check_t order)
+ *
+ * Each runs only once every earlier one has passed, so most requests
+ * only ever pay for the lexical checks, and floods of bad requests are
+ * turned away before any system call, lock or pattern scan. The path
+ * and pattern checks touch the filesystem and the socket, so they run
+ * only once the request holds a concurrency slot.
+ */
+static const struct {
+    bool (*run)(server_t *server, request_context_t *rc);
+    trace_stage_t stage;
+} checks[METRIC_CHECK_COUNT] = {
+    { check_method, TRACE_CHECK },
+    { check_length, TRACE_CHECK },
+    { check_bytes, TRACE_CHECK },
+    { check_rate, TRACE_LIMIT },
+    { check_path, TRACE_PATH },
+    { check_patterns, TRACE_CHECK }
+};
+
+/* Run the enabled checks in [first, end) until one fails, timing each */
+static bool run_checks(server_t *server, request_context_t *rc, request_trace_t *trace,
+                       int first, int end) {
+    for (int i = first; i < end; i++) {
+        if (!(server->checks & (1u << i))) continue;
+
+        uint64_t start = trace->mark;
+        bool passed = checks[i].run(server, rc);
+        trace_mark(trace, checks[i].stage);
+        metrics_check(i, trace_ticks_nsec(trace->mark - start), passed);
+        if (!passed) return false;
+    }
+    return true;
+}
+
+/* Headers every packed response carries besides its own */
+static const char pack_headers[] = "Cache-Control: max-age=86400\r\n" SECURITY_HEADERS;
+
+/* Serve a file from the asset pack, returning the number of body bytes sent
+ *
+ * The entity headers were prepared by zircon-pack, so a response is the
+ * status line, the date and one writev from the mapping. Shaped bodies
+ * are sent from the pack's descriptor instead.
+ */
+static size_t serve_asset(server_t *server, int client_fd, const struct sockaddr_in *addr,
+                          const http_request_t *req, const asset_t *asset,
+                          const char *buffer, access_entry_t *entry, request_trace_t *trace,
+                          request_slot_t *slot) {
+    bool gzip = asset->gzip_size && http_accepts_gzip(buffer);
+    const char *etag = gzip ? asset->gzip_etag : asset->etag;
+    trace_mark(trace, TRACE_OPEN);
+
+    if (http_check_etag_match(buffer, etag)) {
+        char headers[512];
+        snprintf(headers, sizeof(headers), "ETag: %s\r\n%s%s", etag,
+                 asset->gzip_size ? "Vary: Accept-Encoding\r\n" : "", pack_headers);
+        add_server_timing(server, trace, headers, sizeof(headers));
+
+        http_send_response(client_fd, 304, "", NULL, 0, headers);
+        entry->status = 304;
+        entry->cache = ACCESS_CACHE_REVALIDATED;
+        return 0;
+    }
+
+    const char *extra = pack_headers;
+    char timed[1024];
+    if (server->config.server_timing) {
+        snprintf(timed, sizeof(timed), "%s", pack_headers);
+        add_server_timing(server, trace, timed, sizeof(timed));
+        extra = timed;
+    }
+
+    const char *block = gzip ? asset->gzip_headers : asset->headers;
+    size_t block_len = gzip ? asset->gzip_headers_len : asset->headers_len;
+    const char *body = gzip ? asset->gzip : asset->body;
+    size_t size = gzip ? asset->gzip_size : asset->body_size;
+    entry->status = 200;
+    entry->cache = ACCESS_CACHE_PACK;
+
+    if (req->method == HTTP_HEAD) {
+        http_send_prepared(client_fd, block, block_len, extra, NULL, 0);
+        return 0;
+    }
+    mark_served(slot);
+    size_t sent = 0;
+    if (shaper_applies(server->shaper, asset->mime, size)) {
+        http_send_prepared(client_fd, block, block_len, extra, NULL, 0);
+        release_slot(server, slot);
+        sent = shaper_send_range(server->shaper, client_fd, asset_pack_fd(server->pack),
+                                 (off_t)(gzip ? asset->gzip_offset : asset->body_offset),
+                                 size, &addr->sin_addr, true);
+    } else if (http_send_prepared(client_fd, block, block_len, extra, body, size)) {
+        sent = size;
+    }
+    check_sent(req->path, sent, size, addr);
+    return sent;
+}
+
+/* Reply to a request a check turned away */
+static void send_rejection(int client_fd, const request_context_t *rc, access_entry_t *entry) {
+    if (rc->headers) {
+        http_send_response(client_fd, rc->status, "text/plain", rc->message,
+                           strlen(rc->message), rc->headers);
+    } else {
+        http_send_error(client_fd, rc->status, rc->message);
+    }
+    entry->status = rc->status;
+}
+
+/* Check the request, then serve the file */
+static void serve_request(server_t *server, int client_fd, const struct sockaddr_in *addr,
+                          const http_request_t *req, const char *buffer, size_t length,
+                          access_entry_t *entry, request_trace_t *trace) {
+    request_context_t rc = {
+        .fd = client_fd,
+        .addr = addr,
+        .req = req,
+        .buffer = buffer,
+        .length = length
+    };
+
+    /* The path and query are checked separately */
+    const char *query = strchr(req->path, '?');
+    if (query) rc.query = query + 1;
+
+    if (!run_checks(server, &rc, trace, 0, METRIC_CHECK_PATH)) {
+        send_rejection(client_fd, &rc, entry);
+        return;
+    }
+
+    /* Shed load before any file is opened or body read once the server
+     * is saturated */
+    request_slot_t slot = { .held = false };
+    if (server->concurrency) {
+        slot.held = concurrency_limiter_acquire(server->concurrency, &slot.start_usec);
+    }
+    bool admitted = !server->concurrency || slot.held;
+    trace_mark(trace, TRACE_LIMIT);
+    if (!admitted) {
+        LOG_WARN("Overloaded, shedding %s from %s", req->path, inet_ntoa(addr->sin_addr));
+        metrics_reject(METRIC_REJECT_OVERLOAD);
+        http_send_response(client_fd, 503, "text/plain", "Service Unavailable", 19,
+                           retry_headers);
+        entry->status = 503;
+        return;
+    }
+
+    if (!run_checks(server, &rc, trace, METRIC_CHECK_PATH, METRIC_CHECK_COUNT)) {
+        release_slot(server, &slot);
+        send_rejection(client_fd, &rc, entry);
+        return;
     }
 
+    size_t sent = rc.packed
+        ? serve_asset(server, client_fd, addr, req, &rc.asset, buffer, entry, trace, &slot)
+        : serve_file(server, client_fd, addr, req, &rc.path, rc.filepath, buffer, entry, trace,
+                     &slot);
+    entry->bytes = sent;
+    release_slot(server, &slot);
+
+    /* Bandwidth is post-paid in KiB */
+    if (rc.limited && server->bandwidth && sent) {
+        rate_limiter_charge(server->bandwidth, &addr->sin_addr,
+                            (uint32_t)((sent + 1023) / 1024));
+    }
+}
+
+/* Serve the requested file, returning the number of body bytes sent */
+static size_t serve_file(server_t *server, int client_fd, const struct sockaddr_in *addr,
+                         const http_request_t *req, const normalized_path_t *path,
+                         const char *filepath, const char *buffer, access_entry_t *entry,
+                         request_trace_t *trace, request_slot_t *slot) {
     /* Open and send file */
     int fd = open(filepath, O_RDONLY);
     if (fd < 0) {
-        printf("[%s] File not found: %s (requested by %s)\n", 
-               get_timestamp(), filepath, inet_ntoa(addr.sin_addr));
+        /* Remember files that are not there, not ones we failed to open */
+        if (errno == ENOENT || errno == ENOTDIR) {
+            negative_cache_insert(server->negatives, path->path, path->length, 404);
+        }
+        trace_mark(trace, TRACE_OPEN);
         http_send_error(client_fd, 404, "Not Found");
-        close(client_fd);
-        return NULL;
+        entry->status = 404;
+        return 0;
     }
 
     /* Get file stats (size, modification time) */
     struct stat st;
     if (fstat(fd, &st) < 0) {
-        printf("[%s] Error reading file: %s\n", get_timestamp(), filepath);
+        trace_mark(trace, TRACE_OPEN);
+        LOG_ERROR("Error reading file: %s", filepath);
         close(fd);
         http_send_error(client_fd, 500, "Internal Server Error");
-        close(client_fd);
-        return NULL;
+        entry->status = 500;
+        return 0;
+    }
+
+    /* Only regular files have a body to send; a directory named like a
+     * file would otherwise announce its inode size and send nothing */
+    if (!S_ISREG(st.st_mode)) {
+        trace_mark(trace, TRACE_OPEN);
+        negative_cache_insert(server->negatives, path->path, path->length, 404);
+        close(fd);
+        http_send_error(client_fd, 404, "Not Found");
+        entry->status = 404;
+        return 0;
     }
     
     /* Generate ETag based on file metadata */
+    ZIRCON_PROBE3(file_opened, client_fd, filepath, (uint64_t)st.st_size);
     char *etag = http_generate_etag(st.st_mtime, st.st_size);
+    trace_mark(trace, TRACE_OPEN);
     if (etag) {
         /* Check if client already has this version */
         if (http_check_etag_match(buffer, etag)) {
@@ -404,23 +1285,20 @@ static void *handle_client(void *arg) {
             char headers[512] = {0};
             snprintf(headers, sizeof(headers), "ETag: %s\r\nCache-Control: max-age=86400\r\n", etag);
             add_security_headers(headers, sizeof(headers));
+            add_server_timing(server, trace, headers, sizeof(headers));
             
             http_send_response(client_fd, 304, "", NULL, 0, headers);
-            
-            printf("[%s] %s - %s %s - 304 Not Modified\n", 
-                   get_timestamp(), inet_ntoa(addr.sin_addr),
-                   req.method == HTTP_GET ? "GET" : "HEAD", 
-                   req.path);
+            entry->status = 304;
+            entry->cache = ACCESS_CACHE_REVALIDATED;
             
             free(etag);
             close(fd);
-            close(client_fd);
-            return NULL;
+            return 0;
         }
     }
 
     /* Handle HEAD request (no body) */
-    if (req.method == HTTP_HEAD) {
+    if (req->method == HTTP_HEAD) {
         /* Prepare response headers */
         char headers[4096] = {0};
         const char *mime_type = http_get_mime_type(filepath);
@@ -435,38 +1313,17 @@ static void *handle_client(void *arg) {
         
         /* Add security headers */
         add_security_headers(headers, sizeof(headers));
+        add_server_timing(server, trace, headers, sizeof(headers));
         
         /* Send HEAD response */
         http_send_response(client_fd, 200, mime_type, NULL, st.st_size, headers);
-        
-        printf("[%s] %s - HEAD %s - 200 OK - %ld bytes\n", 
-               get_timestamp(), inet_ntoa(addr.sin_addr), req.path, (long)st.st_size);
+        entry->status = 200;
         
         close(fd);
-        close(client_fd);
-        return NULL;
+        return 0;
     }
     
-    /* For GET requests, read and send file */
-    char *content = malloc(st.st_size);
-    if (!content) {
-        printf("[%s] Memory allocation failed for file: %s\n", get_timestamp(), filepath);
-        close(fd);
-        http_send_error(client_fd, 500, "Internal Server Error");
-        close(client_fd);
-        return NULL;
-    }
-
-    if (read(fd, content, st.st_size) != st.st_size) {
-        printf("[%s] Error reading file: %s\n", get_timestamp(), filepath);
-        free(content);
-        close(fd);
-        http_send_error(client_fd, 500, "Internal Server Error");
-        close(client_fd);
-        return NULL;
-    }
-
-        /* Prepare response headers with ETag and caching information */
+    /* For GET requests, prepare response headers with ETag and caching information */
     char headers[4096] = {0};
     const char *mime_type = http_get_mime_type(filepath);
     
@@ -482,56 +1339,111 @@ static void *handle_client(void *arg) {
     
     /* Add security headers for better web protection */
     add_security_headers(headers, sizeof(headers));
+    add_server_timing(server, trace, headers, sizeof(headers));
     
-    /* Send response */
-    http_send_response(client_fd, 200, mime_type, content, st.st_size, headers);
+    /* Send headers, then stream the body from the file (shaped if configured) */
+    mark_served(slot);
+    http_send_response(client_fd, 200, mime_type, NULL, st.st_size, headers);
+    bool shaped = shaper_applies(server->shaper, mime_type, st.st_size);
+    if (shaped) release_slot(server, slot);
+    size_t sent = shaper_send_file(server->shaper, client_fd, fd, st.st_size,
+                                   &addr->sin_addr, shaped);
+    check_sent(path->path, sent, (size_t)st.st_size, addr);
     
-    /* Log access */
-    printf("[%s] %s - %s %s - 200 OK - %ld bytes - %s\n", 
-           get_timestamp(), inet_ntoa(addr.sin_addr), 
-           req.method == HTTP_GET ? "GET" : req.method == HTTP_HEAD ? "HEAD" : "POST",
-           req.path, (long)st.st_size, mime_type);
+    entry->status = 200;
 
     /* Clean up */
-    free(content);
     close(fd);
-    close(client_fd);
-    printf("[%s] Connection closed: %s\n", get_timestamp(), inet_ntoa(addr.sin_addr));
+    LOG_DEBUG("Connection closed: %s", inet_ntoa(addr->sin_addr));
+    return sent;
+}
+
+/* Handle client connection */
+static void *handle_client(void *arg) {
+    client_context_t *ctx = (client_context_t*)arg;
+
+    metrics_connection_open();
+    serve_client(ctx->server, ctx->fd, &ctx->addr);
+    close(ctx->fd);
+    admission_release(ctx->server->admission, &ctx->addr.sin_addr);
+    metrics_connection_close();
+    ZIRCON_PROBE2(connection_closed, ctx->fd, trace_since_usec(ctx->accepted));
+
+    free(ctx);
     return NULL;
 }
 
+/* Canned reply for clients rejected before their request is read */
+static const char rejection_response[] =
+    "HTTP/1.1 429 Too Many Requests\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 17\r\n"
+    "Connection: close\r\n"
+    "Retry-After: 1\r\n"
+    "\r\n"
+    "Too Many Requests";
+
 /* Run server */
 bool server_run(server_t *server) {
     if (!server || server->sock_fd < 0) return false;
 
+    /* Clients may disconnect mid-response; fail the write, not the process */
+    signal(SIGPIPE, SIG_IGN);
+
     server->running = true;
-    printf("[%s] Server is running and ready for connections\n", get_timestamp());
+    LOG_INFO("Server is running and ready for connections");
     
     while (server->running) {
         /* Accept client connection */
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
-        
-        client_context_t *ctx = malloc(sizeof(client_context_t));
-        if (!ctx) {
-            printf("[%s] Memory allocation failed for new connection\n", get_timestamp());
+
+        int client_fd = accept(server->sock_fd, (struct sockaddr*)&client_addr, &client_len);
+        if (client_fd < 0) {
+            if (!server->running) break;
+            LOG_ERROR("Failed to accept connection");
             continue;
         }
+        uint64_t accepted = trace_ticks();
+        ZIRCON_PROBE2(accept, client_fd, client_addr.sin_addr.s_addr);
 
-        ctx->fd = accept(server->sock_fd, (struct sockaddr*)&client_addr, &client_len);
-        if (ctx->fd < 0) {
-            printf("[%s] Failed to accept connection\n", get_timestamp());
-            free(ctx);
+        /* Admission control before any thread, read or parse work */
+        admission_result_t admit = admission_check(server->admission, &client_addr.sin_addr);
+        ZIRCON_PROBE3(admission, client_fd, client_addr.sin_addr.s_addr, (int)admit);
+        if (admit != ADMIT_OK) {
+            LOG_WARN("Rejected connection from %s: %s",
+                     inet_ntoa(client_addr.sin_addr), admission_result_string(admit));
+            metrics_reject(admit == ADMIT_DENIED ? METRIC_REJECT_DENIED :
+                           admit == ADMIT_RATE_LIMITED ? METRIC_REJECT_RATE_LIMITED :
+                           METRIC_REJECT_CONNECTIONS);
+            /* Denied addresses get no reply; limited ones a best-effort 429 */
+            if (admit != ADMIT_DENIED) {
+                send(client_fd, rejection_response, sizeof(rejection_response) - 1,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+            }
+            close(client_fd);
+            continue;
+        }
+
+        client_context_t *ctx = malloc(sizeof(client_context_t));
+        if (!ctx) {
+            LOG_ERROR("Memory allocation failed for new connection");
+            close(client_fd);
+            admission_release(server->admission, &client_addr.sin_addr);
             continue;
         }
+        ctx->fd = client_fd;
         ctx->server = server;
+        ctx->addr = client_addr;
+        ctx->accepted = accepted;
 
         /* Create thread to handle client */
         pthread_t thread;
         if (pthread_create(&thread, NULL, handle_client, ctx) != 0) {
-            printf("[%s] Failed to create thread for client: %s\n", 
-                   get_timestamp(), inet_ntoa(client_addr.sin_addr));
+            LOG_ERROR("Failed to create thread for client: %s",
+                      inet_ntoa(client_addr.sin_addr));
             close(ctx->fd);
+            admission_release(server->admission, &client_addr.sin_addr);
             free(ctx);
             continue;
         }
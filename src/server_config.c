@@ -0,0 +1,134 @@
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/* Trim leading and trailing whitespace in place */
+static char *trim(char *str) {
+    while (isspace((unsigned char)*str)) str++;
+
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+
+    return str;
+}
+
+/* Parse a boolean setting */
+static bool parse_bool(const char *value) {
+    return strcmp(value, "true") == 0 || strcmp(value, "yes") == 0 ||
+           strcmp(value, "1") == 0;
+}
+
+/* Copy a string setting into a fixed-size field */
+static void copy_value(char *dst, size_t size, const char *value) {
+    strncpy(dst, value, size - 1);
+    dst[size - 1] = '\0';
+}
+
+/* Load "key = value" settings from file
+ *
+ * Settings not present in the file keep their current values, so callers
+ * fill in defaults first. Unknown keys are ignored.
+ */
+bool server_config_load(server_config_t *config, const char *filename) {
+    if (!config || !filename) return false;
+
+    FILE *f = fopen(filename, "r");
+    if (!f) return false;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        /* Strip comments */
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char *eq = strchr(line, '=');
+        if (!eq) continue;
+        *eq = '\0';
+
+        char *key = trim(line);
+        char *value = trim(eq + 1);
+
+        if (strcmp(key, "port") == 0)
+            config->port = (uint16_t)atoi(value);
+        else if (strcmp(key, "bind_addr") == 0)
+            copy_value(config->bind_addr, sizeof(config->bind_addr), value);
+        else if (strcmp(key, "root_dir") == 0)
+            copy_value(config->root_dir, sizeof(config->root_dir), value);
+        else if (strcmp(key, "max_requests_per_minute") == 0)
+            config->max_requests = (uint32_t)atoi(value);
+        else if (strcmp(key, "rate_limit_shm") == 0)
+            copy_value(config->rate_limit_shm, sizeof(config->rate_limit_shm), value);
+        else if (strcmp(key, "reuse_port") == 0)
+            config->reuse_port = parse_bool(value);
+        else if (strcmp(key, "max_connections") == 0)
+            config->max_connections = (uint32_t)atoi(value);
+        else if (strcmp(key, "allow") == 0)
+            copy_value(config->acl_allow, sizeof(config->acl_allow), value);
+        else if (strcmp(key, "deny") == 0)
+            copy_value(config->acl_deny, sizeof(config->acl_deny), value);
+        else if (strcmp(key, "trust") == 0)
+            copy_value(config->acl_trust, sizeof(config->acl_trust), value);
+        else if (strcmp(key, "concurrency_limit_min") == 0)
+            config->concurrency_limit_min = (uint32_t)atoi(value);
+        else if (strcmp(key, "concurrency_limit_max") == 0)
+            config->concurrency_limit_max = (uint32_t)atoi(value);
+        else if (strcmp(key, "bandwidth_kb_per_minute") == 0)
+            config->bandwidth_kb_per_minute = (uint32_t)atoi(value);
+        else if (strcmp(key, "bandwidth_burst_kb") == 0)
+            config->bandwidth_burst_kb = (uint32_t)atoi(value);
+        else if (strcmp(key, "route_costs") == 0)
+            copy_value(config->route_costs, sizeof(config->route_costs), value);
+        else if (strcmp(key, "shape_conn_kbps") == 0)
+            config->shape_conn_kbps = (uint32_t)atoi(value);
+        else if (strcmp(key, "shape_ip_kbps") == 0)
+            config->shape_ip_kbps = (uint32_t)atoi(value);
+        else if (strcmp(key, "shape_min_size_kb") == 0)
+            config->shape_min_size_kb = (uint32_t)atoi(value);
+        else if (strcmp(key, "shape_mime") == 0)
+            copy_value(config->shape_mime, sizeof(config->shape_mime), value);
+        else if (strcmp(key, "access_log") == 0)
+            copy_value(config->access_log, sizeof(config->access_log), value);
+        else if (strcmp(key, "binary_access_log") == 0)
+            copy_value(config->binary_access_log, sizeof(config->binary_access_log), value);
+        else if (strcmp(key, "log_overflow") == 0)
+            config->log_block = strcmp(value, "block") == 0;
+        else if (strcmp(key, "log_sampling") == 0)
+            config->log_sampling = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(key, "log_rotate_size_mb") == 0)
+            config->log_rotate_size_mb = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(key, "log_rotate_interval") == 0)
+            config->log_rotate_interval = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(key, "log_rotate_keep") == 0)
+            config->log_rotate_keep = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(key, "metrics_path") == 0)
+            copy_value(config->metrics_path, sizeof(config->metrics_path), value);
+        else if (strcmp(key, "slow_request_ms") == 0)
+            config->slow_request_ms = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(key, "server_timing") == 0)
+            config->server_timing = parse_bool(value);
+        else if (strcmp(key, "heavy_hitters") == 0)
+            config->heavy_hitters = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(key, "heavy_hitters_half_life") == 0)
+            config->heavy_hitters_half_life = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(key, "request_checks") == 0)
+            copy_value(config->request_checks, sizeof(config->request_checks), value);
+        else if (strcmp(key, "methods") == 0)
+            copy_value(config->methods, sizeof(config->methods), value);
+        else if (strcmp(key, "max_request_size") == 0)
+            config->max_request_size = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(key, "security_config") == 0)
+            copy_value(config->security_config, sizeof(config->security_config), value);
+        else if (strcmp(key, "negative_cache") == 0)
+            config->negative_cache = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(key, "negative_cache_ttl") == 0)
+            config->negative_cache_ttl = (uint32_t)strtoul(value, NULL, 10);
+        else if (strcmp(key, "asset_pack") == 0)
+            copy_value(config->asset_pack, sizeof(config->asset_pack), value);
+    }
+
+    fclose(f);
+    return true;
+}
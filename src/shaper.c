@@ -0,0 +1,189 @@
+#include "shaper.h"
+#include "rate_limiter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define SHAPE_CHUNK     (64 * 1024)     /* Bytes sent per paced step */
+#define MAX_SHAPE_MIME  8
+
+/* Egress shaper
+ *
+ * Shaped bodies go out in fixed chunks. Before each chunk the per-client
+ * pacer (a GCRA limiter counting KiB) reserves the chunk and says how long
+ * to wait, and the connection sleeps to its own schedule. Where available,
+ * SO_MAX_PACING_RATE also asks the kernel to spread each chunk out on the
+ * wire; it is only a hint, as the kernel accepts it for sockets it never
+ * paces (loopback, for one), so the schedule is always kept.
+ */
+struct shaper {
+    uint32_t conn_kbps;
+    size_t min_size;
+    char mime[MAX_SHAPE_MIME][48];
+    size_t mime_count;
+    rate_limiter_t *ip_pacer;   /* NULL without a per-client rate */
+};
+
+/* Monotonic time in microseconds */
+static uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Sleep for a number of microseconds */
+static void sleep_usec(uint64_t usec) {
+    struct timespec ts = {
+        .tv_sec = usec / 1000000,
+        .tv_nsec = (usec % 1000000) * 1000
+    };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+/* Create shaper */
+shaper_t *shaper_create(const shaper_config_t *config) {
+    if (!config) return NULL;
+
+    shaper_t *shaper = calloc(1, sizeof(*shaper));
+    if (!shaper) return NULL;
+
+    shaper->conn_kbps = config->conn_kbps;
+    shaper->min_size = (size_t)config->min_size_kb * 1024;
+
+    /* Split MIME prefix list */
+    const char *p = config->mime ? config->mime : "";
+    while (*p) {
+        while (*p == ',' || *p == ' ') p++;
+        if (!*p) break;
+
+        size_t len = strcspn(p, ", ");
+        if (len >= sizeof(shaper->mime[0]) || shaper->mime_count >= MAX_SHAPE_MIME) {
+            free(shaper);
+            return NULL;
+        }
+        memcpy(shaper->mime[shaper->mime_count], p, len);
+        shaper->mime[shaper->mime_count++][len] = '\0';
+        p += len;
+    }
+
+    /* Per-client pacer: ip_kbps KiB per second, one chunk of burst */
+    if (config->ip_kbps) {
+        rate_limit_config_t pacer_config = {
+            .requests_per_window = config->ip_kbps,
+            .burst_size = SHAPE_CHUNK / 1024,
+            .window_seconds = 1
+        };
+
+        if (config->shm_name) {
+            char name[96];
+            snprintf(name, sizeof(name), "%s-shape", config->shm_name);
+            shaper->ip_pacer = rate_limiter_create_shared(&pacer_config, name);
+        } else {
+            shaper->ip_pacer = rate_limiter_create(&pacer_config);
+        }
+        if (!shaper->ip_pacer) {
+            free(shaper);
+            return NULL;
+        }
+    }
+
+    return shaper;
+}
+
+/* Clean up shaper */
+void shaper_destroy(shaper_t *shaper) {
+    if (!shaper) return;
+    rate_limiter_destroy(shaper->ip_pacer);
+    free(shaper);
+}
+
+/* Decide whether a response body is shaped
+ *
+ * With neither a size threshold nor MIME classes configured, every body
+ * is shaped; otherwise bodies matching either one are.
+ */
+bool shaper_applies(const shaper_t *shaper, const char *mime_type, size_t size) {
+    if (!shaper) return false;
+    if (!shaper->min_size && !shaper->mime_count) return true;
+    if (shaper->min_size && size >= shaper->min_size) return true;
+
+    for (size_t i = 0; i < shaper->mime_count; i++) {
+        if (mime_type && strncmp(mime_type, shaper->mime[i], strlen(shaper->mime[i])) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Copy up to len bytes of a file to the socket */
+static ssize_t send_chunk(int client_fd, int file_fd, off_t *offset, size_t len) {
+#ifdef __linux__
+    return sendfile(client_fd, file_fd, offset, len);
+#else
+    char buf[16384];
+    ssize_t n = pread(file_fd, buf, len < sizeof(buf) ? len : sizeof(buf), *offset);
+    if (n <= 0) return n;
+
+    ssize_t written = write(client_fd, buf, n);
+    if (written > 0) *offset += written;
+    return written;
+#endif
+}
+
+/* Send a file body, shaped or at full speed, returning bytes sent */
+size_t shaper_send_file(shaper_t *shaper, int client_fd, int file_fd, size_t size,
+                        const struct in_addr *addr, bool shaped) {
+    return shaper_send_range(shaper, client_fd, file_fd, 0, size, addr, shaped);
+}
+
+/* Send size bytes of a file from offset, as shaper_send_file() does */
+size_t shaper_send_range(shaper_t *shaper, int client_fd, int file_fd, off_t offset,
+                         size_t size, const struct in_addr *addr, bool shaped) {
+    size_t sent = 0;
+    uint64_t start = 0;
+
+    shaped = shaped && shaper;
+    if (shaped && shaper->conn_kbps) {
+#ifdef SO_MAX_PACING_RATE
+        unsigned int rate = shaper->conn_kbps * 1024;
+        setsockopt(client_fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate));
+#endif
+        start = now_usec();
+    }
+
+    while (sent < size) {
+        size_t chunk = size - sent;
+
+        if (shaped) {
+            if (chunk > SHAPE_CHUNK) chunk = SHAPE_CHUNK;
+
+            /* Wait for the client's share of bandwidth */
+            if (shaper->ip_pacer) {
+                uint64_t delay = rate_limiter_reserve(shaper->ip_pacer, addr,
+                                                      (uint32_t)((chunk + 1023) / 1024));
+                if (delay) sleep_usec(delay);
+            }
+
+            /* Hold the connection to its own schedule */
+            if (shaper->conn_kbps) {
+                uint64_t due = start + (uint64_t)sent * 1000000 /
+                               ((uint64_t)shaper->conn_kbps * 1024);
+                uint64_t now = now_usec();
+                if (due > now) sleep_usec(due - now);
+            }
+        }
+
+        ssize_t n = send_chunk(client_fd, file_fd, &offset, chunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        sent += n;
+    }
+
+    return sent;
+}
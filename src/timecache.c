@@ -0,0 +1,95 @@
+#include "timecache.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+#define TIME_SLOTS 64   /* Published strings kept before a slot is reused */
+
+/* Formatted strings for one second */
+typedef struct {
+    time_t sec;
+    char log[TIMECACHE_LOG_LEN];
+    char http[TIMECACHE_HTTP_LEN];
+} time_slot_t;
+
+/* Cached wall clock
+ *
+ * One thread at a time formats the new second into the next slot and then
+ * publishes its index; readers load the index and copy from that slot
+ * without locking. A slot is rewritten only after TIME_SLOTS more seconds
+ * have been published, far longer than any reader holds it.
+ */
+static time_slot_t slots[TIME_SLOTS];
+static uint32_t current = 0;
+static uint32_t updating = 0;
+
+/* Current wall clock second, from the cheapest clock available */
+static time_t wall_seconds(void) {
+    struct timespec ts;
+#ifdef CLOCK_REALTIME_COARSE
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    return ts.tv_sec;
+}
+
+/* Format a new second if the published one is stale */
+void timecache_update(void) {
+    time_t now = wall_seconds();
+    uint32_t index = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    if (slots[index].sec == now) return;
+
+    /* Another thread is already refreshing; its result is as good, but
+     * the very first one must be waited for */
+    uint32_t idle = 0;
+    if (!__atomic_compare_exchange_n(&updating, &idle, 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        while (__atomic_load_n(&current, __ATOMIC_ACQUIRE) == 0 &&
+               __atomic_load_n(&updating, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+        return;
+    }
+
+    index = __atomic_load_n(&current, __ATOMIC_RELAXED);
+    if (slots[index].sec != now) {
+        uint32_t next = (index + 1) % TIME_SLOTS;
+        time_slot_t *slot = &slots[next];
+        struct tm tm_info;
+
+        localtime_r(&now, &tm_info);
+        strftime(slot->log, sizeof(slot->log), "%Y-%m-%d %H:%M:%S", &tm_info);
+
+        /* RFC 7231 IMF-fixdate (the server never changes the C locale) */
+        gmtime_r(&now, &tm_info);
+        strftime(slot->http, sizeof(slot->http), "%a, %d %b %Y %H:%M:%S GMT", &tm_info);
+
+        slot->sec = now;
+        __atomic_store_n(&current, next, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&updating, 0, __ATOMIC_RELEASE);
+}
+
+/* Get the current slot, refreshing it at most once per second */
+static const time_slot_t *current_slot(void) {
+    timecache_update();
+    return &slots[__atomic_load_n(&current, __ATOMIC_ACQUIRE)];
+}
+
+/* Current wall clock second */
+time_t timecache_now(void) {
+    return current_slot()->sec;
+}
+
+/* Local time formatted for log lines */
+void timecache_log_time(char buf[TIMECACHE_LOG_LEN]) {
+    memcpy(buf, current_slot()->log, TIMECACHE_LOG_LEN);
+}
+
+/* Current time formatted for the HTTP Date header */
+void timecache_http_date(char buf[TIMECACHE_HTTP_LEN]) {
+    memcpy(buf, current_slot()->http, TIMECACHE_HTTP_LEN);
+}
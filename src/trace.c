@@ -0,0 +1,120 @@
+#include "trace.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <errno.h>
+
+#define CALIBRATE_USEC 5000     /* Time spent measuring the TSC rate */
+
+static const char *stage_names[TRACE_STAGE_COUNT] = {
+    "read", "parse", "check", "limit", "path", "open", "send"
+};
+
+/* Request tracing
+ *
+ * Stage boundaries are read straight from the TSC (a few ns, no vDSO
+ * call) and kept as raw ticks; they are only converted to microseconds
+ * when a request finishes, using a rate measured once against the
+ * monotonic clock. Without a TSC the ticks are monotonic nanoseconds.
+ */
+static double ticks_per_usec = 1000.0;
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+
+static uint64_t monotonic_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Measure the tick rate against the monotonic clock */
+static void calibrate(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ns_start = monotonic_nsec();
+    uint64_t tsc_start = trace_ticks();
+
+    struct timespec ts = { 0, CALIBRATE_USEC * 1000 };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+
+    uint64_t tsc_end = trace_ticks();
+    uint64_t ns_end = monotonic_nsec();
+    if (ns_end > ns_start && tsc_end > tsc_start) {
+        ticks_per_usec = (double)(tsc_end - tsc_start) * 1000.0 / (double)(ns_end - ns_start);
+    }
+#endif
+}
+
+/* Calibrate the tick rate up front rather than on the first request */
+void trace_init(void) {
+    pthread_once(&calibrate_once, calibrate);
+}
+
+const char *trace_stage_name(trace_stage_t stage) {
+    return stage < TRACE_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+static uint32_t ticks_to_usec(uint64_t ticks) {
+    trace_init();
+    double usec = (double)ticks / ticks_per_usec;
+    return usec < 4294967295.0 ? (uint32_t)usec : UINT32_MAX;
+}
+
+/* Time spent in one stage */
+uint32_t trace_stage_usec(const request_trace_t *trace, trace_stage_t stage) {
+    return stage < TRACE_STAGE_COUNT ? ticks_to_usec(trace->ticks[stage]) : 0;
+}
+
+/* Time from trace_begin to the last mark */
+uint32_t trace_total_usec(const request_trace_t *trace) {
+    return ticks_to_usec(trace->mark - trace->start);
+}
+
+/* Time since an earlier trace_ticks() reading */
+uint32_t trace_since_usec(uint64_t ticks) {
+    return ticks_to_usec(trace_ticks() - ticks);
+}
+
+/* Convert a tick count to nanoseconds, for spans too short for microseconds */
+uint64_t trace_ticks_nsec(uint64_t ticks) {
+    trace_init();
+    return (uint64_t)((double)ticks * 1000.0 / ticks_per_usec);
+}
+
+/* "read=12 parse=3 ..." in microseconds, for the slow request log */
+size_t trace_breakdown(const request_trace_t *trace, char *buf, size_t size) {
+    size_t len = 0;
+    if (size) buf[0] = '\0';
+
+    for (int i = 0; i < TRACE_STAGE_COUNT && len < size; i++) {
+        if (!trace_ran(trace, i)) continue;
+        int n = snprintf(buf + len, size - len, "%s%s=%u", len ? " " : "",
+                         stage_names[i], trace_stage_usec(trace, i));
+        if (n < 0) break;
+        len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+    }
+    return len;
+}
+
+/* Server-Timing header line for the stages run so far, in milliseconds */
+size_t trace_server_timing(const request_trace_t *trace, char *buf, size_t size) {
+    size_t len = 0;
+    if (size) buf[0] = '\0';
+
+    for (int i = 0; i < TRACE_STAGE_COUNT && len < size; i++) {
+        if (!trace_ran(trace, i)) continue;
+        int n = snprintf(buf + len, size - len, "%s%s;dur=%.3f",
+                         len ? ", " : "Server-Timing: ", stage_names[i],
+                         trace_stage_usec(trace, i) / 1000.0);
+        if (n < 0) break;
+        len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+    }
+
+    /* Only emit complete lines */
+    if (len && len + 3 <= size) {
+        buf[len++] = '\r';
+        buf[len++] = '\n';
+        buf[len] = '\0';
+    } else {
+        len = 0;
+        if (size) buf[0] = '\0';
+    }
+    return len;
+}
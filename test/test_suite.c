@@ -6,15 +6,33 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include "../include/server.h"
 #include "../include/http.h"
 #include "../include/security.h"
 #include "../include/security_config.h"
+#include "../include/rate_limiter.h"
+#include "../include/admission.h"
+#include "../include/concurrency_limiter.h"
+#include "../include/shaper.h"
+#include "../include/logger.h"
+#include "../include/timecache.h"
+#include "../include/access_log.h"
+#include "../include/access_log_reader.h"
+#include "../include/metrics.h"
+#include "../include/trace.h"
+#include "../include/heavy_hitters.h"
+#include "../include/pattern_set.h"
+#include "../include/request_validator.h"
+#include "../include/negative_cache.h"
+#include "../include/asset_pack.h"
 
 /* Debug logging */
 #define DEBUG(fmt, ...) \
@@ -36,8 +54,11 @@ static volatile bool server_running = false;
 
 /* Forward declarations */
 static void stop_test_server(void);
-static bool start_test_server(void);
+static bool start_test_server(const char *asset_pack, const char *security_config);
+static bool launch_test_server(const server_config_t *config);
 static int send_test_request(const char *request);
+static unsigned long long metric_value(const char *text, const char *sample);
+static char *render_metrics(void);
 
 /* Server thread function */
 static void *run_test_server(void *arg) {
@@ -54,27 +75,40 @@ static void *run_test_server(void *arg) {
 static void stop_test_server(void) {
     DEBUG("Stopping test server");
     if (test_server) {
-        server_destroy(test_server);
+        server_stop(test_server);
         if (server_running) {
             pthread_join(server_thread, NULL);
         }
+        server_destroy(test_server);
         test_server = NULL;
         server_running = false;
     }
     DEBUG("Server stopped");
 }
 
-/* Start test server */
-static bool start_test_server(void) {
+/* Start test server, serving www or an asset pack; with a security
+ * configuration the injection pattern check runs too */
+static bool start_test_server(const char *asset_pack, const char *security_config) {
     DEBUG("Starting test server");
     server_config_t config = {
         .port = 8080,
         .bind_addr = "127.0.0.1",
         .root_dir = "www",
-        .max_requests = 60
+        .max_requests = 60,
+        .negative_cache = 64
     };
+    if (asset_pack) snprintf(config.asset_pack, sizeof(config.asset_pack), "%s", asset_pack);
+    if (security_config) {
+        snprintf(config.request_checks, sizeof(config.request_checks),
+                 "method, length, bytes, rate, path, patterns");
+        snprintf(config.security_config, sizeof(config.security_config), "%s", security_config);
+    }
+    return launch_test_server(&config);
+}
 
-    test_server = server_create(&config);
+/* Start the test server with the given configuration */
+static bool launch_test_server(const server_config_t *config) {
+    test_server = server_create(config);
     if (!test_server) {
         DEBUG("Failed to create server");
         return false;
@@ -154,6 +188,17 @@ TEST(server_create) {
     });
     bool result = (server != NULL);
     server_destroy(server);
+
+    /* A route that costs more than the burst could never be served */
+    server = server_create(&(server_config_t){
+        .port = 8081,
+        .bind_addr = "127.0.0.1",
+        .root_dir = "www",
+        .max_requests = 60,
+        .route_costs = "/downloads/:100"
+    });
+    result = result && server == NULL;
+    server_destroy(server);
     return result;
 }
 
@@ -229,12 +274,345 @@ TEST(http_error_response) {
     bool has_error = (strstr(response, "400 Bad Request") != NULL) ||
                     (strstr(response, "400 Error") != NULL && 
                      strstr(response, "Bad Request") != NULL);
+    has_error = has_error && strstr(response, "\r\nDate: ") != NULL;
     
     DEBUG("Response %s error message", has_error ? "contains" : "does not contain");
     return has_error;
 }
 
+/* Send a request in pieces and return the response status, or -1 */
+static int request_status(const char *head, const char *rest) {
+    int sock = send_test_request(head);
+    if (sock < 0) return -1;
+    if (rest) {
+        usleep(20000);
+        if (write(sock, rest, strlen(rest)) < 0) {
+            close(sock);
+            return -1;
+        }
+    }
+
+    char response[256] = {0};
+    ssize_t n = read(sock, response, sizeof(response) - 1);
+    close(sock);
+
+    int status = -1;
+    if (n > 0 && sscanf(response, "HTTP/1.1 %d", &status) != 1) status = -1;
+    return status;
+}
+
+TEST(request_checks) {
+    char *before = render_metrics();
+    if (!before) return false;
+
+    /* Queries no longer make the path unservable; bad bytes are turned
+     * away before any file is opened, and patterns are not scanned for
+     * unless asked */
+    bool ok = request_status("GET /index.html?v=2 HTTP/1.1\r\n\r\n", NULL) == 200 &&
+              request_status("GET /index.html?q=\"x\" HTTP/1.1\r\n\r\n", NULL) == 400 &&
+              request_status("GET /%2e%2e/index.html HTTP/1.1\r\n\r\n", NULL) == 403 &&
+              request_status("GET /index.html?q=%3Cscript%3E HTTP/1.1\r\n\r\n", NULL) == 200;
+
+    /* Percent-encoded filenames are decoded rather than refused */
+    FILE *f = fopen("www/release notes.txt", "w");
+    if (f) {
+        fputs("notes", f);
+        fclose(f);
+    }
+    ok = ok && request_status("GET /release%20notes.txt HTTP/1.1\r\n\r\n", NULL) == 200;
+    unlink("www/release notes.txt");
+
+    /* A directory named like a file has no body to serve */
+    mkdir("www/listing.html", 0755);
+    ok = ok && request_status("GET /listing.html HTTP/1.1\r\n\r\n", NULL) == 404;
+    rmdir("www/listing.html");
+
+    /* A body the client stops reading is logged and counted as short */
+    const char *short_sends = "\nzircon_short_responses_total ";
+    int big = open("www/large.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok = ok && big >= 0 && ftruncate(big, 64 << 20) == 0;
+    if (big >= 0) close(big);
+    int sock = send_test_request("GET /large.txt HTTP/1.1\r\n\r\n");
+    char first[64];
+    ok = ok && sock >= 0 && read(sock, first, sizeof(first)) > 0;
+    if (sock >= 0) {
+        struct linger abort_close = { 1, 0 };
+        setsockopt(sock, SOL_SOCKET, SO_LINGER, &abort_close, sizeof(abort_close));
+        close(sock);
+    }
+    bool counted = false;
+    for (int i = 0; ok && !counted && i < 50; i++) {
+        char *now = render_metrics();
+        counted = now && metric_value(now, short_sends) > metric_value(before, short_sends);
+        free(now);
+        if (!counted) usleep(20000);
+    }
+    ok = ok && counted;
+    unlink("www/large.txt");
+
+    /* A missing file is looked for once, then refused by the path check */
+    ok = ok && request_status("GET /no-such-page.html HTTP/1.1\r\n\r\n", NULL) == 404 &&
+               request_status("GET /no-such-page.html HTTP/1.1\r\n\r\n", NULL) == 404;
+
+    /* Bodies are checked against the size limit up front */
+    ok = ok && request_status("POST /index.html HTTP/1.1\r\n"
+                              "content-length: 2000000\r\n\r\n", NULL) == 413;
+
+    /* With the pattern check, queries and bodies are decoded and scanned
+     * for whole words, bodies as they arrive across reads and only until
+     * the body timeout */
+    char rules[] = "/tmp/zircon-rules-XXXXXX";
+    int fd = mkstemp(rules);
+    if (fd < 0) return false;
+    const char timeout[] = "timeout_seconds=1\n";
+    ok = ok && write(fd, timeout, sizeof(timeout) - 1) == (ssize_t)(sizeof(timeout) - 1);
+    close(fd);
+    stop_test_server();
+    ok = start_test_server(NULL, rules) && ok;
+    unlink(rules);
+
+    ok = ok && request_status("GET /index.html?sort=updated HTTP/1.1\r\n\r\n", NULL) == 200 &&
+               request_status("GET /index.html?page=selection HTTP/1.1\r\n\r\n", NULL) == 200 &&
+               request_status("GET /index.html?d=2024--01 HTTP/1.1\r\n\r\n", NULL) == 200 &&
+               request_status("GET /index.html?q=1+union+all HTTP/1.1\r\n\r\n", NULL) == 200 &&
+               request_status("GET /index.html?q=%3Cscript%3E HTTP/1.1\r\n\r\n", NULL) == 403 &&
+               request_status("POST /index.html HTTP/1.1\r\n"
+                              "Content-Length: 24\r\n\r\nname=a&note=<scr",
+                              "ipt>x</b>") == 403 &&
+               request_status("POST /index.html HTTP/1.1\r\n"
+                              "Content-Length: 29\r\n\r\nnote=please",
+                              "+delete+my+account") == 200 &&
+               request_status("POST /index.html HTTP/1.1\r\n"
+                              "Content-Length: 24\r\n\r\nname=a&note=", NULL) == 408;
+    stop_test_server();
+    ok = start_test_server(NULL, NULL) && ok;
+
+    /* Each rejection is counted against the check that made it */
+    char *after = render_metrics();
+    const char *bytes = "zircon_check_rejections_total{check=\"bytes\"} ";
+    const char *patterns = "zircon_check_rejections_total{check=\"patterns\"} ";
+    const char *length = "zircon_check_rejections_total{check=\"length\"} ";
+    const char *path = "zircon_check_rejections_total{check=\"path\"} ";
+    ok = ok && after &&
+         metric_value(after, path) - metric_value(before, path) == 1 &&
+         metric_value(after, bytes) - metric_value(before, bytes) == 2 &&
+         metric_value(after, patterns) - metric_value(before, patterns) == 3 &&
+         metric_value(after, length) - metric_value(before, length) == 1 &&
+         strstr(after, "zircon_check_seconds_total{check=\"method\"} ");
+    free(before);
+    free(after);
+    return ok;
+}
+
+TEST(request_validator) {
+    http_request_t post = { .method = HTTP_POST, .path = "/form.html?a=1&b=two" };
+    http_request_t bad = { .method = HTTP_GET, .path = "/docs/../../index.html" };
+    http_request_t unknown = { .method = HTTP_UNSUPPORTED, .path = "/" };
+
+    char longest[MAX_PATH_LENGTH + 2];
+    memset(longest, 'a', sizeof(longest) - 1);
+    longest[0] = '/';
+    longest[sizeof(longest) - 1] = '\0';
+
+    return validate_request(&post).valid &&
+           !validate_request(&bad).valid && !validate_request(&unknown).valid &&
+           is_path_safe("/") && is_path_safe("/css/site-v2.min.css") &&
+           !is_path_safe("/../etc/passwd") && !is_path_safe("/a\\b") &&
+           !is_path_safe("/a%2fb") && !is_path_safe("index.html") &&
+           !is_path_safe(longest) && (longest[MAX_PATH_LENGTH] = '\0', is_path_safe(longest)) &&
+           is_query_safe(NULL) && is_query_safe("q=a%20b&x=%3Cs%3E") &&
+           !is_query_safe("q=a b") && !is_query_safe("q=<s>") && !is_query_safe("q=\x80");
+}
+
+/* Normalized form of a path, or NULL if it is refused */
+static const char *normalized(const char *target, normalized_path_t *path) {
+    return normalize_path(target, strlen(target), path) ? path->path : NULL;
+}
+
+TEST(normalize_path) {
+    normalized_path_t path;
+    const char *out;
+
+    /* Dot segments resolve and empty segments collapse; the query is not
+     * part of the path */
+    bool ok = (out = normalized("/a/./b//../c.min.css?v=1", &path)) &&
+              strcmp(out, "/a/c.min.css") == 0 && !path.directory &&
+              strcmp(path.path + path.extension, ".css") == 0;
+    ok = ok && (out = normalized("/docs/v1.2/..", &path)) &&
+               strcmp(out, "/docs/") == 0 && path.directory && path.extension == 0;
+    ok = ok && (out = normalized("/", &path)) && strcmp(out, "/") == 0 && path.directory;
+    ok = ok && (out = normalized("/.well-known/x", &path)) &&
+               strcmp(out, "/.well-known/x") == 0 && path.extension == 0;
+
+    /* Encoded filenames decode; encoded dots are still dot segments */
+    ok = ok && (out = normalized("/%7Euser/Release%20Notes%20(2).txt", &path)) &&
+               strcmp(out, "/~user/Release Notes (2).txt") == 0 &&
+               strcmp(path.path + path.extension, ".txt") == 0;
+    ok = ok && (out = normalized("/a/%2e%2E/b.html", &path)) && strcmp(out, "/b.html") == 0;
+
+    /* Long plain runs cross several SIMD blocks and stop at a separator */
+    ok = ok && (out = normalized("/abcdefghijklmnopqrstuvwxyz-ABCDEFGHIJKLMNOP_0123456789.js",
+                                 &path)) &&
+               strcmp(out, "/abcdefghijklmnopqrstuvwxyz-ABCDEFGHIJKLMNOP_0123456789.js") == 0 &&
+               strcmp(path.path + path.extension, ".js") == 0;
+    ok = ok && (out = normalized("/assets/0123456789abcdef/0123456789abcdef/../app.js", &path)) &&
+               strcmp(out, "/assets/0123456789abcdef/app.js") == 0;
+
+    /* Escaping the root, bad encodings and disallowed bytes are refused */
+    static const char *refused[] = {
+        "/..", "/a/../../b", "/%2e%2e/etc/passwd", "/a%2fb", "/a%5cb", "/a%00",
+        "/a%0a", "/a%2", "/a%zz.html", "/a\\b", "/a b", "/<x>", "/\x80", "relative"
+    };
+    for (size_t i = 0; ok && i < sizeof(refused) / sizeof(refused[0]); i++) {
+        ok = !normalized(refused[i], &path);
+    }
+
+    /* Depth is bounded, even when dots bring the path back up */
+    char deep[MAX_PATH_DEPTH * 2 + 8] = "";
+    for (int i = 0; i <= MAX_PATH_DEPTH; i++) strcat(deep, "/a");
+    strcat(deep, "/");
+    ok = ok && !normalized(deep, &path);
+    deep[MAX_PATH_DEPTH * 2 + 1] = '\0';
+    return ok && normalized(deep, &path) && path.directory;
+}
+
 /* Security tests */
+TEST(negative_cache) {
+    char root[] = "/tmp/zircon-negXXXXXX";
+    if (!mkdtemp(root)) return false;
+    negative_cache_t *cache = negative_cache_create(8, 60, root);
+    if (!cache) return false;
+
+    /* Whole keys are compared, and a path can be refused anew */
+    negative_cache_insert(cache, "/wp-login.html", 14, 404);
+    negative_cache_insert(cache, "/.git/config.txt", 16, 403);
+    bool ok = negative_cache_lookup(cache, "/wp-login.html", 14) == 404 &&
+              negative_cache_lookup(cache, "/wp-login.htm", 13) == 0 &&
+              negative_cache_lookup(cache, "/.git/config.txt", 16) == 403;
+    negative_cache_insert(cache, "/wp-login.html", 14, 403);
+    ok = ok && negative_cache_lookup(cache, "/wp-login.html", 14) == 403;
+
+    /* Paths too long to keep are never cached */
+    char long_path[NEGATIVE_CACHE_KEY_MAX + 2];
+    memset(long_path, 'a', sizeof(long_path) - 1);
+    long_path[0] = '/';
+    negative_cache_insert(cache, long_path, sizeof(long_path) - 1, 404);
+    ok = ok && negative_cache_lookup(cache, long_path, sizeof(long_path) - 1) == 0;
+
+    /* Memory is fixed: many paths evict older ones, keeping the newest */
+    char path[32];
+    for (int i = 0; i < 1000; i++) {
+        int len = snprintf(path, sizeof(path), "/scan/%d.html", i);
+        negative_cache_insert(cache, path, (size_t)len, 404);
+    }
+    ok = ok && negative_cache_lookup(cache, path, strlen(path)) == 404;
+
+    negative_cache_clear(cache);
+    ok = ok && negative_cache_lookup(cache, path, strlen(path)) == 0;
+
+    /* A file appearing in the root empties the cache within a second */
+    negative_cache_insert(cache, "/new.html", 9, 404);
+    ok = ok && negative_cache_lookup(cache, "/new.html", 9) == 404;
+    char file[64];
+    snprintf(file, sizeof(file), "%s/new.html", root);
+    FILE *f = fopen(file, "w");
+    if (f) fclose(f);
+    time_t start = timecache_now();
+    while (timecache_now() == start) usleep(10000);
+    negative_cache_stats_t stats;
+    ok = ok && negative_cache_lookup(cache, "/new.html", 9) == 0;
+    negative_cache_stats(cache, &stats);
+    ok = ok && stats.clears == 1 && stats.hits == 5;
+
+    negative_cache_destroy(cache);
+    unlink(file);
+    rmdir(root);
+    return ok && !negative_cache_create(0, 60, root) && !negative_cache_create(8, 0, root);
+}
+
+/* Send a request and read the whole response, returning its length */
+static size_t fetch(const char *request, char *response, size_t size) {
+    size_t len = 0;
+    int sock = send_test_request(request);
+    if (sock >= 0) {
+        ssize_t n;
+        while (len < size - 1 && (n = read(sock, response + len, size - 1 - len)) > 0) {
+            len += (size_t)n;
+        }
+        close(sock);
+    }
+    response[len] = '\0';
+    return len;
+}
+
+TEST(asset_pack) {
+    static const char pack[] = "/tmp/zircon-test.pack";
+    static const char page[] = "<html><body>Packed</body></html>";
+    static const char zipped[] = "(gzip stand-in)";
+
+    asset_pack_writer_t *writer = asset_pack_writer_create(pack);
+    bool ok = writer &&
+              asset_pack_writer_add(writer, "/index.html", page, sizeof(page) - 1,
+                                    zipped, sizeof(zipped) - 1) &&
+              asset_pack_writer_add(writer, "/docs/guide.txt", "guide", 5, NULL, 0) &&
+              asset_pack_writer_add(writer, "/empty.txt", "", 0, NULL, 0) &&
+              asset_pack_writer_finish(writer);
+
+    /* A path may only be packed once */
+    writer = asset_pack_writer_create("/tmp/zircon-dup.pack");
+    ok = ok && writer && asset_pack_writer_add(writer, "/a.txt", "a", 1, NULL, 0) &&
+         asset_pack_writer_add(writer, "/a.txt", "b", 1, NULL, 0) &&
+         !asset_pack_writer_finish(writer) && access("/tmp/zircon-dup.pack", F_OK) != 0;
+
+    /* Lookups point into the mapping; variants have their own ETags */
+    asset_pack_t *opened = asset_pack_open(pack);
+    asset_t asset, zipped_asset;
+    ok = ok && opened && asset_pack_count(opened) == 3 &&
+         asset_pack_find(opened, "/docs/guide.txt", 15, &asset) &&
+         asset.body_size == 5 && memcmp(asset.body, "guide", 5) == 0 && !asset.gzip &&
+         strcmp(asset.mime, "text/plain") == 0 &&
+         !asset_pack_find(opened, "/docs/guide.tx", 14, &asset) &&
+         asset_pack_find(opened, "/index.html", 11, &zipped_asset) &&
+         zipped_asset.gzip_size == sizeof(zipped) - 1 &&
+         strcmp(zipped_asset.etag, zipped_asset.gzip_etag) != 0 &&
+         strstr(zipped_asset.headers, "Content-Length: 32\r\n") &&
+         strstr(zipped_asset.gzip_headers, "Content-Encoding: gzip\r\n");
+    asset_pack_close(opened);
+
+    /* Served from the pack alone, with gzip only when accepted */
+    char response[2048], request[256];
+    stop_test_server();
+    ok = ok && start_test_server(pack, NULL);
+    ok = ok && fetch("GET / HTTP/1.1\r\n\r\n", response, sizeof(response)) &&
+         strncmp(response, "HTTP/1.1 200", 12) == 0 && strstr(response, "\r\n\r\n<html>") &&
+         !strstr(response, "Content-Encoding");
+    ok = ok && fetch("GET /index.html HTTP/1.1\r\nAccept-Encoding: br, gzip\r\n\r\n",
+                     response, sizeof(response)) &&
+         strstr(response, "Content-Encoding: gzip\r\n") && strstr(response, zipped);
+    ok = ok && fetch("HEAD /docs/guide.txt HTTP/1.1\r\n\r\n", response, sizeof(response)) &&
+         strstr(response, "Content-Length: 5\r\n") && !strstr(response, "guide");
+    ok = ok && request_status("GET /docs/missing.txt HTTP/1.1\r\n\r\n", NULL) == 404 &&
+         request_status("GET /empty.txt HTTP/1.1\r\n\r\n", NULL) == 200;
+
+    /* Revalidation against the content ETag */
+    const char *etag = strstr(response, "ETag: ");
+    request[0] = '\0';
+    if (etag) {
+        snprintf(request, sizeof(request),
+                 "HEAD /docs/guide.txt HTTP/1.1\r\nIf-None-Match: %.*s\r\n\r\n",
+                 (int)strcspn(etag + 6, "\r"), etag + 6);
+    }
+    ok = ok && etag && request_status(request, NULL) == 304;
+
+    stop_test_server();
+    ok = start_test_server(NULL, NULL) && ok;
+
+    /* Damaged packs are refused */
+    ok = ok && truncate(pack, 100) == 0 && !asset_pack_open(pack) && !asset_pack_open("/nonexistent");
+    unlink(pack);
+    return ok;
+}
+
 TEST(security_features) {
     /* Configure security */
     security_config_t config = {
@@ -271,8 +649,133 @@ TEST(security_features) {
         28
     );
 
+    /* Escapes are decoded first, and patterns only match whole words */
+    config.enable_rate_limit = false;
+    security_destroy(ctx);
+    ctx = security_create(&config);
+    if (!ctx) return false;
+    bool decoded = !security_check_request(ctx, "192.168.1.1", "GET", "/", "q=%3cScRiPt%3e",
+                                           NULL, 0) &&
+                   !security_check_request(ctx, "192.168.1.1", "GET", "/",
+                                           "id=1%27%20UNION%20SELECT%20pw", NULL, 0) &&
+                   security_check_request(ctx, "192.168.1.1", "GET", "/", "q=100%25+%zz%4",
+                                          NULL, 0);
+    bool bounded = security_check_request(ctx, "192.168.1.1", "GET", "/", "sort=updated",
+                                          NULL, 0) &&
+                   security_check_request(ctx, "192.168.1.1", "GET", "/",
+                                          "q=reunion+selection&d=2024--01", NULL, 0) &&
+                   security_check_request(ctx, "192.168.1.1", "POST", "/", NULL,
+                                          "note=please+delete+my+account", 29) &&
+                   !security_check_request(ctx, "192.168.1.1", "GET", "/", "u=admin'--",
+                                           NULL, 0);
+
+    security_destroy(ctx);
+    return sql_blocked && xss_blocked && decoded && bounded;
+}
+
+TEST(pattern_set) {
+    pattern_set_t *set = pattern_set_create();
+    if (!set) return false;
+
+    /* Overlapping patterns need the failure links to be found */
+    bool ok = pattern_set_add(set, "he", 0) && pattern_set_add(set, "SHE", 1) &&
+              pattern_set_add(set, "hers", 2) && pattern_set_add(set, "his", 3) &&
+              !pattern_set_add(set, "", 0) && pattern_set_compile(set);
+
+    ok = ok && pattern_set_scan(set, "USHERS", 6) == 0x7 &&
+               pattern_set_scan(set, "ahishers", 8) == 0xf &&
+               pattern_set_scan(set, "hhhhhis", 7) == 0x8 &&
+               pattern_set_scan(set, "h-e-r-s", 7) == 0 &&
+               pattern_set_scan(set, "hers", 3) == 0x1;
+
+    /* Long inputs are scanned in interleaved pieces; a match must be found
+     * wherever it falls relative to the cuts */
+    char long_input[1001];
+    memset(long_input, 'x', sizeof(long_input));
+    for (size_t at = 0; ok && at + 3 <= sizeof(long_input); at++) {
+        memcpy(long_input + at, "HiS", 3);
+        ok = pattern_set_scan(set, long_input, sizeof(long_input)) == 0x8;
+        memset(long_input + at, 'x', 3);
+    }
+    pattern_set_destroy(set);
+
+    /* Configured rules join the built-in sets, spaces included */
+    char path[] = "/tmp/zircon-rules-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return false;
+    const char rules[] = "enable_xss_protection=1\nsql_pattern=WAITFOR DELAY\nxss_pattern=<iframe\n";
+    ok = ok && write(fd, rules, sizeof(rules) - 1) == (ssize_t)(sizeof(rules) - 1);
+    close(fd);
+
+    security_config_t config;
+    ok = ok && security_config_load(&config, path) && config.rule_count == 2;
+    unlink(path);
+
+    /* A pattern too long to keep fails the load instead of vanishing */
+    char bad_path[] = "/tmp/zircon-rules-XXXXXX";
+    fd = mkstemp(bad_path);
+    if (fd < 0) return false;
+    char bad[SECURITY_RULE_LEN + 32];
+    int bad_len = snprintf(bad, sizeof(bad), "sql_pattern=%0*d\n", SECURITY_RULE_LEN, 0);
+    ok = ok && write(fd, bad, bad_len) == bad_len;
+    close(fd);
+    security_config_t rejected;
+    ok = ok && !security_config_load(&rejected, bad_path);
+    unlink(bad_path);
+
+    config.enable_rate_limit = false;
+
+    security_ctx_t *ctx = security_create(&config);
+    if (!ctx) return false;
+    ok = ok && !security_check_request(ctx, "192.0.2.1", "GET", "/", "x=1;waitfor delay '0:0:5'",
+                                       NULL, 0) &&
+               !security_check_request(ctx, "192.0.2.1", "POST", "/", NULL, "<IFRAME src=x>", 14) &&
+               security_check_request(ctx, "192.0.2.1", "GET", "/", "q=winter+boots&page=3",
+                                      NULL, 0);
     security_destroy(ctx);
-    return sql_blocked && xss_blocked;
+    return ok;
+}
+
+TEST(security_body_stream) {
+    security_config_t config = {
+        .enable_xss_protection = true,
+        .limits = {
+            .max_request_size = 4096
+        }
+    };
+    security_ctx_t *ctx = security_create(&config);
+    if (!ctx) return false;
+
+    /* A pattern split across chunks is still caught, on the chunk ending it */
+    security_body_t body;
+    security_body_begin(&body);
+    bool ok = security_body_feed(ctx, &body, "192.0.2.1", "comment=nice+post<scr", 21) &&
+              !security_body_feed(ctx, &body, "192.0.2.1", "IPT>alert(1)", 12);
+
+    /* Any chunking finds what a single scan of the whole body finds */
+    char text[2048];
+    for (size_t i = 0; i < sizeof(text); i++) text[i] = "abcdefgh+=&"[i % 11];
+    memcpy(text + 1529, "&javascript:", 12);    /* Straddles 64-byte chunks */
+    static const size_t chunk_sizes[] = { 1, 3, 10, 64, 100, 333, 2048 };
+    for (size_t c = 0; c < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); c++) {
+        security_body_begin(&body);
+        bool allowed = true;
+        for (size_t at = 0; allowed && at < sizeof(text); at += chunk_sizes[c]) {
+            size_t len = sizeof(text) - at < chunk_sizes[c] ? sizeof(text) - at : chunk_sizes[c];
+            allowed = security_body_feed(ctx, &body, "192.0.2.1", text + at, len);
+        }
+        ok = ok && !allowed && body.length >= 1541;
+    }
+
+    /* Oversized bodies are refused as soon as they cross the limit */
+    memset(text, 'a', sizeof(text));
+    security_body_begin(&body);
+    ok = ok && security_body_feed(ctx, &body, "192.0.2.1", text, 2048) &&
+               security_body_feed(ctx, &body, "192.0.2.1", text, 2048) &&
+               !security_body_feed(ctx, &body, "192.0.2.1", text, 1);
+
+    security_destroy(ctx);
+    return ok;
 }
 
 TEST(rate_limit) {
@@ -303,6 +806,378 @@ TEST(rate_limit) {
     return rate_limited;
 }
 
+TEST(rate_limiter_burst) {
+    /* 10 requests per minute, at most 5 back-to-back */
+    rate_limit_config_t config = {
+        .requests_per_window = 10,
+        .burst_size = 5,
+        .window_seconds = 60
+    };
+
+    rate_limiter_t *limiter = rate_limiter_create(&config);
+    if (!limiter) return false;
+
+    /* Exactly the burst is admitted, the next request is not */
+    bool ok = true;
+    for (int i = 0; i < 5; i++) {
+        ok = ok && rate_limiter_check(limiter, "192.168.1.1");
+    }
+    ok = ok && !rate_limiter_check(limiter, "192.168.1.1");
+
+    /* Other clients are tracked independently */
+    ok = ok && rate_limiter_check(limiter, "192.168.1.2");
+
+    /* A hashed (non-IPv4) client never shares the budget of the address
+     * its 32-bit hash spells */
+    uint32_t hash = 2166136261u;
+    for (const char *p = "2001:db8::1"; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    struct in_addr twin = { .s_addr = hash };
+    char twin_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &twin, twin_ip, sizeof(twin_ip));
+    for (int i = 0; i < 5; i++) {
+        ok = ok && rate_limiter_check(limiter, "2001:db8::1");
+    }
+    ok = ok && !rate_limiter_check(limiter, "2001:db8::1") &&
+               rate_limiter_check(limiter, twin_ip);
+
+    rate_limiter_destroy(limiter);
+    return ok;
+}
+
+TEST(rate_limiter_cost) {
+    /* Bandwidth-style budget: 100 units per minute, all usable at once */
+    rate_limit_config_t config = {
+        .requests_per_window = 100,
+        .burst_size = 100,
+        .window_seconds = 60
+    };
+
+    rate_limiter_t *limiter = rate_limiter_create(&config);
+    if (!limiter) return false;
+
+    struct in_addr bulk, small;
+    inet_pton(AF_INET, "192.168.1.1", &bulk);
+    inet_pton(AF_INET, "192.168.1.2", &small);
+
+    /* Weighted charges draw down the same budget */
+    bool ok = rate_limiter_check_cost(limiter, &bulk, 60) &&
+              !rate_limiter_check_cost(limiter, &bulk, 50) &&
+              rate_limiter_check_cost(limiter, &bulk, 40);
+
+    /* Post-paid charges put the client in debt without affecting others */
+    rate_limiter_charge(limiter, &bulk, 1000);
+    ok = ok && !rate_limiter_check_cost(limiter, &bulk, 0) &&
+               rate_limiter_check_cost(limiter, &small, 1);
+
+    rate_limiter_destroy(limiter);
+    return ok;
+}
+
+static uint64_t fake_clock(void *ctx) {
+    return *(uint64_t *)ctx;
+}
+
+TEST(rate_limiter_clock) {
+    /* One request per second, two back-to-back */
+    rate_limit_config_t config = {
+        .requests_per_window = 60,
+        .burst_size = 2,
+        .window_seconds = 60
+    };
+
+    rate_limiter_t *limiter = rate_limiter_create(&config);
+    if (!limiter) return false;
+
+    uint64_t now = 1000000;
+    rate_limiter_set_clock(limiter, fake_clock, &now);
+
+    bool ok = rate_limiter_check(limiter, "192.168.1.1") &&
+              rate_limiter_check(limiter, "192.168.1.1") &&
+              !rate_limiter_check(limiter, "192.168.1.1");
+
+    /* Credit accrues only as the injected clock advances */
+    now += 999999;
+    ok = ok && !rate_limiter_check(limiter, "192.168.1.1");
+    now += 1;
+    ok = ok && rate_limiter_check(limiter, "192.168.1.1") &&
+               !rate_limiter_check(limiter, "192.168.1.1");
+
+    /* An hour later the full burst is available again */
+    now += 3600ULL * 1000000;
+    ok = ok && rate_limiter_check(limiter, "192.168.1.1") &&
+               rate_limiter_check(limiter, "192.168.1.1");
+
+    ok = ok && rate_limiter_footprint(limiter) > 16384 * 16 &&
+               rate_limiter_table_full(limiter) == 0;
+
+    rate_limiter_destroy(limiter);
+    return ok;
+}
+
+/* Run checks for one client from a worker process, exit with allowed count */
+static void rate_limiter_worker(rate_limiter_t *limiter, int checks) {
+    int allowed = 0;
+    for (int i = 0; i < checks; i++) {
+        if (rate_limiter_check(limiter, "192.168.1.1"))
+            allowed++;
+    }
+    _exit(allowed > 255 ? 255 : allowed);
+}
+
+TEST(rate_limiter_shared) {
+    #define NUM_WORKERS 4
+    #define WORKER_CHECKS 100000
+    rate_limit_config_t config = {
+        .requests_per_window = 20,
+        .burst_size = 20,
+        .window_seconds = 60
+    };
+
+    /* Anonymous region, inherited by the forked workers */
+    rate_limiter_t *limiter = rate_limiter_create_shared(&config, NULL);
+    if (!limiter) return false;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pids[NUM_WORKERS];
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) return false;
+        if (pids[i] == 0) rate_limiter_worker(limiter, WORKER_CHECKS);
+    }
+
+    /* The burst must be shared, not granted once per process */
+    int total = 0;
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        int status;
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status))
+            return false;
+        total += WEXITSTATUS(status);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    DEBUG("%d workers: %d allowed, %.0f checks/sec", NUM_WORKERS, total,
+          NUM_WORKERS * WORKER_CHECKS / secs);
+
+    rate_limiter_destroy(limiter);
+
+    /* A named region lives until the last attached limiter is destroyed */
+    char name[64];
+    snprintf(name, sizeof(name), "/zircon-test-%d", (int)getpid());
+    rate_limiter_t *first = rate_limiter_create_shared(&config, name);
+    rate_limiter_t *second = rate_limiter_create_shared(&config, name);
+    if (!first || !second) return false;
+
+
+    /* A worker that dies without destroying its limiter does not keep the
+     * region alive */
+    pid_t crashed = fork();
+    if (crashed < 0) return false;
+    if (crashed == 0) _exit(rate_limiter_create_shared(&config, name) ? 0 : 1);
+    int status;
+    bool attached = waitpid(crashed, &status, 0) == crashed && WIFEXITED(status) &&
+                    WEXITSTATUS(status) == 0;
+
+    rate_limiter_destroy(first);
+    int fd = shm_open(name, O_RDWR, 0600);
+    bool kept = fd >= 0;
+    if (fd >= 0) close(fd);
+    rate_limiter_destroy(second);
+    bool removed = shm_open(name, O_RDWR, 0600) < 0 && errno == ENOENT;
+
+    /* A region its creator never initialized is replaced, while a live
+     * one of another size is refused rather than resized */
+    fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd >= 0) close(fd);
+    rate_limiter_t *replaced = rate_limiter_create_shared(&config, name);
+    bool recovered = replaced != NULL;
+    rate_limiter_destroy(replaced);
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    bool refused = fd >= 0 && ftruncate(fd, 4096) == 0 && flock(fd, LOCK_SH) == 0 &&
+                   !rate_limiter_create_shared(&config, name);
+    struct stat st;
+    refused = refused && fstat(fd, &st) == 0 && st.st_size == 4096;
+    if (fd >= 0) close(fd);
+    shm_unlink(name);
+
+    return total == 20 && attached && kept && removed && recovered && refused;
+}
+
+TEST(admission_control) {
+    admission_config_t config = {
+        .deny = "10.0.0.0/8",
+        .allow = "10.1.0.0/16",
+        .trust = "127.0.0.1",
+        .max_connections = 2
+    };
+
+    admission_t *adm = admission_create(&config);
+    if (!adm) return false;
+
+    struct in_addr denied, allowed, trusted, client;
+    inet_pton(AF_INET, "10.2.3.4", &denied);
+    inet_pton(AF_INET, "10.1.2.3", &allowed);
+    inet_pton(AF_INET, "127.0.0.1", &trusted);
+    inet_pton(AF_INET, "192.168.5.5", &client);
+
+    /* Longest prefix wins */
+    bool ok = admission_check(adm, &denied) == ADMIT_DENIED &&
+              admission_check(adm, &allowed) == ADMIT_OK;
+
+    /* Connection cap applies until a connection is released */
+    ok = ok && admission_check(adm, &client) == ADMIT_OK &&
+               admission_check(adm, &client) == ADMIT_OK &&
+               admission_check(adm, &client) == ADMIT_TOO_MANY_CONNECTIONS;
+    admission_release(adm, &client);
+    ok = ok && admission_check(adm, &client) == ADMIT_OK;
+
+    /* Trusted addresses are not capped */
+    for (int i = 0; i < 5; i++) {
+        ok = ok && admission_check(adm, &trusted) == ADMIT_OK;
+    }
+
+    admission_destroy(adm);
+    return ok;
+}
+
+TEST(concurrency_limiter) {
+    concurrency_config_t config = {
+        .min_limit = 1,
+        .max_limit = 4,
+        .initial_limit = 2
+    };
+
+    concurrency_limiter_t *limiter = concurrency_limiter_create(&config);
+    if (!limiter) return false;
+
+    /* Requests beyond the current limit are shed */
+    uint64_t a, b, c;
+    bool ok = concurrency_limiter_acquire(limiter, &a) &&
+              concurrency_limiter_acquire(limiter, &b) &&
+              !concurrency_limiter_acquire(limiter, &c);
+
+    concurrency_stats_t stats;
+    concurrency_limiter_stats(limiter, &stats);
+    ok = ok && stats.limit == 2 && stats.inflight == 2 && stats.shed == 1;
+
+    /* Fast completions at full utilization raise the limit */
+    concurrency_limiter_release(limiter, a, 0);
+    concurrency_limiter_release(limiter, b, 0);
+    concurrency_limiter_stats(limiter, &stats);
+    ok = ok && stats.inflight == 0 && stats.limit == 3;
+    concurrency_limiter_destroy(limiter);
+
+    /* One request at a time with an occasional slow one leaves the limit
+     * alone, however long it goes on */
+    config = (concurrency_config_t){ .min_limit = 2, .max_limit = 16, .initial_limit = 8 };
+    limiter = concurrency_limiter_create(&config);
+    if (!limiter) return false;
+    for (int i = 0; ok && i < 400; i++) {
+        ok = concurrency_limiter_acquire(limiter, &a);
+        concurrency_limiter_release(limiter, a, a + (i % 10 == 9 ? 200000 : 100));
+    }
+    concurrency_limiter_stats(limiter, &stats);
+    ok = ok && stats.limit == 8;
+
+    /* Slow completions with the limit in use lower it */
+    uint64_t starts[8];
+    for (int i = 0; ok && i < 8; i++) ok = concurrency_limiter_acquire(limiter, &starts[i]);
+    for (int i = 0; i < 8; i++) concurrency_limiter_release(limiter, starts[i], starts[i] + 200000);
+    concurrency_limiter_stats(limiter, &stats);
+    ok = ok && stats.limit < 8;
+
+    concurrency_limiter_destroy(limiter);
+    return ok;
+}
+
+TEST(shaper_classes) {
+    shaper_config_t config = {
+        .conn_kbps = 1024,
+        .min_size_kb = 1024,
+        .mime = "video/, application/zip"
+    };
+
+    shaper_t *shaper = shaper_create(&config);
+    if (!shaper) return false;
+
+    /* Large bodies and listed MIME classes are shaped, small pages are not */
+    bool ok = shaper_applies(shaper, "text/html", 2 * 1024 * 1024) &&
+              shaper_applies(shaper, "video/mp4", 1000) &&
+              shaper_applies(shaper, "application/zip", 1000) &&
+              !shaper_applies(shaper, "text/html", 1000) &&
+              !shaper_applies(NULL, "video/mp4", 1000);
+
+    shaper_destroy(shaper);
+    return ok;
+}
+
+/* Read a socket until the peer closes it */
+static void *drain_thread(void *arg) {
+    char buf[65536];
+    while (read(*(int *)arg, buf, sizeof(buf)) > 0);
+    return NULL;
+}
+
+/* Seconds until a shaped body of size bytes, sent as if to a client
+ * address, has been received */
+static double timed_shaped_send(shaper_t *shaper, int file_fd, size_t size, const char *ip,
+                                size_t *sent) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) return -1;
+    pthread_t reader;
+    pthread_create(&reader, NULL, drain_thread, &sv[1]);
+
+    struct in_addr addr;
+    inet_pton(AF_INET, ip, &addr);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *sent = shaper_send_file(shaper, sv[0], file_fd, size, &addr, true);
+    close(sv[0]);
+    pthread_join(reader, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(sv[1]);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+TEST(shaper_pacing) {
+    #define PACED_SIZE (320 * 1024)
+    char path[] = "/tmp/zircon-shape-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return false;
+    unlink(path);
+    static char body[PACED_SIZE];
+    bool ok = write(fd, body, sizeof(body)) == (ssize_t)sizeof(body);
+
+    /* Per connection: 320 KiB at 1 MiB/s takes at least the time of the
+     * four chunks after the first */
+    shaper_t *conn = shaper_create(&(shaper_config_t){ .conn_kbps = 1024 });
+    size_t sent = 0;
+    double secs = conn ? timed_shaped_send(conn, fd, PACED_SIZE, "192.168.1.1", &sent) : -1;
+    DEBUG("320 KiB at 1024 KiB/s per connection: %.3f s", secs);
+    ok = ok && sent == PACED_SIZE && secs >= 0.24 && secs < 2;
+    shaper_destroy(conn);
+
+    /* Per client: 1 MiB/s with one chunk of burst, shared by a client's
+     * connections but not with other clients */
+    shaper_t *ip = shaper_create(&(shaper_config_t){ .ip_kbps = 1024 });
+    double first = ip ? timed_shaped_send(ip, fd, 256 * 1024, "192.168.1.1", &sent) : -1;
+    ok = ok && sent == 256 * 1024 && first >= 0.18;
+    double again = ip ? timed_shaped_send(ip, fd, 64 * 1024, "192.168.1.1", &sent) : -1;
+    double other = ip ? timed_shaped_send(ip, fd, 64 * 1024, "192.168.1.2", &sent) : -1;
+    DEBUG("Per client pacer: %.3f s, same client %.3f s, other client %.3f s",
+          first, again, other);
+    ok = ok && again >= 0.05 && other >= 0 && other < 0.05;
+    shaper_destroy(ip);
+
+    close(fd);
+    return ok;
+}
+
 /* Integration tests */
 static void *client_thread(void *unused) {
     (void)unused;  /* Suppress unused parameter warning */
@@ -319,6 +1194,461 @@ static void *client_thread(void *unused) {
     return NULL;
 }
 
+TEST(timecache) {
+    char date[TIMECACHE_HTTP_LEN];
+    char stamp[TIMECACHE_LOG_LEN];
+    time_t now;
+
+    /* Read all three within one second */
+    do {
+        now = timecache_now();
+        timecache_http_date(date);
+        timecache_log_time(stamp);
+    } while (timecache_now() != now);
+
+    /* Cached strings match a fresh format of the same second */
+    struct tm tm_info;
+    char expect[64];
+    gmtime_r(&now, &tm_info);
+    strftime(expect, sizeof(expect), "%a, %d %b %Y %H:%M:%S GMT", &tm_info);
+    bool ok = strcmp(date, expect) == 0 && strlen(date) == TIMECACHE_HTTP_LEN - 1;
+
+    localtime_r(&now, &tm_info);
+    strftime(expect, sizeof(expect), "%Y-%m-%d %H:%M:%S", &tm_info);
+    ok = ok && strcmp(stamp, expect) == 0;
+
+    /* And the clock is not stale */
+    return ok && now - time(NULL) <= 1 && time(NULL) - now <= 1;
+}
+
+#define LOG_THREADS 4
+#define LOG_LINES 500
+
+static void *log_burst(void *arg) {
+    for (int i = 0; i < LOG_LINES; i++) {
+        LOG_INFO("logger test %ld line %d", (long)(intptr_t)arg, i);
+    }
+    return NULL;
+}
+
+/* Log once, then hold the buffer until the main thread has counted it */
+static void *log_wave(void *arg) {
+    LOG_INFO("logger wave");
+    pthread_barrier_wait(arg);
+    pthread_barrier_wait(arg);
+    return NULL;
+}
+
+TEST(async_logger) {
+    const char *path = "test_async.log";
+    unlink(path);
+
+    /* Blocking mode loses nothing even when threads outrun the writer */
+    uint64_t dropped = log_dropped();
+    log_set_output(LOG_TO_FILE);
+    log_set_overflow(LOG_OVERFLOW_BLOCK);
+    log_init(path);
+
+    pthread_t threads[LOG_THREADS];
+    for (intptr_t i = 0; i < LOG_THREADS; i++) {
+        pthread_create(&threads[i], NULL, log_burst, (void *)i);
+    }
+    for (int i = 0; i < LOG_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* Buffers of a burst of short-lived threads are freed once drained */
+    #define WAVE_THREADS 32
+    pthread_t wave[WAVE_THREADS];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, WAVE_THREADS + 1);
+    for (int i = 0; i < WAVE_THREADS; i++) {
+        pthread_create(&wave[i], NULL, log_wave, &barrier);
+    }
+    pthread_barrier_wait(&barrier);
+    size_t peak = log_buffers();
+    pthread_barrier_wait(&barrier);
+    for (int i = 0; i < WAVE_THREADS; i++) {
+        pthread_join(wave[i], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+    for (int i = 0; i < 100 && log_buffers() > WAVE_THREADS / 2; i++) {
+        usleep(10000);
+    }
+    size_t after = log_buffers();
+    DEBUG("Log buffers: %zu with %d threads, %zu after", peak, WAVE_THREADS, after);
+    log_close();
+    log_set_output(LOG_TO_BOTH);
+    log_set_overflow(LOG_OVERFLOW_DROP);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+
+    char line[512];
+    int count = 0;
+    bool whole = true;
+    while (fgets(line, sizeof(line), f)) {
+        if (strstr(line, "logger test")) {
+            count++;
+            whole = whole && strncmp(line, "[", 1) == 0 && strchr(line, '\n');
+        }
+    }
+    fclose(f);
+    unlink(path);
+
+    return count == LOG_THREADS * LOG_LINES && whole && log_dropped() == dropped &&
+           peak >= WAVE_THREADS && after <= WAVE_THREADS / 2;
+}
+
+/* Count lines in a file, -1 if missing */
+static int count_lines(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    int lines = 0, c;
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '\n') lines++;
+    }
+    fclose(f);
+    return lines;
+}
+
+TEST(log_rotation) {
+    const char *path = "test_rotate.log";
+    char moved[64], rotated[64];
+    snprintf(moved, sizeof(moved), "%s.moved", path);
+    unlink(path);
+    unlink(moved);
+
+    /* SIGHUP-style reopen: after an external rename, new lines go to a
+     * fresh file while the renamed one keeps the old lines */
+    log_set_output(LOG_TO_FILE);
+    log_init(path);
+    LOG_INFO("before reopen");
+    usleep(50000);
+    rename(path, moved);
+    log_reopen();
+    usleep(50000);
+    LOG_INFO("after reopen");
+    usleep(50000);
+
+    bool ok = count_lines(moved) == 2 && count_lines(path) == 1;
+
+    /* Size-based rotation keeps at most log_rotate_keep old files */
+    log_set_rotation(1024, 0, 2);
+    for (int i = 0; i < 40; i++) {
+        LOG_INFO("rotation test line %d with some padding to fill the file up", i);
+        usleep(5000);
+    }
+    log_close();
+    log_set_rotation(0, 0, 5);
+    log_set_output(LOG_TO_BOTH);
+
+    snprintf(rotated, sizeof(rotated), "%s.1", path);
+    ok = ok && count_lines(rotated) > 0;
+    snprintf(rotated, sizeof(rotated), "%s.2", path);
+    ok = ok && count_lines(rotated) > 0;
+    snprintf(rotated, sizeof(rotated), "%s.3", path);
+    ok = ok && count_lines(rotated) == -1;
+
+    unlink(path);
+    unlink(moved);
+    for (int i = 1; i <= 2; i++) {
+        snprintf(rotated, sizeof(rotated), "%s.%d", path, i);
+        unlink(rotated);
+    }
+    return ok;
+}
+
+TEST(binary_access_log) {
+    const char *path = "test_access.bin";
+    unlink(path);
+    if (!access_log_open(path)) return false;
+
+    access_entry_t entry = {
+        .method = HTTP_GET,
+        .path = "/index.html",
+        .status = 200,
+        .bytes = 1234,
+        .start_usec = 1700000000000000ULL,
+        .duration_usec = 150
+    };
+    inet_pton(AF_INET, "192.168.1.23", &entry.addr);
+
+    /* The second request for a path reuses its definition */
+    access_log_write(&entry);
+    access_log_write(&entry);
+    entry.path = "/about.html";
+    entry.status = 304;
+    entry.cache = ACCESS_CACHE_REVALIDATED;
+    access_log_write(&entry);
+    log_close();
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+
+    access_log_header_t header;
+    access_record_t recs[8];
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+              memcmp(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic)) == 0 &&
+              header.record_size == sizeof(access_record_t);
+
+    /* def + path, request, request, def + path, request */
+    size_t count = fread(recs, sizeof(recs[0]), 8, f);
+    fclose(f);
+    unlink(path);
+
+    /* A new file defines its paths again, with ids starting over */
+    if (!access_log_open(path)) return false;
+    access_log_write(&entry);
+    log_close();
+    access_record_t again[2] = {0};
+    f = fopen(path, "rb");
+    ok = ok && f && fseek(f, sizeof(header), SEEK_SET) == 0 &&
+         fread(again, sizeof(again[0]), 2, f) == 2 &&
+         again[0].status == ACCESS_STATUS_PATHDEF && again[0].path_id == 1;
+    if (f) fclose(f);
+    unlink(path);
+
+    return ok && count == 7 &&
+           recs[0].status == ACCESS_STATUS_PATHDEF && recs[0].bytes == 11 &&
+           memcmp(&recs[1], "/index.html", 11) == 0 &&
+           recs[2].path_id == recs[0].path_id && recs[2].status == 200 &&
+           recs[2].bytes == 1234 && recs[2].addr == entry.addr.s_addr &&
+           recs[3].path_id == recs[0].path_id &&
+           recs[4].status == ACCESS_STATUS_PATHDEF && recs[4].path_id != recs[0].path_id &&
+           recs[6].path_id == recs[4].path_id && recs[6].status == 304 &&
+           recs[6].cache == ACCESS_CACHE_REVALIDATED;
+}
+
+/* Append a path definition or a request record to a log image */
+static void put_log_record(unsigned char *buf, size_t *len, uint32_t id, uint16_t status,
+                           const char *path) {
+    access_record_t rec = { .path_id = id, .status = status };
+    if (path) rec.bytes = strlen(path);
+    memcpy(buf + *len, &rec, sizeof(rec));
+    *len += sizeof(rec);
+    if (path) {
+        size_t padded = (rec.bytes + sizeof(rec) - 1) / sizeof(rec) * sizeof(rec);
+        memset(buf + *len, 0, padded);
+        memcpy(buf + *len, path, rec.bytes);
+        *len += padded;
+    }
+}
+
+TEST(access_log_reader) {
+    static unsigned char buf[4096];
+    access_log_header_t header = {
+        .version = ACCESS_LOG_VERSION,
+        .record_size = sizeof(access_record_t)
+    };
+    memcpy(header.magic, ACCESS_LOG_MAGIC, sizeof(header.magic));
+    memcpy(buf, &header, sizeof(header));
+    size_t len = sizeof(header);
+
+    /* A definition holds until its id is redefined (as after a restart),
+     * a late definition serves the requests before it, and ids need not
+     * be small */
+    put_log_record(buf, &len, 7, ACCESS_STATUS_PATHDEF, "/a");
+    put_log_record(buf, &len, 7, 200, NULL);
+    put_log_record(buf, &len, 0x80000000u, 200, NULL);
+    put_log_record(buf, &len, 7, ACCESS_STATUS_PATHDEF, "/b");
+    put_log_record(buf, &len, 7, 200, NULL);
+    put_log_record(buf, &len, 0xffffffffu, 404, NULL);
+    put_log_record(buf, &len, 0xffffffffu, ACCESS_STATUS_PATHDEF, "/c");
+
+    /* A definition longer than the writer allows ends the file */
+    access_record_t bad = { .path_id = 1, .bytes = ACCESS_LOG_PATH_MAX + 1 };
+    memcpy(buf + len, &bad, sizeof(bad));
+    len += sizeof(bad) + 8 * sizeof(bad);
+    put_log_record(buf, &len, 7, 200, NULL);
+
+    access_log_reader_t *reader = access_log_reader_open(buf, len);
+    if (!reader) return false;
+
+    const char *expect[] = { "/a", NULL, "/b", "/c" };
+    const access_record_t *rec;
+    const access_path_t *path;
+    size_t count = 0;
+    bool ok = access_log_reader_paths(reader) == 3;
+    while ((rec = access_log_reader_next(reader, &path)) != NULL) {
+        if (count < 4) {
+            ok = ok && (expect[count] ? path && path->len == strlen(expect[count]) &&
+                                        memcmp(path->text, expect[count], path->len) == 0
+                                      : path == NULL);
+        }
+        count++;
+    }
+    access_log_reader_close(reader);
+
+    /* Other files are refused */
+    ok = ok && !access_log_reader_open(buf + 8, len - 8);
+    return ok && count == 4;
+}
+
+static void *metrics_burst(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 1000; i++) {
+        metrics_request(HTTP_UNSUPPORTED, 418, 10, false);
+        metrics_observe(METRIC_HIST_REQUEST, 100);
+    }
+    return NULL;
+}
+
+/* Value of one sample line in a metrics rendering, 0 if absent */
+static unsigned long long metric_value(const char *text, const char *sample) {
+    const char *line = strstr(text, sample);
+    return line ? strtoull(line + strlen(sample), NULL, 10) : 0;
+}
+
+/* Render metrics into a fresh string */
+static char *render_metrics(void) {
+    char *text = malloc(65536);
+    if (!text) return NULL;
+    size_t len = metrics_render(text, 65535);
+    text[len] = '\0';
+    return text;
+}
+
+TEST(metrics) {
+    const char *head_404 = "zircon_requests_total{method=\"other\",status=\"other\"} ";
+    const char *count = "zircon_request_duration_seconds_count ";
+    const char *overload = "zircon_rejections_total{reason=\"overload\"} ";
+
+    char *before = render_metrics();
+    if (!before) return false;
+
+    /* Counters from several threads are summed at render time */
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, metrics_burst, NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    metrics_reject(METRIC_REJECT_OVERLOAD);
+
+    char *after = render_metrics();
+    bool ok = after &&
+              metric_value(after, head_404) - metric_value(before, head_404) == 4000 &&
+              metric_value(after, count) - metric_value(before, count) == 4000 &&
+              metric_value(after, overload) - metric_value(before, overload) == 1 &&
+              strstr(after, "# TYPE zircon_request_duration_seconds histogram\n") &&
+              strstr(after, "zircon_request_duration_seconds_bucket{le=\"+Inf\"} ");
+    free(before);
+    free(after);
+
+    /* Mostly fast requests with a slow tail: the quantiles separate them */
+    for (int i = 0; i < 100000; i++) {
+        metrics_observe(METRIC_HIST_REQUEST, i < 99000 ? 100 : 50000);
+    }
+    uint64_t p50 = metrics_quantile(METRIC_HIST_REQUEST, 0.5);
+    uint64_t p999 = metrics_quantile(METRIC_HIST_REQUEST, 0.999);
+    return ok && p50 >= 100 && p50 < 115 && p999 >= 50000 && p999 < 57000;
+}
+
+TEST(request_trace) {
+    request_trace_t trace;
+    trace_begin(&trace);
+
+    /* A 2 ms stage, a near-instant one, and stages that never ran */
+    usleep(2000);
+    trace_mark(&trace, TRACE_READ);
+    trace_mark(&trace, TRACE_PARSE);
+
+    uint32_t read = trace_stage_usec(&trace, TRACE_READ);
+    uint32_t parse = trace_stage_usec(&trace, TRACE_PARSE);
+    if (read < 1900 || read > 100000 || parse > 1000) return false;
+    if (trace_total_usec(&trace) < read) return false;
+    if (trace_ran(&trace, TRACE_OPEN)) return false;
+
+    char header[128];
+    size_t len = trace_server_timing(&trace, header, sizeof(header));
+    char breakdown[128];
+    trace_breakdown(&trace, breakdown, sizeof(breakdown));
+
+    /* Truncated headers are dropped rather than sent half-written */
+    char tiny[24];
+    return len == strlen(header) &&
+           strncmp(header, "Server-Timing: read;dur=", 24) == 0 &&
+           strstr(header, ", parse;dur=") && !strstr(header, "open") &&
+           strcmp(header + len - 2, "\r\n") == 0 &&
+           strncmp(breakdown, "read=", 5) == 0 && strstr(breakdown, " parse=") &&
+           trace_server_timing(&trace, tiny, sizeof(tiny)) == 0 && tiny[0] == '\0';
+}
+
+TEST(heavy_hitters) {
+    heavy_hitters_t *hh = heavy_hitters_create(4, 0);
+    if (!hh) return false;
+
+    /* Three heavy keys hidden among 20000 one-off keys */
+    static const char *heavy[] = { "/big", "/medium", "/small" };
+    static const uint64_t weight[] = { 4000, 2000, 1000 };
+    char key[32];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(key, sizeof(key), "/noise/%d", i);
+        heavy_hitters_add(hh, key, strlen(key), 1);
+        for (int h = 0; h < 3; h++) {
+            if (i % (20000 / weight[h]) == 0) {
+                heavy_hitters_add(hh, heavy[h], strlen(heavy[h]), 1);
+            }
+        }
+    }
+
+    /* Heaviest first; estimates never undercount and stay close */
+    heavy_hitter_t top[4];
+    size_t n = heavy_hitters_top(hh, top, 4);
+    bool ok = n >= 3;
+    for (int h = 0; ok && h < 3; h++) {
+        ok = top[h].len == strlen(heavy[h]) && memcmp(top[h].key, heavy[h], top[h].len) == 0 &&
+             top[h].count >= weight[h] && top[h].count < weight[h] + 200;
+    }
+
+    /* Decay halves every weight */
+    uint64_t before = top[0].count;
+    heavy_hitters_decay(hh);
+    ok = ok && heavy_hitters_top(hh, top, 4) >= 3 && top[0].count == before / 2;
+
+    heavy_hitters_destroy(hh);
+    ok = ok && !heavy_hitters_create(0, 60) && !heavy_hitters_create(HEAVY_HITTERS_MAX_K + 1, 60);
+
+    /* Served paths are counted without their query, odd targets under one
+     * key, and the exposition stays printable ASCII whatever was asked */
+    stop_test_server();
+    server_config_t config = {
+        .port = 8080,
+        .bind_addr = "127.0.0.1",
+        .root_dir = "www",
+        .max_requests = 60,
+        .heavy_hitters = 8,
+        .metrics_path = "/metrics",
+        .acl_trust = "127.0.0.1/32"
+    };
+    ok = launch_test_server(&config) && ok;
+    static const char *targets[] = {
+        "/caf%C3%A9.html?x=1", "/caf%C3%A9.html?x=2", "/q%22%25.html", "/x%01.html",
+        "/\xc3"
+    };
+    char response[65536];
+    for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+        char request[128];
+        snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\n\r\n", targets[i]);
+        fetch(request, response, sizeof(response));
+    }
+    size_t len = fetch("GET /metrics HTTP/1.1\r\n\r\n", response, sizeof(response));
+    const char *body = strstr(response, "\r\n\r\n");
+    ok = ok && body &&
+         strstr(body, "zircon_top_path_requests{path=\"/caf%C3%A9.html\"} 2\n") &&
+         strstr(body, "zircon_top_path_requests{path=\"/q\\\"%25.html\"} 1\n") &&
+         strstr(body, "zircon_top_path_requests{path=\"(invalid)\"} 2\n");
+    for (size_t i = 0; ok && i < len; i++) {
+        unsigned char c = response[i];
+        ok = (c >= 0x20 && c < 0x7f) || c == '\n' || c == '\r';
+    }
+    stop_test_server();
+    return start_test_server(NULL, NULL) && ok;
+}
+
 TEST(concurrent_connections) {
     #define NUM_CLIENTS 10
     pthread_t threads[NUM_CLIENTS];
@@ -356,7 +1686,7 @@ int main(void) {
     }
 
     /* Start test server for integration tests */
-    if (!start_test_server()) {
+    if (!start_test_server(NULL, NULL)) {
         printf("Failed to start test server\n");
         return 1;
     }
@@ -367,8 +1697,31 @@ int main(void) {
     RUN_TEST(server_bind);
     RUN_TEST(http_parse_request);
     RUN_TEST(http_error_response);
+    RUN_TEST(request_checks);
+    RUN_TEST(request_validator);
+    RUN_TEST(normalize_path);
+    RUN_TEST(negative_cache);
+    RUN_TEST(asset_pack);
     RUN_TEST(security_features);
+    RUN_TEST(pattern_set);
+    RUN_TEST(security_body_stream);
     RUN_TEST(rate_limit);
+    RUN_TEST(rate_limiter_burst);
+    RUN_TEST(rate_limiter_cost);
+    RUN_TEST(rate_limiter_clock);
+    RUN_TEST(rate_limiter_shared);
+    RUN_TEST(admission_control);
+    RUN_TEST(concurrency_limiter);
+    RUN_TEST(shaper_classes);
+    RUN_TEST(shaper_pacing);
+    RUN_TEST(timecache);
+    RUN_TEST(async_logger);
+    RUN_TEST(log_rotation);
+    RUN_TEST(binary_access_log);
+    RUN_TEST(access_log_reader);
+    RUN_TEST(metrics);
+    RUN_TEST(request_trace);
+    RUN_TEST(heavy_hitters);
     RUN_TEST(concurrent_connections);
 
     /* Stop test server */
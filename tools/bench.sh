@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# Start zircon on loopback and run the standard benchmark scenarios,
+# writing one JSON object per scenario to $BENCH_OUT.
+#
+#   BENCH_DURATION  seconds per scenario (default 5)
+#   BENCH_PORT      loopback port (default 18080)
+#   BENCH_OUT       results file (default bench_results.jsonl)
+
+DURATION="${BENCH_DURATION:-5}"
+PORT="${BENCH_PORT:-18080}"
+OUT="${BENCH_OUT:-bench_results.jsonl}"
+SERVER_BIN="./bin/zircon"
+BENCH_BIN="./bin/zircon-bench"
+TARGET="127.0.0.1:$PORT"
+
+WORK_DIR=$(mktemp -d)
+SERVER_PID=""
+
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null
+        wait "$SERVER_PID" 2>/dev/null
+    fi
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+# Loopback is trusted so rate limits don't turn the run into 429s
+cat > "$WORK_DIR/bench.conf" <<EOF
+port = $PORT
+bind_addr = 127.0.0.1
+root_dir = www
+max_requests_per_minute = 1000000
+trust = 127.0.0.0/8
+access_log = $WORK_DIR/access.log
+log_sampling = 100
+EOF
+
+"$SERVER_BIN" "$WORK_DIR/bench.conf" > "$WORK_DIR/server.out" 2>&1 &
+SERVER_PID=$!
+
+# Wait for the listener
+for _ in $(seq 1 50); do
+    "$BENCH_BIN" -c 1 -t 1 -d 0.05 -j "$TARGET" 2>/dev/null | grep -q '"requests":[1-9]' && break
+    sleep 0.1
+done
+
+: > "$OUT"
+
+# label | zircon-bench options
+SCENARIOS=(
+    "single|-c 1 -t 1"
+    "closed-64|-c 64 -t 4"
+    "closed-64-keepalive|-c 64 -t 4 -k"
+    "closed-64-mix|-c 64 -t 4 -u /index.html:6 -u /style.css:2 -u /test.js:1 -u /test-image.png:1"
+    "open-2k|-c 64 -t 4 -r 2000"
+    "open-10k|-c 256 -t 4 -r 10000"
+)
+
+for scenario in "${SCENARIOS[@]}"; do
+    label="${scenario%%|*}"
+    options="${scenario#*|}"
+    # shellcheck disable=SC2086
+    "$BENCH_BIN" $options -d "$DURATION" -l "$label" -j "$TARGET" | tee -a "$OUT"
+done
+
+echo "Results written to $OUT"
@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+# Start zircon on loopback and soak it with zircon-soak, failing if its
+# memory, fds, threads or latency keep growing.
+#
+#   SOAK_DURATION     seconds to soak (default 60)
+#   SOAK_CONNECTIONS  idle connections held open (default 10000)
+#   SOAK_INTERVAL     seconds between samples (default 2)
+#   SOAK_PORT         loopback port (default 18081)
+
+DURATION="${SOAK_DURATION:-60}"
+CONNECTIONS="${SOAK_CONNECTIONS:-10000}"
+INTERVAL="${SOAK_INTERVAL:-2}"
+PORT="${SOAK_PORT:-18081}"
+SERVER_BIN="./bin/zircon"
+SOAK_BIN="./bin/zircon-soak"
+TARGET="127.0.0.1:$PORT"
+
+WORK_DIR=$(mktemp -d)
+SERVER_PID=""
+
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null
+        wait "$SERVER_PID" 2>/dev/null
+    fi
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+# Both ends hold one descriptor per connection
+ulimit -n "$(ulimit -Hn)"
+
+# Loopback is trusted so the soak measures the server, not its limits
+cat > "$WORK_DIR/soak.conf" <<CONF
+port = $PORT
+bind_addr = 127.0.0.1
+root_dir = www
+max_requests_per_minute = 1000000
+trust = 127.0.0.0/8
+access_log = $WORK_DIR/access.log
+log_sampling = 100
+CONF
+
+"$SERVER_BIN" "$WORK_DIR/soak.conf" > "$WORK_DIR/server.out" 2>&1 &
+SERVER_PID=$!
+
+# Wait for the listener
+for _ in $(seq 1 50); do
+    (exec 3<>"/dev/tcp/127.0.0.1/$PORT") 2>/dev/null && break
+    sleep 0.1
+done
+
+"$SOAK_BIN" -p "$SERVER_PID" -c "$CONNECTIONS" -d "$DURATION" -i "$INTERVAL" "$TARGET"
@@ -0,0 +1,595 @@
+/* zircon-bench: HTTP load generator
+ *
+ * Usage: zircon-bench [options] [host:port]
+ *
+ * Each thread drives its share of the connections from one epoll loop.
+ * In closed-loop mode a connection sends its next request as soon as the
+ * previous response is read. In open-loop mode (-r) requests are due on
+ * a fixed schedule whether or not the server keeps up, and latency runs
+ * from when a request was due rather than when a connection was free to
+ * send it, so a stalled server cannot hide its queueing delay
+ * (coordinated omission).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_URLS        32
+#define HEADER_MAX      8192
+#define READ_CHUNK      65536
+#define SUB_BITS        5       /* 32 sub-buckets per power of two, ~3% error */
+#define SUB_COUNT       (1 << SUB_BITS)
+#define MAX_MAGNITUDE   40      /* Latencies up to 2^40 ns (~18 min) */
+#define HIST_BUCKETS    ((MAX_MAGNITUDE - SUB_BITS + 1) * SUB_COUNT)
+
+/* Weighted request in the URL mix */
+typedef struct {
+    const char *path;           /* In url_paths, apart from request */
+    unsigned int weight;
+    char request[512];
+    size_t request_len;
+} url_t;
+
+typedef enum {
+    CONN_CLOSED,
+    CONN_IDLE,              /* Connected, kept alive, waiting for work */
+    CONN_CONNECTING,
+    CONN_WRITING,
+    CONN_READING
+} conn_state_t;
+
+struct worker;
+
+/* One client connection */
+typedef struct {
+    int fd;
+    conn_state_t state;
+    const url_t *url;
+    size_t sent;
+    uint64_t start_ns;          /* When the request was due */
+    char header[HEADER_MAX];
+    size_t header_len;
+    bool header_done;
+    bool server_close;
+    bool read_to_eof;
+    uint64_t body_left;
+    int status;
+    struct worker *worker;
+} conn_t;
+
+/* Per-thread state */
+typedef struct worker {
+    pthread_t thread;
+    int epfd;
+    int timerfd;                /* Wakes the loop when the next request is due */
+    conn_t *conns;
+    size_t conn_count;
+    double rate;                /* Requests per second, 0 = closed loop */
+    uint64_t seed;
+
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t non_2xx;
+    uint64_t bytes;
+    uint64_t hist[HIST_BUCKETS];
+    uint64_t max_ns;
+} worker_t;
+
+/* Run settings, shared read-only by workers */
+static struct sockaddr_in target;
+static char host_header[64] = "127.0.0.1:8000";
+static url_t urls[MAX_URLS];
+static char url_paths[MAX_URLS][256];
+static size_t url_count = 0;
+static unsigned int weight_total = 0;
+static bool keep_alive = false;
+static uint64_t end_ns;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Log-linear bucket, as in the server's metrics */
+static unsigned int hist_bucket(uint64_t value) {
+    if (value >= (1ULL << MAX_MAGNITUDE)) value = (1ULL << MAX_MAGNITUDE) - 1;
+    if (value < SUB_COUNT) return (unsigned int)value;
+
+    unsigned int magnitude = 63 - __builtin_clzll(value);
+    unsigned int shift = magnitude - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (unsigned int)((value >> shift) & (SUB_COUNT - 1));
+}
+
+static uint64_t bucket_upper(unsigned int bucket) {
+    if (bucket < SUB_COUNT) return bucket;
+
+    unsigned int shift = bucket / SUB_COUNT - 1;
+    uint64_t lower = (uint64_t)(SUB_COUNT + bucket % SUB_COUNT) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+static uint64_t hist_quantile(const uint64_t *hist, uint64_t total, double quantile) {
+    if (!total) return 0;
+
+    uint64_t rank = (uint64_t)(quantile * total);
+    if (rank >= total) rank = total - 1;
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > rank) return bucket_upper(i);
+    }
+    return bucket_upper(HIST_BUCKETS - 1);
+}
+
+/* xorshift64 for the URL mix */
+static const url_t *pick_url(worker_t *w) {
+    if (url_count == 1) return &urls[0];
+
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 7;
+    w->seed ^= w->seed << 17;
+    unsigned int pick = (unsigned int)(w->seed % weight_total);
+    for (size_t i = 0; i < url_count; i++) {
+        if (pick < urls[i].weight) return &urls[i];
+        pick -= urls[i].weight;
+    }
+    return &urls[url_count - 1];
+}
+
+/* Close a connection; a reset avoids piling up TIME_WAIT on the client */
+static void conn_close(conn_t *c) {
+    if (c->fd >= 0) {
+        struct linger linger = { 1, 0 };
+        setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+        close(c->fd);
+    }
+    c->fd = -1;
+    c->state = CONN_CLOSED;
+}
+
+static void conn_fail(conn_t *c) {
+    c->worker->errors++;
+    conn_close(c);
+}
+
+static bool conn_watch(conn_t *c, uint32_t events, int op) {
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    return epoll_ctl(c->worker->epfd, op, c->fd, &ev) == 0;
+}
+
+/* Write as much of the request as the socket takes */
+static void conn_write(conn_t *c) {
+    while (c->sent < c->url->request_len) {
+        ssize_t n = send(c->fd, c->url->request + c->sent, c->url->request_len - c->sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return;
+            conn_fail(c);
+            return;
+        }
+        c->sent += n;
+    }
+
+    c->state = CONN_READING;
+    if (!conn_watch(c, EPOLLIN, EPOLL_CTL_MOD)) conn_fail(c);
+}
+
+/* Start a request that was due at start_ns */
+static void conn_start(conn_t *c, uint64_t start_ns) {
+    c->url = pick_url(c->worker);
+    c->sent = 0;
+    c->start_ns = start_ns;
+    c->header_len = 0;
+    c->header_done = false;
+    c->server_close = !keep_alive;
+    c->read_to_eof = false;
+    c->body_left = 0;
+    c->status = 0;
+
+    if (c->state == CONN_IDLE) {
+        c->state = CONN_WRITING;
+        if (conn_watch(c, EPOLLOUT, EPOLL_CTL_MOD)) conn_write(c);
+        else conn_fail(c);
+        return;
+    }
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) {
+        c->worker->errors++;
+        return;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    c->state = CONN_CONNECTING;
+    if (connect(c->fd, (struct sockaddr *)&target, sizeof(target)) < 0 &&
+        errno != EINPROGRESS) {
+        conn_fail(c);
+        return;
+    }
+    if (!conn_watch(c, EPOLLOUT, EPOLL_CTL_ADD)) conn_fail(c);
+}
+
+/* Parse status and framing once the header is complete */
+static bool parse_header(conn_t *c, size_t header_end) {
+    c->header[header_end] = '\0';
+    if (strncmp(c->header, "HTTP/1.", 7) != 0 || c->header_len < 12) return false;
+    c->status = atoi(c->header + 9);
+
+    bool have_length = false;
+    for (char *line = strstr(c->header, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            c->body_left = strtoull(line + 15, NULL, 10);
+            have_length = true;
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            const char *value = line + 11;
+            while (*value == ' ') value++;
+            if (strncasecmp(value, "close", 5) == 0) c->server_close = true;
+        }
+    }
+
+    if (c->status == 304 || c->status == 204 || c->status / 100 == 1) {
+        c->body_left = 0;
+    } else if (!have_length) {
+        c->read_to_eof = true;
+        c->server_close = true;
+    }
+    return true;
+}
+
+/* Account a finished response and free or reuse the connection */
+static void conn_done(conn_t *c) {
+    worker_t *w = c->worker;
+    uint64_t latency = now_ns() - c->start_ns;
+
+    w->requests++;
+    if (c->status / 100 != 2) w->non_2xx++;
+    w->hist[hist_bucket(latency)]++;
+    if (latency > w->max_ns) w->max_ns = latency;
+
+    if (c->server_close) {
+        conn_close(c);
+    } else {
+        c->state = CONN_IDLE;
+    }
+}
+
+/* Read the response */
+static void conn_read(conn_t *c) {
+    char buf[READ_CHUNK];
+
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return;
+            conn_fail(c);
+            return;
+        }
+        if (n == 0) {
+            if (c->header_done && c->read_to_eof) conn_done(c);
+            else conn_fail(c);
+            return;
+        }
+        c->worker->bytes += n;
+
+        size_t body = n;
+        if (!c->header_done) {
+            size_t room = sizeof(c->header) - 1 - c->header_len;
+            size_t take = (size_t)n < room ? (size_t)n : room;
+            memcpy(c->header + c->header_len, buf, take);
+            size_t old_len = c->header_len;
+            c->header_len += take;
+            c->header[c->header_len] = '\0';
+
+            char *end = strstr(c->header, "\r\n\r\n");
+            if (!end) {
+                if (c->header_len == sizeof(c->header) - 1) conn_fail(c);
+                continue;
+            }
+            size_t header_end = end - c->header + 4;
+            if (!parse_header(c, header_end)) {
+                conn_fail(c);
+                return;
+            }
+            c->header_done = true;
+            body = old_len + n - header_end;
+        }
+
+        if (!c->read_to_eof) {
+            c->body_left -= body < c->body_left ? body : c->body_left;
+            if (c->body_left == 0) {
+                conn_done(c);
+                return;
+            }
+        }
+    }
+}
+
+/* Handle readiness on a connection */
+static void conn_event(conn_t *c, uint32_t events) {
+    if (c->state == CONN_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            conn_fail(c);
+            return;
+        }
+        c->state = CONN_WRITING;
+    }
+
+    if (c->state == CONN_WRITING) {
+        conn_write(c);
+    } else if (c->state == CONN_READING) {
+        conn_read(c);
+    } else if (c->state == CONN_IDLE && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        /* Kept-alive connection closed by the server between requests */
+        conn_close(c);
+    }
+}
+
+static bool conn_free(const conn_t *c) {
+    return c->state == CONN_CLOSED || c->state == CONN_IDLE;
+}
+
+/* Worker loop */
+static void *worker_run(void *arg) {
+    worker_t *w = arg;
+    struct epoll_event events[256];
+    uint64_t interval = w->rate > 0 ? (uint64_t)(1e9 / w->rate) : 0;
+    uint64_t next_due = now_ns();
+
+    for (;;) {
+        uint64_t now = now_ns();
+        if (now >= end_ns) break;
+
+        /* Hand due requests to free connections */
+        for (size_t i = 0; i < w->conn_count; i++) {
+            conn_t *c = &w->conns[i];
+            if (!conn_free(c)) continue;
+
+            if (!interval) {
+                conn_start(c, now);
+            } else if (next_due <= now) {
+                conn_start(c, next_due);
+                next_due += interval;
+            } else {
+                break;
+            }
+        }
+
+        /* With a connection free, sleep until the next request is due;
+         * epoll_wait's millisecond timeout is too coarse for that */
+        int timeout = 100;
+        if (interval) {
+            bool idle = false;
+            for (size_t i = 0; i < w->conn_count && !idle; i++) {
+                idle = conn_free(&w->conns[i]);
+            }
+            if (idle) {
+                struct itimerspec due = {
+                    .it_value = { (time_t)(next_due / 1000000000),
+                                  (long)(next_due % 1000000000) }
+                };
+                timerfd_settime(w->timerfd, TFD_TIMER_ABSTIME, &due, NULL);
+            }
+        }
+
+        int n = epoll_wait(w->epfd, events, sizeof(events) / sizeof(events[0]), timeout);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr) {
+                conn_event(events[i].data.ptr, events[i].events);
+            } else {
+                uint64_t expirations;
+                if (read(w->timerfd, &expirations, sizeof(expirations)) < 0) continue;
+            }
+        }
+    }
+
+    /* Requests in flight at the deadline are not counted */
+    for (size_t i = 0; i < w->conn_count; i++) {
+        conn_close(&w->conns[i]);
+    }
+    return NULL;
+}
+
+/* Add "path[:weight]" to the URL mix */
+static bool add_url(const char *spec) {
+    if (url_count >= MAX_URLS) return false;
+
+    url_t *url = &urls[url_count];
+    const char *colon = strrchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+    char *path = url_paths[url_count];
+    if (len == 0 || len >= sizeof(url_paths[0]) || spec[0] != '/') return false;
+
+    memcpy(path, spec, len);
+    path[len] = '\0';
+    url->path = path;
+    url->weight = colon ? (unsigned int)atoi(colon + 1) : 1;
+    if (url->weight == 0) return false;
+
+    url_count++;
+    weight_total += url->weight;
+    return true;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: zircon-bench [options] [host:port]\n"
+            "  -c N        connections (default 64)\n"
+            "  -t N        threads (default 4)\n"
+            "  -d SECONDS  duration (default 10)\n"
+            "  -r RATE     open loop at RATE requests/s total (default closed loop)\n"
+            "  -k          keep connections alive between requests\n"
+            "  -u PATH[:W] request PATH with weight W (repeatable, default /index.html)\n"
+            "  -l LABEL    scenario label for the report\n"
+            "  -j          print one JSON object instead of text\n");
+}
+
+int main(int argc, char *argv[]) {
+    size_t connections = 64, threads = 4;
+    double duration = 10, rate = 0;
+    const char *label = "default";
+    bool json = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:t:d:r:ku:l:jh")) != -1) {
+        switch (opt) {
+        case 'c': connections = strtoul(optarg, NULL, 10); break;
+        case 't': threads = strtoul(optarg, NULL, 10); break;
+        case 'd': duration = atof(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'k': keep_alive = true; break;
+        case 'u':
+            if (!add_url(optarg)) {
+                fprintf(stderr, "zircon-bench: bad URL spec: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'l': label = optarg; break;
+        case 'j': json = true; break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    const char *host = optind < argc ? argv[optind] : "127.0.0.1:8000";
+    char addr[64];
+    snprintf(addr, sizeof(addr), "%s", host);
+    char *colon = strchr(addr, ':');
+    target.sin_family = AF_INET;
+    target.sin_port = htons(colon ? (uint16_t)atoi(colon + 1) : 80);
+    if (colon) *colon = '\0';
+    if (inet_pton(AF_INET, addr, &target.sin_addr) != 1) {
+        fprintf(stderr, "zircon-bench: target must be an IPv4 address: %s\n", host);
+        return 2;
+    }
+    snprintf(host_header, sizeof(host_header), "%s", host);
+
+    if (threads == 0 || connections < threads || duration <= 0 || rate < 0) {
+        usage();
+        return 2;
+    }
+    if (url_count == 0) add_url("/index.html");
+
+    for (size_t i = 0; i < url_count; i++) {
+        int n = snprintf(urls[i].request, sizeof(urls[i].request),
+                         "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: zircon-bench\r\n"
+                         "Connection: %s\r\n\r\n",
+                         urls[i].path, host_header, keep_alive ? "keep-alive" : "close");
+        urls[i].request_len = n > 0 && (size_t)n < sizeof(urls[i].request) ? (size_t)n : 0;
+        if (!urls[i].request_len) {
+            fprintf(stderr, "zircon-bench: URL too long: %s\n", urls[i].path);
+            return 2;
+        }
+    }
+
+    /* Split connections and rate across workers */
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    conn_t *conns = calloc(connections, sizeof(conn_t));
+    if (!workers || !conns) {
+        fprintf(stderr, "zircon-bench: out of memory\n");
+        return 1;
+    }
+
+    uint64_t start = now_ns();
+    end_ns = start + (uint64_t)(duration * 1e9);
+    size_t next_conn = 0;
+    for (size_t t = 0; t < threads; t++) {
+        worker_t *w = &workers[t];
+        w->conn_count = connections / threads + (t < connections % threads);
+        w->conns = &conns[next_conn];
+        next_conn += w->conn_count;
+        w->rate = rate / threads;
+        w->seed = 0x9e3779b97f4a7c15ULL * (t + 1);
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        w->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct epoll_event timer_event = { .events = EPOLLIN, .data.ptr = NULL };
+        if (w->epfd < 0 || w->timerfd < 0 ||
+            epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->timerfd, &timer_event) < 0) {
+            perror("zircon-bench: epoll");
+            return 1;
+        }
+        for (size_t i = 0; i < w->conn_count; i++) {
+            w->conns[i].fd = -1;
+            w->conns[i].worker = w;
+        }
+        if (pthread_create(&w->thread, NULL, worker_run, w) != 0) {
+            perror("zircon-bench: pthread_create");
+            return 1;
+        }
+    }
+
+    /* Merge results */
+    static uint64_t hist[HIST_BUCKETS];
+    uint64_t requests = 0, errors = 0, non_2xx = 0, bytes = 0, max_ns = 0;
+    for (size_t t = 0; t < threads; t++) {
+        worker_t *w = &workers[t];
+        pthread_join(w->thread, NULL);
+        close(w->epfd);
+        close(w->timerfd);
+        requests += w->requests;
+        errors += w->errors;
+        non_2xx += w->non_2xx;
+        bytes += w->bytes;
+        if (w->max_ns > max_ns) max_ns = w->max_ns;
+        for (unsigned int i = 0; i < HIST_BUCKETS; i++) hist[i] += w->hist[i];
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    /* Bucket upper bounds can overshoot the largest sample */
+    double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    for (size_t i = 0; i < 4; i++) {
+        uint64_t value = hist_quantile(hist, requests, quantiles[i]);
+        quantiles[i] = (value < max_ns ? value : max_ns) / 1e3;
+    }
+    double p50 = quantiles[0], p90 = quantiles[1], p99 = quantiles[2], p999 = quantiles[3];
+    const char *mode = rate > 0 ? "open" : "closed";
+
+    if (json) {
+        printf("{\"label\":\"%s\",\"mode\":\"%s\",\"rate\":%.0f,\"connections\":%zu,"
+               "\"threads\":%zu,\"keep_alive\":%s,\"duration_s\":%.3f,"
+               "\"requests\":%llu,\"errors\":%llu,\"non_2xx\":%llu,\"bytes\":%llu,"
+               "\"rps\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,"
+               "\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+               label, mode, rate, connections, threads, keep_alive ? "true" : "false",
+               elapsed, (unsigned long long)requests, (unsigned long long)errors,
+               (unsigned long long)non_2xx, (unsigned long long)bytes,
+               requests / elapsed, p50, p90, p99, p999, max_ns / 1e3);
+    } else {
+        printf("%s: %s, %s loop%s, %zu connections, %zu threads, %.1f s\n",
+               label, host, mode, keep_alive ? ", keep-alive" : "",
+               connections, threads, elapsed);
+        if (rate > 0) printf("  target      %.0f requests/s\n", rate);
+        printf("  requests    %llu (%.1f/s), %llu errors, %llu non-2xx, %.1f MB read\n",
+               (unsigned long long)requests, requests / elapsed,
+               (unsigned long long)errors, (unsigned long long)non_2xx, bytes / 1e6);
+        printf("  latency us  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               p50, p90, p99, p999, max_ns / 1e3);
+    }
+
+    free(conns);
+    free(workers);
+    return errors && !requests ? 1 : 0;
+}
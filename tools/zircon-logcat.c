@@ -0,0 +1,301 @@
+/* zircon-logcat: convert binary access logs to text
+ *
+ * Usage: zircon-logcat [-f clf|combined|json] [-s] file...
+ *
+ * Files are mapped rather than read, path definitions are indexed in a
+ * first pass by the access log reader, and output is formatted by hand
+ * into a large buffer so the conversion runs at memory speed rather than
+ * stdio speed.
+ */
+#include "access_log_reader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define OUT_BUFFER (1 << 20)
+/* Worst-case bytes for one formatted line: a path of control characters
+ * escaped to six bytes each, plus the fixed fields */
+#define OUT_SLACK  (6 * ACCESS_LOG_PATH_MAX + 256)
+
+typedef enum {
+    FORMAT_CLF,
+    FORMAT_COMBINED,
+    FORMAT_JSON
+} format_t;
+
+/* Output buffer */
+static char out[OUT_BUFFER + OUT_SLACK];
+static size_t out_len = 0;
+static uint64_t out_total = 0;
+
+static const char *method_names[] = { "GET", "HEAD", "POST", "UNKNOWN" };
+static const char *month_names[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/* Write out the buffer */
+static bool flush_out(void) {
+    size_t off = 0;
+    while (off < out_len) {
+        ssize_t n = write(STDOUT_FILENO, out + off, out_len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        off += n;
+    }
+    out_total += out_len;
+    out_len = 0;
+    return true;
+}
+
+static inline void put_str(const char *s, size_t len) {
+    memcpy(out + out_len, s, len);
+    out_len += len;
+}
+
+#define PUT_LIT(s) put_str(s, sizeof(s) - 1)
+
+static inline void put_uint(uint64_t value) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n) out[out_len++] = tmp[--n];
+}
+
+/* Zero-padded decimal of fixed width */
+static inline void put_padded(uint64_t value, int width) {
+    for (int i = width - 1; i >= 0; i--) {
+        out[out_len + i] = '0' + value % 10;
+        value /= 10;
+    }
+    out_len += width;
+}
+
+static inline void put_addr(uint32_t addr) {
+    const unsigned char *b = (const unsigned char *)&addr;
+    put_uint(b[0]); out[out_len++] = '.';
+    put_uint(b[1]); out[out_len++] = '.';
+    put_uint(b[2]); out[out_len++] = '.';
+    put_uint(b[3]);
+}
+
+/* Path with JSON escaping (CLF paths are written raw) */
+static inline void put_json_str(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out[out_len++] = '\\';
+            out[out_len++] = c;
+        } else if (c < 0x20) {
+            static const char hex[] = "0123456789abcdef";
+            PUT_LIT("\\u00");
+            out[out_len++] = hex[c >> 4];
+            out[out_len++] = hex[c & 15];
+        } else {
+            out[out_len++] = c;
+        }
+    }
+}
+
+/* Time formats, cached per second */
+static time_t cached_sec = -1;
+static char clf_time[32];           /* 10/Oct/2000:13:55:36 +0000 */
+static char iso_time[32];           /* 2000-10-10T13:55:36 */
+
+static void format_times(time_t sec) {
+    if (sec == cached_sec) return;
+
+    struct tm tm_info;
+    gmtime_r(&sec, &tm_info);
+    snprintf(clf_time, sizeof(clf_time), "%02d/%s/%04d:%02d:%02d:%02d +0000",
+             tm_info.tm_mday % 100, month_names[tm_info.tm_mon % 12],
+             (tm_info.tm_year + 1900) % 10000, tm_info.tm_hour % 100,
+             tm_info.tm_min % 100, tm_info.tm_sec % 100);
+    strftime(iso_time, sizeof(iso_time), "%Y-%m-%dT%H:%M:%S", &tm_info);
+    cached_sec = sec;
+}
+
+/* Format one request record */
+static void format_record(const access_record_t *rec, const access_path_t *path,
+                          format_t format) {
+    const char *method = method_names[rec->method < 3 ? rec->method : 3];
+    format_times((time_t)(rec->time_usec / 1000000));
+
+    if (format == FORMAT_JSON) {
+        PUT_LIT("{\"time\":\"");
+        put_str(iso_time, strlen(iso_time));
+        out[out_len++] = '.';
+        put_padded(rec->time_usec % 1000000, 6);
+        PUT_LIT("Z\",\"addr\":\"");
+        put_addr(rec->addr);
+        PUT_LIT("\",\"method\":\"");
+        put_str(method, strlen(method));
+        PUT_LIT("\",\"path\":\"");
+        put_json_str(path->text, path->len);
+        PUT_LIT("\",\"status\":");
+        put_uint(rec->status);
+        PUT_LIT(",\"bytes\":");
+        put_uint(rec->bytes);
+        PUT_LIT(",\"duration_us\":");
+        put_uint(rec->duration_usec);
+        if (rec->cache == ACCESS_CACHE_REVALIDATED) {
+            PUT_LIT(",\"cache\":\"revalidated\"}\n");
+        } else if (rec->cache == ACCESS_CACHE_PACK) {
+            PUT_LIT(",\"cache\":\"pack\"}\n");
+        } else {
+            PUT_LIT(",\"cache\":\"none\"}\n");
+        }
+        return;
+    }
+
+    /* host ident authuser [date] "request" status bytes */
+    put_addr(rec->addr);
+    PUT_LIT(" - - [");
+    put_str(clf_time, strlen(clf_time));
+    PUT_LIT("] \"");
+    put_str(method, strlen(method));
+    out[out_len++] = ' ';
+    put_str(path->text, path->len);
+    PUT_LIT(" HTTP/1.1\" ");
+    put_uint(rec->status);
+    out[out_len++] = ' ';
+    if (rec->bytes) {
+        put_uint(rec->bytes);
+    } else {
+        out[out_len++] = '-';
+    }
+    if (format == FORMAT_COMBINED) {
+        PUT_LIT(" \"-\" \"-\"");
+    }
+    out[out_len++] = '\n';
+}
+
+/* Convert one file, returning the number of requests written or -1 */
+static long convert_file(const char *name, format_t format) {
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "zircon-logcat: %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(access_log_header_t)) {
+        fprintf(stderr, "zircon-logcat: %s: not an access log\n", name);
+        close(fd);
+        return -1;
+    }
+
+    size_t size = st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "zircon-logcat: %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+
+    access_log_reader_t *reader = access_log_reader_open(map, size);
+    if (!reader) {
+        fprintf(stderr, "zircon-logcat: %s: unsupported format\n", name);
+        munmap((void *)map, size);
+        return -1;
+    }
+
+    static const access_path_t unknown = { "-", 1, 0 };
+    long requests = 0;
+    const access_record_t *rec;
+    const access_path_t *path;
+    while ((rec = access_log_reader_next(reader, &path)) != NULL) {
+        format_record(rec, path ? path : &unknown, format);
+        requests++;
+
+        if (out_len >= OUT_BUFFER && !flush_out()) {
+            requests = -1;
+            break;
+        }
+    }
+
+    access_log_reader_close(reader);
+    munmap((void *)map, size);
+    return requests;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: zircon-logcat [-f clf|combined|json] [-s] file...\n");
+}
+
+int main(int argc, char *argv[]) {
+    format_t format = FORMAT_CLF;
+    bool stats = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:sh")) != -1) {
+        switch (opt) {
+        case 'f':
+            if (strcmp(optarg, "clf") == 0) format = FORMAT_CLF;
+            else if (strcmp(optarg, "combined") == 0) format = FORMAT_COMBINED;
+            else if (strcmp(optarg, "json") == 0) format = FORMAT_JSON;
+            else {
+                usage();
+                return 2;
+            }
+            break;
+        case 's':
+            stats = true;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        return 2;
+    }
+
+    double start = now_seconds();
+    uint64_t in_total = 0;
+    long requests = 0;
+    int status = 0;
+
+    for (int i = optind; i < argc; i++) {
+        long n = convert_file(argv[i], format);
+        if (n < 0) {
+            status = 1;
+            continue;
+        }
+        requests += n;
+
+        struct stat st;
+        if (stat(argv[i], &st) == 0) in_total += st.st_size;
+    }
+    if (!flush_out()) status = 1;
+
+    /* Conversion statistics go to stderr so they never mix with output */
+    if (stats) {
+        double elapsed = now_seconds() - start;
+        fprintf(stderr, "%ld requests, %llu bytes in, %llu bytes out, %.3f s, "
+                "%.1f MB/s in, %.1f MB/s out\n",
+                requests, (unsigned long long)in_total, (unsigned long long)out_total,
+                elapsed, in_total / 1e6 / elapsed, out_total / 1e6 / elapsed);
+    }
+    return status;
+}
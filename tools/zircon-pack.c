@@ -0,0 +1,259 @@
+/* zircon-pack: pack a web root into an asset pack
+ *
+ * Usage: zircon-pack [-z] [-l level] [-o pack] [-v] [dir]
+ *
+ * Every regular file under dir (default www) is stored under its request
+ * path with its MIME type, a strong ETag from its contents and its
+ * response headers, ready for the server to map with asset_pack = pack
+ * and serve without touching the filesystem. With -z, text files also
+ * get a gzip variant when it saves at least a tenth of their size.
+ *
+ * Files are added in path order and gzip headers carry no timestamp, so
+ * the same tree always gives the same pack. Symbolic links to files are
+ * followed if they stay inside dir, as the server would; links to
+ * directories are not, which rules out cycles. The pack is written under
+ * a temporary name and renamed over the old one, so a server can be
+ * pointed at it at any time.
+ */
+#include "asset_pack.h"
+#include "../src/http.h"
+#include "request_validator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define GZIP_MIN_SIZE   256     /* Smaller files are not worth compressing */
+
+/* File to pack */
+typedef struct {
+    char *file;                 /* Where it is */
+    char *path;                 /* Request path, "/" + relative name */
+} source_t;
+
+static source_t *sources;
+static size_t source_count, source_capacity;
+static char root[PATH_MAX];    /* Resolved dir, for link checks */
+static int gzip_level = 9;
+static bool gzip_text = false;
+static bool verbose = false;
+
+/* Types worth compressing */
+static bool compressible(const char *mime) {
+    return strncmp(mime, "text/", 5) == 0 || strcmp(mime, "application/javascript") == 0 ||
+           strcmp(mime, "application/json") == 0 || strcmp(mime, "application/xml") == 0 ||
+           strcmp(mime, "image/svg+xml") == 0;
+}
+
+static bool add_source(const char *file, const char *path) {
+    if (strlen(path) > MAX_PATH_LENGTH) {
+        fprintf(stderr, "zircon-pack: %s: path too long to be requested, skipped\n", file);
+        return true;
+    }
+    if (source_count == source_capacity) {
+        size_t capacity = source_capacity ? source_capacity * 2 : 256;
+        source_t *grown = realloc(sources, capacity * sizeof(*grown));
+        if (!grown) return false;
+        sources = grown;
+        source_capacity = capacity;
+    }
+    sources[source_count].file = strdup(file);
+    sources[source_count].path = strdup(path);
+    if (!sources[source_count].file || !sources[source_count].path) return false;
+    source_count++;
+    return true;
+}
+
+/* Collect the files under a directory */
+static bool walk(const char *dir, const char *prefix) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "zircon-pack: %s: %s\n", dir, strerror(errno));
+        return false;
+    }
+
+    bool ok = true;
+    struct dirent *de;
+    while (ok && (de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+
+        char file[PATH_MAX], path[PATH_MAX];
+        if (snprintf(file, sizeof(file), "%s/%s", dir, de->d_name) >= (int)sizeof(file) ||
+            snprintf(path, sizeof(path), "%s/%s", prefix, de->d_name) >= (int)sizeof(path)) {
+            fprintf(stderr, "zircon-pack: %s/%s: name too long, skipped\n", dir, de->d_name);
+            continue;
+        }
+
+        struct stat st;
+        if (lstat(file, &st) < 0) {
+            fprintf(stderr, "zircon-pack: %s: %s\n", file, strerror(errno));
+            ok = false;
+        } else if (S_ISDIR(st.st_mode)) {
+            ok = walk(file, path);
+        } else if (S_ISREG(st.st_mode)) {
+            ok = add_source(file, path);
+        } else if (S_ISLNK(st.st_mode)) {
+            char resolved[PATH_MAX];
+            size_t len = strlen(root);
+            if (stat(file, &st) == 0 && S_ISREG(st.st_mode) && realpath(file, resolved) &&
+                strncmp(resolved, root, len) == 0 && resolved[len] == '/') {
+                ok = add_source(file, path);
+            } else if (verbose) {
+                fprintf(stderr, "zircon-pack: %s: link not to a file inside the root, skipped\n",
+                        file);
+            }
+        }
+    }
+    closedir(d);
+    return ok;
+}
+
+static int compare_path(const void *a, const void *b) {
+    return strcmp(((const source_t *)a)->path, ((const source_t *)b)->path);
+}
+
+/* Compress into a new buffer; NULL if it would not save enough */
+static unsigned char *gzip_body(const void *data, size_t size, size_t *gzip_size) {
+    z_stream zs = {0};
+    if (deflateInit2(&zs, gzip_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+
+    size_t bound = deflateBound(&zs, size);
+    unsigned char *out = malloc(bound);
+    if (out) {
+        zs.next_in = (Bytef *)data;
+        zs.avail_in = (uInt)size;
+        zs.next_out = out;
+        zs.avail_out = (uInt)bound;
+        if (deflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out > size - size / 10) {
+            free(out);
+            out = NULL;
+        }
+    }
+    *gzip_size = zs.total_out;
+    deflateEnd(&zs);
+    return out;
+}
+
+/* Add one file to the pack */
+static bool pack_file(asset_pack_writer_t *writer, const source_t *source,
+                      size_t *bytes, size_t *variants) {
+    int fd = open(source->file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "zircon-pack: %s: %s\n", source->file, strerror(errno));
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *data = NULL;
+    if (size) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "zircon-pack: %s: %s\n", source->file, strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+
+    /* zlib takes 32-bit lengths; bigger files go uncompressed */
+    unsigned char *gzip = NULL;
+    size_t gzip_size = 0;
+    if (gzip_text && size >= GZIP_MIN_SIZE && size <= UINT32_MAX &&
+        compressible(http_get_mime_type(source->path))) {
+        gzip = gzip_body(data, size, &gzip_size);
+    }
+
+    bool ok = asset_pack_writer_add(writer, source->path, data, size, gzip, gzip ? gzip_size : 0);
+    if (!ok) {
+        fprintf(stderr, "zircon-pack: %s: cannot add to pack\n", source->file);
+    } else if (verbose) {
+        if (gzip) {
+            printf("%s %zu (gzip %zu)\n", source->path, size, gzip_size);
+        } else {
+            printf("%s %zu\n", source->path, size);
+        }
+    }
+
+    *bytes += size;
+    if (gzip) (*variants)++;
+    free(gzip);
+    if (size) munmap(data, size);
+    return ok;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: zircon-pack [options] [dir]\n"
+            "  -o PACK     write the pack here (default www.pack)\n"
+            "  -z          add gzip variants of text files\n"
+            "  -l LEVEL    gzip level, 1-9 (default 9)\n"
+            "  -v          list the files packed\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = "www.pack";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:zl:vh")) != -1) {
+        switch (opt) {
+        case 'o': output = optarg; break;
+        case 'z': gzip_text = true; break;
+        case 'l': gzip_level = atoi(optarg); break;
+        case 'v': verbose = true; break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (gzip_level < 1 || gzip_level > 9 || optind + 1 < argc) {
+        usage();
+        return 2;
+    }
+    const char *dir = optind < argc ? argv[optind] : "www";
+
+    if (!realpath(dir, root)) {
+        fprintf(stderr, "zircon-pack: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if (!walk(dir, "")) return 1;
+    qsort(sources, source_count, sizeof(*sources), compare_path);
+
+    asset_pack_writer_t *writer = asset_pack_writer_create(output);
+    if (!writer) {
+        fprintf(stderr, "zircon-pack: %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+
+    size_t bytes = 0, variants = 0;
+    for (size_t i = 0; i < source_count; i++) {
+        if (!pack_file(writer, &sources[i], &bytes, &variants)) {
+            asset_pack_writer_abort(writer);
+            return 1;
+        }
+    }
+    if (!asset_pack_writer_finish(writer)) {
+        fprintf(stderr, "zircon-pack: %s: cannot write pack\n", output);
+        return 1;
+    }
+
+    fprintf(stderr, "zircon-pack: %zu files, %zu bytes, %zu gzip variants -> %s\n",
+            source_count, bytes, variants, output);
+
+    for (size_t i = 0; i < source_count; i++) {
+        free(sources[i].file);
+        free(sources[i].path);
+    }
+    free(sources);
+    return 0;
+}
@@ -0,0 +1,859 @@
+/* zircon-replay: replay access logs against a server
+ *
+ * Usage: zircon-replay [options] [host:port] log...
+ *
+ * Reads binary access logs, zircon-logcat JSON lines, or the server's
+ * text access lines, and re-issues each request at its original offset
+ * from the first one (divided by the -s speedup). Every original client
+ * is mapped to its own 127.x.y.z source address so the rate limiter and
+ * admission control see the original client diversity, and requests
+ * that were revalidated (304) are sent again with a current ETag.
+ *
+ * Latency is timed from when a request was due, so a server that falls
+ * behind shows its queueing delay. The report compares the replay with
+ * the original log per path class: request latency against the logged
+ * server time, error rates, and responses whose status changed.
+ */
+#define _GNU_SOURCE
+#include "access_log_reader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define SUB_BITS        5
+#define SUB_COUNT       (1 << SUB_BITS)
+#define MAX_MAGNITUDE   36      /* Latencies up to 2^36 us */
+#define HIST_BUCKETS    ((MAX_MAGNITUDE - SUB_BITS + 1) * SUB_COUNT)
+#define MAX_THREADS     64
+#define RESPONSE_PEEK   64      /* Bytes kept from each response for its status */
+#define ETAG_SLOTS      4096
+
+/* Path classes reported separately */
+typedef enum {
+    CLASS_PAGE,
+    CLASS_STYLE,
+    CLASS_SCRIPT,
+    CLASS_IMAGE,
+    CLASS_FONT,
+    CLASS_DATA,
+    CLASS_OTHER,
+    CLASS_COUNT
+} path_class_t;
+
+static const char *class_names[CLASS_COUNT] = {
+    "page", "style", "script", "image", "font", "data", "other"
+};
+
+static const char *method_names[] = { "GET", "HEAD", "POST" };
+
+/* One request from the log */
+typedef struct {
+    uint64_t time_usec;         /* Wall clock in the original */
+    uint32_t addr;              /* Original client, network byte order */
+    uint32_t duration_usec;     /* Server time in the original */
+    const char *path;
+    uint16_t status;
+    uint8_t method;             /* http_method_t: GET, HEAD, POST */
+    uint8_t conditional;        /* Revalidated in the original */
+} event_t;
+
+/* Event list */
+typedef struct {
+    event_t *items;
+    size_t count;
+    size_t capacity;
+} event_list_t;
+
+/* Per-class results */
+typedef struct {
+    uint64_t requests;
+    uint64_t errors;            /* Connection or protocol failures */
+    uint64_t replay_failed;     /* 4xx/5xx in the replay */
+    uint64_t original_failed;   /* 4xx/5xx in the original */
+    uint64_t status_changed;
+    uint64_t replay_hist[HIST_BUCKETS];
+    uint64_t original_hist[HIST_BUCKETS];
+} class_stats_t;
+
+typedef enum {
+    CONN_FREE,
+    CONN_CONNECTING,
+    CONN_WRITING,
+    CONN_READING
+} conn_state_t;
+
+struct worker;
+
+/* One in-flight request */
+typedef struct {
+    int fd;
+    conn_state_t state;
+    const event_t *event;
+    uint64_t due_ns;
+    char request[768];
+    size_t request_len;
+    size_t sent;
+    char peek[RESPONSE_PEEK];
+    size_t peek_len;
+    struct worker *worker;
+} conn_t;
+
+/* Per-thread state */
+typedef struct worker {
+    pthread_t thread;
+    int epfd;
+    int timerfd;
+    event_list_t events;
+    size_t next_event;
+    conn_t *conns;
+    size_t conn_count;
+    size_t inflight;
+    class_stats_t stats[CLASS_COUNT];
+} worker_t;
+
+/* Run settings */
+static struct sockaddr_in target;
+static char host_header[64];
+static double speedup = 1.0;
+static bool spread_sources = true;
+static uint64_t first_usec;
+static uint64_t start_ns;
+
+/* ETags of revalidated paths, fetched before the replay */
+static struct {
+    const char *path;
+    char etag[64];
+} etags[ETAG_SLOTS];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Log-linear histogram, as in zircon-bench */
+static unsigned int hist_bucket(uint64_t value) {
+    if (value >= (1ULL << MAX_MAGNITUDE)) value = (1ULL << MAX_MAGNITUDE) - 1;
+    if (value < SUB_COUNT) return (unsigned int)value;
+
+    unsigned int magnitude = 63 - __builtin_clzll(value);
+    unsigned int shift = magnitude - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (unsigned int)((value >> shift) & (SUB_COUNT - 1));
+}
+
+static uint64_t bucket_upper(unsigned int bucket) {
+    if (bucket < SUB_COUNT) return bucket;
+
+    unsigned int shift = bucket / SUB_COUNT - 1;
+    uint64_t lower = (uint64_t)(SUB_COUNT + bucket % SUB_COUNT) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+static uint64_t hist_quantile(const uint64_t *hist, uint64_t total, double quantile) {
+    if (!total) return 0;
+
+    uint64_t rank = (uint64_t)(quantile * total);
+    if (rank >= total) rank = total - 1;
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > rank) return bucket_upper(i);
+    }
+    return bucket_upper(HIST_BUCKETS - 1);
+}
+
+static uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t hash_str(const char *s) {
+    uint32_t hash = 2166136261u;
+    while (*s) {
+        hash ^= (unsigned char)*s++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Classify a path by its extension */
+static path_class_t path_class(const char *path) {
+    static const struct {
+        const char *ext;
+        path_class_t class;
+    } classes[] = {
+        { ".html", CLASS_PAGE }, { ".htm", CLASS_PAGE }, { ".txt", CLASS_PAGE },
+        { ".css", CLASS_STYLE }, { ".js", CLASS_SCRIPT },
+        { ".png", CLASS_IMAGE }, { ".jpg", CLASS_IMAGE }, { ".jpeg", CLASS_IMAGE },
+        { ".gif", CLASS_IMAGE }, { ".webp", CLASS_IMAGE }, { ".svg", CLASS_IMAGE },
+        { ".ico", CLASS_IMAGE },
+        { ".woff", CLASS_FONT }, { ".woff2", CLASS_FONT }, { ".ttf", CLASS_FONT },
+        { ".eot", CLASS_FONT },
+        { ".json", CLASS_DATA }, { ".xml", CLASS_DATA }
+    };
+
+    size_t len = strlen(path);
+    if (len && path[len - 1] == '/') return CLASS_PAGE;
+
+    const char *ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '/')) return CLASS_OTHER;
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strcasecmp(ext, classes[i].ext) == 0) return classes[i].class;
+    }
+    return CLASS_OTHER;
+}
+
+static bool add_event(event_list_t *list, const event_t *event) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 4096;
+        event_t *grown = realloc(list->items, capacity * sizeof(*grown));
+        if (!grown) return false;
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = *event;
+    return true;
+}
+
+/* Only requests that were parsed can be replayed */
+static bool replayable(const event_t *event) {
+    return event->method <= 2 && event->path[0] == '/';
+}
+
+/* Binary access log, read by the reader shared with zircon-logcat */
+static bool load_binary(const char *name, const char *map, size_t size, event_list_t *list) {
+    access_log_reader_t *reader = access_log_reader_open(map, size);
+    if (!reader) {
+        fprintf(stderr, "zircon-replay: %s: unsupported format\n", name);
+        return false;
+    }
+
+    /* One copy of each defined path, shared by its events */
+    char **paths = calloc(access_log_reader_paths(reader) + 1, sizeof(*paths));
+    if (!paths) {
+        access_log_reader_close(reader);
+        return false;
+    }
+
+    const access_record_t *rec;
+    const access_path_t *path;
+    while ((rec = access_log_reader_next(reader, &path)) != NULL) {
+        if (!path) continue;
+        if (!paths[path->index]) {
+            paths[path->index] = strndup(path->text, path->len);
+            if (!paths[path->index]) break;
+        }
+
+        event_t event = {
+            .time_usec = rec->time_usec,
+            .addr = rec->addr,
+            .duration_usec = rec->duration_usec,
+            .path = paths[path->index],
+            .status = rec->status,
+            .method = rec->method,
+            .conditional = rec->cache == ACCESS_CACHE_REVALIDATED
+        };
+        if (replayable(&event) && !add_event(list, &event)) break;
+    }
+
+    /* Path strings stay referenced by the events */
+    free(paths);
+    access_log_reader_close(reader);
+    return true;
+}
+
+static uint8_t method_code(const char *method) {
+    for (uint8_t i = 0; i < 3; i++) {
+        if (strcmp(method, method_names[i]) == 0) return i;
+    }
+    return 3;
+}
+
+/* JSON string value of a key, unescaped into out */
+static bool json_string(const char *line, const char *key, char *out, size_t size) {
+    const char *p = strstr(line, key);
+    if (!p) return false;
+    p += strlen(key);
+
+    size_t len = 0;
+    while (*p && *p != '"' && len + 1 < size) {
+        if (*p == '\\' && p[1]) {
+            p++;
+            if (*p == 'u' && strlen(p) >= 5) {
+                out[len++] = (char)strtol((char[]){ p[3], p[4], 0 }, NULL, 16);
+                p += 5;
+                continue;
+            }
+        }
+        out[len++] = *p++;
+    }
+    out[len] = '\0';
+    return *p == '"';
+}
+
+static uint64_t json_number(const char *line, const char *key) {
+    const char *p = strstr(line, key);
+    return p ? strtoull(p + strlen(key), NULL, 10) : 0;
+}
+
+/* zircon-logcat -f json line */
+static bool parse_json(const char *line, event_t *event) {
+    char time_text[40], addr[20], method[16], path[4096];
+    if (!json_string(line, "\"time\":\"", time_text, sizeof(time_text)) ||
+        !json_string(line, "\"addr\":\"", addr, sizeof(addr)) ||
+        !json_string(line, "\"method\":\"", method, sizeof(method)) ||
+        !json_string(line, "\"path\":\"", path, sizeof(path))) {
+        return false;
+    }
+
+    struct tm tm_info = {0};
+    unsigned int usec = 0;
+    if (sscanf(time_text, "%d-%d-%dT%d:%d:%d.%u", &tm_info.tm_year, &tm_info.tm_mon,
+               &tm_info.tm_mday, &tm_info.tm_hour, &tm_info.tm_min, &tm_info.tm_sec,
+               &usec) < 6) {
+        return false;
+    }
+    tm_info.tm_year -= 1900;
+    tm_info.tm_mon -= 1;
+
+    struct in_addr in;
+    if (inet_pton(AF_INET, addr, &in) != 1) return false;
+
+    char cache[16] = "";
+    json_string(line, "\"cache\":\"", cache, sizeof(cache));
+
+    event->time_usec = (uint64_t)timegm(&tm_info) * 1000000 + usec;
+    event->addr = in.s_addr;
+    event->status = (uint16_t)json_number(line, "\"status\":");
+    event->duration_usec = (uint32_t)json_number(line, "\"duration_us\":");
+    event->method = method_code(method);
+    event->conditional = strcmp(cache, "revalidated") == 0;
+    event->path = strdup(path);
+    return event->path != NULL;
+}
+
+/* Server text access line:
+ * [2024-03-13 12:00:00] INFO: 192.0.2.1 - GET /index.html - 200 - 220 bytes - 45 us */
+static bool parse_text(const char *line, event_t *event) {
+    struct tm tm_info = {0};
+    char addr[20], method[16], path[4096];
+    int status;
+    unsigned long long bytes;
+    unsigned int duration;
+
+    if (sscanf(line, "[%d-%d-%d %d:%d:%d] %*s %19s - %15s %4095s - %d - %llu bytes - %u us",
+               &tm_info.tm_year, &tm_info.tm_mon, &tm_info.tm_mday, &tm_info.tm_hour,
+               &tm_info.tm_min, &tm_info.tm_sec, addr, method, path, &status, &bytes,
+               &duration) != 12) {
+        return false;
+    }
+    tm_info.tm_year -= 1900;
+    tm_info.tm_mon -= 1;
+    tm_info.tm_isdst = -1;
+
+    struct in_addr in;
+    if (inet_pton(AF_INET, addr, &in) != 1) return false;
+
+    event->time_usec = (uint64_t)mktime(&tm_info) * 1000000;
+    event->addr = in.s_addr;
+    event->status = (uint16_t)status;
+    event->duration_usec = duration;
+    event->method = method_code(method);
+    event->conditional = status == 304;
+    event->path = strdup(path);
+    return event->path != NULL;
+}
+
+/* Load one log file of any supported format */
+static bool load_file(const char *name, event_list_t *list) {
+    int fd = open(name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "zircon-replay: %s: %s\n", name, strerror(errno));
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    size_t size = st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "zircon-replay: %s: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    bool ok = true;
+    if (size >= 8 && memcmp(map, ACCESS_LOG_MAGIC, 8) == 0) {
+        ok = load_binary(name, map, size, list);
+    } else {
+        /* Text formats, line by line */
+        char line[8192];
+        const char *p = map, *end = map + size;
+        while (p < end && ok) {
+            const char *nl = memchr(p, '\n', end - p);
+            size_t len = (nl ? nl : end) - p;
+            if (len < sizeof(line)) {
+                memcpy(line, p, len);
+                line[len] = '\0';
+
+                event_t event;
+                bool parsed = line[0] == '{' ? parse_json(line, &event)
+                                             : parse_text(line, &event);
+                if (parsed) {
+                    if (replayable(&event)) ok = add_event(list, &event);
+                    else free((void *)event.path);
+                }
+            }
+            p += len + 1;
+        }
+    }
+
+    munmap(map, size);
+    return ok;
+}
+
+/* Connect from a given source address */
+static int connect_from(uint32_t source, bool blocking) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (blocking ? 0 : SOCK_NONBLOCK), 0);
+    if (fd < 0) return -1;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (source) {
+        struct sockaddr_in local = { .sin_family = AF_INET, .sin_addr.s_addr = source };
+        if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (connect(fd, (struct sockaddr *)&target, sizeof(target)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Loopback source for an original client: 127.a.b.c, keeping 127.0.x.x
+ * (the usual trusted range) and the prefetch range 127.255.x.x clear */
+static uint32_t source_for(uint32_t addr) {
+    if (!spread_sources) return 0;
+
+    uint32_t h = hash32(addr);
+    uint32_t a = 1 + (h >> 24) % 254;
+    uint32_t b = (h >> 16) & 0xff;
+    uint32_t c = 1 + (h & 0xff) % 254;
+    return htonl((127u << 24) | (a << 16) | (b << 8) | c);
+}
+
+/* ETag slot for a path */
+static size_t etag_slot(const char *path) {
+    size_t slot = hash_str(path) % ETAG_SLOTS;
+    for (size_t i = 0; i < ETAG_SLOTS; i++) {
+        size_t s = (slot + i) % ETAG_SLOTS;
+        if (!etags[s].path || strcmp(etags[s].path, path) == 0) return s;
+    }
+    return ETAG_SLOTS;
+}
+
+/* Fetch current ETags for revalidated paths with blocking HEAD requests */
+static void prefetch_etags(const event_list_t *list) {
+    uint32_t fetched = 0;
+
+    for (size_t i = 0; i < list->count; i++) {
+        const event_t *event = &list->items[i];
+        if (!event->conditional) continue;
+
+        size_t slot = etag_slot(event->path);
+        if (slot == ETAG_SLOTS || etags[slot].path) continue;
+        etags[slot].path = event->path;
+
+        uint32_t source = spread_sources
+            ? htonl((127u << 24) | (255u << 16) | (fetched++ & 0xffff)) : 0;
+        int fd = connect_from(source, true);
+        if (fd < 0) continue;
+
+        char request[4400];
+        int len = snprintf(request, sizeof(request),
+                           "HEAD %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                           event->path, host_header);
+        char response[4096];
+        size_t got = 0;
+        if (len > 0 && (size_t)len < sizeof(request) && write(fd, request, len) == len) {
+            ssize_t n;
+            while (got < sizeof(response) - 1 &&
+                   (n = read(fd, response + got, sizeof(response) - 1 - got)) > 0) {
+                got += n;
+            }
+        }
+        close(fd);
+        response[got] = '\0';
+
+        const char *etag = strcasestr(response, "\r\nETag: ");
+        if (etag) {
+            etag += 8;
+            size_t etag_len = strcspn(etag, "\r\n");
+            if (etag_len < sizeof(etags[slot].etag)) {
+                memcpy(etags[slot].etag, etag, etag_len);
+                etags[slot].etag[etag_len] = '\0';
+            }
+        }
+    }
+}
+
+static void conn_finish(conn_t *c, bool failed) {
+    worker_t *w = c->worker;
+    const event_t *event = c->event;
+    class_stats_t *stats = &w->stats[path_class(event->path)];
+
+    stats->requests++;
+    if (event->status >= 400) stats->original_failed++;
+    stats->original_hist[hist_bucket(event->duration_usec)]++;
+
+    int status = 0;
+    if (!failed) {
+        c->peek[c->peek_len < RESPONSE_PEEK ? c->peek_len : RESPONSE_PEEK - 1] = '\0';
+        if (c->peek_len >= 12 && strncmp(c->peek, "HTTP/1.", 7) == 0) {
+            status = atoi(c->peek + 9);
+        }
+    }
+
+    if (!status) {
+        stats->errors++;
+    } else {
+        uint64_t latency = (now_ns() - c->due_ns) / 1000;
+        stats->replay_hist[hist_bucket(latency)]++;
+        if (status >= 400) stats->replay_failed++;
+        if (status != event->status) stats->status_changed++;
+    }
+
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->state = CONN_FREE;
+    w->inflight--;
+}
+
+static void conn_write(conn_t *c) {
+    while (c->sent < c->request_len) {
+        ssize_t n = send(c->fd, c->request + c->sent, c->request_len - c->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return;
+            conn_finish(c, true);
+            return;
+        }
+        c->sent += n;
+    }
+
+    c->state = CONN_READING;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    if (epoll_ctl(c->worker->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) conn_finish(c, true);
+}
+
+/* Read until the server closes; only the status line is kept */
+static void conn_read(conn_t *c) {
+    char buf[65536];
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return;
+            conn_finish(c, c->peek_len == 0);
+            return;
+        }
+        if (n == 0) {
+            conn_finish(c, c->peek_len == 0);
+            return;
+        }
+        if (c->peek_len < RESPONSE_PEEK) {
+            size_t take = RESPONSE_PEEK - c->peek_len < (size_t)n ? RESPONSE_PEEK - c->peek_len
+                                                                  : (size_t)n;
+            memcpy(c->peek + c->peek_len, buf, take);
+            c->peek_len += take;
+        }
+    }
+}
+
+static void conn_event(conn_t *c) {
+    if (c->state == CONN_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            conn_finish(c, true);
+            return;
+        }
+        c->state = CONN_WRITING;
+    }
+    if (c->state == CONN_WRITING) conn_write(c);
+    else if (c->state == CONN_READING) conn_read(c);
+}
+
+/* Issue one logged request */
+static void conn_start(conn_t *c, const event_t *event, uint64_t due_ns) {
+    c->event = event;
+    c->due_ns = due_ns;
+    c->sent = 0;
+    c->peek_len = 0;
+    c->worker->inflight++;
+
+    const char *etag = NULL;
+    if (event->conditional) {
+        size_t slot = etag_slot(event->path);
+        if (slot < ETAG_SLOTS && etags[slot].path && etags[slot].etag[0]) {
+            etag = etags[slot].etag;
+        }
+    }
+
+    int len = snprintf(c->request, sizeof(c->request),
+                       "%s %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: zircon-replay\r\n"
+                       "%s%s%s%sConnection: close\r\n\r\n",
+                       method_names[event->method], event->path, host_header,
+                       etag ? "If-None-Match: " : "", etag ? etag : "", etag ? "\r\n" : "",
+                       event->method == 2 ? "Content-Length: 0\r\n" : "");
+    c->request_len = len > 0 && (size_t)len < sizeof(c->request) ? (size_t)len : 0;
+
+    c->fd = c->request_len ? connect_from(source_for(event->addr), false) : -1;
+    if (c->fd < 0) {
+        conn_finish(c, true);
+        return;
+    }
+
+    c->state = CONN_CONNECTING;
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+    if (epoll_ctl(c->worker->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) conn_finish(c, true);
+}
+
+/* When an event is due, on the monotonic clock */
+static uint64_t event_due(const event_t *event) {
+    if (speedup <= 0) return start_ns;
+    return start_ns + (uint64_t)((event->time_usec - first_usec) * 1000 / speedup);
+}
+
+static void *worker_run(void *arg) {
+    worker_t *w = arg;
+    struct epoll_event events[256];
+
+    while (w->next_event < w->events.count || w->inflight) {
+        /* Issue due requests while connections are free */
+        uint64_t now = now_ns();
+        for (size_t i = 0; i < w->conn_count && w->next_event < w->events.count; i++) {
+            conn_t *c = &w->conns[i];
+            if (c->state != CONN_FREE) continue;
+
+            const event_t *event = &w->events.items[w->next_event];
+            uint64_t due = event_due(event);
+            if (due > now) break;
+            conn_start(c, event, due);
+            w->next_event++;
+        }
+
+        /* Sleep until the next request is due if a connection is free */
+        if (w->next_event < w->events.count && w->inflight < w->conn_count) {
+            uint64_t due = event_due(&w->events.items[w->next_event]);
+            struct itimerspec timer = {
+                .it_value = { (time_t)(due / 1000000000), (long)(due % 1000000000) }
+            };
+            timerfd_settime(w->timerfd, TFD_TIMER_ABSTIME, &timer, NULL);
+        }
+
+        int n = epoll_wait(w->epfd, events, sizeof(events) / sizeof(events[0]), 100);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr) {
+                conn_event(events[i].data.ptr);
+            } else {
+                uint64_t expirations;
+                if (read(w->timerfd, &expirations, sizeof(expirations)) < 0) continue;
+            }
+        }
+    }
+    return NULL;
+}
+
+static int compare_time(const void *a, const void *b) {
+    uint64_t ta = ((const event_t *)a)->time_usec, tb = ((const event_t *)b)->time_usec;
+    return ta < tb ? -1 : ta > tb;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: zircon-replay [options] [host:port] log...\n"
+            "  -s FACTOR   replay FACTOR times faster, 0 = as fast as possible (default 1)\n"
+            "  -c N        maximum requests in flight (default 256)\n"
+            "  -t N        threads (default 4)\n"
+            "  -n N        replay only the first N requests\n"
+            "  -S          send everything from 127.0.0.1 instead of one address per client\n");
+}
+
+int main(int argc, char *argv[]) {
+    size_t max_inflight = 256, threads = 4, limit = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:c:t:n:Sh")) != -1) {
+        switch (opt) {
+        case 's': speedup = atof(optarg); break;
+        case 'c': max_inflight = strtoul(optarg, NULL, 10); break;
+        case 't': threads = strtoul(optarg, NULL, 10); break;
+        case 'n': limit = strtoul(optarg, NULL, 10); break;
+        case 'S': spread_sources = false; break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (threads == 0 || threads > MAX_THREADS || max_inflight < threads || speedup < 0) {
+        usage();
+        return 2;
+    }
+
+    /* Optional target before the logs */
+    const char *host = "127.0.0.1:8000";
+    if (optind < argc && strchr(argv[optind], ':') && access(argv[optind], F_OK) != 0) {
+        host = argv[optind++];
+    }
+    if (optind >= argc) {
+        usage();
+        return 2;
+    }
+
+    char addr[64];
+    snprintf(addr, sizeof(addr), "%s", host);
+    char *colon = strchr(addr, ':');
+    target.sin_family = AF_INET;
+    target.sin_port = htons(colon ? (uint16_t)atoi(colon + 1) : 80);
+    if (colon) *colon = '\0';
+    if (inet_pton(AF_INET, addr, &target.sin_addr) != 1) {
+        fprintf(stderr, "zircon-replay: target must be an IPv4 address: %s\n", host);
+        return 2;
+    }
+    snprintf(host_header, sizeof(host_header), "%s", host);
+
+    event_list_t all = {0};
+    for (int i = optind; i < argc; i++) {
+        if (!load_file(argv[i], &all)) return 1;
+    }
+    if (all.count == 0) {
+        fprintf(stderr, "zircon-replay: no replayable requests found\n");
+        return 1;
+    }
+
+    qsort(all.items, all.count, sizeof(event_t), compare_time);
+    if (limit && limit < all.count) all.count = limit;
+    first_usec = all.items[0].time_usec;
+    double span = (all.items[all.count - 1].time_usec - first_usec) / 1e6;
+
+    prefetch_etags(&all);
+
+    /* A client's requests stay on one thread, in order */
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    conn_t *conns = calloc(max_inflight, sizeof(conn_t));
+    if (!workers || !conns) {
+        fprintf(stderr, "zircon-replay: out of memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < all.count; i++) {
+        worker_t *w = &workers[hash32(all.items[i].addr) % threads];
+        if (!add_event(&w->events, &all.items[i])) {
+            fprintf(stderr, "zircon-replay: out of memory\n");
+            return 1;
+        }
+    }
+
+    printf("Replaying %zu requests spanning %.1f s at %s against %s\n",
+           all.count, span, speedup > 0 ? "scaled time" : "full speed", host);
+
+    start_ns = now_ns() + 10000000;
+    size_t next_conn = 0;
+    for (size_t t = 0; t < threads; t++) {
+        worker_t *w = &workers[t];
+        w->conn_count = max_inflight / threads + (t < max_inflight % threads);
+        w->conns = &conns[next_conn];
+        next_conn += w->conn_count;
+        for (size_t i = 0; i < w->conn_count; i++) {
+            w->conns[i].fd = -1;
+            w->conns[i].worker = w;
+        }
+
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        w->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct epoll_event timer_event = { .events = EPOLLIN, .data.ptr = NULL };
+        if (w->epfd < 0 || w->timerfd < 0 ||
+            epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->timerfd, &timer_event) < 0 ||
+            pthread_create(&w->thread, NULL, worker_run, w) != 0) {
+            perror("zircon-replay: worker");
+            return 1;
+        }
+    }
+
+    /* Merge per-class results */
+    static class_stats_t totals[CLASS_COUNT];
+    for (size_t t = 0; t < threads; t++) {
+        worker_t *w = &workers[t];
+        pthread_join(w->thread, NULL);
+        close(w->epfd);
+        close(w->timerfd);
+        for (int c = 0; c < CLASS_COUNT; c++) {
+            class_stats_t *src = &w->stats[c], *dst = &totals[c];
+            dst->requests += src->requests;
+            dst->errors += src->errors;
+            dst->replay_failed += src->replay_failed;
+            dst->original_failed += src->original_failed;
+            dst->status_changed += src->status_changed;
+            for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+                dst->replay_hist[i] += src->replay_hist[i];
+                dst->original_hist[i] += src->original_hist[i];
+            }
+        }
+        free(w->events.items);
+    }
+    double elapsed = (now_ns() - start_ns) / 1e9;
+
+    printf("Finished in %.1f s\n\n", elapsed);
+    printf("%-8s %9s %17s %17s %15s %8s %8s\n", "class", "requests",
+           "p50 us orig/now", "p99 us orig/now", "4xx/5xx % o/n", "changed", "errors");
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        const class_stats_t *s = &totals[c];
+        if (!s->requests) continue;
+
+        uint64_t replayed = s->requests - s->errors;
+        printf("%-8s %9llu %8llu/%-8llu %8llu/%-8llu %7.1f/%-7.1f %8llu %8llu\n",
+               class_names[c], (unsigned long long)s->requests,
+               (unsigned long long)hist_quantile(s->original_hist, s->requests, 0.5),
+               (unsigned long long)hist_quantile(s->replay_hist, replayed, 0.5),
+               (unsigned long long)hist_quantile(s->original_hist, s->requests, 0.99),
+               (unsigned long long)hist_quantile(s->replay_hist, replayed, 0.99),
+               100.0 * s->original_failed / s->requests,
+               replayed ? 100.0 * s->replay_failed / replayed : 0.0,
+               (unsigned long long)s->status_changed, (unsigned long long)s->errors);
+    }
+    printf("\nOriginal latency is the server's logged time; replay latency is "
+           "measured by the client from when each request was due.\n");
+
+    free(conns);
+    return 0;
+}
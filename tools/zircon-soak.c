@@ -0,0 +1,645 @@
+/* zircon-soak: long-running connection soak test
+ *
+ * Usage: zircon-soak -p pid [options] [host:port]
+ *
+ * Holds thousands of idle (slowloris-style) connections open against a
+ * running server while a few active connections cycle through a request
+ * mix that exercises every early-return path: 304s, 403s, 404s, bad and
+ * unsupported requests, truncated requests and connections that close
+ * without sending anything. Idle connections are recycled after their
+ * hold time, half of them completing a request and half abandoning the
+ * connection with a reset.
+ *
+ * Every interval the server's RSS, open fds and thread count are read
+ * from /proc along with the active requests' p99 latency. With the load
+ * held constant none of these should trend upwards, so the run fails if
+ * the second half of the samples grows past the first half by more than
+ * the allowed margin, or if fds and threads do not return to their
+ * starting level once every connection has been closed.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define TICK_NS         50000000ULL     /* Idle connection housekeeping */
+#define REQUEST_TIMEOUT 10000000000ULL  /* Active request gives up */
+#define DRAIN_TIMEOUT   10              /* Seconds for fds and threads to settle */
+#define DRAIN_SLACK     4               /* Allowed fds/threads left after draining */
+#define MAX_REQUESTS    16
+#define MAX_SAMPLES     4096
+
+typedef enum {
+    KIND_ACTIVE,            /* Request after request, timed */
+    KIND_IDLE               /* Connects and sends nothing until its hold expires */
+} conn_kind_t;
+
+typedef enum {
+    CONN_CLOSED,
+    CONN_CONNECTING,
+    CONN_HOLDING,
+    CONN_WRITING,
+    CONN_READING
+} conn_state_t;
+
+/* One client connection */
+typedef struct {
+    int fd;
+    conn_kind_t kind;
+    conn_state_t state;
+    uint64_t start_ns;
+    uint64_t deadline_ns;   /* Holding: end of hold; others: give up */
+    const char *request;
+    size_t request_len;
+    size_t sent;
+    bool responded;
+    unsigned int sequence;
+} conn_t;
+
+/* One /proc sample */
+typedef struct {
+    double elapsed;
+    long rss_kb;
+    long fds;
+    long threads;
+    long open;              /* Our connections open at the time */
+    double rate;
+    uint64_t p99_usec;
+    uint64_t errors;
+} sample_t;
+
+/* Run settings */
+static struct sockaddr_in target;
+static pid_t server_pid;
+static size_t idle_count = 1000;
+static size_t active_count = 8;
+static double duration = 60;
+static double interval = 2;
+static double hold = 10;
+static double growth = 20;
+static size_t ramp = 500;
+
+/* Request mix for active connections */
+static char requests[MAX_REQUESTS][512];
+static size_t request_count;
+
+/* Run state */
+static int epfd;
+static conn_t *conns;
+static size_t conn_total;
+static size_t open_conns;
+static uint32_t next_source;
+static uint64_t *latencies;
+static size_t latency_count;
+static size_t latency_capacity;
+static uint64_t interval_requests;
+static uint64_t interval_errors;
+static sample_t samples[MAX_SAMPLES];
+static size_t sample_count;
+static volatile sig_atomic_t stop;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+/* Read RSS, threads and open fds of the server */
+static bool sample_process(sample_t *s) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)server_pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+
+    char line[256];
+    s->rss_kb = s->threads = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmRSS:", 6) == 0) s->rss_kb = strtol(line + 6, NULL, 10);
+        else if (strncmp(line, "Threads:", 8) == 0) s->threads = strtol(line + 8, NULL, 10);
+    }
+    fclose(f);
+
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)server_pid);
+    DIR *dir = opendir(path);
+    if (!dir) return false;
+    s->fds = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] != '.') s->fds++;
+    }
+    closedir(dir);
+    return s->rss_kb >= 0 && s->threads >= 0;
+}
+
+/* Fetch a current ETag so the mix can include a 304 */
+static bool fetch_etag(const char *path, char *etag, size_t size) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    if (connect(fd, (struct sockaddr *)&target, sizeof(target)) < 0) {
+        close(fd);
+        return false;
+    }
+
+    char request[256];
+    int len = snprintf(request, sizeof(request),
+                       "HEAD %s HTTP/1.1\r\nHost: soak\r\nConnection: close\r\n\r\n", path);
+    char response[4096];
+    size_t got = 0;
+    if (write(fd, request, len) == len) {
+        ssize_t n;
+        while (got < sizeof(response) - 1 &&
+               (n = read(fd, response + got, sizeof(response) - 1 - got)) > 0) {
+            got += n;
+        }
+    }
+    close(fd);
+    response[got] = '\0';
+
+    const char *value = strcasestr(response, "\r\nETag: ");
+    if (!value) return false;
+    value += 8;
+    size_t value_len = strcspn(value, "\r\n");
+    if (value_len >= size) return false;
+    memcpy(etag, value, value_len);
+    etag[value_len] = '\0';
+    return true;
+}
+
+static void add_request(const char *fmt, const char *arg) {
+    if (request_count < MAX_REQUESTS) {
+        snprintf(requests[request_count++], sizeof(requests[0]), fmt, arg);
+    }
+}
+
+/* Requests that take every exit from serve_client and serve_file */
+static void build_mix(void) {
+    add_request("GET %s HTTP/1.1\r\nHost: soak\r\nConnection: close\r\n\r\n", "/index.html");
+    add_request("HEAD %s HTTP/1.1\r\nHost: soak\r\nConnection: close\r\n\r\n", "/");
+    add_request("GET %s HTTP/1.1\r\nHost: soak\r\nIf-None-Match: \"stale\"\r\n"
+                "Connection: close\r\n\r\n", "/style.css");
+    add_request("GET %s HTTP/1.1\r\nHost: soak\r\nConnection: close\r\n\r\n", "/missing.html");
+    add_request("GET %s HTTP/1.1\r\nHost: soak\r\nConnection: close\r\n\r\n", "/../../etc/passwd");
+    add_request("GET %s HTTP/1.1\r\nHost: soak\r\nConnection: close\r\n\r\n", "/soak.exe");
+    add_request("POST %s HTTP/1.1\r\nHost: soak\r\nContent-Length: 0\r\n"
+                "Connection: close\r\n\r\n", "/index.html");
+    add_request("BREW %s HTTP/1.1\r\nHost: soak\r\n\r\n", "/pot");
+    add_request("%s\r\n\r\n", "garbage");
+    add_request("GET %s HTTP/1.1\r\nHost: so", "/test.html");
+    add_request("%s", "");      /* Connect and close */
+
+    char etag[128];
+    if (fetch_etag("/test.js", etag, sizeof(etag))) {
+        char request[512];
+        snprintf(request, sizeof(request),
+                 "GET /test.js HTTP/1.1\r\nHost: soak\r\nIf-None-Match: %s\r\n"
+                 "Connection: close\r\n\r\n", etag);
+        add_request("%s", request);
+    } else {
+        fprintf(stderr, "zircon-soak: no ETag for /test.js, skipping 304s\n");
+    }
+}
+
+static void record_latency(uint64_t usec) {
+    if (latency_count == latency_capacity) {
+        size_t capacity = latency_capacity ? latency_capacity * 2 : 4096;
+        uint64_t *grown = realloc(latencies, capacity * sizeof(*grown));
+        if (!grown) return;
+        latencies = grown;
+        latency_capacity = capacity;
+    }
+    latencies[latency_count++] = usec;
+}
+
+static bool conn_open(conn_t *c, uint64_t now);
+
+static void conn_close(conn_t *c, bool reset) {
+    if (c->fd >= 0) {
+        if (reset) {
+            struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+            setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+        }
+        close(c->fd);
+        open_conns--;
+    }
+    c->fd = -1;
+    c->state = CONN_CLOSED;
+}
+
+/* Request finished or failed; active connections go straight to the next */
+static void conn_done(conn_t *c, bool failed) {
+    conn_close(c, failed);
+    if (c->kind != KIND_ACTIVE) return;
+
+    uint64_t now = now_ns();
+    interval_requests++;
+    if (failed) interval_errors++;
+    else if (c->request_len) record_latency((now - c->start_ns) / 1000);
+    if (!stop) conn_open(c, now);
+}
+
+/* Open a connection from its own loopback source address */
+static bool conn_open(conn_t *c, uint64_t now) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+
+    /* Spreading sources over 127.1.0.0/16 keeps ephemeral ports plentiful */
+    uint32_t n = next_source++ % 65024;
+    struct sockaddr_in local = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl((127u << 24) | (1u << 16) | ((n / 254) << 8) | (1 + n % 254))
+    };
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+        (connect(fd, (struct sockaddr *)&target, sizeof(target)) < 0 && errno != EINPROGRESS)) {
+        close(fd);
+        return false;
+    }
+
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        return false;
+    }
+
+    c->fd = fd;
+    c->state = CONN_CONNECTING;
+    c->start_ns = now;
+    c->deadline_ns = now + REQUEST_TIMEOUT;
+    c->sent = 0;
+    c->responded = false;
+    open_conns++;
+
+    if (c->kind == KIND_ACTIVE) {
+        c->request = requests[c->sequence % request_count];
+    } else {
+        c->request = requests[0];
+    }
+    c->request_len = strlen(c->request);
+    c->sequence++;
+    return true;
+}
+
+static void conn_write(conn_t *c) {
+    while (c->sent < c->request_len) {
+        ssize_t n = send(c->fd, c->request + c->sent, c->request_len - c->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return;
+            conn_done(c, true);
+            return;
+        }
+        c->sent += n;
+    }
+
+    c->state = CONN_READING;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) conn_done(c, true);
+}
+
+/* Read to EOF; the server closes after every response */
+static void conn_read(conn_t *c) {
+    char buf[16384];
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c->responded = true;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        conn_done(c, !c->responded);
+        return;
+    }
+}
+
+/* Idle connection's hold is over: complete a request or walk away */
+static void conn_release(conn_t *c) {
+    if (c->sequence % 2) {
+        conn_close(c, true);
+        return;
+    }
+    c->state = CONN_WRITING;
+    c->deadline_ns = now_ns() + REQUEST_TIMEOUT;
+    conn_write(c);
+}
+
+static void conn_event(conn_t *c, uint32_t events) {
+    if (c->state == CONN_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            conn_done(c, true);
+            return;
+        }
+
+        if (c->kind == KIND_IDLE) {
+            /* Wait silently; only a hangup from the server is of interest */
+            uint64_t spread = (uint64_t)(hold * 1e9);
+            c->state = CONN_HOLDING;
+            c->deadline_ns = now_ns() + spread / 2 + (uint64_t)rand() % (spread + 1);
+            struct epoll_event ev = { .events = EPOLLRDHUP, .data.ptr = c };
+            if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) conn_close(c, true);
+            return;
+        }
+        if (c->request_len == 0) {
+            conn_done(c, false);
+            return;
+        }
+        c->state = CONN_WRITING;
+    }
+
+    if (c->state == CONN_HOLDING) {
+        if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) conn_close(c, true);
+    } else if (c->state == CONN_WRITING) {
+        conn_write(c);
+    } else if (c->state == CONN_READING) {
+        conn_read(c);
+    }
+}
+
+/* Reopen closed connections, release expired holds, time out requests */
+static void tick(uint64_t now, bool reopen) {
+    size_t opened = 0;
+
+    for (size_t i = 0; i < conn_total; i++) {
+        conn_t *c = &conns[i];
+        if (c->state == CONN_CLOSED) {
+            if (!reopen) continue;
+            /* Active connections always; idle ones ramp up gradually */
+            if (c->kind == KIND_IDLE && opened >= ramp) continue;
+            if (conn_open(c, now) && c->kind == KIND_IDLE) opened++;
+        } else if (now >= c->deadline_ns) {
+            if (c->state == CONN_HOLDING) conn_release(c);
+            else conn_done(c, true);
+        }
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_sample(const sample_t *s) {
+    printf("%7.1f %9ld %7ld %8ld %7ld %8.0f %9llu %7llu\n",
+           s->elapsed, s->rss_kb, s->fds, s->threads, s->open, s->rate,
+           (unsigned long long)s->p99_usec, (unsigned long long)s->errors);
+    fflush(stdout);
+}
+
+/* Take a sample and close the latency interval */
+static bool take_sample(double elapsed, double seconds) {
+    if (sample_count == MAX_SAMPLES) return true;
+
+    sample_t *s = &samples[sample_count];
+    if (!sample_process(s)) return false;
+
+    s->elapsed = elapsed;
+    s->open = (long)open_conns;
+    s->rate = seconds > 0 ? interval_requests / seconds : 0;
+    s->errors = interval_errors;
+    s->p99_usec = 0;
+    if (latency_count) {
+        qsort(latencies, latency_count, sizeof(*latencies), compare_u64);
+        s->p99_usec = latencies[(size_t)(latency_count * 0.99)];
+    }
+    latency_count = 0;
+    interval_requests = interval_errors = 0;
+
+    print_sample(s);
+    sample_count++;
+    return true;
+}
+
+typedef long (*sample_field_t)(const sample_t *s);
+
+static long field_rss(const sample_t *s) { return s->rss_kb; }
+static long field_fds(const sample_t *s) { return s->fds; }
+static long field_threads(const sample_t *s) { return s->threads; }
+static long field_p99(const sample_t *s) { return (long)s->p99_usec; }
+
+static int compare_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Median or maximum of a field over samples [from, to) */
+static long summarize(size_t from, size_t to, sample_field_t field, bool median) {
+    long values[MAX_SAMPLES];
+    size_t n = 0;
+    for (size_t i = from; i < to; i++) values[n++] = field(&samples[i]);
+    qsort(values, n, sizeof(*values), compare_long);
+    return median ? values[n / 2] : values[n - 1];
+}
+
+/* Compare the second half of the loaded run with the first */
+static bool check_trend(const char *name, const char *unit, sample_field_t field,
+                        bool median, double allowed_pct, long slack) {
+    size_t warmup = sample_count / 5;
+    size_t mid = warmup + (sample_count - warmup) / 2;
+    long first = summarize(warmup, mid, field, median);
+    long second = summarize(mid, sample_count, field, median);
+    long limit = first + (long)(first * allowed_pct / 100) + slack;
+
+    bool ok = second <= limit;
+    printf("  %-8s %s %ld -> %ld %s (limit %ld) %s\n", name, median ? "median" : "max   ",
+           first, second, unit, limit, ok ? "ok" : "GREW");
+    return ok;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: zircon-soak -p pid [options] [host:port]\n"
+            "  -p PID      server process to watch (required)\n"
+            "  -c N        idle connections held open (default 1000)\n"
+            "  -a N        active connections cycling requests (default 8)\n"
+            "  -d SECONDS  soak duration (default 60)\n"
+            "  -i SECONDS  sample interval (default 2)\n"
+            "  -H SECONDS  mean idle connection hold time (default 10)\n"
+            "  -g PERCENT  allowed growth between halves of the run (default 20)\n"
+            "  -r N        idle connections opened per 50 ms tick (default 500)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:c:a:d:i:H:g:r:h")) != -1) {
+        switch (opt) {
+        case 'p': server_pid = (pid_t)atoi(optarg); break;
+        case 'c': idle_count = strtoul(optarg, NULL, 10); break;
+        case 'a': active_count = strtoul(optarg, NULL, 10); break;
+        case 'd': duration = atof(optarg); break;
+        case 'i': interval = atof(optarg); break;
+        case 'H': hold = atof(optarg); break;
+        case 'g': growth = atof(optarg); break;
+        case 'r': ramp = strtoul(optarg, NULL, 10); break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (server_pid <= 0 || active_count == 0 || duration <= 0 || interval <= 0 ||
+        hold <= 0 || growth < 0 || ramp == 0 || duration / interval >= MAX_SAMPLES) {
+        usage();
+        return 2;
+    }
+
+    const char *host = optind < argc ? argv[optind] : "127.0.0.1:8000";
+    char addr[64];
+    snprintf(addr, sizeof(addr), "%s", host);
+    char *colon = strchr(addr, ':');
+    target.sin_family = AF_INET;
+    target.sin_port = htons(colon ? (uint16_t)atoi(colon + 1) : 80);
+    if (colon) *colon = '\0';
+    if (inet_pton(AF_INET, addr, &target.sin_addr) != 1) {
+        fprintf(stderr, "zircon-soak: target must be an IPv4 address: %s\n", host);
+        return 2;
+    }
+
+    /* Every connection needs a descriptor on this side too */
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur != RLIM_INFINITY && idle_count + active_count + 64 > limit.rlim_cur) {
+            fprintf(stderr, "zircon-soak: %zu connections need a higher file limit (%llu)\n",
+                    idle_count + active_count, (unsigned long long)limit.rlim_cur);
+            return 2;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    srand((unsigned int)getpid());
+
+    sample_t baseline;
+    if (!sample_process(&baseline)) {
+        fprintf(stderr, "zircon-soak: cannot read /proc/%d\n", (int)server_pid);
+        return 2;
+    }
+
+    build_mix();
+    conn_total = active_count + idle_count;
+    conns = calloc(conn_total, sizeof(conn_t));
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!conns || epfd < 0) {
+        perror("zircon-soak");
+        return 1;
+    }
+    for (size_t i = 0; i < conn_total; i++) {
+        conns[i].fd = -1;
+        conns[i].kind = i < active_count ? KIND_ACTIVE : KIND_IDLE;
+        conns[i].sequence = (unsigned int)i;
+    }
+
+    printf("Soaking pid %d at %s: %zu idle + %zu active connections for %.0f s\n",
+           (int)server_pid, host, idle_count, active_count, duration);
+    printf("Baseline: %ld kB RSS, %ld fds, %ld threads\n\n",
+           baseline.rss_kb, baseline.fds, baseline.threads);
+    printf("%7s %9s %7s %8s %7s %8s %9s %7s\n",
+           "time s", "rss kB", "fds", "threads", "open", "req/s", "p99 us", "errors");
+
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)(duration * 1e9);
+    uint64_t next_tick = start;
+    uint64_t last_sample = start;
+    uint64_t step = (uint64_t)(interval * 1e9);
+    bool alive = true;
+    struct epoll_event events[1024];
+
+    while (!stop && alive) {
+        uint64_t now = now_ns();
+        if (now >= end) {
+            stop = 1;
+            break;
+        }
+
+        if (now >= next_tick) {
+            tick(now, true);
+            next_tick = now + TICK_NS;
+        }
+        if (now - last_sample >= step) {
+            alive = take_sample((now - start) / 1e9, (now - last_sample) / 1e9);
+            last_sample = now;
+        }
+
+        int timeout = (int)((next_tick - now) / 1000000);
+        int n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), timeout);
+        for (int i = 0; i < n; i++) {
+            conn_event(events[i].data.ptr, events[i].events);
+        }
+    }
+
+    if (!alive) {
+        printf("\nFAIL: server process %d went away\n", (int)server_pid);
+        return 1;
+    }
+
+    /* Close everything and let the server wind down */
+    for (size_t i = 0; i < conn_total; i++) conn_close(&conns[i], false);
+    close(epfd);
+
+    sample_t drained = baseline;
+    for (int i = 0; i < DRAIN_TIMEOUT * 5; i++) {
+        usleep(200000);
+        if (!sample_process(&drained)) {
+            printf("\nFAIL: server process %d went away\n", (int)server_pid);
+            return 1;
+        }
+        if (drained.fds <= baseline.fds + DRAIN_SLACK &&
+            drained.threads <= baseline.threads + DRAIN_SLACK) {
+            break;
+        }
+    }
+
+    bool ok = true;
+    printf("\nAfter closing all connections: %ld kB RSS, %ld fds, %ld threads\n",
+           drained.rss_kb, drained.fds, drained.threads);
+    if (drained.fds > baseline.fds + DRAIN_SLACK) {
+        printf("  fds did not return to baseline (%ld -> %ld)\n", baseline.fds, drained.fds);
+        ok = false;
+    }
+    if (drained.threads > baseline.threads + DRAIN_SLACK) {
+        printf("  threads did not return to baseline (%ld -> %ld)\n",
+               baseline.threads, drained.threads);
+        ok = false;
+    }
+
+    if (sample_count >= 5) {
+        printf("Trend, second half against first half:\n");
+        ok &= check_trend("rss", "kB", field_rss, true, growth, 2048);
+        ok &= check_trend("fds", "", field_fds, false, growth, 16);
+        ok &= check_trend("threads", "", field_threads, false, growth, 16);
+        ok &= check_trend("p99", "us", field_p99, true, 200, 1000);
+    } else {
+        printf("Too few samples to judge trends; run longer or sample more often\n");
+    }
+
+    printf("\n%s\n", ok ? "PASS" : "FAIL");
+    free(conns);
+    free(latencies);
+    return ok ? 0 : 1;
+}